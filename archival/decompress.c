@@ -0,0 +1,275 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+/*
+ * Registry of the streaming decompressors. Each backend is
+ * enabled by its own option, and gets its input through
+ * decompress_read(), that takes care of checksum, hash,
+ * decryption and progress in the same way for all.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "generated/autoconf.h"
+#include "util.h"
+#include "sslapi.h"
+#include "progress.h"
+#include "decompress.h"
+#include "metrics.h"
+
+#define MODULE_NAME "decompress"
+
+static const struct decompressor decompressors[] = {
+#ifdef CONFIG_GUNZIP
+	{ "zlib", COMPRESSED_ZLIB, gunzip_image },
+#endif
+#ifdef CONFIG_ZSTD
+	{ "zstd", COMPRESSED_ZSTD, zstd_image },
+#endif
+#ifdef CONFIG_XZ
+	{ "xz", COMPRESSED_XZ, xz_image },
+#endif
+#ifdef CONFIG_LZ4
+	{ "lz4", COMPRESSED_LZ4, lz4_image },
+#endif
+	{ NULL, COMPRESSED_NONE, NULL }
+};
+
+static const struct {
+	const char *name;
+	compression_type type;
+} compression_names[] = {
+	{ "zlib", COMPRESSED_ZLIB },
+	{ "gzip", COMPRESSED_ZLIB },
+	{ "zstd", COMPRESSED_ZSTD },
+	{ "xz", COMPRESSED_XZ },
+	{ "lz4", COMPRESSED_LZ4 },
+};
+
+void print_registered_decompressors(void)
+{
+	unsigned int i;
+
+	if (!decompressors[0].desc)
+		return;
+
+	printf("Registered decompressors:\n");
+	for (i = 0; decompressors[i].desc; i++) {
+		printf("\t%s\n", decompressors[i].desc);
+	}
+}
+
+static const struct decompressor *find_decompressor(int type)
+{
+	unsigned int i;
+
+	for (i = 0; decompressors[i].desc; i++) {
+		if ((int)decompressors[i].type == type)
+			return &decompressors[i];
+	}
+
+	return NULL;
+}
+
+int get_compression_type(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(compression_names); i++) {
+		if (!strcmp(compression_names[i].name, name))
+			return compression_names[i].type;
+	}
+
+	return -1;
+}
+
+const char *get_compression_name(int type)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(compression_names); i++) {
+		if ((int)compression_names[i].type == type)
+			return compression_names[i].name;
+	}
+
+	return "unknown";
+}
+
+#ifdef CONFIG_ENCRYPTED_IMAGES
+/*
+ * Checksum and hash are computed on the data as it is stored
+ * in the archive, that is before decryption. The decryption
+ * is finalized when the last byte is read.
+ */
+static int read_decrypted(struct decompress_in *in, unsigned char *buf,
+		unsigned int size)
+{
+	unsigned char *cryptbuf = in->cryptbuf;
+	int ret, outlen, finlen;
+	unsigned int raw;
+	unsigned long long t;
+
+	/*
+	 * CBC output can exceed the input by up to one block,
+	 * and the final call adds up to one more
+	 */
+	if (size <= 2 * AES_BLOCK_SIZE)
+		return 0;
+
+	outlen = 0;
+	while (!outlen && !in->decrypted) {
+		raw = min(size - 2 * AES_BLOCK_SIZE, (unsigned int)DECRYPT_PIECE);
+		raw = min(raw, (unsigned int)in->nbytes);
+		if (raw) {
+			ret = fill_buffer(in->infile, cryptbuf, raw, in->offs,
+					in->checksum, in->dgst);
+			if (ret <= 0)
+				return ret;
+			in->nbytes -= ret;
+			t = metrics_now();
+			if (swupdate_DECRYPT_update(in->dcrypt, buf, &outlen,
+						cryptbuf, ret) < 0)
+				return -EFAULT;
+			metrics_add(METRIC_DECRYPT, t, ret);
+		}
+		if (in->nbytes == 0) {
+			t = metrics_now();
+			if (swupdate_DECRYPT_final(in->dcrypt, buf + outlen,
+						&finlen) < 0)
+				return -EFAULT;
+			metrics_add(METRIC_DECRYPT, t, 0);
+			outlen += finlen;
+			in->decrypted = 1;
+		}
+	}
+
+	return outlen;
+}
+#else
+static int read_decrypted(struct decompress_in __attribute__ ((__unused__)) *in,
+		unsigned char __attribute__ ((__unused__)) *buf,
+		unsigned int __attribute__ ((__unused__)) size)
+{
+	return -EINVAL;
+}
+#endif
+
+int decompress_read(struct decompress_in *in, unsigned char *buf,
+		unsigned int size)
+{
+	unsigned int percent;
+	unsigned long long t = metrics_now();
+	int ret;
+
+	if (in->dcrypt) {
+		ret = read_decrypted(in, buf, size);
+	} else {
+		size = min(size, (unsigned int)in->nbytes);
+		if (!size)
+			return 0;
+		ret = fill_buffer(in->infile, buf, size, in->offs,
+				in->checksum, in->dgst);
+		if (ret > 0)
+			in->nbytes -= ret;
+	}
+
+	if (ret > 0) {
+		percent = (unsigned int)(((double)(in->total - in->nbytes)) * 100 /
+				(in->total ? in->total : 1));
+		if (percent != in->percent) {
+			in->percent = percent;
+			swupdate_progress_update(percent);
+		}
+	}
+	in->nsec += metrics_now() - t;
+
+	return ret;
+}
+
+int decompress_write(struct decompress_out *out, const unsigned char *buf,
+		unsigned int len)
+{
+	unsigned long long t;
+
+	out->bytes += len;
+	if (!out->out || !len)
+		return 0;
+
+	t = metrics_now();
+	if (out->callback(out->out, buf, len) < 0)
+		return -ENOSPC;
+	metrics_add(METRIC_WRITE, t, len);
+	out->nsec += metrics_now() - t;
+
+	return 0;
+}
+
+int decompress_image(int type, int infile, unsigned long *offs, int nbytes,
+	void *out, writeimage callback, uint32_t *checksum,
+	void *dgst, void *dcrypt)
+{
+	const struct decompressor *d;
+	struct decompress_in in;
+	struct decompress_out dst;
+	unsigned long long t;
+	int ret;
+
+	d = find_decompressor(type);
+	if (!d) {
+		ERROR("Image is %s compressed, but this is not supported",
+			get_compression_name(type));
+		return -EINVAL;
+	}
+
+	memset(&in, 0, sizeof(in));
+	in.infile = infile;
+	in.offs = offs;
+	in.checksum = checksum;
+	in.dgst = dgst;
+	in.dcrypt = dcrypt;
+	in.nbytes = nbytes;
+	in.total = nbytes;
+
+	if (dcrypt) {
+		in.cryptbuf = (unsigned char *)malloc(DECRYPT_PIECE);
+		if (!in.cryptbuf)
+			return -ENOMEM;
+	}
+
+	memset(&dst, 0, sizeof(dst));
+	dst.out = out;
+	dst.callback = callback;
+
+	if (checksum)
+		*checksum = 0;
+	t = metrics_now();
+	ret = d->decompress(&in, &dst);
+	t = metrics_now() - t;
+	metrics_add_nsec(METRIC_DECOMPRESS,
+			t > in.nsec + dst.nsec ? t - in.nsec - dst.nsec : 0,
+			dst.bytes);
+
+	free(in.cryptbuf);
+
+	return ret;
+}
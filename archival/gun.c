@@ -30,62 +30,44 @@
 #include <zlib.h>           /* inflateBackInit(), inflateBack(), */
                             /* inflateBackEnd(), crc32() */
 #include <util.h>
-#include <progress.h>
+#include "generated/autoconf.h"
+#include <decompress.h>
 
 /* buffer constants */
 #define SIZE 32768U         /* input and output buffer sizes */
-#define PIECE 16384         /* limits i/o chunks for 16-bit int case */
 
 #define MODULE_NAME "gunzip"
 
 /* structure for infback() to pass to input function in() -- it maintains the
-   input file and a buffer of size SIZE */
+   source of the compressed data and a buffer of size SIZE */
 struct ind {
-    int infile;
+    struct decompress_in *src;
     unsigned char *inbuf;
-    unsigned long *offs;
-    unsigned long *checksum;
-    int nbytes;
-    int total;
-    int percent;
-    void *dgst;
+    struct gunbufs *bufs;
 };
 
 /* Load input buffer, assumed to be empty, and return bytes loaded and a
-   pointer to them.  read() is called until the buffer is full, or until it
-   returns end-of-file or error.  Return 0 on error. */
+   pointer to them.  decompress_read() is called until the buffer is full, or
+   until it returns end-of-file or error.  Return 0 on error. */
 static unsigned in(void *in_desc, unsigned char **buf)
 {
     int ret;
     unsigned len;
     unsigned char *next;
     struct ind *me = (struct ind *)in_desc;
-    unsigned int percent;
 
     next = me->inbuf;
     *buf = next;
     len = 0;
     do {
-        ret = PIECE;
-        if ((unsigned)ret > SIZE - len)
-            ret = (int)(SIZE - len);
-	if (ret > me->nbytes)
-		ret = me->nbytes;
-	ret = fill_buffer(me->infile, next, ret, me->offs, (uint32_t *)me->checksum, me->dgst);
+        ret = decompress_read(me->src, next, SIZE - len);
         if (ret < 0) {
             len = 0;
             break;
         }
         next += ret;
         len += ret;
-	me->nbytes -= ret;
     } while (ret != 0 && len < SIZE);
-    percent = (unsigned int)(((double)(me->total - me->nbytes)) * 100 /
-		    (me->total ? me->total : 1));
-    if (percent != (unsigned int)me->percent) {
-	me->percent = percent;
-	swupdate_progress_update(percent);
-    }
     return len;
 }
 
@@ -95,37 +77,27 @@ static unsigned in(void *in_desc, unsigned char **buf)
    the gzip trailer is stored modulo 2^32, so it's ok if a long is 32 bits and
    the output is greater than 4 GB.) */
 struct outd {
-    int outfile;
+    struct decompress_out *dst;
     int check;                  /* true if checking crc and total */
     unsigned long crc;
     unsigned long total;
 };
 
-/* Write output buffer and update the CRC-32 and total bytes written.  write()
-   is called until all of the output is written or an error is encountered.
-   On success out() returns 0.  For a write failure, out() returns 1.  If the
-   output file descriptor is -1, then nothing is written.
+/* Write output buffer and update the CRC-32 and total bytes written.  The
+   output is passed to decompress_write().  On success out() returns 0.  For a
+   write failure, out() returns 1.  If there is no output, then nothing is
+   written.
  */
 static int out(void *out_desc, unsigned char *buf, unsigned len)
 {
-    int ret;
     struct outd *me = (struct outd *)out_desc;
 
     if (me->check) {
         me->crc = crc32(me->crc, buf, len);
         me->total += len;
     }
-    if (me->outfile != -1)
-        do {
-            ret = PIECE;
-            if ((unsigned)ret > len)
-                ret = (int)len;
-            ret = (int)write(me->outfile, buf, ret);
-            if (ret == -1)
-                return 1;
-            buf += ret;
-            len -= ret;
-        } while (len != 0);
+    if (decompress_write(me->dst, buf, len) < 0)
+        return 1;
     return 0;
 }
 
@@ -135,13 +107,16 @@ static int out(void *out_desc, unsigned char *buf, unsigned len)
 
 /* memory for gunpipe() and lunpipe() --
    the first 256 entries of prefix[] and suffix[] are never used, could
-   have offset the index, but it's faster to waste the memory */
-unsigned char inbuf[SIZE];              /* input buffer */
-unsigned char outbuf[SIZE];             /* output buffer */
-unsigned short prefix[65536];           /* index to LZW prefix string */
-unsigned char suffix[65536];            /* one-character LZW suffix */
-unsigned char match[65280 + 2];         /* buffer for reversed match or gzip
+   have offset the index, but it's faster to waste the memory.
+   It is allocated for each image, images can be installed in parallel */
+struct gunbufs {
+    unsigned char inbuf[SIZE];          /* input buffer */
+    unsigned char outbuf[SIZE];         /* output buffer */
+    unsigned short prefix[65536];       /* index to LZW prefix string */
+    unsigned char suffix[65536];        /* one-character LZW suffix */
+    unsigned char match[65280 + 2];     /* buffer for reversed match or gzip
                                            32K sliding window */
+};
 
 /* throw out what's left in the current bits byte buffer (this is a vestigial
    aspect of the compressed data format derived from an implementation that
@@ -166,7 +141,7 @@ unsigned char match[65280 + 2];         /* buffer for reversed match or gzip
         chunk = 0; \
     } while (0)
 
-/* Decompress a compress (LZW) file from indp to outfile.  The compress magic
+/* Decompress a compress (LZW) file from indp to dst.  The compress magic
    header (two bytes) has already been read and verified.  There are have bytes
    of buffered input at next.  strm is used for passing error information back
    to gunpipe().
@@ -176,7 +151,7 @@ unsigned char match[65280 + 2];         /* buffer for reversed match or gzip
    not equal to Z_NULL), or Z_DATA_ERROR for invalid input.
  */
 static int lunpipe(unsigned have, unsigned char *next, struct ind *indp,
-                  int outfile, z_stream *strm)
+                  struct decompress_out *dst, z_stream *strm)
 {
     int last;                   /* last byte read by NEXT(), or -1 if EOF */
     unsigned chunk;             /* bytes left in current chunk */
@@ -194,9 +169,13 @@ static int lunpipe(unsigned have, unsigned char *next, struct ind *indp,
     unsigned stack;             /* next position for reversed string */
     unsigned outcnt;            /* bytes in output buffer */
     struct outd outd;           /* output structure */
+    unsigned char *outbuf = indp->bufs->outbuf;
+    unsigned short *prefix = indp->bufs->prefix;
+    unsigned char *suffix = indp->bufs->suffix;
+    unsigned char *match = indp->bufs->match;
 
     /* set up output */
-    outd.outfile = outfile;
+    outd.dst = dst;
     outd.check = 0;
 
     /* process remainder of compress header -- a flags byte */
@@ -342,10 +321,10 @@ static int lunpipe(unsigned have, unsigned char *next, struct ind *indp,
 }
 
 
-/* Decompress a gzip file from infile to outfile.  strm is assumed to have been
+/* Decompress a gzip file from src to dst.  strm is assumed to have been
    successfully initialized with inflateBackInit().  The input file may consist
    of a series of gzip streams, in which case all of them will be decompressed
-   to the output file.  If outfile is -1, then the gzip stream(s) integrity is
+   to the output.  If there is no output, then the gzip stream(s) integrity is
    checked and nothing is written.
 
    The return value is a zlib error code: Z_MEM_ERROR if out of memory,
@@ -354,7 +333,8 @@ static int lunpipe(unsigned have, unsigned char *next, struct ind *indp,
    prematurely or a write error occurs, or Z_ERRNO if junk (not a another gzip
    stream) follows a valid gzip stream.
  */
-static int gunpipe(z_stream *strm, int infile, unsigned long *offs, int nbytes, int outfile, uint32_t *checksum, void *dgst)
+static int gunpipe(z_stream *strm, struct gunbufs *bufs,
+                   struct decompress_in *src, struct decompress_out *dst)
 {
     int ret, first, last;
     unsigned have, flags, len;
@@ -363,14 +343,9 @@ static int gunpipe(z_stream *strm, int infile, unsigned long *offs, int nbytes,
     struct outd outd;
 
     /* setup input buffer */
-    ind.infile = infile;
-    ind.inbuf = inbuf;
-    ind.nbytes = nbytes;
-    ind.total = nbytes; /* Used just for progress */
-    ind.percent = 0;
-    ind.offs = offs;
-    ind.checksum = (unsigned long *)checksum;
-    ind.dgst = dgst; /* digest for computing hashes */
+    ind.src = src;
+    ind.inbuf = bufs->inbuf;
+    ind.bufs = bufs;
     indp = &ind;
 
     /* decompress concatenated gzip streams */
@@ -392,7 +367,7 @@ static int gunpipe(z_stream *strm, int infile, unsigned long *offs, int nbytes,
 
         /* process a compress (LZW) file -- can't be concatenated after this */
         if (last == 157) {
-            ret = lunpipe(have, next, indp, outfile, strm);
+            ret = lunpipe(have, next, indp, dst, strm);
             break;
         }
 
@@ -444,7 +419,7 @@ static int gunpipe(z_stream *strm, int infile, unsigned long *offs, int nbytes,
         if (last == -1) break;
 
         /* set up output */
-        outd.outfile = outfile;
+        outd.dst = dst;
         outd.check = 1;
         outd.crc = crc32(0L, Z_NULL, 0);
         outd.total = 0;
@@ -490,30 +465,35 @@ static int gunpipe(z_stream *strm, int infile, unsigned long *offs, int nbytes,
     return ret;
 }
 
-/* Process the gun command line arguments.  See the command syntax near the
-   beginning of this source file. */
-int decompress_image(int infile, unsigned long *offs, int nbytes,
-	int outfile, uint32_t *checksum, void *dgst)
+/* Decompress a gzip image from the input source to the output */
+int gunzip_image(struct decompress_in *src, struct decompress_out *dst)
 {
     int ret;
     unsigned char *window;
+    struct gunbufs *bufs;
     z_stream strm;
 
-    *checksum = 0;
+    bufs = (struct gunbufs *)malloc(sizeof(*bufs));
+    if (bufs == NULL) {
+        ERROR("gun out of memory error--aborting\n");
+        return -ENOMEM;
+    }
 
     /* initialize inflateBack state for repeated use */
-    window = match;                         /* reuse LZW match buffer */
+    window = bufs->match;                   /* reuse LZW match buffer */
     strm.zalloc = Z_NULL;
     strm.zfree = Z_NULL;
     strm.opaque = Z_NULL;
     ret = inflateBackInit(&strm, 15, window);
     if (ret != Z_OK) {
         ERROR("gun out of memory error--aborting\n");
-        return 1;
+        free(bufs);
+        return -ENOMEM;
     }
     errno = 0;
-    ret = gunpipe(&strm, infile, offs, nbytes, outfile, checksum, dgst);
+    ret = gunpipe(&strm, bufs, src, dst);
     /* clean up */
     inflateBackEnd(&strm);
+    free(bufs);
     return ret;
 }
@@ -0,0 +1,98 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <lz4frame.h>
+
+#include "generated/autoconf.h"
+#include "util.h"
+#include "decompress.h"
+
+#define MODULE_NAME "unlz4"
+
+#define LZ4_BUFF_SIZE	(64 * 1024)
+
+int lz4_image(struct decompress_in *in, struct decompress_out *out)
+{
+	LZ4F_decompressionContext_t dctx;
+	unsigned char *inbuf = NULL, *outbuf = NULL;
+	const unsigned char *src;
+	size_t srcsize, dstsize, left;
+	size_t hint = 0;
+	LZ4F_errorCode_t err;
+	int len, status = 0;
+
+	err = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+	if (LZ4F_isError(err)) {
+		ERROR("lz4: %s", LZ4F_getErrorName(err));
+		return -ENOMEM;
+	}
+
+	inbuf = (unsigned char *)malloc(LZ4_BUFF_SIZE);
+	outbuf = (unsigned char *)malloc(LZ4_BUFF_SIZE);
+	if (!inbuf || !outbuf) {
+		ERROR("lz4: out of memory");
+		status = -ENOMEM;
+		goto lz4_exit;
+	}
+
+	/*
+	 * A new frame is started as soon as the previous one is
+	 * complete. When the output buffer is full, the decoder may
+	 * still have data buffered, so it is called again.
+	 */
+	while ((len = decompress_read(in, inbuf, LZ4_BUFF_SIZE)) > 0) {
+		src = inbuf;
+		left = len;
+		do {
+			srcsize = left;
+			dstsize = LZ4_BUFF_SIZE;
+			hint = LZ4F_decompress(dctx, outbuf, &dstsize,
+						src, &srcsize, NULL);
+			if (LZ4F_isError(hint)) {
+				ERROR("lz4: %s", LZ4F_getErrorName(hint));
+				status = -EINVAL;
+				goto lz4_exit;
+			}
+			if (decompress_write(out, outbuf, dstsize) < 0) {
+				status = -ENOSPC;
+				goto lz4_exit;
+			}
+			src += srcsize;
+			left -= srcsize;
+		} while (left || (hint && dstsize == LZ4_BUFF_SIZE));
+	}
+	if (len < 0)
+		status = -EFAULT;
+
+	if (!status && hint) {
+		ERROR("lz4: truncated stream");
+		status = -EINVAL;
+	}
+
+lz4_exit:
+	LZ4F_freeDecompressionContext(dctx);
+	free(inbuf);
+	free(outbuf);
+
+	return status;
+}
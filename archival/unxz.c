@@ -0,0 +1,99 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <lzma.h>
+
+#include "generated/autoconf.h"
+#include "util.h"
+#include "decompress.h"
+
+#define MODULE_NAME "unxz"
+
+#define XZ_BUFF_SIZE	(64 * 1024)
+
+int xz_image(struct decompress_in *in, struct decompress_out *out)
+{
+	lzma_stream strm = LZMA_STREAM_INIT;
+	lzma_action action = LZMA_RUN;
+	unsigned char *inbuf, *outbuf;
+	lzma_ret ret;
+	int len, status = 0;
+
+	inbuf = (unsigned char *)malloc(XZ_BUFF_SIZE);
+	outbuf = (unsigned char *)malloc(XZ_BUFF_SIZE);
+	if (!inbuf || !outbuf) {
+		ERROR("xz: out of memory");
+		status = -ENOMEM;
+		goto xz_exit;
+	}
+
+	/* several .xz streams may be concatenated */
+	ret = lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED);
+	if (ret != LZMA_OK) {
+		ERROR("xz: decoder initialization failed (%d)", ret);
+		status = -ENOMEM;
+		goto xz_exit;
+	}
+
+	strm.next_out = outbuf;
+	strm.avail_out = XZ_BUFF_SIZE;
+	do {
+		if (!strm.avail_in && action == LZMA_RUN) {
+			len = decompress_read(in, inbuf, XZ_BUFF_SIZE);
+			if (len < 0) {
+				status = -EFAULT;
+				break;
+			}
+			if (!len)
+				action = LZMA_FINISH;
+			strm.next_in = inbuf;
+			strm.avail_in = len;
+		}
+
+		ret = lzma_code(&strm, action);
+		if (ret != LZMA_OK && ret != LZMA_STREAM_END) {
+			ERROR("xz: decoding failed (%d)", ret);
+			status = -EINVAL;
+			break;
+		}
+
+		if (!strm.avail_out || ret == LZMA_STREAM_END) {
+			if (decompress_write(out, outbuf,
+					XZ_BUFF_SIZE - strm.avail_out) < 0) {
+				status = -ENOSPC;
+				break;
+			}
+			strm.next_out = outbuf;
+			strm.avail_out = XZ_BUFF_SIZE;
+		}
+	} while (ret != LZMA_STREAM_END);
+
+	lzma_end(&strm);
+
+xz_exit:
+	free(inbuf);
+	free(outbuf);
+
+	return status;
+}
@@ -0,0 +1,92 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <zstd.h>
+
+#include "generated/autoconf.h"
+#include "util.h"
+#include "decompress.h"
+
+#define MODULE_NAME "unzstd"
+
+int zstd_image(struct decompress_in *in, struct decompress_out *out)
+{
+	ZSTD_DStream *dstream;
+	ZSTD_inBuffer input;
+	ZSTD_outBuffer output;
+	size_t insize = ZSTD_DStreamInSize();
+	size_t outsize = ZSTD_DStreamOutSize();
+	unsigned char *inbuf, *outbuf;
+	size_t ret = 0;
+	int len, status = 0;
+
+	dstream = ZSTD_createDStream();
+	inbuf = (unsigned char *)malloc(insize);
+	outbuf = (unsigned char *)malloc(outsize);
+	if (!dstream || !inbuf || !outbuf) {
+		ERROR("zstd: out of memory");
+		status = -ENOMEM;
+		goto zstd_exit;
+	}
+	ZSTD_initDStream(dstream);
+
+	/*
+	 * Frames are decoded one after the other. When the output
+	 * buffer is full, the decoder may still have data buffered,
+	 * so it is called again until it returns less.
+	 */
+	while ((len = decompress_read(in, inbuf, insize)) > 0) {
+		input.src = inbuf;
+		input.size = len;
+		input.pos = 0;
+		do {
+			output.dst = outbuf;
+			output.size = outsize;
+			output.pos = 0;
+			ret = ZSTD_decompressStream(dstream, &output, &input);
+			if (ZSTD_isError(ret)) {
+				ERROR("zstd: %s", ZSTD_getErrorName(ret));
+				status = -EINVAL;
+				goto zstd_exit;
+			}
+			if (decompress_write(out, outbuf, output.pos) < 0) {
+				status = -ENOSPC;
+				goto zstd_exit;
+			}
+		} while (input.pos < input.size ||
+			 (ret && output.pos == output.size));
+	}
+	if (len < 0)
+		status = -EFAULT;
+
+	if (!status && ret) {
+		ERROR("zstd: truncated stream");
+		status = -EINVAL;
+	}
+
+zstd_exit:
+	ZSTD_freeDStream(dstream);
+	free(inbuf);
+	free(outbuf);
+
+	return status;
+}
@@ -0,0 +1,578 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+/*
+ * Writer for block devices with several requests in flight.
+ * Data from copyfile() is collected into aligned buffers, that
+ * are written with O_DIRECT while the next ones are filled.
+ * The requests are queued with io_uring if available, else
+ * each of them is handed to a thread of a pool.
+ * The last bytes, if they are not a multiple of the block size,
+ * are written through the page cache after everything else.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "generated/autoconf.h"
+#include "util.h"
+#include "async_writer.h"
+
+#ifdef CONFIG_ASYNC_WRITER_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#define MODULE_NAME "async_writer"
+
+#define AW_BUFF_SIZE	(1024 * 1024)
+#define AW_ALIGN	4096	/* covers 512 and 4K logical blocks */
+#define AW_MAX_DEPTH	64
+
+struct aw_buf {
+	unsigned char *data;
+	unsigned int len;
+	unsigned long long offset;
+	struct iovec iov;
+	int busy;		/* write in flight */
+};
+
+struct aw_ops {
+	const char *name;
+	int (*init)(struct async_writer *aw);
+	int (*submit)(struct async_writer *aw, struct aw_buf *buf);
+	void (*wait)(struct async_writer *aw, struct aw_buf *buf);
+	void (*exit)(struct async_writer *aw);
+};
+
+struct aw_uring;
+
+struct async_writer {
+	/*
+	 * Must be the first member: copyfile() takes the
+	 * output as a file descriptor to seek on it
+	 */
+	int fd;
+	int dfd;		/* opened with O_DIRECT */
+	unsigned long long offset;	/* offset of the next buffer */
+	unsigned int depth;
+	unsigned int cur;	/* buffer being filled */
+	struct aw_buf *bufs;
+	int error;		/* first error of any write */
+	const struct aw_ops *ops;
+
+	/* thread pool */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t *threads;
+	unsigned int nthreads;
+	struct aw_buf **queue;
+	unsigned int head, count;
+	int stop;
+
+	/* io_uring */
+	struct aw_uring *ring;
+};
+
+static void aw_set_error(struct async_writer *aw, int err)
+{
+	if (!aw->error)
+		aw->error = err;
+}
+
+static int aw_pwrite(int fd, const unsigned char *buf, unsigned int len,
+		unsigned long long offset)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = pwrite(fd, buf, len, offset);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -errno;
+		if (ret == 0)
+			return -EIO;
+		buf += ret;
+		len -= ret;
+		offset += ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Thread pool: each thread takes a buffer from
+ * the queue and writes it with a blocking pwrite()
+ */
+static void *aw_thread(void *data)
+{
+	struct async_writer *aw = (struct async_writer *)data;
+	struct aw_buf *buf;
+	int ret;
+
+	pthread_mutex_lock(&aw->lock);
+	for (;;) {
+		while (!aw->count && !aw->stop)
+			pthread_cond_wait(&aw->cond, &aw->lock);
+		if (!aw->count)
+			break;
+		buf = aw->queue[aw->head];
+		aw->head = (aw->head + 1) % aw->depth;
+		aw->count--;
+		pthread_mutex_unlock(&aw->lock);
+
+		ret = aw_pwrite(aw->dfd, buf->data, buf->len, buf->offset);
+
+		pthread_mutex_lock(&aw->lock);
+		if (ret < 0)
+			aw_set_error(aw, ret);
+		buf->busy = 0;
+		pthread_cond_broadcast(&aw->cond);
+	}
+	pthread_mutex_unlock(&aw->lock);
+
+	return NULL;
+}
+
+static void threads_exit(struct async_writer *aw)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&aw->lock);
+	aw->stop = 1;
+	pthread_cond_broadcast(&aw->cond);
+	pthread_mutex_unlock(&aw->lock);
+
+	for (i = 0; i < aw->nthreads; i++)
+		pthread_join(aw->threads[i], NULL);
+
+	free(aw->threads);
+	free(aw->queue);
+	pthread_cond_destroy(&aw->cond);
+	pthread_mutex_destroy(&aw->lock);
+}
+
+static int threads_init(struct async_writer *aw)
+{
+	pthread_mutex_init(&aw->lock, NULL);
+	pthread_cond_init(&aw->cond, NULL);
+	aw->threads = (pthread_t *)calloc(aw->depth, sizeof(*aw->threads));
+	aw->queue = (struct aw_buf **)calloc(aw->depth, sizeof(*aw->queue));
+	if (!aw->threads || !aw->queue) {
+		threads_exit(aw);
+		return -ENOMEM;
+	}
+
+	for (aw->nthreads = 0; aw->nthreads < aw->depth; aw->nthreads++) {
+		if (pthread_create(&aw->threads[aw->nthreads], NULL,
+					aw_thread, aw)) {
+			threads_exit(aw);
+			return -EAGAIN;
+		}
+	}
+
+	return 0;
+}
+
+static int threads_submit(struct async_writer *aw, struct aw_buf *buf)
+{
+	pthread_mutex_lock(&aw->lock);
+	aw->queue[(aw->head + aw->count) % aw->depth] = buf;
+	aw->count++;
+	pthread_cond_broadcast(&aw->cond);
+	pthread_mutex_unlock(&aw->lock);
+
+	return 0;
+}
+
+static void threads_wait(struct async_writer *aw, struct aw_buf *buf)
+{
+	pthread_mutex_lock(&aw->lock);
+	while (buf->busy)
+		pthread_cond_wait(&aw->cond, &aw->lock);
+	pthread_mutex_unlock(&aw->lock);
+}
+
+static const struct aw_ops threads_ops = {
+	.name = "thread pool",
+	.init = threads_init,
+	.submit = threads_submit,
+	.wait = threads_wait,
+	.exit = threads_exit,
+};
+
+#ifdef CONFIG_ASYNC_WRITER_IO_URING
+/*
+ * io_uring through the raw system calls, the requests
+ * are writev() of a single buffer each
+ */
+struct aw_uring {
+	int fd;
+	void *sq_ptr, *cq_ptr;
+	size_t sq_len, cq_len;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+	struct io_uring_cqe *cqes;
+};
+
+static int uring_enter(int fd, unsigned int to_submit,
+		unsigned int min_complete, unsigned int flags)
+{
+	long ret;
+
+	do {
+		ret = syscall(__NR_io_uring_enter, fd, to_submit,
+				min_complete, flags, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret < 0 ? -errno : (int)ret;
+}
+
+static void uring_exit(struct async_writer *aw)
+{
+	struct aw_uring *r = aw->ring;
+
+	if (!r)
+		return;
+	if (r->sqes)
+		munmap(r->sqes, r->sqes_len);
+	if (r->cq_ptr && r->cq_ptr != r->sq_ptr)
+		munmap(r->cq_ptr, r->cq_len);
+	if (r->sq_ptr)
+		munmap(r->sq_ptr, r->sq_len);
+	if (r->fd >= 0)
+		close(r->fd);
+	free(r);
+	aw->ring = NULL;
+}
+
+static int uring_init(struct async_writer *aw)
+{
+	struct io_uring_params p;
+	struct aw_uring *r;
+
+	r = (struct aw_uring *)calloc(1, sizeof(*r));
+	if (!r)
+		return -ENOMEM;
+	aw->ring = r;
+
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, aw->depth, &p);
+	if (r->fd < 0) {
+		uring_exit(aw);
+		return -errno;
+	}
+
+	r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->sq_len = r->cq_len = max(r->sq_len, r->cq_len);
+
+	r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED) {
+		r->sq_ptr = NULL;
+		uring_exit(aw);
+		return -ENOMEM;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_ptr = r->sq_ptr;
+	} else {
+		r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ptr == MAP_FAILED) {
+			r->cq_ptr = NULL;
+			uring_exit(aw);
+			return -ENOMEM;
+		}
+	}
+	r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		r->sqes = NULL;
+		uring_exit(aw);
+		return -ENOMEM;
+	}
+
+	r->sq_tail = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+	r->sq_mask = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+	r->cq_head = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+	r->cq_tail = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+	r->cq_mask = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+
+	return 0;
+}
+
+static int uring_submit(struct async_writer *aw, struct aw_buf *buf)
+{
+	struct aw_uring *r = aw->ring;
+	struct io_uring_sqe *sqe;
+	unsigned tail, idx;
+	int ret;
+
+	tail = *r->sq_tail;
+	idx = tail & *r->sq_mask;
+	sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->fd = aw->dfd;
+	sqe->off = buf->offset;
+	sqe->addr = (unsigned long)&buf->iov;
+	sqe->len = 1;
+	sqe->user_data = buf - aw->bufs;
+	r->sq_array[idx] = idx;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	ret = uring_enter(r->fd, 1, 0, 0);
+
+	return ret < 0 ? ret : 0;
+}
+
+static void uring_reap(struct async_writer *aw)
+{
+	struct aw_uring *r = aw->ring;
+	struct io_uring_cqe *cqe;
+	struct aw_buf *buf;
+	unsigned head, tail;
+
+	head = *r->cq_head;
+	tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &r->cqes[head & *r->cq_mask];
+		buf = &aw->bufs[cqe->user_data];
+		if (cqe->res < 0)
+			aw_set_error(aw, cqe->res);
+		else if ((unsigned int)cqe->res != buf->len)
+			aw_set_error(aw, -EIO);
+		buf->busy = 0;
+	}
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void uring_wait(struct async_writer *aw, struct aw_buf *buf)
+{
+	int ret;
+
+	uring_reap(aw);
+	while (buf->busy) {
+		ret = uring_enter(aw->ring->fd, 0, 1, IORING_ENTER_GETEVENTS);
+		if (ret < 0) {
+			/* the request cannot complete anymore */
+			aw_set_error(aw, ret);
+			buf->busy = 0;
+			break;
+		}
+		uring_reap(aw);
+	}
+}
+
+static const struct aw_ops uring_ops = {
+	.name = "io_uring",
+	.init = uring_init,
+	.submit = uring_submit,
+	.wait = uring_wait,
+	.exit = uring_exit,
+};
+#endif
+
+static void aw_free(struct async_writer *aw)
+{
+	unsigned int i;
+
+	if (aw->bufs) {
+		for (i = 0; i < aw->depth; i++)
+			free(aw->bufs[i].data);
+		free(aw->bufs);
+	}
+	if (aw->dfd >= 0)
+		close(aw->dfd);
+	if (aw->fd >= 0)
+		close(aw->fd);
+	free(aw);
+}
+
+struct async_writer *async_writer_open(const char *device,
+		unsigned long long offset, unsigned int depth)
+{
+	struct async_writer *aw;
+	unsigned int i;
+
+	if (offset % AW_ALIGN) {
+		TRACE("Offset %llu of %s is not aligned, no direct I/O",
+			offset, device);
+		return NULL;
+	}
+
+	aw = (struct async_writer *)calloc(1, sizeof(*aw));
+	if (!aw)
+		return NULL;
+	aw->fd = aw->dfd = -1;
+	aw->offset = offset;
+	aw->depth = depth ? min(depth, (unsigned int)AW_MAX_DEPTH) :
+				CONFIG_ASYNC_WRITER_QUEUE_DEPTH;
+
+	aw->fd = open(device, O_RDWR);
+	aw->dfd = open(device, O_WRONLY | O_DIRECT);
+	if (aw->fd < 0 || aw->dfd < 0) {
+		TRACE("Device %s cannot be opened for direct I/O: %s",
+			device, strerror(errno));
+		aw_free(aw);
+		return NULL;
+	}
+
+	aw->bufs = (struct aw_buf *)calloc(aw->depth, sizeof(*aw->bufs));
+	if (!aw->bufs) {
+		aw_free(aw);
+		return NULL;
+	}
+	for (i = 0; i < aw->depth; i++) {
+		if (posix_memalign((void **)&aw->bufs[i].data, AW_ALIGN,
+					AW_BUFF_SIZE)) {
+			aw->bufs[i].data = NULL;
+			aw_free(aw);
+			return NULL;
+		}
+	}
+
+#ifdef CONFIG_ASYNC_WRITER_IO_URING
+	aw->ops = &uring_ops;
+	if (aw->ops->init(aw) < 0)
+		aw->ops = NULL;
+#endif
+	if (!aw->ops) {
+		aw->ops = &threads_ops;
+		if (aw->ops->init(aw) < 0) {
+			aw_free(aw);
+			return NULL;
+		}
+	}
+
+	TRACE("Writing %s with O_DIRECT (%s, %u writes in flight)",
+		device, aw->ops->name, aw->depth);
+
+	return aw;
+}
+
+/* Queue the buffer being filled and wait until the next one is free */
+static int aw_submit(struct async_writer *aw)
+{
+	struct aw_buf *buf = &aw->bufs[aw->cur];
+	int ret;
+
+	buf->offset = aw->offset;
+	buf->iov.iov_base = buf->data;
+	buf->iov.iov_len = buf->len;
+	buf->busy = 1;
+	aw->offset += buf->len;
+
+	ret = aw->ops->submit(aw, buf);
+	if (ret < 0) {
+		buf->busy = 0;
+		aw_set_error(aw, ret);
+		return ret;
+	}
+
+	aw->cur = (aw->cur + 1) % aw->depth;
+	buf = &aw->bufs[aw->cur];
+	aw->ops->wait(aw, buf);
+	buf->len = 0;
+
+	return aw->error;
+}
+
+int async_writer_write(void *out, const void *buf, unsigned int len)
+{
+	struct async_writer *aw = (struct async_writer *)out;
+	const unsigned char *data = (const unsigned char *)buf;
+	struct aw_buf *cur;
+	unsigned int n;
+
+	while (len > 0) {
+		cur = &aw->bufs[aw->cur];
+		n = min(len, (unsigned int)(AW_BUFF_SIZE - cur->len));
+		memcpy(cur->data + cur->len, data, n);
+		cur->len += n;
+		data += n;
+		len -= n;
+		if (cur->len == AW_BUFF_SIZE && aw_submit(aw) < 0) {
+			ERROR("Writing at offset %llu failed: %s",
+				aw->offset, strerror(-aw->error));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int async_writer_close(struct async_writer *aw)
+{
+	struct aw_buf *cur = &aw->bufs[aw->cur];
+	unsigned int tail, i;
+	int ret;
+
+	/* the aligned part of the last buffer is still written directly */
+	tail = cur->len % AW_ALIGN;
+	cur->len -= tail;
+	if (cur->len && !aw->error) {
+		cur->offset = aw->offset;
+		cur->iov.iov_base = cur->data;
+		cur->iov.iov_len = cur->len;
+		cur->busy = 1;
+		aw->offset += cur->len;
+		ret = aw->ops->submit(aw, cur);
+		if (ret < 0) {
+			cur->busy = 0;
+			aw_set_error(aw, ret);
+		}
+	}
+
+	for (i = 0; i < aw->depth; i++)
+		aw->ops->wait(aw, &aw->bufs[i]);
+	aw->ops->exit(aw);
+
+	if (tail && !aw->error) {
+		ret = aw_pwrite(aw->fd, cur->data + cur->len, tail, aw->offset);
+		if (ret < 0)
+			aw_set_error(aw, ret);
+	}
+	if (!aw->error && fsync(aw->fd) < 0)
+		aw_set_error(aw, -errno);
+
+	ret = aw->error;
+	if (ret < 0)
+		ERROR("Writing with O_DIRECT failed: %s", strerror(-ret));
+
+	aw_free(aw);
+
+	return ret;
+}
@@ -21,12 +21,20 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 
 #include "generated/autoconf.h"
 #include "cpiohdr.h"
 #include "util.h"
 #include "sslapi.h"
 #include "progress.h"
+#include "pipeline.h"
+#include "checksum.h"
+#include "metrics.h"
 
 #define MODULE_NAME "cpio"
 
@@ -34,6 +42,29 @@
 
 #define NPAD_BYTES(o) ((4 - (o % 4)) % 4)
 
+/*
+ * Chunks moved by the kernel in the direct copy,
+ * progress is updated after each of them
+ */
+#define DIRECT_CHUNK	(1024 * 1024)
+#define PIPE_CHUNK	(64 * 1024)
+
+/*
+ * Set by the installer when the images still being copied
+ * must stop, because another one installed in parallel failed
+ */
+static int copy_aborted;
+
+void copy_abort(int abort)
+{
+	__atomic_store_n(&copy_aborted, abort, __ATOMIC_RELAXED);
+}
+
+static int copy_is_aborted(void)
+{
+	return __atomic_load_n(&copy_aborted, __ATOMIC_RELAXED);
+}
+
 static int get_cpiohdr(unsigned char *buf, unsigned long *size,
 			unsigned long *namesize, unsigned long *chksum)
 {
@@ -56,23 +87,34 @@ int fill_buffer(int fd, unsigned char *buf, unsigned int nbytes, unsigned long *
 {
 	ssize_t len;
 	unsigned long count = 0;
-	int i;
+	unsigned long long t;
 
 	while (nbytes > 0) {
+		if (copy_is_aborted())
+			return -EINTR;
+		t = metrics_now();
 		len = read(fd, buf, nbytes);
 		if (len < 0) {
 			ERROR("Failure in stream: I cannot go on\n");
 			return -EFAULT;
 		}
+		/* the caller cannot use a part of what it asked for */
 		if (len == 0) {
-			return 0;
+			ERROR("Premature end of stream, %u bytes missing\n",
+				nbytes);
+			return -EFAULT;
+		}
+		metrics_add(METRIC_READ, t, len);
+		if (checksum) {
+			t = metrics_now();
+			*checksum = cpio_checksum(*checksum, buf, len);
+			metrics_add(METRIC_CHECKSUM, t, len);
 		}
-		if (checksum)
-			for (i = 0; i < len; i++)
-				*checksum += buf[i];
 
 		if (dgst) {
+			t = metrics_now();
 			swupdate_HASH_update(dgst, buf, len);
+			metrics_add(METRIC_HASH, t, len);
 		}
 		buf += len;
 		count += len;
@@ -110,11 +152,18 @@ static int copy_write(void *out, const void *buf, unsigned int len)
 	return 0;
 }
 
-int copyfile(int fdin, void *out, unsigned int nbytes, unsigned long *offs, unsigned long long seek,
-	int skip_file, int __attribute__ ((__unused__)) compressed,
-	uint32_t *checksum, unsigned char *hash, int encrypted, writeimage callback)
+/*
+ * hash_chunk is 0 for a plain SHA-256, else hash is the root
+ * of a tree hash over chunks of hash_chunk bytes
+ */
+static int copyfile_hash(int fdin, void *out, unsigned int nbytes,
+	unsigned long *offs, unsigned long long seek,
+	int skip_file, int compressed, uint32_t *checksum,
+	unsigned char *hash, unsigned int hash_chunk,
+	int encrypted, writeimage callback)
 {
 	unsigned long size;
+	unsigned long bufsize = encrypted ? DECRYPT_PIECE : BUFF_SIZE;
 	unsigned char *in = NULL, *inbuf;
 	unsigned char *decbuf = NULL;
 	unsigned long filesize = nbytes;
@@ -131,13 +180,17 @@ int copyfile(int fdin, void *out, unsigned int nbytes, unsigned long *offs, unsi
 	unsigned char *aes_key;
 	unsigned char *ivt;
 	unsigned char *salt;
+	unsigned long long t;
 
 	if (!callback) {
 		callback = copy_write;
 	}
 
 	if (IsValidHash(hash)) {
-		dgst = swupdate_HASH_init();
+		if (hash_chunk)
+			dgst = swupdate_HASH_init_tree(hash_chunk);
+		else
+			dgst = swupdate_HASH_init();
 		if (!dgst)
 			return -EFAULT;
 	}
@@ -145,21 +198,12 @@ int copyfile(int fdin, void *out, unsigned int nbytes, unsigned long *offs, unsi
 	if (checksum)
 		*checksum = 0;
 
-	/*
-	 * Simultaneous compression and decryption of images
-	 * is not (yet ?) supported
-	 */
-	if (compressed && encrypted) {
-		ERROR("encrypted zip images are not yet supported -- aborting\n");
-		return -EINVAL;
-	}
-
-	in = (unsigned char *)malloc(BUFF_SIZE);
+	in = (unsigned char *)malloc(bufsize);
 	if (!in)
 		return -ENOMEM;
 
 	if (encrypted) {
-		decbuf = (unsigned char *)calloc(1, BUFF_SIZE + AES_BLOCK_SIZE);
+		decbuf = (unsigned char *)calloc(1, bufsize + AES_BLOCK_SIZE);
 		if (!decbuf) {
 			ret = -ENOMEM;
 			goto copyfile_exit;
@@ -168,7 +212,8 @@ int copyfile(int fdin, void *out, unsigned int nbytes, unsigned long *offs, unsi
 		aes_key = get_aes_key();
 		ivt = get_aes_ivt();
 		salt = get_aes_salt();
-		dcrypt = swupdate_DECRYPT_init(aes_key, ivt, salt);
+		dcrypt = swupdate_DECRYPT_init_cipher(aes_key, ivt, salt,
+						encrypted);
 		if (!dcrypt) {
 			ERROR("decrypt initialization failure, aborting");
 			ret = -EFAULT;
@@ -186,19 +231,38 @@ int copyfile(int fdin, void *out, unsigned int nbytes, unsigned long *offs, unsi
 		}
 	}
 
-	int fdout = (out != NULL) ? *(int *)out : -1;
 	if (compressed) {
-		ret = decompress_image(fdin, offs, nbytes, fdout, checksum, dgst);
+		/*
+		 * Encrypted and compressed images are decrypted
+		 * and inflated in the same pass, hash and checksum
+		 * are computed on the data as stored in the archive
+		 */
+		ret = decompress_image(compressed, fdin, offs, nbytes, out,
+					callback, checksum, dgst, dcrypt);
 		if (ret < 0) {
-			ERROR("gunzip failure %d (errno %d) -- aborting\n", ret, errno);
+			ERROR("decompression failure %d (errno %d) -- aborting\n", ret, errno);
 			goto copyfile_exit;
 		}
 	} else {
 
+	/*
+	 * Large images can be copied by a staged pipeline,
+	 * if it cannot be started go on with the serial copy
+	 */
+	ret = -EAGAIN;
+	if (!skip_file && nbytes >= PIPELINE_MIN_SIZE) {
+		ret = copy_pipeline(fdin, out, nbytes, offs, checksum,
+					dgst, dcrypt, callback);
+		if (ret < 0 && ret != -EAGAIN)
+			goto copyfile_exit;
+		if (!ret)
+			nbytes = 0;
+	}
+
 	while (nbytes > 0) {
-		size = (nbytes < BUFF_SIZE ? nbytes : BUFF_SIZE);
+		size = (nbytes < bufsize ? nbytes : bufsize);
 
-		if ((ret = fill_buffer(fdin, in, size, offs, checksum, dgst) < 0)) {
+		if ((ret = fill_buffer(fdin, in, size, offs, checksum, dgst)) < 0) {
 			goto copyfile_exit;
 		}
 
@@ -210,10 +274,12 @@ int copyfile(int fdin, void *out, unsigned int nbytes, unsigned long *offs, unsi
 		len = size;
 
 		if (encrypted) {
+			t = metrics_now();
 			ret = swupdate_DECRYPT_update(dcrypt, decbuf,
 				&len, in, size);
 			if (ret < 0)
 				goto copyfile_exit;
+			metrics_add(METRIC_DECRYPT, t, size);
 			inbuf = decbuf;
 		}
 
@@ -223,10 +289,12 @@ int copyfile(int fdin, void *out, unsigned int nbytes, unsigned long *offs, unsi
 		 * results corrupted. This lets the cleanup routine
 		 * to remove it
 		 */
+		t = metrics_now();
 		if (callback(out, inbuf, len) < 0) {
 			ret =-ENOSPC;
 			goto copyfile_exit;
 		}
+		metrics_add(METRIC_WRITE, t, len);
 
 		percent = (unsigned int)(((double)(filesize - nbytes)) * 100 / filesize);
 		if (percent != prevpercent) {
@@ -239,16 +307,21 @@ int copyfile(int fdin, void *out, unsigned int nbytes, unsigned long *offs, unsi
 
 	/*
 	 * Finalise the decryption. Further plaintext bytes may be written at
-	 * this stage.
+	 * this stage. For compressed images, this was already done
+	 * by the decompressor.
 	 */
-	if (encrypted) {
+	if (encrypted && !compressed) {
+		t = metrics_now();
 		ret = swupdate_DECRYPT_final(dcrypt, decbuf, &len);
 		if (ret < 0)
 			goto copyfile_exit;
+		metrics_add(METRIC_DECRYPT, t, 0);
+		t = metrics_now();
 		if (callback(out, decbuf, len) < 0) {
 			ret =-ENOSPC;
 			goto copyfile_exit;
 		}
+		metrics_add(METRIC_WRITE, t, len);
 	}
 
 
@@ -292,9 +365,34 @@ copyfile_exit:
 	return ret;
 }
 
+int copyfile(int fdin, void *out, unsigned int nbytes, unsigned long *offs, unsigned long long seek,
+	int skip_file, int compressed,
+	uint32_t *checksum, unsigned char *hash, int encrypted, writeimage callback)
+{
+	return copyfile_hash(fdin, out, nbytes, offs, seek, skip_file,
+			compressed, checksum, hash, 0, encrypted, callback);
+}
+
+/*
+ * If img->checksum is set, it is the value from the cpio
+ * header and it is verified after the copy. It is then
+ * replaced by the computed checksum.
+ * A tree hash is checked instead of sha256 if both are set.
+ */
 int copyimage(void *out, struct img_type *img, writeimage callback)
 {
-	return copyfile(img->fdin,
+	uint32_t expected = img->checksum;
+	unsigned char *hash = img->sha256;
+	unsigned int hash_chunk = 0;
+	int ret;
+
+	if (IsValidHash(img->tree_sha256)) {
+		hash = img->tree_sha256;
+		hash_chunk = img->hash_chunk_size > 0 ?
+			(unsigned int)img->hash_chunk_size : HASH_TREE_CHUNK_SIZE;
+	}
+
+	ret = copyfile_hash(img->fdin,
 			out,
 			img->size,
 			(unsigned long *)&img->offset,
@@ -302,9 +400,288 @@ int copyimage(void *out, struct img_type *img, writeimage callback)
 			0, /* no skip */
 			img->compressed,
 			&img->checksum,
-			img->sha256,
+			hash,
+			hash_chunk,
 			img->is_encrypted,
 			callback);
+	if (ret)
+		return ret;
+
+	if (expected && img->checksum != expected) {
+		ERROR("Checksum WRONG ! Computed 0x%lx, it should be 0x%lx\n",
+			(unsigned long)img->checksum, (unsigned long)expected);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+/*
+ * copy_file_range() was added to glibc later as to the kernel,
+ * call it directly to build with older toolchains
+ */
+static ssize_t swupdate_copy_file_range(int fdin, int fdout, size_t len)
+{
+#ifdef __NR_copy_file_range
+	return syscall(__NR_copy_file_range, fdin, NULL, fdout, NULL, len, 0);
+#else
+	(void)fdin;
+	(void)fdout;
+	(void)len;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/*
+ * Compute the cpio checksum of a region of a file without
+ * copying it, by mapping it piece by piece
+ */
+static int checksum_file_region(int fd, off_t start, unsigned int nbytes,
+				uint32_t *checksum)
+{
+	long pagesize = sysconf(_SC_PAGESIZE);
+	unsigned char *map;
+	unsigned int chunk;
+	size_t delta;
+	off_t base;
+
+	while (nbytes > 0) {
+		base = start & ~((off_t)pagesize - 1);
+		delta = start - base;
+		chunk = min(nbytes, (unsigned int)DIRECT_CHUNK);
+		map = mmap(NULL, chunk + delta, PROT_READ, MAP_SHARED, fd, base);
+		if (map == MAP_FAILED)
+			return -errno;
+		madvise(map, chunk + delta, MADV_SEQUENTIAL);
+		*checksum = cpio_checksum(*checksum, map + delta, chunk);
+		munmap(map, chunk + delta);
+		start += chunk;
+		nbytes -= chunk;
+	}
+
+	return 0;
+}
+
+/*
+ * Local file: the checksum is verified before writing, then
+ * data is moved with copy_file_range() or sendfile()
+ */
+static int copy_direct_file(int fdin, int fdout, unsigned int nbytes,
+			uint32_t *checksum, uint32_t expected)
+{
+	unsigned int filesize = nbytes;
+	unsigned int percent, prevpercent = 0;
+	off_t start;
+	ssize_t n;
+	int use_sendfile = 0;
+
+	start = lseek(fdin, 0, SEEK_CUR);
+	if (start < 0)
+		return -EAGAIN;
+
+	/*
+	 * If the file cannot be mapped, let copyfile()
+	 * compute the checksum while reading
+	 */
+	if (checksum_file_region(fdin, start, nbytes, checksum) < 0)
+		return -EAGAIN;
+	if (expected && *checksum != expected) {
+		ERROR("Checksum WRONG ! Computed 0x%lx, it should be 0x%lx\n",
+			(unsigned long)*checksum, (unsigned long)expected);
+		return -EFAULT;
+	}
+
+	while (nbytes > 0) {
+		if (copy_is_aborted())
+			return -EINTR;
+		if (!use_sendfile) {
+			n = swupdate_copy_file_range(fdin, fdout,
+						min(nbytes, (unsigned int)DIRECT_CHUNK));
+			if (n < 0 && nbytes == filesize &&
+			    (errno == ENOSYS || errno == EXDEV ||
+			     errno == EINVAL || errno == EOPNOTSUPP)) {
+				use_sendfile = 1;
+				continue;
+			}
+		} else {
+			n = sendfile(fdout, fdin, NULL,
+					min(nbytes, (unsigned int)DIRECT_CHUNK));
+			/* nothing was consumed, copyfile() can be used */
+			if (n < 0 && nbytes == filesize &&
+			    (errno == ENOSYS || errno == EINVAL))
+				return -EAGAIN;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			ERROR("cannot copy %u bytes", nbytes);
+			return -ENOSPC;
+		}
+		nbytes -= n;
+
+		percent = (unsigned int)(((double)(filesize - nbytes)) * 100 / filesize);
+		if (percent != prevpercent) {
+			prevpercent = percent;
+			swupdate_progress_update(percent);
+		}
+	}
+
+	return 0;
+}
+
+static int splice_all(int fdin, int fdout, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = splice(fdin, NULL, fdout, NULL, len, SPLICE_F_MOVE);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Pipe or socket: data is spliced through a pipe to the output,
+ * a tee() of the pipe is read back to compute the checksum
+ */
+static int copy_direct_stream(int fdin, int fdout, unsigned int nbytes,
+			uint32_t *checksum)
+{
+	unsigned int filesize = nbytes;
+	unsigned int percent, prevpercent = 0;
+	unsigned char *buf;
+	int datapipe[2], teepipe[2];
+	ssize_t n, t;
+	size_t len;
+	int ret = 0;
+
+	buf = (unsigned char *)malloc(PIPE_CHUNK);
+	if (!buf)
+		return -EAGAIN;
+	if (pipe(datapipe) < 0) {
+		free(buf);
+		return -EAGAIN;
+	}
+	if (pipe(teepipe) < 0) {
+		close(datapipe[0]);
+		close(datapipe[1]);
+		free(buf);
+		return -EAGAIN;
+	}
+
+	while (nbytes > 0) {
+		if (copy_is_aborted()) {
+			ret = -EINTR;
+			break;
+		}
+		n = splice(fdin, NULL, datapipe[1], NULL,
+				min(nbytes, (unsigned int)PIPE_CHUNK),
+				SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && nbytes == filesize &&
+		    (errno == EINVAL || errno == ENOSYS)) {
+			ret = -EAGAIN;
+			break;
+		}
+		if (n <= 0) {
+			ERROR("Failure in stream: I cannot go on\n");
+			ret = -EFAULT;
+			break;
+		}
+
+		/*
+		 * tee() always starts at the head of the pipe: the
+		 * bytes already duplicated are moved out before the
+		 * next tee(), so each of them is checksummed once
+		 */
+		for (len = 0; len < (size_t)n; len += t) {
+			t = tee(datapipe[0], teepipe[1], n - len, 0);
+			if (t <= 0)
+				break;
+			if (read(teepipe[0], buf, t) != t)
+				break;
+			*checksum = cpio_checksum(*checksum, buf, t);
+			if (splice_all(datapipe[0], fdout, t) < 0)
+				break;
+		}
+		if (len != (size_t)n) {
+			ERROR("cannot write %d bytes", (int)n);
+			ret = -ENOSPC;
+			break;
+		}
+		nbytes -= n;
+
+		percent = (unsigned int)(((double)(filesize - nbytes)) * 100 / filesize);
+		if (percent != prevpercent) {
+			prevpercent = percent;
+			swupdate_progress_update(percent);
+		}
+	}
+
+	close(datapipe[0]);
+	close(datapipe[1]);
+	close(teepipe[0]);
+	close(teepipe[1]);
+	free(buf);
+
+	return ret;
+}
+
+int copyimage_direct(int fdout, struct img_type *img)
+{
+	unsigned long *offs = (unsigned long *)&img->offset;
+	uint32_t expected = img->checksum;
+	uint32_t checksum = 0;
+	unsigned char pad[4];
+	struct stat st;
+	unsigned long long t;
+	int ret;
+
+	if (img->compressed || img->is_encrypted || IsValidHash(img->sha256) ||
+	    IsValidHash(img->tree_sha256))
+		return -EAGAIN;
+	if (img->size <= 0 || fstat(img->fdin, &st) < 0)
+		return -EAGAIN;
+
+	if (img->seek) {
+		TRACE("offset has been defined: %llu bytes\n", img->seek);
+		if (lseek(fdout, img->seek, SEEK_SET) < 0) {
+			ERROR("offset argument: seek failed\n");
+			return -EFAULT;
+		}
+	}
+
+	/* the kernel reads and writes, it is all accounted as write */
+	t = metrics_now();
+	if (S_ISREG(st.st_mode))
+		ret = copy_direct_file(img->fdin, fdout, img->size, &checksum,
+					expected);
+	else if (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode))
+		ret = copy_direct_stream(img->fdin, fdout, img->size, &checksum);
+	else
+		ret = -EAGAIN;
+	if (ret < 0)
+		return ret;
+	metrics_add(METRIC_WRITE, t, img->size);
+
+	*offs += img->size;
+	fill_buffer(img->fdin, pad, NPAD_BYTES(*offs), offs, NULL, NULL);
+
+	img->checksum = checksum;
+	if (expected && checksum != expected) {
+		ERROR("Checksum WRONG ! Computed 0x%lx, it should be 0x%lx\n",
+			(unsigned long)checksum, (unsigned long)expected);
+		return -EFAULT;
+	}
+
+	return 0;
 }
 
 int extract_cpio_header(int fd, struct filehdr *fhdr, unsigned long *offset)
@@ -432,6 +809,7 @@ off_t extract_next_file(int fd, int fdout, off_t start, int compressed,
 		ERROR("CPIO file corrupted : %s\n", strerror(errno));
 	if (copyfile(fd, &fdout, fdh.size, &offset, 0, 0, compressed, &checksum, hash, encrypted, NULL) < 0) {
 		ERROR("Error copying extracted file\n");
+		return -1;
 	}
 
 	TRACE("Copied file:\n\tfilename %s\n\tsize %u\n\tchecksum 0x%lx %s\n",
@@ -440,19 +818,30 @@ off_t extract_next_file(int fd, int fdout, off_t start, int compressed,
 		(unsigned long)checksum,
 		(checksum == fdh.chksum) ? "VERIFIED" : "WRONG");
 
-	if (checksum != fdh.chksum)
+	if (checksum != fdh.chksum) {
 		ERROR("Checksum WRONG ! Computed 0x%lx, it should be 0x%lx\n",
 			(unsigned long)checksum, fdh.chksum);
+		return -1;
+	}
 
 	return offset;
 }
 
-int cpio_scan(int fd, struct swupdate_cfg *cfg, off_t start)
+/*
+ * With verify, all files are read to check their checksum.
+ * Else only the headers are read and checksums are verified
+ * while the files are installed.
+ */
+int cpio_scan(int fd, struct swupdate_cfg *cfg, off_t start, int verify)
 {
 	struct filehdr fdh;
 	unsigned long offset = start;
 	int file_listed;
 	uint32_t checksum;
+	struct stat st;
+
+	if (!verify && fstat(fd, &st) < 0)
+		return -1;
 
 
 	while (1) {
@@ -475,6 +864,20 @@ int cpio_scan(int fd, struct swupdate_cfg *cfg, off_t start)
 			fdh.size,
 			file_listed ? "REQUIRED" : "not required");
 
+		if (!verify) {
+			offset += fdh.size;
+			offset += NPAD_BYTES(offset);
+			if (S_ISREG(st.st_mode) && offset > (unsigned long)st.st_size) {
+				ERROR("Archive truncated at %s\n", fdh.filename);
+				return -1;
+			}
+			if (lseek(fd, offset, SEEK_SET) < 0) {
+				ERROR("CPIO file corrupted : %s\n", strerror(errno));
+				return -1;
+			}
+			continue;
+		}
+
 		/*
 		 * use copyfile for checksum verification, as we skip file
 		 * we do not have to provide fdout
@@ -498,3 +901,154 @@ int cpio_scan(int fd, struct swupdate_cfg *cfg, off_t start)
 
 	return 0;
 }
+
+static void cpio_index_add(struct imglist *list, struct filehdr *fdh,
+		off_t offset)
+{
+	struct img_type *img;
+
+	LIST_FOREACH(img, list, next) {
+		if (strcmp(img->fname, fdh->filename))
+			continue;
+		img->offset = offset;
+		img->provided = 1;
+		img->size = fdh->size;
+		img->checksum = fdh->chksum;
+	}
+}
+
+static void cpio_index_reset(struct imglist *list)
+{
+	struct img_type *img;
+
+	LIST_FOREACH(img, list, next)
+		img->provided = 0;
+}
+
+/*
+ * Check that the index points to the cpio headers of
+ * the files: only the headers are read.
+ */
+static int cpio_index_check(int fd, struct imglist *list)
+{
+	struct img_type *img;
+	struct filehdr fdh;
+
+	LIST_FOREACH(img, list, next) {
+		if (!img->provided)
+			continue;
+		if (extract_img_from_cpio(fd, img->offset, &fdh) < 0 ||
+		    strcmp(fdh.filename, img->fname) ||
+		    (long long)fdh.size != img->size ||
+		    fdh.chksum != img->checksum) {
+			WARN("Index does not match the archive for %s",
+				img->fname);
+			return -EAGAIN;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * The index is an optional entry after sw-description (and
+ * its signature), with one line for each file in the archive:
+ *
+ *	filename offset size checksum
+ *
+ * The offset of the cpio header is relative to the first
+ * header after the index (and after its signature, that is
+ * required with signed images). It returns -ENOENT if there
+ * is no index and -EAGAIN if it cannot be used: the archive
+ * must then be scanned.
+ */
+int cpio_index_scan(int fd, struct swupdate_cfg *cfg, off_t start)
+{
+	struct filehdr fdh;
+	unsigned long offset = start;
+	char path[MAX_IMAGE_FNAME + 64];
+	char line[MAX_IMAGE_FNAME + 64];
+	char name[sizeof(line)];
+#ifdef CONFIG_SIGNED_IMAGES
+	char sigpath[sizeof(path) + 8];
+#endif
+	unsigned long long reloff;
+	off_t base;
+	FILE *fp;
+	int ret = 0;
+	const char* TMPDIR = get_tmpdir();
+
+	if (lseek(fd, start, SEEK_SET) < 0 ||
+	    extract_cpio_header(fd, &fdh, &offset) ||
+	    strcmp(fdh.filename, SW_INDEX_FILENAME)) {
+		lseek(fd, start, SEEK_SET);
+		return -ENOENT;
+	}
+
+	lseek(fd, start, SEEK_SET);
+	base = extract_sw_description(fd, SW_INDEX_FILENAME, start);
+	if (base < 0)
+		return -EINVAL;
+	snprintf(path, sizeof(path), "%s%s", TMPDIR, SW_INDEX_FILENAME);
+
+#ifdef CONFIG_SIGNED_IMAGES
+	base = extract_sw_description(fd, SW_INDEX_FILENAME ".sig", base);
+	if (base < 0) {
+		unlink(path);
+		return -EINVAL;
+	}
+	snprintf(sigpath, sizeof(sigpath), "%s.sig", path);
+	ret = swupdate_verify_file(cfg->dgst, sigpath, path);
+	unlink(sigpath);
+	if (ret) {
+		ERROR("Signature of %s cannot be verified", SW_INDEX_FILENAME);
+		unlink(path);
+		return -EINVAL;
+	}
+#else
+	/* a signature is not checked, but offsets start after it */
+	offset = base;
+	if (!extract_cpio_header(fd, &fdh, &offset) &&
+	    !strcmp(fdh.filename, SW_INDEX_FILENAME ".sig")) {
+		offset += fdh.size;
+		base = offset + NPAD_BYTES(offset);
+	}
+#endif
+
+	fp = fopen(path, "r");
+	unlink(path);
+	if (!fp) {
+		lseek(fd, start, SEEK_SET);
+		return -EAGAIN;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%s %llu %lu %lx", name, &reloff,
+			   &fdh.size, &fdh.chksum) != 4 ||
+		    strlen(name) >= sizeof(fdh.filename)) {
+			WARN("Index corrupted: %s", line);
+			ret = -EAGAIN;
+			break;
+		}
+		strcpy(fdh.filename, name);
+		cpio_index_add(&cfg->images, &fdh, base + reloff);
+		cpio_index_add(&cfg->scripts, &fdh, base + reloff);
+	}
+	fclose(fp);
+
+	if (!ret)
+		ret = cpio_index_check(fd, &cfg->images);
+	if (!ret)
+		ret = cpio_index_check(fd, &cfg->scripts);
+	if (ret) {
+		cpio_index_reset(&cfg->images);
+		cpio_index_reset(&cfg->scripts);
+		/* the caller scans from start */
+		lseek(fd, start, SEEK_SET);
+		return ret;
+	}
+
+	TRACE("Files found with %s", SW_INDEX_FILENAME);
+
+	return 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+/*
+ * Incoming data is collected into chunks of several blocks.
+ * The same region is read from the target, and only runs of
+ * blocks that differ are written: unchanged blocks cost a
+ * read instead of a write, that is faster on most storages
+ * and does not wear the flash.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "util.h"
+#include "diff_writer.h"
+
+#define DIFF_CHUNK_SIZE	(1024 * 1024)
+
+int diff_writer_init(struct diff_writer *dw, int fd,
+		unsigned long long offset, unsigned int blocksize, int fill)
+{
+	memset(dw, 0, sizeof(*dw));
+
+	if (!blocksize)
+		return -EINVAL;
+
+	dw->fd = fd;
+	dw->offset = offset;
+	dw->blocksize = blocksize;
+	dw->fill = fill;
+	dw->chunksize = max((unsigned int)DIFF_CHUNK_SIZE / blocksize, 1U) *
+			blocksize;
+	dw->buf = (unsigned char *)malloc(dw->chunksize);
+	dw->cmp = (unsigned char *)malloc(dw->chunksize);
+	if (!dw->buf || !dw->cmp) {
+		free(dw->buf);
+		free(dw->cmp);
+		dw->buf = dw->cmp = NULL;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static int diff_read(int fd, unsigned char *buf, unsigned int len,
+		unsigned long long offset)
+{
+	unsigned int n = 0;
+	ssize_t ret;
+
+	while (n < len) {
+		ret = pread(fd, buf + n, len - n, offset + n);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -errno;
+		if (ret == 0)
+			break;
+		n += ret;
+	}
+
+	return n;
+}
+
+static int diff_write_run(struct diff_writer *dw, unsigned int start,
+		unsigned int end)
+{
+	unsigned long long offset = dw->offset + start;
+	unsigned int len = end - start;
+	unsigned int n = 0;
+	ssize_t ret;
+
+	if (dw->prepare && dw->prepare(dw->priv, offset, len) < 0)
+		return -EIO;
+
+	while (n < len) {
+		ret = pwrite(dw->fd, dw->buf + start + n, len - n, offset + n);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			ERROR("Cannot write at %llu: %s", offset + n,
+				ret < 0 ? strerror(errno) : "no space left");
+			return ret < 0 ? -errno : -ENOSPC;
+		}
+		n += ret;
+	}
+
+	return 0;
+}
+
+/* Compare the buffered data with the target and write the differences */
+static int diff_flush(struct diff_writer *dw)
+{
+	unsigned int start, blen, run;
+	int nread, ret;
+
+	if (!dw->len)
+		return 0;
+
+	nread = diff_read(dw->fd, dw->cmp, dw->len, dw->offset);
+	if (nread < 0) {
+		ERROR("Cannot read back at %llu: %s", dw->offset,
+			strerror(-nread));
+		return nread;
+	}
+
+	run = dw->len;	/* no run of different blocks */
+	for (start = 0; start < dw->len; start += blen) {
+		blen = min(dw->blocksize, dw->len - start);
+		if (start + blen <= (unsigned int)nread &&
+		    !memcmp(dw->buf + start, dw->cmp + start, blen)) {
+			dw->skipped++;
+			if (run < start) {
+				ret = diff_write_run(dw, run, start);
+				if (ret < 0)
+					return ret;
+				run = dw->len;
+			}
+			continue;
+		}
+		dw->written++;
+		if (run > start)
+			run = start;
+	}
+	if (run < dw->len) {
+		ret = diff_write_run(dw, run, dw->len);
+		if (ret < 0)
+			return ret;
+	}
+
+	dw->offset += dw->len;
+	dw->len = 0;
+
+	return 0;
+}
+
+int diff_writer_write(void *out, const void *buf, unsigned int len)
+{
+	struct diff_writer *dw = (struct diff_writer *)out;
+	const unsigned char *data = (const unsigned char *)buf;
+	unsigned int n;
+
+	while (len > 0) {
+		n = min(len, dw->chunksize - dw->len);
+		memcpy(dw->buf + dw->len, data, n);
+		dw->len += n;
+		data += n;
+		len -= n;
+		if (dw->len == dw->chunksize && diff_flush(dw) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int diff_writer_close(struct diff_writer *dw)
+{
+	unsigned int tail;
+	int ret;
+
+	tail = dw->len % dw->blocksize;
+	if (tail && dw->fill >= 0) {
+		memset(dw->buf + dw->len, dw->fill, dw->blocksize - tail);
+		dw->len += dw->blocksize - tail;
+	}
+	ret = diff_flush(dw);
+
+	TRACE("%llu blocks written, %llu unchanged blocks skipped",
+		dw->written, dw->skipped);
+
+	free(dw->buf);
+	free(dw->cmp);
+	dw->buf = dw->cmp = NULL;
+
+	return ret;
+}
@@ -35,6 +35,12 @@ static unsigned long nr_installers = 0;
 int register_handler(const char *desc,
 		handler installer, void *data)
 {
+	return register_handler_flags(desc, installer, data, 0);
+}
+
+int register_handler_flags(const char *desc, handler installer,
+		void *data, unsigned int flags)
+{
 
 	if (nr_installers > MAX_INSTALLER_HANDLER - 1)
 		return -1;
@@ -43,6 +49,7 @@ int register_handler(const char *desc,
 		      sizeof(supported_types[nr_installers].desc));
 	supported_types[nr_installers].installer = installer;
 	supported_types[nr_installers].data = data;
+	supported_types[nr_installers].flags = flags;
 	nr_installers++;
 
 	return 0;
@@ -25,10 +25,14 @@
 #include <errno.h>
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <sys/un.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "bsdqueue.h"
 #include "util.h"
@@ -67,6 +71,199 @@ static struct sockaddr_un notify_client;
 static struct sockaddr_un notify_server;
 static int notifyfd = -1;
 
+/*
+ * Subprocesses started by SWUpdate inherit a ring in shared
+ * memory: a notification is copied into a free slot without
+ * locks or syscalls, and the notifier thread drains all the
+ * slots written since its last run. The thread is woken up
+ * only when it sleeps, so a burst of traces costs a single
+ * write to an eventfd. If the ring stays full for
+ * NOTIFY_RING_WAIT us, the notification is dropped and counted.
+ * The socket is kept for processes that cannot use the ring.
+ *
+ * A slot is free for position pos when its seq is pos, and
+ * written when it is pos + 1 (bounded MPMC queue, D. Vyukov).
+ * A subprocess that dies after taking a slot never writes it:
+ * after NOTIFY_RING_STUCK ms the notifier thread skips it.
+ */
+#define NOTIFY_RING_SLOTS	128
+#define NOTIFY_RING_WAIT	20000
+#define NOTIFY_RING_STUCK	1000
+#define NOTIFY_RING_POLL	100
+
+struct notify_slot {
+	unsigned long seq;
+	struct notify_ipc_msg msg;
+};
+
+struct notify_ring {
+	unsigned long tail;	/* next position to write */
+	unsigned long head;	/* next position to read, notifier thread */
+	int sleeping;		/* the notifier thread waits for a wake up */
+	unsigned long long dropped;
+	struct notify_slot slots[NOTIFY_RING_SLOTS];
+};
+
+static struct notify_ring *ring;
+static int ring_wakefd = -1;
+static unsigned long long ring_stuck;	/* since when head is not written */
+
+static void ring_init(void)
+{
+	struct notify_ring *r;
+	unsigned long i;
+
+	r = (struct notify_ring *)mmap(NULL, sizeof(*r), PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (r == MAP_FAILED)
+		return;
+
+	ring_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ring_wakefd < 0) {
+		munmap(r, sizeof(*r));
+		return;
+	}
+
+	for (i = 0; i < NOTIFY_RING_SLOTS; i++)
+		r->slots[i].seq = i;
+	ring = r;
+}
+
+/* Called in a subprocess */
+static void ring_put(RECOVERY_STATUS status, int error, const char *msg)
+{
+	struct notify_slot *slot;
+	unsigned long pos, seq;
+	uint64_t one = 1;
+	unsigned int waited = 0;
+	size_t len;
+	long diff;
+
+	pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &ring->slots[pos % NOTIFY_RING_SLOTS];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		diff = (long)(seq - pos);
+		if (diff == 0) {
+			/* on failure pos is reloaded */
+			if (__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1,
+						true, __ATOMIC_RELAXED,
+						__ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			/* full, give the notifier thread some time */
+			if (waited >= NOTIFY_RING_WAIT) {
+				__atomic_fetch_add(&ring->dropped, 1,
+						   __ATOMIC_RELAXED);
+				return;
+			}
+			usleep(100);
+			waited += 100;
+			pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+		} else {
+			pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->msg.status = status;
+	slot->msg.error = error;
+	len = msg ? strnlen(msg, sizeof(slot->msg.buf) - 1) : 0;
+	memcpy(slot->msg.buf, msg ? msg : "", len);
+	slot->msg.buf[len] = '\0';
+	/* it fails if the notifier thread skipped the slot */
+	seq = pos;
+	if (!__atomic_compare_exchange_n(&slot->seq, &seq, pos + 1, false,
+					 __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		return;
+
+	/* it fails only if a wake up is already pending */
+	if (__atomic_exchange_n(&ring->sleeping, 0, __ATOMIC_SEQ_CST) &&
+	    write(ring_wakefd, &one, sizeof(one)) < 0)
+		return;
+}
+
+static unsigned long long ring_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * The slot at head was taken but is not written yet: skip
+ * it if this lasts too long, the writer may be dead.
+ */
+static bool ring_skip(struct notify_slot *slot)
+{
+	static bool reported;
+	unsigned long long now = ring_now_ms();
+	unsigned long seq = ring->head;
+
+	if (!ring_stuck) {
+		ring_stuck = now;
+		return false;
+	}
+	if (now - ring_stuck < NOTIFY_RING_STUCK)
+		return false;
+
+	/* it fails if the writer has just completed the slot */
+	if (!__atomic_compare_exchange_n(&slot->seq, &seq,
+					 ring->head + NOTIFY_RING_SLOTS, false,
+					 __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		return true;
+	ring->head++;
+	ring_stuck = 0;
+	if (!reported) {
+		WARN("A subprocess did not complete a notification, it is lost");
+		reported = true;
+	}
+
+	return true;
+}
+
+/* Copy the next notification into msg, notifier thread */
+static bool ring_get(struct notify_ipc_msg *msg)
+{
+	struct notify_slot *slot;
+	unsigned long seq;
+	size_t len;
+
+	for (;;) {
+		slot = &ring->slots[ring->head % NOTIFY_RING_SLOTS];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq == ring->head + 1)
+			break;
+		if (seq != ring->head ||
+		    __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) == ring->head) {
+			/* empty */
+			ring_stuck = 0;
+			return false;
+		}
+		if (!ring_skip(slot))
+			return false;
+	}
+	ring_stuck = 0;
+
+	msg->status = slot->msg.status;
+	msg->error = slot->msg.error;
+	len = strnlen(slot->msg.buf, sizeof(msg->buf) - 1);
+	memcpy(msg->buf, slot->msg.buf, len);
+	msg->buf[len] = '\0';
+	__atomic_store_n(&slot->seq, ring->head + NOTIFY_RING_SLOTS,
+			 __ATOMIC_RELEASE);
+	ring->head++;
+
+	return true;
+}
+
+/* Notifications of subprocesses lost because the ring was full */
+unsigned long long notify_get_dropped(void)
+{
+	return ring ? __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED) : 0;
+}
+
 /*
  * This allows to extend the list of notifier.
  * One can register a new notifier and it will
@@ -102,12 +299,15 @@ void notify(RECOVERY_STATUS status, int error, const char *msg)
 	struct notify_ipc_msg notifymsg;
 
 	if ((pid == getpid())) {
-		if (notifyfd > 0) {
+		if (ring) {
+			ring_put(status, error, msg);
+		} else if (notifyfd > 0) {
 			notifymsg.status = status;
 			notifymsg.error = error;
-			if (msg)
-				strcpy(notifymsg.buf, msg);
-			else
+			if (msg) {
+				strncpy(notifymsg.buf, msg, sizeof(notifymsg.buf) - 1);
+				notifymsg.buf[sizeof(notifymsg.buf) - 1] = '\0';
+			} else
 				notifymsg.buf[0] = '\0';
 			sendto(notifyfd, &notifymsg, sizeof(notifymsg), 0,
 			      (struct sockaddr *) &notify_server,
@@ -194,11 +394,44 @@ static void addr_init(struct sockaddr_un *addr, const char *path)
  * This allows to have a central point to manage
  * all logs.
  */
+/* Dispatch what the subprocesses wrote into the ring */
+static void ring_drain(void)
+{
+	static unsigned long long reported;
+	struct notify_ipc_msg msg;
+	unsigned long long dropped;
+
+	while (ring_get(&msg))
+		notify(msg.status, msg.error, msg.buf);
+
+	dropped = notify_get_dropped();
+	if (dropped != reported) {
+		WARN("%llu notifications of subprocesses dropped",
+			dropped - reported);
+		reported = dropped;
+	}
+}
+
+/* Check again after announcing the sleep, a writer may have missed it */
+static bool ring_sleep(void)
+{
+	__atomic_store_n(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->slots[ring->head % NOTIFY_RING_SLOTS].seq,
+			    __ATOMIC_SEQ_CST) == ring->head + 1) {
+		__atomic_store_n(&ring->sleeping, 0, __ATOMIC_SEQ_CST);
+		return false;
+	}
+
+	return true;
+}
+
 static void *notifier_thread (void __attribute__ ((__unused__)) *data)
 {
 	int serverfd;
 	int len;
 	struct notify_ipc_msg msg;
+	struct pollfd fds[2];
+	uint64_t val;
 
 	/* Initialize and bind to UDS */
 	serverfd = socket(AF_UNIX, SOCK_DGRAM, 0);
@@ -222,10 +455,34 @@ static void *notifier_thread (void __attribute__ ((__unused__)) *data)
 		exit(2);
 	}
 
+	fds[0].fd = serverfd;
+	fds[0].events = POLLIN;
+	fds[1].fd = ring_wakefd;
+	fds[1].events = POLLIN;
+
 	do {
-		len =  recvfrom(serverfd, &msg, sizeof(msg), 0, NULL, NULL);
+		if (ring) {
+			ring_drain();
+			if (!ring_sleep())
+				continue;
+		}
+
+		/* wake up to skip a slot that is never written */
+		if (poll(fds, ring ? 2 : 1, ring_stuck ? NOTIFY_RING_POLL : -1) < 0)
+			continue;
+
+		if (fds[1].revents & POLLIN) {
+			if (read(ring_wakefd, &val, sizeof(val)) < 0 &&
+			    errno != EAGAIN)
+				TRACE("Cannot read wake up event");
+		}
 
-		if (len > 0) {
+		while (fds[0].revents & POLLIN) {
+			len =  recvfrom(serverfd, &msg, sizeof(msg), MSG_DONTWAIT,
+					NULL, NULL);
+			if (len <= 0)
+				break;
+			msg.buf[sizeof(msg.buf) - 1] = '\0';
 			notify(msg.status, msg.error, msg.buf);
 		}
 
@@ -238,6 +495,11 @@ void notify_init(void)
 
 	if (pid == getpid()) {
 		char buf[60];
+
+		/* the ring is inherited from the main process */
+		if (ring)
+			return;
+
 		snprintf(buf, sizeof(buf), "Notify%d", pid);
 		addr_init(&notify_client, buf);
 		notifyfd = socket(AF_UNIX, SOCK_DGRAM, 0);
@@ -254,6 +516,7 @@ void notify_init(void)
 			return;
 		}
 	} else {
+		ring_init();
 		STAILQ_INIT(&clients);
 		register_notifier(console_notifier);
 		register_notifier(process_notifier);
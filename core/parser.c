@@ -39,19 +39,32 @@ static parser_fn parsers[] = {
 
 #ifdef CONFIG_SIGNED_IMAGES
 /*
- * Check that all images in a list have a valid hash
+ * Check that all images in a list have a valid hash. A tree
+ * hash is verified only by copyimage(), it is not accepted
+ * for scripts, that are extracted with their sha256, nor for
+ * handlers that read the image themselves.
  */
-static int check_missing_hash(struct imglist *list)
+static int check_missing_hash(struct imglist *list, bool tree)
 {
+	struct installer_handler *hnd;
 	struct img_type *image;
 
 	LIST_FOREACH(image, list, next) {
+		hnd = find_handler(image);
+		if (tree && !IsValidHash(image->sha256) &&
+		    IsValidHash(image->tree_sha256) &&
+		    hnd && (hnd->flags & HANDLER_RAW_INPUT)) {
+			ERROR("Handler %s cannot check sha256-tree of %s, "
+				"sha256 is needed", image->type, image->fname);
+			return -EINVAL;
+		}
 		/*
 		 * Skip "ubipartition" because there is no image
 		 * associated for this type
 		 */
 		if ( (strcmp(image->type, "ubipartition")) &&
-				(!IsValidHash(image->sha256))) {
+				(!IsValidHash(image->sha256)) &&
+				(!tree || !IsValidHash(image->tree_sha256))) {
 			ERROR("Hash not set for %s Type %s",
 				image->fname,
 				image->type);
@@ -137,8 +150,8 @@ int parse(struct swupdate_cfg *sw, const char *descfile)
 	 * If the software must be verified, all images
 	 * must have a valid hash to be checked
 	 */
-	if (check_missing_hash(&sw->images) ||
-		check_missing_hash(&sw->scripts))
+	if (check_missing_hash(&sw->images, true) ||
+		check_missing_hash(&sw->scripts, false))
 		ret = -EINVAL;
 #endif
 
@@ -0,0 +1,348 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+/*
+ * Staged copy of an image: each step of copyfile() runs
+ * in its own thread. Buffers are taken from a pool and
+ * travel through a chain of rings:
+ *
+ *   free -> read -> [hash] -> [decrypt] -> write -> free
+ *
+ * The write stage runs in the caller's thread, so that
+ * handlers see the same context as with the serial copy.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "generated/autoconf.h"
+#include "util.h"
+#include "sslapi.h"
+#include "progress.h"
+#include "pipeline.h"
+#include "metrics.h"
+
+#define MODULE_NAME "pipeline"
+
+/* a buffer is a piece for the decryption */
+#define PIPELINE_BUFF_SIZE	DECRYPT_PIECE
+#define PIPELINE_NBUFS		8
+#define PIPELINE_MAX_STAGES	3	/* read, hash, decrypt */
+
+struct pipeline_buf {
+	unsigned char *data;	/* raw data as read from the stream */
+	unsigned char *dec;	/* decrypted data, if any */
+	unsigned char *out;	/* data passed to the write callback */
+	unsigned int len;
+	int outlen;
+	int last;		/* no data follows this buffer */
+};
+
+struct pipeline_ring {
+	struct pipeline_buf *slot[PIPELINE_NBUFS];
+	unsigned int head;
+	unsigned int count;
+};
+
+struct pipeline;
+
+typedef int (*pipeline_fn)(struct pipeline *p, struct pipeline_buf *buf);
+
+struct pipeline_stage {
+	struct pipeline *p;
+	pipeline_fn fn;
+	unsigned int in;	/* ring to get buffers from */
+	pthread_t id;
+	int running;
+};
+
+struct pipeline {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int abort;
+	/* ring[0] has the free buffers, ring[nstages] feeds the writer */
+	struct pipeline_ring ring[PIPELINE_MAX_STAGES + 1];
+	struct pipeline_stage stages[PIPELINE_MAX_STAGES];
+	unsigned int nstages;
+	struct pipeline_buf bufs[PIPELINE_NBUFS];
+
+	int fdin;
+	unsigned int nbytes;
+	unsigned long *offs;
+	uint32_t *checksum;
+	void *dgst;
+	void *dcrypt;
+};
+
+static struct pipeline_buf *ring_get(struct pipeline *p, unsigned int idx)
+{
+	struct pipeline_ring *r = &p->ring[idx];
+	struct pipeline_buf *buf = NULL;
+
+	pthread_mutex_lock(&p->lock);
+	while (!r->count && !p->abort)
+		pthread_cond_wait(&p->cond, &p->lock);
+	if (!p->abort) {
+		buf = r->slot[r->head];
+		r->head = (r->head + 1) % PIPELINE_NBUFS;
+		r->count--;
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	return buf;
+}
+
+static void ring_put(struct pipeline *p, unsigned int idx,
+			struct pipeline_buf *buf)
+{
+	struct pipeline_ring *r = &p->ring[idx];
+
+	pthread_mutex_lock(&p->lock);
+	r->slot[(r->head + r->count) % PIPELINE_NBUFS] = buf;
+	r->count++;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+}
+
+static void pipeline_abort(struct pipeline *p)
+{
+	pthread_mutex_lock(&p->lock);
+	p->abort = 1;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+}
+
+static int pipeline_read(struct pipeline *p, struct pipeline_buf *buf)
+{
+	unsigned int size;
+	int ret;
+
+	size = min(p->nbytes, (unsigned int)PIPELINE_BUFF_SIZE);
+	ret = fill_buffer(p->fdin, buf->data, size, p->offs, p->checksum, NULL);
+	if (ret < 0)
+		return ret;
+	if ((unsigned int)ret != size) {
+		ERROR("Premature end of stream, %u bytes missing",
+			p->nbytes - ret);
+		return -EFAULT;
+	}
+
+	p->nbytes -= size;
+	buf->len = size;
+	buf->out = buf->data;
+	buf->outlen = size;
+	buf->last = (p->nbytes == 0);
+
+	return 0;
+}
+
+#ifdef CONFIG_HASH_VERIFY
+static int pipeline_hash(struct pipeline *p, struct pipeline_buf *buf)
+{
+	unsigned long long t = metrics_now();
+	int ret;
+
+	ret = swupdate_HASH_update(p->dgst, buf->data, buf->len);
+	metrics_add(METRIC_HASH, t, buf->len);
+
+	return ret;
+}
+#endif
+
+#ifdef CONFIG_ENCRYPTED_IMAGES
+static int pipeline_decrypt(struct pipeline *p, struct pipeline_buf *buf)
+{
+	unsigned long long t = metrics_now();
+	int ret;
+
+	ret = swupdate_DECRYPT_update(p->dcrypt, buf->dec, &buf->outlen,
+					buf->data, buf->len);
+	buf->out = buf->dec;
+	metrics_add(METRIC_DECRYPT, t, buf->len);
+
+	return ret;
+}
+#endif
+
+static void *pipeline_stage_thread(void *data)
+{
+	struct pipeline_stage *stage = (struct pipeline_stage *)data;
+	struct pipeline *p = stage->p;
+	struct pipeline_buf *buf;
+	int last = 0;
+
+	do {
+		buf = ring_get(p, stage->in);
+		if (!buf)
+			break;
+		if (stage->fn(p, buf) < 0) {
+			pipeline_abort(p);
+			break;
+		}
+		last = buf->last;
+		ring_put(p, stage->in + 1, buf);
+	} while (!last);
+
+	return NULL;
+}
+
+static void pipeline_add_stage(struct pipeline *p, pipeline_fn fn)
+{
+	struct pipeline_stage *stage = &p->stages[p->nstages];
+
+	stage->p = p;
+	stage->fn = fn;
+	stage->in = p->nstages;
+	p->nstages++;
+}
+
+static void pipeline_free(struct pipeline *p)
+{
+	unsigned int i;
+
+	for (i = 0; i < PIPELINE_NBUFS; i++) {
+		free(p->bufs[i].data);
+		free(p->bufs[i].dec);
+	}
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->lock);
+	free(p);
+}
+
+static void pipeline_stop(struct pipeline *p)
+{
+	unsigned int i;
+
+	for (i = 0; i < p->nstages; i++) {
+		if (p->stages[i].running)
+			pthread_join(p->stages[i].id, NULL);
+	}
+}
+
+int copy_pipeline(int fdin, void *out, unsigned int nbytes,
+	unsigned long *offs, uint32_t *checksum,
+	void *dgst, void *dcrypt, writeimage callback)
+{
+	struct pipeline *p;
+	struct pipeline_buf *buf;
+	unsigned int filesize = nbytes, consumed = 0;
+	unsigned int percent, prevpercent = 0;
+	unsigned int i;
+	unsigned long long t;
+	int done = 0;
+	int ret = 0;
+
+	p = (struct pipeline *)calloc(1, sizeof(*p));
+	if (!p)
+		return -EAGAIN;
+
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->cond, NULL);
+	p->fdin = fdin;
+	p->nbytes = nbytes;
+	p->offs = offs;
+	p->checksum = checksum;
+	p->dgst = dgst;
+	p->dcrypt = dcrypt;
+
+	for (i = 0; i < PIPELINE_NBUFS; i++) {
+		p->bufs[i].data = (unsigned char *)malloc(PIPELINE_BUFF_SIZE);
+		if (!p->bufs[i].data) {
+			pipeline_free(p);
+			return -EAGAIN;
+		}
+		if (dcrypt) {
+			p->bufs[i].dec = (unsigned char *)malloc(PIPELINE_BUFF_SIZE +
+							AES_BLOCK_SIZE);
+			if (!p->bufs[i].dec) {
+				pipeline_free(p);
+				return -EAGAIN;
+			}
+		}
+		ring_put(p, 0, &p->bufs[i]);
+	}
+
+	pipeline_add_stage(p, pipeline_read);
+#ifdef CONFIG_HASH_VERIFY
+	if (dgst)
+		pipeline_add_stage(p, pipeline_hash);
+#endif
+#ifdef CONFIG_ENCRYPTED_IMAGES
+	if (dcrypt)
+		pipeline_add_stage(p, pipeline_decrypt);
+#endif
+
+	/*
+	 * Start from the last stage: the reader is started at the end,
+	 * so that nothing is consumed from the stream if a thread
+	 * cannot be created and the caller can still fall back
+	 */
+	for (i = p->nstages; i > 0; i--) {
+		struct pipeline_stage *stage = &p->stages[i - 1];
+		if (pthread_create(&stage->id, NULL, pipeline_stage_thread, stage)) {
+			ERROR("Cannot start pipeline, copying serially");
+			pipeline_abort(p);
+			pipeline_stop(p);
+			pipeline_free(p);
+			return -EAGAIN;
+		}
+		stage->running = 1;
+	}
+
+	while (!done) {
+		buf = ring_get(p, p->nstages);
+		if (!buf) {
+			/* one of the stages has failed */
+			ret = -EFAULT;
+			break;
+		}
+
+		/*
+		 * If there is no enough place,
+		 * returns an error and close the output file that
+		 * results corrupted. This lets the cleanup routine
+		 * to remove it
+		 */
+		t = metrics_now();
+		if (callback(out, buf->out, buf->outlen) < 0) {
+			pipeline_abort(p);
+			ret = -ENOSPC;
+			break;
+		}
+		metrics_add(METRIC_WRITE, t, buf->outlen);
+
+		consumed += buf->len;
+		done = buf->last;
+		ring_put(p, 0, buf);
+
+		percent = (unsigned int)(((double)consumed) * 100 / filesize);
+		if (percent != prevpercent) {
+			prevpercent = percent;
+			swupdate_progress_update(percent);
+		}
+	}
+
+	pipeline_stop(p);
+	pipeline_free(p);
+
+	return ret;
+}
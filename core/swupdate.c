@@ -58,6 +58,9 @@
 #include "swupdate_settings.h"
 #include "pctl.h"
 #include "bootloader.h"
+#include "checksum.h"
+#include "decompress.h"
+#include "metrics.h"
 
 #define MODULE_NAME	"swupdate"
 
@@ -278,6 +281,39 @@ static int searching_for_image(char *name)
 	return fd;
 }
 
+/*
+ * Handlers that read the image without copyimage() may not
+ * verify its checksum, it must then be done by the scan.
+ */
+static bool raw_input_images(struct swupdate_cfg *sw)
+{
+	struct installer_handler *hnd;
+	struct img_type *img;
+
+	LIST_FOREACH(img, &sw->images, next) {
+		hnd = find_handler(img);
+		if (hnd && (hnd->flags & HANDLER_RAW_INPUT))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * With CONFIG_SINGLE_PASS_INSTALL, the archive is read only
+ * once: the checksums are verified during the installation.
+ */
+static int verify_scan(struct swupdate_cfg *sw, int check)
+{
+#ifdef CONFIG_SINGLE_PASS_INSTALL
+	return check || raw_input_images(sw);
+#else
+	(void)sw;
+	(void)check;
+	return 1;
+#endif
+}
+
 static int install_from_file(char *fname, int check)
 {
 	int fdsw;
@@ -319,7 +355,16 @@ static int install_from_file(char *fname, int check)
 		exit(1);
 	}
 
-	if (cpio_scan(fdsw, &swcfg, pos) < 0) {
+	/*
+	 * An index lets to skip the scan of the whole archive,
+	 * but all checksums are verified when only checking or
+	 * when a handler does not verify them
+	 */
+	ret = check || raw_input_images(&swcfg) ? -ENOENT :
+		cpio_index_scan(fdsw, &swcfg, pos);
+	if (ret == -ENOENT || ret == -EAGAIN)
+		ret = cpio_scan(fdsw, &swcfg, pos, verify_scan(&swcfg, check));
+	if (ret < 0) {
 		ERROR("failed to scan for pos '%ld'!", pos);
 		close(fdsw);
 		exit(1);
@@ -564,6 +609,9 @@ int main(int argc, char **argv)
 	 */
 	notify_init();
 
+	/* Counters are shared with the subprocesses */
+	metrics_init();
+
 	/*
 	 * Check if there is a configuration file and parse it
 	 * Parse once the command line just to find if a
@@ -825,6 +873,10 @@ int main(int argc, char **argv)
 		printf("Running on %s Revision %s\n", swcfg.hw.boardname, swcfg.hw.revision);
 
 	print_registered_handlers();
+	print_registered_decompressors();
+	cpio_checksum_init();
+	TRACE("cpio checksum: %s", cpio_checksum_name());
+
 	if (swcfg.globals.syslog_enabled) {
 		if (syslog_init()) {
 			ERROR("failed to initialize syslog notifier");
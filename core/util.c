@@ -422,6 +422,39 @@ unsigned char *get_aes_salt(void) {
 	return aes_key->salt;
 }
 
+static const struct {
+	const char *name;
+	cipher_type type;
+} cipher_names[] = {
+	{ "aes-cbc", CIPHER_AES_CBC },
+	{ "aes-ctr", CIPHER_AES_CTR },
+	{ "aes-gcm", CIPHER_AES_GCM },
+};
+
+int get_cipher_type(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(cipher_names); i++) {
+		if (!strcmp(cipher_names[i].name, name))
+			return cipher_names[i].type;
+	}
+
+	return -1;
+}
+
+const char *get_cipher_name(int type)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(cipher_names); i++) {
+		if ((int)cipher_names[i].type == type)
+			return cipher_names[i].name;
+	}
+
+	return "unknown";
+}
+
 char** string_split(char* s, const char d)
 {
 	char** result    = 0;
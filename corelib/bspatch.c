@@ -0,0 +1,340 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+/*
+ * Streaming bspatch. In the bsdiff 4.3 format, control data,
+ * diff and extra bytes are interleaved in a single bzip2
+ * stream after a 24 bytes header:
+ *
+ *	"ENDSLEY/BSDIFF43" | size of new data
+ *
+ * followed by a sequence of
+ *
+ *	add | copy | seek | add bytes of diff | copy bytes of extra
+ *
+ * The diff bytes are added to the old data, the extra bytes are
+ * copied, and then the position in the old data is moved by seek.
+ * The new data is produced in order, so it can be written while
+ * the patch is received: only the buffers below are needed,
+ * whatever the size of the image.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <bzlib.h>
+
+#include "util.h"
+#include "bspatch.h"
+
+#define MODULE_NAME "bspatch"
+
+#define BSPATCH_MAGIC		"ENDSLEY/BSDIFF43"
+#define BSPATCH_MAGIC_LEN	16
+#define BSPATCH_HDR_LEN		24
+#define BSPATCH_CTRL_LEN	24
+#define BSPATCH_BUF_SIZE	(64 * 1024)
+
+enum bspatch_state {
+	BSPATCH_HEADER,
+	BSPATCH_CTRL,
+	BSPATCH_DIFF,
+	BSPATCH_EXTRA,
+	BSPATCH_DONE
+};
+
+struct bspatch {
+	int srcfd;
+	unsigned long long srcsize;
+	void *out;
+	writeimage callback;
+	bz_stream bz;
+	int bz_init;
+	int bz_end;		/* end of the bzip2 stream */
+	enum bspatch_state state;
+	unsigned char hdr[BSPATCH_HDR_LEN];
+	unsigned char ctrl[BSPATCH_CTRL_LEN];
+	unsigned int hdrlen;	/* bytes in hdr or ctrl */
+	long long newsize;
+	long long newpos;
+	long long oldpos;
+	long long left;		/* bytes left in the diff or extra block */
+	long long copy;
+	long long seek;
+	unsigned char data[BSPATCH_BUF_SIZE];	/* decompressed patch */
+	unsigned char old[BSPATCH_BUF_SIZE];
+};
+
+/* Sign and magnitude, little endian */
+static long long offtin(const unsigned char *buf)
+{
+	long long y;
+	int i;
+
+	y = buf[7] & 0x7F;
+	for (i = 6; i >= 0; i--)
+		y = y * 256 + buf[i];
+
+	return (buf[7] & 0x80) ? -y : y;
+}
+
+struct bspatch *bspatch_init(int srcfd, unsigned long long srcsize,
+		void *out, writeimage callback)
+{
+	struct bspatch *bp;
+
+	bp = (struct bspatch *)calloc(1, sizeof(*bp));
+	if (!bp)
+		return NULL;
+
+	bp->srcfd = srcfd;
+	bp->srcsize = srcsize;
+	bp->out = out;
+	bp->callback = callback;
+	bp->state = BSPATCH_HEADER;
+
+	return bp;
+}
+
+/* Read the old data, bytes outside of it are taken as zero */
+static int bspatch_read_old(struct bspatch *bp, unsigned int len)
+{
+	long long start, end;
+	ssize_t ret;
+	unsigned int n;
+
+	memset(bp->old, 0, len);
+
+	start = max(bp->oldpos, 0LL);
+	end = min(bp->oldpos + (long long)len, (long long)bp->srcsize);
+	for (n = 0; start + n < end; n += ret) {
+		ret = pread(bp->srcfd, bp->old + (start - bp->oldpos) + n,
+				end - start - n, start + n);
+		if (ret < 0 && errno == EINTR) {
+			ret = 0;
+			continue;
+		}
+		if (ret <= 0) {
+			ERROR("Cannot read source at %lld", start + n);
+			return -EIO;
+		}
+	}
+
+	return 0;
+}
+
+static int bspatch_out(struct bspatch *bp, unsigned char *buf,
+		unsigned int len)
+{
+	if (bp->callback(bp->out, buf, len) < 0)
+		return -ENOSPC;
+	bp->newpos += len;
+
+	return 0;
+}
+
+static int bspatch_next_ctrl(struct bspatch *bp)
+{
+	long long add;
+
+	add = offtin(bp->ctrl);
+	bp->copy = offtin(bp->ctrl + 8);
+	bp->seek = offtin(bp->ctrl + 16);
+	if (add < 0 || bp->copy < 0 ||
+	    add > bp->newsize - bp->newpos ||
+	    bp->copy > bp->newsize - bp->newpos - add) {
+		ERROR("Corrupted patch: control data out of range");
+		return -EINVAL;
+	}
+
+	bp->left = add;
+	bp->state = BSPATCH_DIFF;
+
+	return 0;
+}
+
+/* Consume decompressed patch data */
+static int bspatch_process(struct bspatch *bp, unsigned char *buf,
+		unsigned int len)
+{
+	unsigned int n, i;
+	int ret;
+
+	for (;;) {
+		switch (bp->state) {
+		case BSPATCH_CTRL:
+			if (!len)
+				return 0;
+			n = min(len, BSPATCH_CTRL_LEN - bp->hdrlen);
+			memcpy(bp->ctrl + bp->hdrlen, buf, n);
+			bp->hdrlen += n;
+			buf += n;
+			len -= n;
+			if (bp->hdrlen < BSPATCH_CTRL_LEN)
+				return 0;
+			bp->hdrlen = 0;
+			ret = bspatch_next_ctrl(bp);
+			if (ret < 0)
+				return ret;
+			break;
+
+		case BSPATCH_DIFF:
+			if (!bp->left) {
+				bp->left = bp->copy;
+				bp->state = BSPATCH_EXTRA;
+				break;
+			}
+			if (!len)
+				return 0;
+			n = (unsigned int)min((long long)len, bp->left);
+			ret = bspatch_read_old(bp, n);
+			if (ret < 0)
+				return ret;
+			for (i = 0; i < n; i++)
+				buf[i] += bp->old[i];
+			ret = bspatch_out(bp, buf, n);
+			if (ret < 0)
+				return ret;
+			bp->oldpos += n;
+			bp->left -= n;
+			buf += n;
+			len -= n;
+			break;
+
+		case BSPATCH_EXTRA:
+			if (!bp->left) {
+				bp->oldpos += bp->seek;
+				bp->state = (bp->newpos == bp->newsize) ?
+					BSPATCH_DONE : BSPATCH_CTRL;
+				break;
+			}
+			if (!len)
+				return 0;
+			n = (unsigned int)min((long long)len, bp->left);
+			ret = bspatch_out(bp, buf, n);
+			if (ret < 0)
+				return ret;
+			bp->left -= n;
+			buf += n;
+			len -= n;
+			break;
+
+		case BSPATCH_DONE:
+			if (len) {
+				ERROR("Corrupted patch: data after the end");
+				return -EINVAL;
+			}
+			return 0;
+
+		default:
+			return -EINVAL;
+		}
+	}
+}
+
+static int bspatch_header(struct bspatch *bp)
+{
+	if (memcmp(bp->hdr, BSPATCH_MAGIC, BSPATCH_MAGIC_LEN)) {
+		ERROR("Patch is not in bsdiff 4.3 format");
+		return -EINVAL;
+	}
+
+	bp->newsize = offtin(bp->hdr + BSPATCH_MAGIC_LEN);
+	if (bp->newsize < 0) {
+		ERROR("Corrupted patch: wrong size");
+		return -EINVAL;
+	}
+
+	if (BZ2_bzDecompressInit(&bp->bz, 0, 0) != BZ_OK)
+		return -ENOMEM;
+	bp->bz_init = 1;
+	bp->hdrlen = 0;
+	bp->state = bp->newsize ? BSPATCH_CTRL : BSPATCH_DONE;
+
+	TRACE("Applying patch, new size %lld bytes", bp->newsize);
+
+	return 0;
+}
+
+int bspatch_write(struct bspatch *bp, const void *buf, unsigned int len)
+{
+	const unsigned char *in = (const unsigned char *)buf;
+	unsigned int n;
+	int full = 0;
+	int ret;
+
+	if (bp->state == BSPATCH_HEADER) {
+		n = min(len, BSPATCH_HDR_LEN - bp->hdrlen);
+		memcpy(bp->hdr + bp->hdrlen, in, n);
+		bp->hdrlen += n;
+		in += n;
+		len -= n;
+		if (bp->hdrlen < BSPATCH_HDR_LEN)
+			return 0;
+		ret = bspatch_header(bp);
+		if (ret < 0)
+			return ret;
+	}
+
+	bp->bz.next_in = (char *)in;
+	bp->bz.avail_in = len;
+	/* the output may be full with input still buffered in bzip2 */
+	while (!bp->bz_end && (bp->bz.avail_in > 0 || full)) {
+		bp->bz.next_out = (char *)bp->data;
+		bp->bz.avail_out = sizeof(bp->data);
+		ret = BZ2_bzDecompress(&bp->bz);
+		if (ret == BZ_STREAM_END) {
+			bp->bz_end = 1;
+		} else if (ret != BZ_OK) {
+			ERROR("Corrupted patch: bzip2 error %d", ret);
+			return -EINVAL;
+		}
+		n = sizeof(bp->data) - bp->bz.avail_out;
+		full = !bp->bz.avail_out;
+		ret = bspatch_process(bp, bp->data, n);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (bp->bz_end && bp->bz.avail_in > 0) {
+		ERROR("Corrupted patch: data after the end");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int bspatch_end(struct bspatch *bp)
+{
+	int ret = 0;
+
+	if (bp->state != BSPATCH_DONE || !bp->bz_end) {
+		ERROR("Patch is truncated: %lld of %lld bytes written",
+			bp->newpos, bp->newsize);
+		ret = -EINVAL;
+	}
+
+	if (bp->bz_init)
+		BZ2_bzDecompressEnd(&bp->bz);
+	free(bp);
+
+	return ret;
+}
@@ -0,0 +1,195 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+/*
+ * Kernels for the cpio checksum. The SIMD versions sum the bytes
+ * in wide lanes and fold them at the end: because the checksum is
+ * a plain sum modulo 2^32, the result is bit-exact with the scalar
+ * loop whatever the order of the additions.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "util.h"
+#include "checksum.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || __GNUC__ > 4 || \
+	 (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define CHECKSUM_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CHECKSUM_NEON
+#include <arm_neon.h>
+#endif
+
+static uint32_t checksum_scalar(uint32_t sum, const unsigned char *buf,
+				size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		sum += buf[i];
+
+	return sum;
+}
+
+#ifdef CHECKSUM_X86
+/*
+ * psadbw against zero sums 8 bytes into a 64 bit lane,
+ * that cannot overflow for any buffer passed here
+ */
+__attribute__((target("sse2")))
+static uint32_t checksum_sse2(uint32_t sum, const unsigned char *buf,
+				size_t len)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc0 = zero, acc1 = zero;
+	uint64_t lanes[2];
+
+	for (; len >= 32; len -= 32, buf += 32) {
+		__m128i v0 = _mm_loadu_si128((const __m128i *)buf);
+		__m128i v1 = _mm_loadu_si128((const __m128i *)(buf + 16));
+		acc0 = _mm_add_epi64(acc0, _mm_sad_epu8(v0, zero));
+		acc1 = _mm_add_epi64(acc1, _mm_sad_epu8(v1, zero));
+	}
+	acc0 = _mm_add_epi64(acc0, acc1);
+	_mm_storeu_si128((__m128i *)lanes, acc0);
+	sum += (uint32_t)(lanes[0] + lanes[1]);
+
+	return checksum_scalar(sum, buf, len);
+}
+
+__attribute__((target("avx2")))
+static uint32_t checksum_avx2(uint32_t sum, const unsigned char *buf,
+				size_t len)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i acc0 = zero, acc1 = zero;
+	uint64_t lanes[4];
+
+	for (; len >= 64; len -= 64, buf += 64) {
+		__m256i v0 = _mm256_loadu_si256((const __m256i *)buf);
+		__m256i v1 = _mm256_loadu_si256((const __m256i *)(buf + 32));
+		acc0 = _mm256_add_epi64(acc0, _mm256_sad_epu8(v0, zero));
+		acc1 = _mm256_add_epi64(acc1, _mm256_sad_epu8(v1, zero));
+	}
+	acc0 = _mm256_add_epi64(acc0, acc1);
+	_mm256_storeu_si256((__m256i *)lanes, acc0);
+	sum += (uint32_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+
+	return checksum_scalar(sum, buf, len);
+}
+
+static int has_sse2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+static int has_avx2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
+#ifdef CHECKSUM_NEON
+/*
+ * Each vpadal adds at most 2 * 255 to a 16 bit lane,
+ * so 128 vectors can be summed before widening to 32 bit.
+ * The 32 bit lanes may wrap, that is fine modulo 2^32.
+ */
+#define NEON_BLOCKS	128
+
+static uint32_t checksum_neon(uint32_t sum, const unsigned char *buf,
+				size_t len)
+{
+	uint32x4_t acc32 = vdupq_n_u32(0);
+	uint16x8_t acc16;
+	uint32_t lanes[4];
+	size_t blocks;
+
+	while (len >= 16) {
+		blocks = min(len / 16, (size_t)NEON_BLOCKS);
+		len -= blocks * 16;
+		acc16 = vdupq_n_u16(0);
+		for (; blocks > 0; blocks--, buf += 16)
+			acc16 = vpadalq_u8(acc16, vld1q_u8(buf));
+		acc32 = vpadalq_u16(acc32, acc16);
+	}
+	vst1q_u32(lanes, acc32);
+	sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+	return checksum_scalar(sum, buf, len);
+}
+#endif
+
+/* The fastest kernel comes last */
+static const struct cpio_checksum_impl checksum_impls[] = {
+	{ "scalar", checksum_scalar, NULL },
+#ifdef CHECKSUM_X86
+	{ "sse2", checksum_sse2, has_sse2 },
+	{ "avx2", checksum_avx2, has_avx2 },
+#endif
+#ifdef CHECKSUM_NEON
+	{ "neon", checksum_neon, NULL },
+#endif
+};
+
+static const struct cpio_checksum_impl *checksum_selected;
+
+void cpio_checksum_init(void)
+{
+	unsigned int i = ARRAY_SIZE(checksum_impls);
+
+	while (--i > 0) {
+		if (!checksum_impls[i].supported ||
+		    checksum_impls[i].supported())
+			break;
+	}
+	checksum_selected = &checksum_impls[i];
+}
+
+const char *cpio_checksum_name(void)
+{
+	if (!checksum_selected)
+		cpio_checksum_init();
+
+	return checksum_selected->name;
+}
+
+uint32_t cpio_checksum(uint32_t sum, const unsigned char *buf, size_t len)
+{
+	if (!checksum_selected)
+		cpio_checksum_init();
+
+	return checksum_selected->fn(sum, buf, len);
+}
+
+const struct cpio_checksum_impl *cpio_checksum_impls(unsigned int *count)
+{
+	*count = ARRAY_SIZE(checksum_impls);
+
+	return checksum_impls;
+}
@@ -0,0 +1,575 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+/*
+ * Persistent cache of the downloads. Each artifact has two
+ * files in the cache directory, named after a hash of its
+ * URL and the hash announced by the server:
+ *	<key>.data	the bytes received so far
+ *	<key>.meta	URL, hash, length, validator of the server,
+ *			bytes synced and if the download is complete
+ * The data file is only appended. The meta file is written
+ * after the data is synced, every DL_CACHE_SYNC_SIZE bytes
+ * and at the end, the bytes it records are the ones that can
+ * be replayed: a restart drops what is beyond and resumes
+ * from there. The meta file is replaced with
+ * rename(), its mtime is the last use of the entry for the
+ * eviction.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "util.h"
+#include "download_cache.h"
+
+#define META_SUFFIX	".meta"
+#define DATA_SUFFIX	".data"
+#define REPLAY_BUFSIZE	(64 * 1024)
+
+struct cache_victim {
+	char key[NAME_MAX + 1];
+	time_t mtime;
+	unsigned long long bytes;
+};
+
+/* FNV-1a, only to name the files */
+static uint64_t url_key(const char *url)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (*url) {
+		h ^= (unsigned char)*url++;
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+static void entry_path(const struct dl_cache_entry *e, const char *suffix,
+		       char *path, size_t len)
+{
+	snprintf(path, len, "%s%s", e->name, suffix);
+}
+
+/* Only called when the size bytes of the data file are synced */
+static int write_meta(struct dl_cache_entry *e)
+{
+	char path[PATH_MAX], tmp[PATH_MAX];
+	FILE *fp;
+	int fd, ret = 0;
+
+	entry_path(e, META_SUFFIX, path, sizeof(path));
+	entry_path(e, META_SUFFIX ".tmp", tmp, sizeof(tmp));
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return -errno;
+	fp = fdopen(fd, "w");
+	if (!fp) {
+		ret = -errno;
+		close(fd);
+		unlink(tmp);
+		return ret;
+	}
+	fprintf(fp, "url %s\nhash %s\ntotal %llu\nsize %llu\nvalidator %s\n"
+		"complete %d\n", e->url, e->hash, e->total, e->size,
+		e->validator, e->complete ? 1 : 0);
+	if (fflush(fp) || fsync(fileno(fp)))
+		ret = -errno;
+	if (fclose(fp) && !ret)
+		ret = -errno;
+	if (!ret && rename(tmp, path))
+		ret = -errno;
+	if (!ret)
+		e->synced = e->size;
+	if (ret) {
+		WARN("Download cache: cannot write the entry of %s: %s",
+			e->url, strerror(-ret));
+		unlink(tmp);
+	}
+
+	return ret;
+}
+
+/*
+ * Read the meta file, it returns 0 only if it belongs
+ * to the same URL and hash. synced is 0 if it is not there.
+ */
+static int read_meta(struct dl_cache_entry *e, unsigned long long *synced)
+{
+	char path[PATH_MAX], line[PATH_MAX + 16], *value, *nl;
+	bool same_url = false, same_hash = false;
+	FILE *fp;
+
+	entry_path(e, META_SUFFIX, path, sizeof(path));
+	*synced = 0;
+	fp = fopen(path, "r");
+	if (!fp)
+		return -ENOENT;
+
+	while (fgets(line, sizeof(line), fp)) {
+		nl = strchr(line, '\n');
+		if (nl)
+			*nl = '\0';
+		value = strchr(line, ' ');
+		if (!value)
+			continue;
+		*value++ = '\0';
+		if (!strcmp(line, "url"))
+			same_url = !strcmp(value, e->url);
+		else if (!strcmp(line, "hash"))
+			same_hash = !strcmp(value, e->hash);
+		else if (!strcmp(line, "total"))
+			e->total = strtoull(value, NULL, 10);
+		else if (!strcmp(line, "size"))
+			*synced = strtoull(value, NULL, 10);
+		else if (!strcmp(line, "validator"))
+			snprintf(e->validator, sizeof(e->validator), "%s", value);
+		else if (!strcmp(line, "complete"))
+			e->complete = atoi(value) == 1;
+	}
+	/* the hash line is empty if there is no hash */
+	if (!e->hash[0])
+		same_hash = true;
+	fclose(fp);
+
+	return same_url && same_hash ? 0 : -ESTALE;
+}
+
+static void reset_entry(struct dl_cache_entry *e)
+{
+	if (ftruncate(e->fd, 0))
+		WARN("Download cache: cannot truncate the entry of %s: %s",
+			e->url, strerror(errno));
+	e->size = 0;
+	e->synced = 0;
+	e->total = 0;
+	e->validator[0] = '\0';
+	e->complete = false;
+}
+
+static void drop_files(const char *dir, const char *key)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s" DATA_SUFFIX, dir, key);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/%s" META_SUFFIX, dir, key);
+	unlink(path);
+}
+
+static int oldest_first(const void *a, const void *b)
+{
+	const struct cache_victim *va = a, *vb = b;
+
+	return (va->mtime > vb->mtime) - (va->mtime < vb->mtime);
+}
+
+/*
+ * Evict the least recently used entries, other than e, until
+ * need more bytes for e fit in the limit. It returns 0 if they do.
+ */
+static int make_room(struct dl_cache_entry *e, unsigned long long need)
+{
+	const struct dl_cache *cache = e->cache;
+	struct cache_victim *victims = NULL, *v;
+	unsigned int n = 0, i;
+	struct dirent *de;
+	struct stat st;
+	char path[PATH_MAX], *own;
+	size_t len;
+	DIR *dir;
+
+	own = strrchr(e->name, '/') + 1;
+	dir = opendir(cache->dir);
+	if (!dir)
+		return -errno;
+
+	e->others = 0;
+	while ((de = readdir(dir))) {
+		len = strlen(de->d_name);
+		if (len <= strlen(META_SUFFIX) ||
+		    strcmp(de->d_name + len - strlen(META_SUFFIX), META_SUFFIX))
+			continue;
+		len -= strlen(META_SUFFIX);
+		if (len > NAME_MAX - strlen(DATA_SUFFIX) ||
+		    (strlen(own) == len && !strncmp(de->d_name, own, len)))
+			continue;
+
+		v = (struct cache_victim *)realloc(victims,
+						   (n + 1) * sizeof(*victims));
+		if (!v)
+			break;
+		victims = v;
+		v = &victims[n];
+		memcpy(v->key, de->d_name, len);
+		v->key[len] = '\0';
+		snprintf(path, sizeof(path), "%s/%s", cache->dir, de->d_name);
+		if (stat(path, &st))
+			continue;
+		v->mtime = st.st_mtime;
+		v->bytes = st.st_size;
+		snprintf(path, sizeof(path), "%s/%s" DATA_SUFFIX, cache->dir,
+			 v->key);
+		if (!stat(path, &st))
+			v->bytes += st.st_size;
+		e->others += v->bytes;
+		n++;
+	}
+	closedir(dir);
+
+	if (cache->max_size) {
+		qsort(victims, n, sizeof(*victims), oldest_first);
+		for (i = 0; i < n && e->others + need > cache->max_size; i++) {
+			TRACE("Download cache: evict %s, %llu bytes",
+				victims[i].key, victims[i].bytes);
+			drop_files(cache->dir, victims[i].key);
+			e->others -= victims[i].bytes;
+		}
+	}
+	free(victims);
+
+	return !cache->max_size || e->others + need <= cache->max_size ?
+		0 : -ENOSPC;
+}
+
+static bool valid_hash(const char *hash)
+{
+	size_t len = strlen(hash);
+
+	if (len > DL_CACHE_HASH_MAX)
+		return false;
+	while (*hash)
+		if (!isxdigit((unsigned char)*hash++))
+			return false;
+
+	return true;
+}
+
+int dl_cache_open(const struct dl_cache *cache, const char *url,
+		  const char *hash, struct dl_cache_entry *e)
+{
+	char path[PATH_MAX];
+	unsigned long long synced;
+	struct stat st;
+	int ret;
+
+	memset(e, 0, sizeof(*e));
+	e->fd = -1;
+	if (!cache || !cache->dir || !url)
+		return -EINVAL;
+	if (hash && !valid_hash(hash)) {
+		WARN("Download cache: invalid hash %s", hash);
+		return -EINVAL;
+	}
+	if (mkdir(cache->dir, 0700) && errno != EEXIST) {
+		ERROR("Download cache: cannot create %s: %s", cache->dir, strerror(errno));
+		return -errno;
+	}
+
+	e->cache = cache;
+	e->url = strdup(url);
+	if (!e->url)
+		return -ENOMEM;
+	if (hash)
+		snprintf(e->hash, sizeof(e->hash), "%s", hash);
+	snprintf(e->name, sizeof(e->name), "%s/%016llx%s%s", cache->dir,
+		 (unsigned long long)url_key(url), hash ? "-" : "",
+		 hash ? hash : "");
+
+	entry_path(e, DATA_SUFFIX, path, sizeof(path));
+	e->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (e->fd < 0) {
+		ret = -errno;
+		ERROR("Download cache: cannot open the entry of %s: %s", url,
+			strerror(errno));
+		free(e->url);
+		e->url = NULL;
+		return ret;
+	}
+	if (fstat(e->fd, &st)) {
+		ret = -errno;
+		dl_cache_close(e);
+		return ret;
+	}
+	e->size = st.st_size;
+
+	if (read_meta(e, &synced) || synced > e->size)
+		reset_entry(e);
+	/* what was written after the last sync may not be there */
+	if (e->size > synced) {
+		if (ftruncate(e->fd, synced)) {
+			ret = -errno;
+			dl_cache_remove(e);
+			return ret;
+		}
+		e->size = synced;
+	}
+	if ((e->total && e->size > e->total) ||
+	    (e->complete && e->size != e->total))
+		reset_entry(e);
+
+	/* the new meta file marks the entry as recently used */
+	if (write_meta(e) || make_room(e, max(e->total, e->size))) {
+		dl_cache_remove(e);
+		return -ENOSPC;
+	}
+
+	TRACE("Download cache: %s has %llu bytes%s", url, e->size,
+		e->complete ? ", complete" : "");
+
+	return 0;
+}
+
+struct validate_data {
+	char validator[DL_CACHE_VALIDATOR_MAX];
+	bool etag;
+	bool ranges;
+};
+
+static size_t validate_header(char *buffer, size_t size, size_t nitems,
+			      void *userdata)
+{
+	struct validate_data *v = (struct validate_data *)userdata;
+	size_t len = size * nitems, n;
+	char *value;
+
+	value = memchr(buffer, ':', len);
+	if (!value)
+		return len;
+	n = value - buffer;
+	value++;
+	while (value < buffer + len && isspace((unsigned char)*value))
+		value++;
+
+	if (n == strlen("Accept-Ranges") &&
+	    !strncasecmp(buffer, "Accept-Ranges", n)) {
+		v->ranges = !strncasecmp(value, "bytes", strlen("bytes"));
+	} else if ((n == strlen("ETag") && !strncasecmp(buffer, "ETag", n)) ||
+		   (!v->etag && n == strlen("Last-Modified") &&
+		    !strncasecmp(buffer, "Last-Modified", n))) {
+		/* ETag is preferred, it does not depend on the clock */
+		v->etag = n == strlen("ETag");
+		n = buffer + len - value;
+		while (n && isspace((unsigned char)value[n - 1]))
+			n--;
+		n = min(n, sizeof(v->validator) - 1);
+		memcpy(v->validator, value, n);
+		v->validator[n] = '\0';
+	}
+
+	return len;
+}
+
+int dl_cache_validate(struct dl_cache_entry *e, CURL *curl)
+{
+	struct validate_data v;
+	CURLcode res;
+	long code = 0;
+#if LIBCURL_VERSION_NUM >= 0x073700
+	curl_off_t total = -1;
+#else
+	double total = -1;
+#endif
+
+	if (e->fd < 0)
+		return -EINVAL;
+	if (e->hash[0])
+		return 0;
+
+	memset(&v, 0, sizeof(v));
+	curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, validate_header);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, &v);
+	res = curl_easy_perform(curl);
+	if (res == CURLE_OK) {
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+#if LIBCURL_VERSION_NUM >= 0x073700
+		curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &total);
+#else
+		curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &total);
+#endif
+	}
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, NULL);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, NULL);
+	curl_easy_setopt(curl, CURLOPT_NOBODY, 0L);
+	curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+
+	if (res != CURLE_OK || code != 200) {
+		TRACE("Download cache: cannot check %s, not used", e->url);
+		dl_cache_close(e);
+		return -EIO;
+	}
+
+	/* without these a later run cannot know if the data is still good */
+	if (!v.validator[0] || !v.ranges || total <= 0) {
+		TRACE("Download cache: %s cannot be resumed, not cached", e->url);
+		dl_cache_remove(e);
+		return -ENOTSUP;
+	}
+
+	if (strcmp(v.validator, e->validator) ||
+	    e->total != (unsigned long long)total) {
+		if (e->size)
+			TRACE("Download cache: %s has changed, %llu bytes dropped",
+				e->url, e->size);
+		reset_entry(e);
+		memcpy(e->validator, v.validator, sizeof(e->validator));
+		e->total = (unsigned long long)total;
+		if (write_meta(e) || make_room(e, e->total)) {
+			dl_cache_remove(e);
+			return -ENOSPC;
+		}
+	}
+
+	return 0;
+}
+
+int dl_cache_replay(struct dl_cache_entry *e, dl_cache_sink sink, void *ctx)
+{
+	unsigned long long off = 0;
+	char *buf;
+	ssize_t n;
+	int ret = 0;
+
+	if (e->fd < 0 || !e->size)
+		return 0;
+
+	buf = (char *)malloc(REPLAY_BUFSIZE);
+	if (!buf)
+		return -ENOMEM;
+
+	TRACE("Download cache: replay %llu bytes of %s", e->size, e->url);
+	while (off < e->size) {
+		n = pread(e->fd, buf, min((unsigned long long)REPLAY_BUFSIZE,
+					  e->size - off), off);
+		if (n <= 0) {
+			ret = n ? -errno : -EIO;
+			ERROR("Cannot read the download cache: %s", strerror(-ret));
+			break;
+		}
+		ret = sink(ctx, buf, n);
+		if (ret < 0)
+			break;
+		off += n;
+		ret = 0;
+	}
+	free(buf);
+
+	return ret;
+}
+
+void dl_cache_write(struct dl_cache_entry *e, const void *buf, size_t len)
+{
+	const struct dl_cache *cache = e->cache;
+	ssize_t n;
+
+	if (e->fd < 0 || !len)
+		return;
+
+	if (cache->max_size && e->others + e->size + len > cache->max_size &&
+	    make_room(e, e->size + len)) {
+		WARN("Download cache: %s does not fit, not cached", e->url);
+		dl_cache_remove(e);
+		return;
+	}
+
+	n = pwrite(e->fd, buf, len, e->size);
+	if (n != (ssize_t)len) {
+		WARN("Download cache: cannot write the entry of %s: %s",
+			e->url, n < 0 ? strerror(errno) : "short write");
+		dl_cache_remove(e);
+		return;
+	}
+	e->size += len;
+
+	/* what is synced is kept if the device goes down */
+	if (e->size - e->synced >= DL_CACHE_SYNC_SIZE &&
+	    (fdatasync(e->fd) || write_meta(e))) {
+		WARN("Download cache: cannot sync the entry of %s", e->url);
+		dl_cache_remove(e);
+	}
+}
+
+void dl_cache_done(struct dl_cache_entry *e)
+{
+	if (e->fd < 0)
+		return;
+
+	if (e->total && e->size != e->total) {
+		WARN("Download cache: %s has %llu bytes instead of %llu",
+			e->url, e->size, e->total);
+		dl_cache_remove(e);
+		return;
+	}
+	if (fdatasync(e->fd)) {
+		dl_cache_remove(e);
+		return;
+	}
+	e->total = e->size;
+	e->complete = true;
+	if (write_meta(e))
+		dl_cache_remove(e);
+}
+
+void dl_cache_close(struct dl_cache_entry *e)
+{
+	if (e->fd >= 0) {
+		if (fdatasync(e->fd))
+			WARN("Download cache: cannot sync the entry of %s",
+				e->url);
+		else
+			write_meta(e);
+		close(e->fd);
+		e->fd = -1;
+	}
+	e->size = 0;
+	e->complete = false;
+	free(e->url);
+	e->url = NULL;
+}
+
+void dl_cache_remove(struct dl_cache_entry *e)
+{
+	char path[PATH_MAX];
+
+	if (e->fd >= 0) {
+		close(e->fd);
+		e->fd = -1;
+		entry_path(e, DATA_SUFFIX, path, sizeof(path));
+		unlink(path);
+		entry_path(e, META_SUFFIX, path, sizeof(path));
+		unlink(path);
+	}
+	e->size = 0;
+	e->complete = false;
+	free(e->url);
+	e->url = NULL;
+}
@@ -0,0 +1,440 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+/*
+ * Segmented download: the image is split into ranges that
+ * are fetched on several connections at once, from one URL
+ * or from a list of mirrors, with the curl multi interface.
+ * Only the ranges inside a window of "connections" segments
+ * after the first one not yet sent are running, each one
+ * into its own buffer: the installer gets the data in
+ * order, as soon as the first segment receives it, and the
+ * memory is bounded by connections * segment_size.
+ * A segment that fails is resumed on the next mirror.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+
+#include <curl/curl.h>
+
+#include "util.h"
+#include "network_ipc.h"
+#include "download_interface.h"
+#include "download_cache.h"
+
+/* Minimum bytes/sec, else connection is broken */
+#define DL_LOWSPEED_BYTES	8
+
+struct dl_segment {
+	struct dl_segments *dl;
+	unsigned int index;
+	unsigned long long off;	/* offset in the image */
+	size_t len;
+	size_t got;		/* bytes received */
+	size_t written;		/* bytes sent to the installer */
+	char *buf;
+	CURL *curl;
+	unsigned int mirror;	/* index into urls */
+	unsigned int attempts;
+	time_t retry_at;	/* 0: not waiting for a retry */
+	bool running;
+	bool checked;		/* answer of this transfer is 206 */
+	bool done;
+};
+
+struct dl_segments {
+	const struct dwl_segment_opts *opts;
+	CURLM *multi;
+	unsigned long long size;
+	unsigned long long offset;	/* already sent to the installer */
+	unsigned long long sent;	/* offset up to which data was sent */
+	unsigned int nsegs;
+	struct dl_segment *slots;	/* segment i is in slot i % connections */
+	unsigned int next_start;
+	unsigned int next_write;
+	unsigned long long received;
+	time_t last_info;
+};
+
+static time_t now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec;
+}
+
+static size_t header_ranges(char *buffer, size_t size, size_t nitems,
+			    void *userdata)
+{
+	bool *ranges = (bool *)userdata;
+	size_t len = size * nitems;
+	const char hdr[] = "Accept-Ranges:";
+
+	if (len > strlen(hdr) && !strncasecmp(buffer, hdr, strlen(hdr)) &&
+	    strstr(buffer + strlen(hdr), "bytes"))
+		*ranges = true;
+
+	return len;
+}
+
+static void set_options(CURL *curl, const struct dwl_segment_opts *opts,
+			const char *url)
+{
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_USERAGENT, "swupdate");
+	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, DL_LOWSPEED_BYTES);
+	curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long)opts->lowspeed_time);
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+}
+
+/*
+ * Ask the size of the image and if ranges are supported,
+ * trying the mirrors in turn.
+ */
+static int probe_size(struct dl_segments *dl)
+{
+	const struct dwl_segment_opts *opts = dl->opts;
+	CURL *curl;
+	CURLcode res;
+	long code = 0;
+	bool ranges;
+	unsigned int i;
+#if LIBCURL_VERSION_NUM >= 0x073700
+	curl_off_t len = -1;
+#else
+	double len = -1;
+#endif
+
+	curl = curl_easy_init();
+	if (!curl)
+		return -ENOMEM;
+
+	for (i = 0; i < opts->nurls; i++) {
+		ranges = false;
+		curl_easy_reset(curl);
+		set_options(curl, opts, opts->urls[i]);
+		curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_ranges);
+		curl_easy_setopt(curl, CURLOPT_HEADERDATA, &ranges);
+
+		res = curl_easy_perform(curl);
+		if (res != CURLE_OK) {
+			TRACE("Cannot reach %s: %s", opts->urls[i],
+				curl_easy_strerror(res));
+			continue;
+		}
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+#if LIBCURL_VERSION_NUM >= 0x073700
+		curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &len);
+#else
+		curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &len);
+#endif
+		break;
+	}
+	curl_easy_cleanup(curl);
+
+	if (i == opts->nurls)
+		return -EIO;
+	if (code != 200 || !ranges || len <= 0) {
+		TRACE("%s does not support ranges, no segmented download",
+			opts->urls[i]);
+		return -ENOTSUP;
+	}
+	dl->size = (unsigned long long)len;
+
+	return 0;
+}
+
+static size_t segment_write(void *buffer, size_t size, size_t nmemb,
+			    void *userp)
+{
+	struct dl_segment *seg = (struct dl_segment *)userp;
+	size_t len = size * nmemb;
+	long code = 0;
+
+	if (!seg->checked) {
+		curl_easy_getinfo(seg->curl, CURLINFO_RESPONSE_CODE, &code);
+		if (code != 206) {
+			ERROR("%s answers %ld to a range request",
+				seg->dl->opts->urls[seg->mirror], code);
+			return 0;
+		}
+		seg->checked = true;
+	}
+
+	if (len > seg->len - seg->got) {
+		ERROR("Range longer than requested from %s",
+			seg->dl->opts->urls[seg->mirror]);
+		return 0;
+	}
+	memcpy(seg->buf + seg->got, buffer, len);
+	seg->got += len;
+	seg->dl->received += len;
+
+	return nmemb;
+}
+
+/* Start or resume the transfer of what is missing in seg */
+static int start_transfer(struct dl_segments *dl, struct dl_segment *seg)
+{
+	char range[64];
+
+	if (!seg->curl) {
+		seg->curl = curl_easy_init();
+		if (!seg->curl)
+			return -ENOMEM;
+	}
+	curl_easy_reset(seg->curl);
+	set_options(seg->curl, dl->opts, dl->opts->urls[seg->mirror]);
+	curl_easy_setopt(seg->curl, CURLOPT_WRITEFUNCTION, segment_write);
+	curl_easy_setopt(seg->curl, CURLOPT_WRITEDATA, seg);
+	curl_easy_setopt(seg->curl, CURLOPT_PRIVATE, seg);
+	snprintf(range, sizeof(range), "%llu-%llu", seg->off + seg->got,
+		 seg->off + seg->len - 1);
+	curl_easy_setopt(seg->curl, CURLOPT_RANGE, range);
+
+	if (curl_multi_add_handle(dl->multi, seg->curl) != CURLM_OK)
+		return -EFAULT;
+	seg->checked = false;
+	seg->running = true;
+	seg->retry_at = 0;
+	seg->attempts++;
+
+	return 0;
+}
+
+static int start_segment(struct dl_segments *dl, unsigned int index)
+{
+	const struct dwl_segment_opts *opts = dl->opts;
+	struct dl_segment *seg = &dl->slots[index % opts->connections];
+
+	seg->index = index;
+	seg->off = dl->offset + (unsigned long long)index * opts->segment_size;
+	seg->len = (size_t)min((unsigned long long)opts->segment_size,
+			       dl->size - seg->off);
+	seg->got = 0;
+	seg->written = 0;
+	seg->attempts = 0;
+	seg->done = false;
+	/* spread the segments over the mirrors */
+	seg->mirror = index % opts->nurls;
+
+	return start_transfer(dl, seg);
+}
+
+/* A transfer is over: the segment is complete or it is retried */
+static int end_transfer(struct dl_segments *dl, struct dl_segment *seg,
+			CURLcode res)
+{
+	const struct dwl_segment_opts *opts = dl->opts;
+
+	curl_multi_remove_handle(dl->multi, seg->curl);
+	seg->running = false;
+
+	/*
+	 * All bytes are there even if curl reports an error after
+	 * them: a retry would ask for an empty (inverted) range
+	 */
+	if (seg->got == seg->len) {
+		seg->done = true;
+		return 0;
+	}
+
+	TRACE("Segment %u from %s interrupted after %zu bytes: %s",
+		seg->index, opts->urls[seg->mirror], seg->got,
+		res == CURLE_OK ? "short answer" : curl_easy_strerror(res));
+
+	if (opts->retries && seg->attempts > opts->retries) {
+		ERROR("Segment %u failed %u times, giving up", seg->index,
+			seg->attempts);
+		return -EIO;
+	}
+
+	/* resume on the next mirror, wait before using the same one again */
+	seg->mirror = (seg->mirror + 1) % opts->nurls;
+	seg->retry_at = now_sec() + (opts->nurls > 1 ? 0 : opts->retry_delay);
+
+	return 0;
+}
+
+/* Send to the installer what is there in order */
+static int flush_segments(struct dl_segments *dl, int fd)
+{
+	const struct dwl_segment_opts *opts = dl->opts;
+	struct dl_segment *seg;
+
+	/* the slot of a segment not yet started has an old one */
+	while (dl->next_write < dl->next_start) {
+		seg = &dl->slots[dl->next_write % opts->connections];
+		if (seg->got > seg->written) {
+			if (ipc_send_data(fd, seg->buf + seg->written,
+					  (int)(seg->got - seg->written)) < 0) {
+				ERROR("Failure writing into IPC Stream");
+				return -EIO;
+			}
+			if (opts->cache)
+				dl_cache_write(opts->cache, seg->buf + seg->written,
+					       seg->got - seg->written);
+			dl->sent += seg->got - seg->written;
+			seg->written = seg->got;
+		}
+		if (!seg->done)
+			break;
+		dl->next_write++;
+	}
+
+	return 0;
+}
+
+static int run_segments(struct dl_segments *dl, int fd)
+{
+	const struct dwl_segment_opts *opts = dl->opts;
+	struct dl_segment *seg;
+	struct CURLMsg *m;
+	int running, msgs, ret = 0;
+	unsigned int i;
+	time_t now;
+
+	while (dl->next_write < dl->nsegs) {
+		while (dl->next_start < dl->nsegs &&
+		       dl->next_start < dl->next_write + opts->connections) {
+			ret = start_segment(dl, dl->next_start++);
+			if (ret)
+				return ret;
+		}
+
+		now = now_sec();
+		for (i = 0; i < opts->connections; i++) {
+			seg = &dl->slots[i];
+			if (seg->retry_at && seg->retry_at <= now) {
+				ret = start_transfer(dl, seg);
+				if (ret)
+					return ret;
+			}
+		}
+
+		if (curl_multi_perform(dl->multi, &running) != CURLM_OK)
+			return -EFAULT;
+
+		while ((m = curl_multi_info_read(dl->multi, &msgs))) {
+			if (m->msg != CURLMSG_DONE)
+				continue;
+			curl_easy_getinfo(m->easy_handle, CURLINFO_PRIVATE,
+					  (char **)&seg);
+			ret = end_transfer(dl, seg, m->data.result);
+			if (ret)
+				return ret;
+		}
+
+		ret = flush_segments(dl, fd);
+		if (ret)
+			return ret;
+
+		if (now - dl->last_info >= 1) {
+			dl->last_info = now;
+			INFO("Received : %llu / %llu", dl->received, dl->size);
+		}
+
+		if (dl->next_write < dl->nsegs &&
+		    curl_multi_wait(dl->multi, NULL, 0, 1000, NULL) != CURLM_OK)
+			return -EFAULT;
+	}
+
+	return 0;
+}
+
+int download_segments(const struct dwl_segment_opts *opts, int fd,
+		      unsigned long long *sent)
+{
+	struct dl_segments dl;
+	unsigned int i;
+	int ret;
+
+	*sent = opts->offset;
+
+	if (!opts->nurls || !opts->connections || !opts->segment_size)
+		return -EINVAL;
+
+	memset(&dl, 0, sizeof(dl));
+	dl.opts = opts;
+
+	ret = probe_size(&dl);
+	if (ret)
+		return ret;
+	if (opts->offset > dl.size) {
+		ERROR("Image is %llu bytes, cannot resume after %llu",
+			dl.size, opts->offset);
+		return -EINVAL;
+	}
+	dl.offset = opts->offset;
+	dl.sent = dl.offset;
+	dl.received = dl.offset;
+	dl.nsegs = (unsigned int)((dl.size - dl.offset + opts->segment_size - 1) /
+				  opts->segment_size);
+
+	TRACE("Segmented download of %llu bytes: %u segments, %u connections, %u URLs",
+		dl.size, dl.nsegs, opts->connections, opts->nurls);
+
+	dl.multi = curl_multi_init();
+	dl.slots = (struct dl_segment *)calloc(opts->connections,
+					       sizeof(*dl.slots));
+	if (!dl.multi || !dl.slots) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < opts->connections; i++) {
+		dl.slots[i].dl = &dl;
+		dl.slots[i].buf = (char *)malloc(opts->segment_size);
+		if (!dl.slots[i].buf) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	ret = run_segments(&dl, fd);
+	*sent = dl.sent;
+
+out:
+	if (dl.slots) {
+		for (i = 0; i < opts->connections; i++) {
+			if (dl.slots[i].curl) {
+				if (dl.slots[i].running)
+					curl_multi_remove_handle(dl.multi,
+								 dl.slots[i].curl);
+				curl_easy_cleanup(dl.slots[i].curl);
+			}
+			free(dl.slots[i].buf);
+		}
+		free(dl.slots);
+	}
+	if (dl.multi)
+		curl_multi_cleanup(dl.multi);
+
+	return ret;
+}
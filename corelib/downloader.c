@@ -40,6 +40,8 @@
 #include "swupdate_status.h"
 #include "swupdate_settings.h"
 #include "download_interface.h"
+#include "download_cache.h"
+#include "ipc_batch.h"
 
 #define SETSTRING(p, v) do { \
 	if (p) \
@@ -56,12 +58,29 @@
 
 #define DL_DEFAULT_RETRIES	3
 
+/*
+ * Segmented download: size of a range and seconds
+ * to wait before asking again the same server
+ */
+#define DL_SEGMENT_SIZE		(1024 * 1024)
+#define DL_SEGMENT_DELAY	20
+#define DL_MAX_MIRRORS		8
+
 static int cnt = 0;
 
 struct dwl_options {
 	char *url;
 	unsigned int retries;
 	unsigned int timeout;
+	unsigned int connections;
+	char *mirrors[DL_MAX_MIRRORS];
+	unsigned int nmirrors;
+	struct dl_cache cache;
+};
+
+struct dwl_output {
+	struct ipc_batch *batch;
+	struct dl_cache_entry *cache;
 };
 
 /* notify download progress each second */
@@ -76,6 +95,10 @@ static struct option long_options[] = {
     {"url", required_argument, NULL, 'u'},
     {"retries", required_argument, NULL, 'r'},
     {"timeout", required_argument, NULL, 't'},
+    {"connections", required_argument, NULL, 'n'},
+    {"mirror", required_argument, NULL, 'm'},
+    {"cache", required_argument, NULL, 'c'},
+    {"cache-size", required_argument, NULL, 'z'},
     {NULL, 0, NULL, 0}};
 
 
@@ -121,27 +144,33 @@ static int legacy_download_info(void *p,
  */
 static size_t write_data(void *buffer, size_t size, size_t nmemb, void *userp)
 {
+	struct dwl_output *out = (struct dwl_output *)userp;
 	int ret;
-	int fd;
 
 	if (!nmemb)
 		return 0;
-	if (!userp) {
+	if (!out) {
 		ERROR("Failure IPC stream file descriptor \n");
 		return -EFAULT;
 	}
 
-	fd = *(int *)userp;
-	ret = ipc_send_data(fd, buffer, size * nmemb);
+	ret = ipc_batch_write(out->batch, buffer, size * nmemb);
 	if (ret < 0) {
 		ERROR("Failure writing into IPC Stream\n");
 		return ret;
 	}
+	dl_cache_write(out->cache, buffer, size * nmemb);
 	cnt += size * nmemb;
 
 	return nmemb;
 }
 
+/* Pass the cached part of the image to the installer */
+static int send_cached(void *ctx, char *buf, size_t len)
+{
+	return ipc_batch_write((struct ipc_batch *)ctx, buf, len);
+}
+
 /* Minimum bytes/sec, else connection is broken */
 #define DL_LOWSPEED_BYTES	8
 
@@ -194,13 +223,47 @@ static void set_option_common(CURL *curl_handle,
 	curl_easy_setopt(curl_handle, CURLOPT_TCP_KEEPINTVL, 120L);
 }
 
+/*
+ * Fetch ranges of the image on several connections,
+ * from the URL and its mirrors. It returns -ENOTSUP
+ * if a single connection must be used instead. On
+ * error, sent tells where to resume.
+ */
+static int download_segmented(struct dwl_options *opt, int fd,
+			      struct dl_cache_entry *cache,
+			      unsigned long long *sent)
+{
+	const char *urls[DL_MAX_MIRRORS + 1];
+	struct dwl_segment_opts seg;
+	unsigned int i;
+
+	if (opt->connections < 2 && !opt->nmirrors)
+		return -ENOTSUP;
+
+	urls[0] = opt->url;
+	for (i = 0; i < opt->nmirrors; i++)
+		urls[i + 1] = opt->mirrors[i];
+
+	memset(&seg, 0, sizeof(seg));
+	seg.urls = urls;
+	seg.nurls = opt->nmirrors + 1;
+	seg.connections = max(opt->connections, 1U);
+	seg.segment_size = DL_SEGMENT_SIZE;
+	seg.retries = opt->retries;
+	seg.retry_delay = DL_SEGMENT_DELAY;
+	seg.lowspeed_time = opt->timeout;
+	seg.offset = cache->size;
+	seg.cache = cache;
+
+	return download_segments(&seg, fd, sent);
+}
+
 /*
  * This provide a pull from an external server
  * It si not thought to work with local (file://)
  * for that, the -i option is used.
  */
-static RECOVERY_STATUS download_from_url(char *image_url, unsigned int retries,
-					unsigned long lowspeed_time)
+static RECOVERY_STATUS download_from_url(struct dwl_options *opt)
 {
 	CURL *curl_handle;
 	CURLcode res = CURLE_GOT_NOTHING;
@@ -211,6 +274,11 @@ static RECOVERY_STATUS download_from_url(char *image_url, unsigned int retries,
 	unsigned long long dwlbytes = 0;
 	unsigned int i;
 	struct dlprogress progress;
+	struct dl_cache_entry cache;
+	struct dwl_output out;
+	char *image_url = opt->url;
+	unsigned int retries = opt->retries;
+	unsigned long lowspeed_time = opt->timeout;
 
 
 	/*
@@ -253,23 +321,64 @@ static RECOVERY_STATUS download_from_url(char *image_url, unsigned int retries,
 		return FAILURE;
 	}
 
+	/* the small chunks from libcurl go to the installer together */
+	out.batch = ipc_batch_new(fd, IPC_BATCH_THREAD);
+	if (!out.batch) {
+		ERROR("Cannot allocate the IPC buffers");
+		curl_easy_cleanup(curl_handle);
+		curl_global_cleanup();
+		ipc_end(fd);
+		return FAILURE;
+	}
+	out.cache = &cache;
 	curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, write_data);
-	curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, &fd);
+	curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, &out);
 	set_option_common(curl_handle, lowspeed_time, &progress);
 
-	TRACE("Image download started : %s", image_url);
+	/*
+	 * What a previous run left in the cache goes to the
+	 * installer first, the download goes on from there
+	 */
+	dl_cache_open(&opt->cache, image_url, NULL, &cache);
+	if (!dl_cache_validate(&cache, curl_handle) &&
+	    dl_cache_replay(&cache, send_cached, out.batch) < 0) {
+		ERROR("Failure writing into IPC Stream");
+		ipc_batch_close(out.batch);
+		dl_cache_close(&cache);
+		curl_easy_cleanup(curl_handle);
+		curl_global_cleanup();
+		ipc_end(fd);
+		return FAILURE;
+	}
+	dwlbytes = cache.size;
+
+	if (cache.complete) {
+		TRACE("Image taken from the download cache : %s", image_url);
+		res = CURLE_OK;
+	} else if (ipc_batch_flush(out.batch) < 0) {
+		/* segments are written in order by download_segments() */
+		res = CURLE_WRITE_ERROR;
+	} else {
+		/* after an error, go on from what the installer got */
+		result = download_segmented(opt, fd, &cache, &dwlbytes);
+		if (result != -ENOTSUP)
+			res = result ? CURLE_PARTIAL_FILE : CURLE_OK;
+		else
+			TRACE("Image download started : %s", image_url);
+	}
 
 	for (i = 0; (res != CURLE_OK); i++) {
 		/* if resume, set the offset */
-		if (i) {
-			TRACE("Connection with server interrupted, try RESUME after %llu",
-					dwlbytes);
+		if (i || dwlbytes) {
+			TRACE("Resume download after %llu", dwlbytes);
 			if (curl_easy_setopt(curl_handle,CURLOPT_RESUME_FROM_LARGE,
 					dwlbytes) != CURLE_OK) {
 				TRACE("CURLOPT_RESUME_FROM_LARGE not implemented");
 				break;
 			}
-
+		}
+		if (i) {
+			TRACE("Connection with server interrupted");
 			/* motivation: router restart, DNS reconfiguration */
 			sleep(20);
 		}
@@ -292,13 +401,21 @@ static RECOVERY_STATUS download_from_url(char *image_url, unsigned int retries,
 	curl_easy_cleanup(curl_handle);
 	curl_global_cleanup();
 
+	if (ipc_batch_close(out.batch) < 0 && res == CURLE_OK)
+		res = CURLE_WRITE_ERROR;
+
 	if (res == CURLE_OK) {
+		dl_cache_done(&cache);
 		result = ipc_wait_for_complete(NULL);
+		/* an image that cannot be installed is not kept */
+		if (result == FAILURE)
+			dl_cache_remove(&cache);
 	} else {
 		INFO("Error : %s", curl_easy_strerror(res));
 		result = FAILURE;
 	}
 
+	dl_cache_close(&cache);
 	ipc_end(fd);
 
 	return result;
@@ -318,6 +435,15 @@ static int download_settings(void *elem, void  __attribute__ ((__unused__)) *dat
 		&opt->retries);
 	get_field(LIBCFG_PARSER, elem, "timeout",
 		&opt->timeout);
+	get_field(LIBCFG_PARSER, elem, "connections",
+		&opt->connections);
+	GET_FIELD_STRING_RESET(LIBCFG_PARSER, elem, "cache", tmp);
+	if (strlen(tmp)) {
+		SETSTRING(opt->cache.dir, tmp);
+	}
+	GET_FIELD_STRING_RESET(LIBCFG_PARSER, elem, "cache-size", tmp);
+	if (strlen(tmp))
+		opt->cache.max_size = strtoull(tmp, NULL, 10) * 1024 * 1024;
 
 	return 0;
 }
@@ -330,7 +456,11 @@ void download_print_help(void)
 	    "\t  -u, --url <url>   * <url> is a link to the .swu update image\n"
 	    "\t  -r, --retries       number of retries (resumed download) if connection\n"
 	    "\t                      is broken (0 means indefinitely retries) (default: %d)\n"
-	    "\t  -t, --timeout       timeout to check if a connection is lost (default: %d)\n",
+	    "\t  -t, --timeout       timeout to check if a connection is lost (default: %d)\n"
+	    "\t  -n, --connections   number of ranges downloaded at once (default: 1)\n"
+	    "\t  -m, --mirror <url>  another link to the same image, can be repeated\n"
+	    "\t  -c, --cache <dir>   keep the download in <dir> to resume it after a restart\n"
+	    "\t  -z, --cache-size    size limit of the cache in MiB (default: no limit)\n",
 	    DL_DEFAULT_RETRIES, DL_LOWSPEED_TIME);
 }
 
@@ -353,7 +483,7 @@ int start_download(const char *fname, int argc, char *argv[])
 
 	/* reset to optind=1 to parse download's argument vector */
 	optind = 1;
-	while ((choice = getopt_long(argc, argv, "t:u:r:",
+	while ((choice = getopt_long(argc, argv, "t:u:r:n:m:c:z:",
 				     long_options, NULL)) != -1) {
 		switch (choice) {
 		case 't':
@@ -365,6 +495,23 @@ int start_download(const char *fname, int argc, char *argv[])
 		case 'r':
 			options.retries = strtoul(optarg, NULL, 10);
 			break;
+		case 'n':
+			options.connections = strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			if (options.nmirrors == DL_MAX_MIRRORS) {
+				ERROR("Too many mirrors, max %d", DL_MAX_MIRRORS);
+				return -EINVAL;
+			}
+			options.mirrors[options.nmirrors++] = strdup(optarg);
+			break;
+		case 'c':
+			SETSTRING(options.cache.dir, optarg);
+			break;
+		case 'z':
+			options.cache.max_size = strtoull(optarg, NULL, 10) *
+						 1024 * 1024;
+			break;
 		case '?':
 		default:
 			return -EINVAL;
@@ -378,8 +525,7 @@ int start_download(const char *fname, int argc, char *argv[])
 	 * to check if an updated must be retried
 	 */
 	for (attempt = 0;; attempt++) {
-		result = download_from_url(options.url, options.retries,
-						options.timeout);
+		result = download_from_url(&options);
 		if (result != FAILURE)
 			break;
 
@@ -31,6 +31,7 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/mount.h>
+#include <pthread.h>
 
 #include "generated/autoconf.h"
 #include "bsdqueue.h"
@@ -43,6 +44,8 @@
 #include "parsers.h"
 #include "bootloader.h"
 #include "progress.h"
+#include "spool.h"
+#include "metrics.h"
 
 static int isImageInstalled(struct swver *sw_ver_list,
 				struct img_type *img)
@@ -87,10 +90,6 @@ int check_if_required(struct imglist *list, struct filehdr *pfdh,
 	struct img_type *img;
 	int img_skip = 0;
 	const char* TMPDIR = get_tmpdir();
-
-	/*
-	 * Check that not more as one image wnat to be streamed
-	 */
 	int install_direct = 0;
 
 	LIST_FOREACH(img, list, next) {
@@ -110,7 +109,8 @@ int check_if_required(struct imglist *list, struct filehdr *pfdh,
 				continue;
 			}
 
-			skip = COPY_FILE;
+			if (!install_direct)
+				skip = COPY_FILE;
 			img->provided = 1;
 			img->size = (unsigned int)pfdh->size;
 
@@ -121,14 +121,12 @@ int check_if_required(struct imglist *list, struct filehdr *pfdh,
 				return -EBADF;
 			}
 			/*
-			 *  Streaming is possible to only one handler
-			 *  If more img requires the same file,
-			 *  sw-description contains an error
+			 * If more images require the same file, the
+			 * first one to be streamed is returned, the
+			 * stream is then passed to all of them
 			 */
-			if (install_direct) {
-				ERROR("sw-description: stream to several handlers unsupported\n");
-				return -EINVAL;
-			}
+			if (install_direct)
+				continue;
 
 			if (img->install_directly) {
 				skip = INSTALL_FROM_STREAM;
@@ -166,8 +164,11 @@ static int extract_script(int fd, struct imglist *head, const char *dest)
 				dest, script->fname);
 
 		fdout = openfileoutput(script->extract_file);
-		extract_next_file(fd, fdout, script->offset, 0,
-					script->is_encrypted, script->sha256);
+		if (extract_next_file(fd, fdout, script->offset, 0,
+					script->is_encrypted, script->sha256) < 0) {
+			close(fdout);
+			return -1;
+		}
 		close(fdout);
 	}
 	return 0;
@@ -217,6 +218,7 @@ static int update_bootloader_env(void)
 int install_single_image(struct img_type *img)
 {
 	struct installer_handler *hnd;
+	unsigned long long t;
 	int ret;
 
 	hnd = find_handler(img);
@@ -229,7 +231,9 @@ int install_single_image(struct img_type *img)
 	swupdate_progress_inc_step(img->fname);
 
 	/* TODO : check callback to push results / progress */
+	t = metrics_now();
 	ret = hnd->installer(img, hnd->data);
+	metrics_add(METRIC_INSTALL, t, img->size > 0 ? img->size : 0);
 	if (ret != 0) {
 		TRACE("Installer for %s not successful !",
 			hnd->desc);
@@ -240,6 +244,315 @@ int install_single_image(struct img_type *img)
 	return ret;
 }
 
+/*
+ * Open the input of an image and install it. When several
+ * images are installed at the same time, each of them needs
+ * its own file descriptor: the position is not shared.
+ */
+static int install_from_image_list(struct swupdate_cfg *sw,
+		struct img_type *img, int fdsw, int fromfile)
+{
+	char filename[64];
+	struct filehdr fdh;
+	struct stat buf;
+	const char* TMPDIR = get_tmpdir();
+	int ret;
+
+	if (!fromfile && (img->fdin = spool_open(img->fname)) >= 0) {
+		img->offset = 0;
+	} else if (!fromfile) {
+		if (snprintf(filename, sizeof(filename), "%s%s",
+			     TMPDIR, img->fname) >= (int)sizeof(filename)) {
+			ERROR("Path too long: %s%s", TMPDIR, img->fname);
+			return -1;
+		}
+
+		ret = stat(filename, &buf);
+		if (ret) {
+			TRACE("%s not found or wrong", filename);
+			return -1;
+		}
+		img->size = buf.st_size;
+
+		img->fdin = open(filename, O_RDONLY);
+		if (img->fdin < 0) {
+			ERROR("Image %s cannot be opened",
+			img->fname);
+			return -1;
+		}
+	} else {
+		/*
+		 * Skip if the image in the same version is already
+		 * installed
+		 */
+		if (isImageInstalled(&sw->installed_sw_list, img))
+			return 0;
+
+		if (fdsw < 0)
+			return -1;
+		if (extract_img_from_cpio(fdsw, img->offset, &fdh) < 0)
+			return -1;
+		img->size = fdh.size;
+		img->checksum = fdh.chksum;
+		img->fdin = fdsw;
+	}
+
+	ret = install_single_image(img);
+
+	if (!fromfile)
+		close(img->fdin);
+
+	return ret;
+}
+
+/*
+ *  If image is flagged to be installed from stream
+ *  it  was already installed by loading the
+ *  .swu image and it is skipped here.
+ *  This does not make sense when installed from file,
+ *  because images are seekd (no streaming)
+ */
+static bool image_to_install(struct img_type *img, int fromfile)
+{
+	return fromfile || !img->install_directly;
+}
+
+#ifdef CONFIG_PARALLEL_INSTALL
+/*
+ * Images are installed by a pool of threads. An image
+ * depends on all images before it in sw-description
+ * that it conflicts with, and it is started only after
+ * all of them are installed. The first failure stops
+ * the start of further images, and the copy of the
+ * running ones is aborted.
+ */
+enum job_state {
+	JOB_PENDING,
+	JOB_RUNNING,
+	JOB_DONE
+};
+
+struct install_job {
+	struct img_type *img;
+	struct installer_handler *hnd;
+	enum job_state state;
+};
+
+struct install_sched {
+	struct swupdate_cfg *sw;
+	int fdsw;
+	int fromfile;
+	int reopen;		/* each worker reads from its own fd */
+	struct install_job *jobs;
+	unsigned int njobs;
+	unsigned int next;	/* first job not started */
+	int error;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+/*
+ * Images are extracted from the .swu at their offset: a
+ * new open file description is needed to read them
+ * concurrently, a dup() would share the position.
+ */
+static int reopen_file(int fd)
+{
+	char path[64];
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+
+	return open(path, O_RDONLY);
+}
+
+static bool same_string(const char *a, const char *b)
+{
+	return strlen(a) && !strcmp(a, b);
+}
+
+static bool jobs_conflict(struct install_job *a, struct install_job *b)
+{
+	struct img_type *x = a->img, *y = b->img;
+
+	if (!a->hnd || !b->hnd ||
+	    !(a->hnd->flags & HANDLER_PARALLEL) ||
+	    !(b->hnd->flags & HANDLER_PARALLEL))
+		return true;
+	if ((a->hnd->flags & HANDLER_MTD) && (b->hnd->flags & HANDLER_MTD))
+		return true;
+
+	/* the same target, or one reads what the other writes */
+	if (same_string(x->device, y->device) ||
+	    same_string(x->volname, y->volname) ||
+	    same_string(x->source, y->device) ||
+	    same_string(y->source, x->device))
+		return true;
+
+	/* devices are mounted always on the same directory */
+	if (strlen(x->filesystem) && strlen(y->filesystem))
+		return true;
+
+	return false;
+}
+
+/* This must be called with the lock held */
+static struct install_job *next_ready_job(struct install_sched *s)
+{
+	unsigned int i, j;
+
+	for (i = s->next; i < s->njobs; i++) {
+		if (s->jobs[i].state != JOB_PENDING)
+			continue;
+		for (j = 0; j < i; j++) {
+			if (s->jobs[j].state != JOB_DONE &&
+			    jobs_conflict(&s->jobs[j], &s->jobs[i]))
+				break;
+		}
+		if (j == i)
+			return &s->jobs[i];
+		/* a barrier blocks everything after it */
+		if (!s->jobs[i].hnd ||
+		    !(s->jobs[i].hnd->flags & HANDLER_PARALLEL))
+			break;
+	}
+
+	return NULL;
+}
+
+static void *install_worker(void *data)
+{
+	struct install_sched *s = (struct install_sched *)data;
+	struct install_job *job;
+	int fd = s->fdsw;
+	int ret;
+
+	if (s->reopen) {
+		fd = reopen_file(s->fdsw);
+		if (fd < 0) {
+			ERROR("Cannot reopen the update file: %s",
+				strerror(errno));
+			pthread_mutex_lock(&s->lock);
+			s->error = -EBADF;
+			copy_abort(1);
+			pthread_cond_broadcast(&s->cond);
+			pthread_mutex_unlock(&s->lock);
+			return NULL;
+		}
+	}
+
+	pthread_mutex_lock(&s->lock);
+	while (!s->error && s->next < s->njobs) {
+		job = next_ready_job(s);
+		if (!job) {
+			pthread_cond_wait(&s->cond, &s->lock);
+			continue;
+		}
+		job->state = JOB_RUNNING;
+		while (s->next < s->njobs && s->jobs[s->next].state != JOB_PENDING)
+			s->next++;
+		pthread_mutex_unlock(&s->lock);
+
+		ret = install_from_image_list(s->sw, job->img, fd, s->fromfile);
+
+		pthread_mutex_lock(&s->lock);
+		job->state = JOB_DONE;
+		if (ret && !s->error) {
+			s->error = ret;
+			copy_abort(1);
+		}
+		pthread_cond_broadcast(&s->cond);
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	if (s->reopen)
+		close(fd);
+
+	return NULL;
+}
+
+static int install_image_list(struct swupdate_cfg *sw, int fdsw, int fromfile)
+{
+	struct install_sched s;
+	struct img_type *img;
+	pthread_t threads[CONFIG_PARALLEL_INSTALL_WORKERS];
+	unsigned int nthreads, i;
+
+	memset(&s, 0, sizeof(s));
+	s.sw = sw;
+	s.fdsw = fdsw;
+	s.fromfile = fromfile;
+
+	LIST_FOREACH(img, &sw->images, next)
+		s.njobs++;
+	s.jobs = (struct install_job *)calloc(s.njobs ? s.njobs : 1,
+			sizeof(*s.jobs));
+	if (!s.jobs)
+		return -ENOMEM;
+
+	s.njobs = 0;
+	LIST_FOREACH(img, &sw->images, next) {
+		if (!image_to_install(img, fromfile))
+			continue;
+		s.jobs[s.njobs].img = img;
+		s.jobs[s.njobs].hnd = find_handler(img);
+		s.njobs++;
+	}
+
+	pthread_mutex_init(&s.lock, NULL);
+	pthread_cond_init(&s.cond, NULL);
+
+	nthreads = min(s.njobs, (unsigned int)CONFIG_PARALLEL_INSTALL_WORKERS);
+	if (fromfile && nthreads > 1) {
+		int fd = reopen_file(fdsw);
+
+		if (fd < 0) {
+			WARN("Update file cannot be reopened, images are installed sequentially");
+			nthreads = 1;
+		} else {
+			close(fd);
+			s.reopen = 1;
+		}
+	}
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, install_worker, &s)) {
+			ERROR("Cannot start installer thread");
+			pthread_mutex_lock(&s.lock);
+			s.error = -EAGAIN;
+			copy_abort(1);
+			pthread_cond_broadcast(&s.cond);
+			pthread_mutex_unlock(&s.lock);
+			break;
+		}
+	}
+	while (i > 0)
+		pthread_join(threads[--i], NULL);
+	copy_abort(0);
+
+	pthread_cond_destroy(&s.cond);
+	pthread_mutex_destroy(&s.lock);
+	free(s.jobs);
+
+	return s.error;
+}
+#else
+static int install_image_list(struct swupdate_cfg *sw, int fdsw, int fromfile)
+{
+	struct img_type *img;
+	int ret;
+
+	LIST_FOREACH(img, &sw->images, next) {
+		if (!image_to_install(img, fromfile))
+			continue;
+
+		ret = install_from_image_list(sw, img, fdsw, fromfile);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+#endif
+
 /*
  * streamfd: file descriptor if it is required to extract
  *           images from the stream (update from file)
@@ -249,10 +562,6 @@ int install_single_image(struct img_type *img)
 int install_images(struct swupdate_cfg *sw, int fdsw, int fromfile)
 {
 	int ret;
-	struct img_type *img;
-	char filename[64];
-	struct filehdr fdh;
-	struct stat buf;
 	const char* TMPDIR = get_tmpdir();
 
 	/* Extract all scripts, preinstall scripts must be run now */
@@ -279,62 +588,9 @@ int install_images(struct swupdate_cfg *sw, int fdsw, int fromfile)
 		return ret;
 	}
 
-	LIST_FOREACH(img, &sw->images, next) {
-
-		/*
-		 *  If image is flagged to be installed from stream
-		 *  it  was already installed by loading the
-		 *  .swu image and it is skipped here.
-		 *  This does not make sense when installed from file,
-		 *  because images are seekd (no streaming)
-		 */
-		if (!fromfile && img->install_directly)
-			continue;
-
-		if (!fromfile) {
-			if (snprintf(filename, sizeof(filename), "%s%s",
-				     TMPDIR, img->fname) >= (int)sizeof(filename)) {
-				ERROR("Path too long: %s%s", TMPDIR, img->fname);
-				return -1;
-			}
-
-			ret = stat(filename, &buf);
-			if (ret) {
-				TRACE("%s not found or wrong", filename);
-				return -1;
-			}
-			img->size = buf.st_size;
-
-			img->fdin = open(filename, O_RDONLY);
-			if (img->fdin < 0) {
-				ERROR("Image %s cannot be opened",
-				img->fname);
-				return -1;
-			}
-		} else {
-			if (extract_img_from_cpio(fdsw, img->offset, &fdh) < 0)
-				return -1;
-			img->size = fdh.size;
-			img->checksum = fdh.chksum;
-			img->fdin = fdsw;
-
-			/*
-			 * Skip if the image in the same version is already
-			 * installed
-			 */
-			if (isImageInstalled(&sw->installed_sw_list, img))
-				continue;
-		}
-
-		ret = install_single_image(img);
-
-		if (!fromfile)
-			close(img->fdin);
-
-		if (ret)
-			return ret;
-
-	}
+	ret = install_image_list(sw, fdsw, fromfile);
+	if (ret)
+		return ret;
 
 	ret = run_prepost_scripts(sw, POSTINSTALL);
 	if (ret) {
@@ -385,6 +641,8 @@ void cleanup_files(struct swupdate_cfg *software) {
 	struct hw_type *hw;
 	const char* TMPDIR = get_tmpdir();
 
+	spool_clear();
+
 	LIST_FOREACH(img, &software->images, next) {
 		if (img->fname[0]) {
 			if (snprintf(fn, sizeof(fn), "%s%s", TMPDIR,
@@ -0,0 +1,259 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+/*
+ * Batching of the data sent to the installer. The callbacks
+ * of libcurl get a few KB at a time, sending each of them is a
+ * system call and a wake up of the installer.
+ *
+ * Without a thread the data is copied into one buffer. The
+ * chunk that does not fit is sent with it by writev(), without
+ * copying it, and a chunk as large as the buffer is not copied
+ * at all.
+ *
+ * With a thread, the chunks are copied into a ring of buffers.
+ * A full buffer is queued, the thread sends all queued buffers
+ * with one writev() while the receiver fills the next one: a
+ * slow installer does not stop the download until the ring is
+ * full.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "util.h"
+#include "network_ipc.h"
+#include "ipc_batch.h"
+
+struct ipc_batch {
+	int fd;
+	int error;			/* sticky, 0 or -EIO */
+	bool thread;
+	char *buf[IPC_BATCH_BUFFERS];
+	size_t len[IPC_BATCH_BUFFERS];
+
+	/*
+	 * Thread: buf[send] is the oldest of the queued buffers,
+	 * buf[(send + queued) % IPC_BATCH_BUFFERS] is being filled.
+	 * Without a thread only buf[0] is used.
+	 */
+	unsigned int send;
+	unsigned int queued;
+	bool stop;
+	pthread_t forwarder;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static void *forward_thread(void *data)
+{
+	struct ipc_batch *b = (struct ipc_batch *)data;
+	struct iovec iov[IPC_BATCH_BUFFERS];
+	unsigned int i, n, idx;
+	int error;
+
+	pthread_mutex_lock(&b->lock);
+	for (;;) {
+		while (!b->queued && !b->stop)
+			pthread_cond_wait(&b->cond, &b->lock);
+		if (!b->queued)
+			break;
+
+		/* the queued buffers are not touched by the receiver */
+		n = b->queued;
+		for (i = 0; i < n; i++) {
+			idx = (b->send + i) % IPC_BATCH_BUFFERS;
+			iov[i].iov_base = b->buf[idx];
+			iov[i].iov_len = b->len[idx];
+		}
+		error = b->error;
+		pthread_mutex_unlock(&b->lock);
+
+		/* after an error the data is dropped */
+		if (!error && ipc_send_datav(b->fd, iov, n) < 0)
+			error = -EIO;
+
+		pthread_mutex_lock(&b->lock);
+		for (i = 0; i < n; i++)
+			b->len[(b->send + i) % IPC_BATCH_BUFFERS] = 0;
+		b->send = (b->send + n) % IPC_BATCH_BUFFERS;
+		b->queued -= n;
+		b->error = error;
+		pthread_cond_broadcast(&b->cond);
+	}
+	pthread_mutex_unlock(&b->lock);
+
+	return NULL;
+}
+
+struct ipc_batch *ipc_batch_new(int fd, bool thread)
+{
+	struct ipc_batch *b;
+	unsigned int i, n = thread ? IPC_BATCH_BUFFERS : 1;
+
+	b = (struct ipc_batch *)calloc(1, sizeof(*b));
+	if (!b)
+		return NULL;
+	b->fd = fd;
+	b->thread = thread;
+	for (i = 0; i < n; i++) {
+		b->buf[i] = (char *)malloc(IPC_BATCH_SIZE);
+		if (!b->buf[i])
+			goto fail;
+	}
+
+	if (thread) {
+		pthread_mutex_init(&b->lock, NULL);
+		pthread_cond_init(&b->cond, NULL);
+		if (pthread_create(&b->forwarder, NULL, forward_thread, b)) {
+			ERROR("Cannot start the forward thread");
+			pthread_cond_destroy(&b->cond);
+			pthread_mutex_destroy(&b->lock);
+			goto fail;
+		}
+	}
+
+	return b;
+
+fail:
+	for (i = 0; i < n; i++)
+		free(b->buf[i]);
+	free(b);
+	return NULL;
+}
+
+static int send_direct(struct ipc_batch *b, const void *buf, size_t len)
+{
+	struct iovec iov[2];
+	int n = 0;
+
+	if (b->len[0]) {
+		iov[n].iov_base = b->buf[0];
+		iov[n++].iov_len = b->len[0];
+	}
+	if (len) {
+		iov[n].iov_base = (void *)buf;
+		iov[n++].iov_len = len;
+	}
+	b->len[0] = 0;
+	if (n && ipc_send_datav(b->fd, iov, n) < 0)
+		b->error = -EIO;
+
+	return b->error;
+}
+
+/* Queue the buffer being filled, the lock is held */
+static void queue_buffer(struct ipc_batch *b)
+{
+	b->queued++;
+	pthread_cond_broadcast(&b->cond);
+	while (b->queued == IPC_BATCH_BUFFERS)
+		pthread_cond_wait(&b->cond, &b->lock);
+}
+
+static int write_thread(struct ipc_batch *b, const char *buf, size_t len)
+{
+	unsigned int fill;
+	size_t n;
+	int error;
+
+	pthread_mutex_lock(&b->lock);
+	while (len && !b->error) {
+		fill = (b->send + b->queued) % IPC_BATCH_BUFFERS;
+		n = min(len, IPC_BATCH_SIZE - b->len[fill]);
+
+		/* the copy does not need the lock, fill is only ours */
+		pthread_mutex_unlock(&b->lock);
+		memcpy(b->buf[fill] + b->len[fill], buf, n);
+		b->len[fill] += n;
+		buf += n;
+		len -= n;
+		pthread_mutex_lock(&b->lock);
+
+		if (b->len[fill] == IPC_BATCH_SIZE)
+			queue_buffer(b);
+	}
+	error = b->error;
+	pthread_mutex_unlock(&b->lock);
+
+	return error;
+}
+
+int ipc_batch_write(struct ipc_batch *b, const void *buf, size_t len)
+{
+	if (b->thread)
+		return write_thread(b, (const char *)buf, len);
+
+	if (b->error)
+		return b->error;
+	if (b->len[0] + len < IPC_BATCH_SIZE) {
+		memcpy(b->buf[0] + b->len[0], buf, len);
+		b->len[0] += len;
+		return 0;
+	}
+
+	return send_direct(b, buf, len);
+}
+
+int ipc_batch_flush(struct ipc_batch *b)
+{
+	unsigned int fill;
+	int error;
+
+	if (!b->thread)
+		return b->error ? b->error : send_direct(b, NULL, 0);
+
+	pthread_mutex_lock(&b->lock);
+	fill = (b->send + b->queued) % IPC_BATCH_BUFFERS;
+	if (b->len[fill])
+		queue_buffer(b);
+	while (b->queued)
+		pthread_cond_wait(&b->cond, &b->lock);
+	error = b->error;
+	pthread_mutex_unlock(&b->lock);
+
+	return error;
+}
+
+int ipc_batch_close(struct ipc_batch *b)
+{
+	unsigned int i;
+	int error;
+
+	error = ipc_batch_flush(b);
+
+	if (b->thread) {
+		pthread_mutex_lock(&b->lock);
+		b->stop = true;
+		pthread_cond_broadcast(&b->cond);
+		pthread_mutex_unlock(&b->lock);
+		pthread_join(b->forwarder, NULL);
+		pthread_cond_destroy(&b->cond);
+		pthread_mutex_destroy(&b->lock);
+	}
+	for (i = 0; i < IPC_BATCH_BUFFERS; i++)
+		free(b->buf[i]);
+	free(b);
+
+	return error;
+}
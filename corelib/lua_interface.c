@@ -22,12 +22,14 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <unistd.h>
 #include "lua.h"
 #include "lauxlib.h"
 #include "lualib.h"
 #include "lua_util.h"
 #include "util.h"
 #include "handler.h"
+#include "decompress.h"
 
 #define LUA_PUSH_IMG_STRING(img, attr, field)  do { \
 	lua_pushstring(L, attr);		\
@@ -200,6 +202,12 @@ static void lua_string_to_img(struct img_type *img, const char *key,
 			sizeof(img->filesystem));
 	if (!strcmp(key, "sha256"))
 		ascii_to_hash(img->sha256, value);
+	if (!strcmp(key, "sha256-tree"))
+		ascii_to_hash(img->tree_sha256, value);
+	if (!strcmp(key, "compressed") && get_compression_type(value) >= 0)
+		img->compressed = get_compression_type(value);
+	if (!strcmp(key, "encrypted") && get_cipher_type(value) >= 0)
+		img->is_encrypted = get_cipher_type(value);
 
 	if (!strncmp(key, offset, sizeof(offset))) {
 		strncpy(seek_str, value,
@@ -237,6 +245,8 @@ static void lua_number_to_img(struct img_type *img, const char *key,
 {
 	if (!strcmp(key, "offset"))
 		img->seek = (unsigned long long)val;
+	if (!strcmp(key, "hash-chunk-size"))
+		img->hash_chunk_size = (int)val;
 
 }
 
@@ -254,10 +264,22 @@ static void image2table(lua_State* L, struct img_type *img) {
 		LUA_PUSH_IMG_STRING(img, "data", type_data);
 		LUA_PUSH_IMG_STRING(img, "filesystem", filesystem);
 
-		LUA_PUSH_IMG_BOOL(img, "compressed", compressed);
+		/* a boolean for zlib, the name of the compression otherwise */
+		if (img->compressed > COMPRESSED_ZLIB) {
+			lua_pushstring(L, "compressed");
+			lua_pushstring(L, get_compression_name(img->compressed));
+			lua_settable(L, -3);
+		} else
+			LUA_PUSH_IMG_BOOL(img, "compressed", compressed);
 		LUA_PUSH_IMG_BOOL(img, "installed_directly", install_directly);
 		LUA_PUSH_IMG_BOOL(img, "install_if_different", id.install_if_different);
-		LUA_PUSH_IMG_BOOL(img, "encrypted", is_encrypted);
+		/* a boolean for CBC, the name of the cipher otherwise */
+		if (img->is_encrypted > CIPHER_AES_CBC) {
+			lua_pushstring(L, "encrypted");
+			lua_pushstring(L, get_cipher_name(img->is_encrypted));
+			lua_settable(L, -3);
+		} else
+			LUA_PUSH_IMG_BOOL(img, "encrypted", is_encrypted);
 		LUA_PUSH_IMG_BOOL(img, "partition", is_partitioner);
 		LUA_PUSH_IMG_BOOL(img, "script", is_script);
 
@@ -419,6 +441,17 @@ static int l_handler_wrapper(struct img_type *img, void *data) {
 		res = extract_next_file(img->fdin, fdout, img->offset, 0,
 					 img->is_encrypted, img->sha256);
 	}
+#ifdef CONFIG_SPOOL
+	/*
+	 * the image was staged in the spool, but Lua
+	 * gets the name of the file
+	 */
+	else if (!img->install_directly && access(img->extract_file, F_OK)) {
+		fdout = openfileoutput(img->extract_file);
+		res = copyimage(&fdout, img, NULL);
+		close(fdout);
+	}
+#endif
 
 	l_func_ref = *((int*)data);
 	/* get the callback function */
@@ -463,7 +496,9 @@ static int l_register_handler( lua_State *L ) {
 		*l_func_ref = luaL_ref (L, LUA_REGISTRYINDEX);
 		/* pop the arguments from the stack */
 		lua_pop (L, 2);
-		register_handler(handler_desc,l_handler_wrapper,l_func_ref);
+		/* images are extracted with their sha256 only */
+		register_handler_flags(handler_desc, l_handler_wrapper,
+				       l_func_ref, HANDLER_RAW_INPUT);
 		return 0;
 	}
 }
@@ -0,0 +1,155 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+/*
+ * Counters of the copy path: for each stage the number of
+ * calls, the bytes, the time and a histogram of the latency
+ * of a call. They are updated with relaxed atomics and no
+ * lock, the cost of a call is two reads of the monotonic
+ * clock (vDSO) and a few atomic additions. A snapshot is
+ * not consistent between fields, that is fine for counters.
+ * After metrics_init(), they are in shared memory: the
+ * subprocesses forked later (webserver, downloader,
+ * suricatta) add to the same counters, so that the sends
+ * on the IPC are seen by GET_METRICS.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "util.h"
+#include "metrics.h"
+
+struct metric_counter {
+	unsigned long long calls;
+	unsigned long long bytes;
+	unsigned long long nsec;
+	unsigned long long hist[IPC_METRICS_BUCKETS];
+};
+
+static struct metric_counter local_counters[METRIC_STAGES];
+static struct metric_counter *counters = local_counters;
+
+static const char *stage_names[METRIC_STAGES] = {
+	[METRIC_READ] = "read",
+	[METRIC_CHECKSUM] = "checksum",
+	[METRIC_HASH] = "hash",
+	[METRIC_DECRYPT] = "decrypt",
+	[METRIC_DECOMPRESS] = "decompress",
+	[METRIC_WRITE] = "write",
+	[METRIC_INSTALL] = "install",
+	[METRIC_IPC_SEND] = "ipc-send",
+};
+
+void metrics_init(void)
+{
+	void *p;
+
+	if (counters != local_counters)
+		return;
+
+	p = mmap(NULL, sizeof(local_counters), PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		WARN("Counters cannot be shared, subprocesses are not counted");
+		return;
+	}
+	memcpy(p, local_counters, sizeof(local_counters));
+	counters = (struct metric_counter *)p;
+}
+
+unsigned long long metrics_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned int metrics_bucket(unsigned long long nsec)
+{
+	unsigned long long us = nsec / 1000;
+	unsigned int b;
+
+	/* bucket b: less than 2^b us */
+	b = us ? 64 - __builtin_clzll(us) : 0;
+
+	return min(b, (unsigned int)(IPC_METRICS_BUCKETS - 1));
+}
+
+void metrics_add_nsec(metric_stage stage, unsigned long long nsec,
+		unsigned long long bytes)
+{
+	struct metric_counter *c;
+
+	if (stage >= METRIC_STAGES)
+		return;
+
+	c = &counters[stage];
+	__atomic_fetch_add(&c->calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->nsec, nsec, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->hist[metrics_bucket(nsec)], 1, __ATOMIC_RELAXED);
+}
+
+void metrics_add(metric_stage stage, unsigned long long start,
+		unsigned long long bytes)
+{
+	metrics_add_nsec(stage, metrics_now() - start, bytes);
+}
+
+void metrics_get(struct ipc_metric *m, unsigned int nstages)
+{
+	unsigned int i, j;
+
+	memset(m, 0, nstages * sizeof(*m));
+	for (i = 0; i < min(nstages, (unsigned int)METRIC_STAGES); i++) {
+		strncpy(m[i].name, stage_names[i], sizeof(m[i].name) - 1);
+		m[i].calls = __atomic_load_n(&counters[i].calls, __ATOMIC_RELAXED);
+		m[i].bytes = __atomic_load_n(&counters[i].bytes, __ATOMIC_RELAXED);
+		m[i].nsec = __atomic_load_n(&counters[i].nsec, __ATOMIC_RELAXED);
+		for (j = 0; j < IPC_METRICS_BUCKETS; j++)
+			m[i].hist[j] = __atomic_load_n(&counters[i].hist[j],
+							__ATOMIC_RELAXED);
+	}
+}
+
+void metrics_reset(void)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < METRIC_STAGES; i++) {
+		__atomic_store_n(&counters[i].calls, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&counters[i].bytes, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&counters[i].nsec, 0, __ATOMIC_RELAXED);
+		for (j = 0; j < IPC_METRICS_BUCKETS; j++)
+			__atomic_store_n(&counters[i].hist[j], 0,
+					__ATOMIC_RELAXED);
+	}
+}
+
+const char *metrics_stage_name(metric_stage stage)
+{
+	if (stage >= METRIC_STAGES)
+		return "unknown";
+
+	return stage_names[stage];
+}
@@ -39,9 +39,13 @@ static char mtd_ubi_blacklist[100] = { 0 };
  * Note: the functions here are derived directly
  * with minor changes from mtd-utils.
  */
-#define EMPTY_BYTE	0xFF
 
 int flash_erase(int mtdnum)
+{
+	return flash_erase_from(mtdnum, 0);
+}
+
+int flash_erase_from(int mtdnum, unsigned int eb_start)
 {
 	int fd;
 	char mtd_device[80];
@@ -49,7 +53,7 @@ int flash_erase(int mtdnum)
 	int noskipbad = 0;
 	int unlock = 0;
 	int ret = 0;
-	unsigned int eb, eb_start, eb_cnt, i;
+	unsigned int eb, eb_cnt, i;
 	uint8_t *buf;
 	struct flash_description *flash = get_flash_info();
 
@@ -66,7 +70,7 @@ int flash_erase(int mtdnum)
 	}
 
 	/*
-	 * prepare to erase all of the MTD partition,
+	 * prepare to erase the MTD partition from eb_start,
 	 */
 	buf = (uint8_t *)malloc(mtd->eb_size);
 	if (!buf) {
@@ -76,9 +80,9 @@ int flash_erase(int mtdnum)
 		return -ENOMEM;
 	}
 
-	eb_start = 0;
-	eb_cnt = (mtd->size / mtd->eb_size) - eb_start;
-	for (eb = 0; eb < eb_start + eb_cnt; eb++) {
+	eb_cnt = (mtd->size / mtd->eb_size);
+	eb_cnt = eb_start < eb_cnt ? eb_cnt - eb_start : 0;
+	for (eb = eb_start; eb < eb_start + eb_cnt; eb++) {
 
 		/* Always skip bad sectors */
 		if (!noskipbad) {
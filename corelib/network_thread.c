@@ -30,10 +30,12 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "bsdqueue.h"
 #include "util.h"
@@ -42,6 +44,8 @@
 #include "installer.h"
 #include "swupdate.h"
 #include "pctl.h"
+#include "metrics.h"
+#include "spool.h"
 #include "generated/autoconf.h"
 
 #define LISTENQ	1024
@@ -49,9 +53,104 @@
 #define NUM_CACHED_MESSAGES 100
 #define DEFAULT_INTERNAL_TIMEOUT 60
 
+/*
+ * The control socket is served by an event loop: requests
+ * of several clients are read and answered without
+ * blocking, and a request for a subprocess waits for its
+ * answer without stopping the other clients. stream_mutex
+ * is taken only to read or change the state of the
+ * installer.
+ */
+enum ctrl_kind {
+	CTRL_LISTEN,
+	CTRL_WAKE,
+	CTRL_CONN,
+	CTRL_CHAN,
+};
+
+enum conn_state {
+	CONN_READ,	/* reading the request */
+	CONN_WAIT,	/* waiting for a subprocess */
+	CONN_WRITE,	/* writing the answer */
+	CONN_EVENTS,	/* subscribed, sending events */
+};
+
+/* An ipc_event and its description, ready to be sent */
+struct sub_event {
+	SIMPLEQ_ENTRY(sub_event) next;
+	size_t len;
+	char frame[];
+};
+
+SIMPLEQ_HEAD(eventlist, sub_event);
+
+struct ctrl_chan;
+
+struct ctrl_conn {
+	enum ctrl_kind kind;
+	SIMPLEQ_ENTRY(ctrl_conn) next;
+	int fd;
+	enum conn_state state;
+	size_t len;		/* bytes of msg read or written */
+	ipc_message msg;
+	struct ctrl_chan *chan;	/* CONN_WAIT */
+	unsigned long long deadline;	/* ms, CLOCK_MONOTONIC */
+
+	/* subscribers, the queue is protected by msglock */
+	bool subscribed;
+	SIMPLEQ_ENTRY(ctrl_conn) subnext;
+	struct eventlist events;
+	unsigned int nevents;
+	struct sub_event *out;	/* being sent */
+	bool pollout;
+};
+
+SIMPLEQ_HEAD(connlist, ctrl_conn);
+
+/*
+ * Clients that subscribed get each notification as it is
+ * sent, instead of polling with GET_STATUS. The notifier
+ * queues the events and wakes up the network thread, that
+ * writes them without blocking. A client that does not
+ * read loses the oldest events.
+ */
+static struct {
+	struct connlist conns;
+	int wakefd;
+	struct installer *instp;
+} subscribers = {
+	.conns = SIMPLEQ_HEAD_INITIALIZER(subscribers.conns),
+	.wakefd = -1,
+};
+
+/*
+ * Pipe to a subprocess: its answers are not tagged, so
+ * there is one request at a time and the others wait.
+ */
+struct ctrl_chan {
+	enum ctrl_kind kind;
+	SIMPLEQ_ENTRY(ctrl_chan) next;
+	int pipe;
+	bool dead;
+	struct ctrl_conn *busy;	/* waiting for the answer */
+	struct connlist pending;
+	size_t len;
+	ipc_message answer;
+};
+
+SIMPLEQ_HEAD(chanlist, ctrl_chan);
+
+struct ctrl_server {
+	int epfd;
+	struct installer *instp;
+	struct chanlist chans;
+	struct connlist closed;	/* freed after each batch */
+};
+
 struct msg_elem {
 	RECOVERY_STATUS status;
 	int error;
+	size_t size;		/* room in msg */
 	char *msg;
 	SIMPLEQ_ENTRY(msg_elem) next;
 };
@@ -60,49 +159,160 @@ SIMPLEQ_HEAD(msglist, msg_elem);
 static struct msglist notifymsgs;
 static unsigned long nrmsgs = 0;
 
+/*
+ * Elements are recycled: a notification reuses the oldest
+ * one if the list is full, or one already read, and is
+ * allocated only if it does not fit.
+ */
+#define MSG_ELEM_MIN_SIZE	256
+static struct msglist freemsgs = SIMPLEQ_HEAD_INITIALIZER(freemsgs);
+static unsigned long nrfree = 0;
+
 static pthread_mutex_t msglock = PTHREAD_MUTEX_INITIALIZER;
 
-static void clean_msg(char *msg, char drop)
+/* Replace tabs and line breaks with blanks */
+static void clean_msg(char *msg)
 {
 	char *lfpos;
-	lfpos = strchr(msg, drop);
-	while (lfpos) {
+
+	for (lfpos = strpbrk(msg, "\t\n\r"); lfpos;
+	     lfpos = strpbrk(lfpos + 1, "\t\n\r"))
 		*lfpos = ' ';
-		lfpos = strchr(msg, drop);
+}
+
+static struct sub_event *make_event(int current, int last_result, int error,
+				    const char *desc)
+{
+	size_t len = desc ? strlen(desc) : 0;
+	struct sub_event *ev;
+	ipc_event hdr;
+
+	/* it must fit into an answer to GET_STATUS */
+	len = min(len, sizeof(((msgdata *)0)->status.desc) - 1);
+	ev = (struct sub_event *)malloc(sizeof(*ev) + sizeof(hdr) + len);
+	if (!ev)
+		return NULL;
+
+	hdr.magic = IPC_MAGIC;
+	hdr.current = current;
+	hdr.last_result = last_result;
+	hdr.error = error;
+	hdr.len = (unsigned int)len;
+	memcpy(ev->frame, &hdr, sizeof(hdr));
+	if (len)
+		memcpy(ev->frame + sizeof(hdr), desc, len);
+	ev->len = sizeof(hdr) + len;
+
+	return ev;
+}
+
+/* This must be called after acquiring msglock */
+static void queue_event(struct ctrl_conn *conn, struct sub_event *ev)
+{
+	struct sub_event *old;
+
+	if (conn->nevents == NUM_CACHED_MESSAGES) {
+		old = SIMPLEQ_FIRST(&conn->events);
+		SIMPLEQ_REMOVE_HEAD(&conn->events, next);
+		free(old);
+		conn->nevents--;
 	}
+	SIMPLEQ_INSERT_TAIL(&conn->events, ev, next);
+	conn->nevents++;
 }
 
-static void network_notifier(RECOVERY_STATUS status, int error, const char *msg)
+/* This must be called after acquiring msglock */
+static void notify_subscribers(RECOVERY_STATUS status, int error,
+			       const char *msg)
 {
-	int len = msg ? strlen(msg) : 0;
-	struct msg_elem *newmsg = (struct msg_elem *)calloc(1, sizeof(*newmsg) + len + 1);
-	struct msg_elem *oldmsg;
+	struct ctrl_conn *conn;
+	struct sub_event *ev;
+	uint64_t one = 1;
+	int last_result;
 
-	if (!newmsg)
+	if (SIMPLEQ_EMPTY(&subscribers.conns))
 		return;
 
-	pthread_mutex_lock(&msglock);
-	nrmsgs++;
-	if (nrmsgs > NUM_CACHED_MESSAGES) {
-		oldmsg = SIMPLEQ_FIRST(&notifymsgs);
+	/*
+	 * Not read under stream_mutex: notifiers can run with it
+	 * held. The installer sets the result before notifying.
+	 */
+	last_result = subscribers.instp ? subscribers.instp->last_install : IDLE;
+
+	SIMPLEQ_FOREACH(conn, &subscribers.conns, subnext) {
+		ev = make_event(status, last_result, error, msg);
+		if (!ev)
+			break;
+		queue_event(conn, ev);
+	}
+
+	/* it fails only if a wake up is already pending */
+	if (write(subscribers.wakefd, &one, sizeof(one)) < 0)
+		return;
+}
+
+/* This must be called after acquiring msglock */
+static void put_msg_elem(struct msg_elem *elem)
+{
+	if (nrfree >= NUM_CACHED_MESSAGES) {
+		free(elem);
+		return;
+	}
+	SIMPLEQ_INSERT_TAIL(&freemsgs, elem, next);
+	nrfree++;
+}
+
+/* This must be called after acquiring msglock */
+static struct msg_elem *get_msg_elem(size_t len)
+{
+	struct msg_elem *elem = NULL;
+	size_t size;
+
+	if (nrmsgs >= NUM_CACHED_MESSAGES) {
+		elem = SIMPLEQ_FIRST(&notifymsgs);
 		SIMPLEQ_REMOVE_HEAD(&notifymsgs, next);
-		free(oldmsg);
 		nrmsgs--;
+	} else if (!SIMPLEQ_EMPTY(&freemsgs)) {
+		elem = SIMPLEQ_FIRST(&freemsgs);
+		SIMPLEQ_REMOVE_HEAD(&freemsgs, next);
+		nrfree--;
 	}
-	newmsg->msg = (char *)newmsg + sizeof(struct msg_elem);
+	if (elem && elem->size > len)
+		return elem;
+	free(elem);
 
-	newmsg->status = status;
-	newmsg->error = error;
+	size = max(len + 1, (size_t)MSG_ELEM_MIN_SIZE);
+	elem = (struct msg_elem *)malloc(sizeof(*elem) + size);
+	if (!elem)
+		return NULL;
+	elem->size = size;
+	elem->msg = (char *)elem + sizeof(struct msg_elem);
 
-	if (msg) {
-		strncpy(newmsg->msg, msg, len);
-		clean_msg(newmsg->msg, '\t');
-		clean_msg(newmsg->msg, '\n');
-		clean_msg(newmsg->msg, '\r');
+	return elem;
+}
+
+static void network_notifier(RECOVERY_STATUS status, int error, const char *msg)
+{
+	size_t len = msg ? strlen(msg) : 0;
+	struct msg_elem *newmsg;
+
+	pthread_mutex_lock(&msglock);
+	newmsg = get_msg_elem(len);
+	if (!newmsg) {
+		pthread_mutex_unlock(&msglock);
+		return;
 	}
 
+	newmsg->status = status;
+	newmsg->error = error;
+
+	memcpy(newmsg->msg, msg ? msg : "", len);
+	newmsg->msg[len] = '\0';
+	clean_msg(newmsg->msg);
 
 	SIMPLEQ_INSERT_TAIL(&notifymsgs, newmsg, next);
+	nrmsgs++;
+	notify_subscribers(status, error, newmsg->msg);
 	pthread_mutex_unlock(&msglock);
 }
 
@@ -142,53 +352,748 @@ static void cleanum_msg_list(void)
 	while (!SIMPLEQ_EMPTY(&notifymsgs)) {
 		notification = SIMPLEQ_FIRST(&notifymsgs);
 		SIMPLEQ_REMOVE_HEAD(&notifymsgs, next);
-		free(notification);
+		put_msg_elem(notification);
 	}
 	nrmsgs = 0;
 	pthread_mutex_unlock(&msglock);
 }
 
-static void empty_pipe(int fd)
+static unsigned long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void unlink_socket(void)
+{
+	unlink((char*)CONFIG_SOCKET_CTRL_PATH);
+}
+
+static void chan_next(struct ctrl_server *srv, struct ctrl_chan *chan);
+
+static void close_conn(struct ctrl_server *srv, struct ctrl_conn *conn)
+{
+	struct ctrl_chan *chan = conn->chan;
+	struct sub_event *ev;
+
+	if (conn->fd < 0)
+		return;
+
+	if (chan) {
+		conn->chan = NULL;
+		if (chan->busy == conn) {
+			/*
+			 * The next request is forwarded. The pipe has no
+			 * request id: if the answer to this one comes
+			 * later, it is taken as the answer to the next.
+			 */
+			chan->busy = NULL;
+			chan_next(srv, chan);
+		} else {
+			SIMPLEQ_REMOVE(&chan->pending, conn, ctrl_conn, next);
+		}
+	}
+	if (conn->subscribed) {
+		pthread_mutex_lock(&msglock);
+		SIMPLEQ_REMOVE(&subscribers.conns, conn, ctrl_conn, subnext);
+		while (!SIMPLEQ_EMPTY(&conn->events)) {
+			ev = SIMPLEQ_FIRST(&conn->events);
+			SIMPLEQ_REMOVE_HEAD(&conn->events, next);
+			free(ev);
+		}
+		pthread_mutex_unlock(&msglock);
+		free(conn->out);
+		conn->out = NULL;
+		conn->subscribed = false;
+	}
+	epoll_ctl(srv->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	close(conn->fd);
+	conn->fd = -1;
+	SIMPLEQ_INSERT_TAIL(&srv->closed, conn, next);
+}
+
+static void set_events(struct ctrl_server *srv, struct ctrl_conn *conn,
+			uint32_t events)
+{
+	struct epoll_event ev;
+
+	ev.events = events;
+	ev.data.ptr = conn;
+	epoll_ctl(srv->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+static void set_pollout(struct ctrl_server *srv, struct ctrl_conn *conn,
+			bool on)
+{
+	if (conn->pollout == on)
+		return;
+	set_events(srv, conn, EPOLLIN | (on ? EPOLLOUT : 0));
+	conn->pollout = on;
+}
+
+/* Send the queued events until the socket is full */
+static void flush_events(struct ctrl_server *srv, struct ctrl_conn *conn)
+{
+	ssize_t n;
+
+	for (;;) {
+		if (!conn->out) {
+			pthread_mutex_lock(&msglock);
+			conn->out = SIMPLEQ_FIRST(&conn->events);
+			if (conn->out) {
+				SIMPLEQ_REMOVE_HEAD(&conn->events, next);
+				conn->nevents--;
+			}
+			pthread_mutex_unlock(&msglock);
+			if (!conn->out) {
+				set_pollout(srv, conn, false);
+				return;
+			}
+			conn->len = 0;
+		}
+
+		n = send(conn->fd, conn->out->frame + conn->len,
+			 conn->out->len - conn->len, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			set_pollout(srv, conn, true);
+			return;
+		}
+		if (n <= 0) {
+			close_conn(srv, conn);
+			return;
+		}
+		conn->len += (size_t)n;
+		if (conn->len == conn->out->len) {
+			free(conn->out);
+			conn->out = NULL;
+		}
+	}
+}
+
+/* Write the answer, the connection is closed when it is sent */
+static void write_answer(struct ctrl_server *srv, struct ctrl_conn *conn)
+{
+	ssize_t n;
+
+	while (conn->len < sizeof(conn->msg)) {
+		n = send(conn->fd, (char *)&conn->msg + conn->len,
+			 sizeof(conn->msg) - conn->len,
+			 MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			set_pollout(srv, conn, true);
+			return;
+		}
+		if (n <= 0) {
+			TRACE("Error write on socket ctrl");
+			close_conn(srv, conn);
+			return;
+		}
+		conn->len += (size_t)n;
+	}
+
+	if (conn->subscribed && conn->msg.type == ACK) {
+		conn->state = CONN_EVENTS;
+		conn->out = NULL;
+		flush_events(srv, conn);
+		return;
+	}
+	close_conn(srv, conn);
+}
+
+static void answer(struct ctrl_server *srv, struct ctrl_conn *conn)
+{
+	conn->state = CONN_WRITE;
+	conn->len = 0;
+	conn->chan = NULL;
+	write_answer(srv, conn);
+}
+
+static void nack(struct ctrl_server *srv, struct ctrl_conn *conn)
+{
+	conn->msg.type = NACK;
+	answer(srv, conn);
+}
+
+/* Discard what a subprocess sent when nobody was waiting */
+static void drain_chan(struct ctrl_chan *chan)
 {
-	fd_set fds;
-	int ret;
 	ipc_message msg;
-	struct timeval tv;
 
-	do {
-		FD_ZERO(&fds);
-		FD_SET(fd, &fds);
-		tv.tv_sec = 0;
-		tv.tv_usec = 10000; /* Check for not more as 10 mSec */
-		ret = select(fd + 1, &fds, NULL, NULL, &tv);
-		if (ret <= 0 || !FD_ISSET(fd, &fds))
-			break;
+	while (recv(chan->pipe, &msg, sizeof(msg), MSG_DONTWAIT) > 0)
+		;
+	chan->len = 0;
+}
+
+/* Forward the next waiting request to the subprocess */
+static void chan_next(struct ctrl_server *srv, struct ctrl_chan *chan)
+{
+	struct ctrl_conn *conn;
+	ssize_t ret;
+
+	while (!chan->busy && !SIMPLEQ_EMPTY(&chan->pending)) {
+		conn = SIMPLEQ_FIRST(&chan->pending);
+		SIMPLEQ_REMOVE_HEAD(&chan->pending, next);
+
+		if (chan->dead) {
+			nack(srv, conn);
+			continue;
+		}
+
 		/*
-		 * simply read to drop old messages
+		 * Cleanup the queue to be sure there are not
+		 * outstanding messages
 		 */
-		if (read(fd, &msg, sizeof(msg)) < 0)
-			break;
-	} while (1);
+		drain_chan(chan);
+
+		ret = send(chan->pipe, &conn->msg, sizeof(conn->msg),
+			   MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (ret != sizeof(conn->msg)) {
+			ERROR("Writing to pipe failed !");
+			nack(srv, conn);
+			continue;
+		}
+		chan->busy = conn;
+	}
 }
 
-static void unlink_socket(void)
+static struct ctrl_chan *get_chan(struct ctrl_server *srv, int pipe)
 {
-	unlink((char*)CONFIG_SOCKET_CTRL_PATH);
+	struct ctrl_chan *chan;
+	struct epoll_event ev;
+
+	SIMPLEQ_FOREACH(chan, &srv->chans, next) {
+		if (chan->pipe == pipe)
+			return chan;
+	}
+
+	chan = (struct ctrl_chan *)calloc(1, sizeof(*chan));
+	if (!chan)
+		return NULL;
+	chan->kind = CTRL_CHAN;
+	chan->pipe = pipe;
+	SIMPLEQ_INIT(&chan->pending);
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = chan;
+	if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, pipe, &ev) < 0) {
+		free(chan);
+		return NULL;
+	}
+	SIMPLEQ_INSERT_TAIL(&srv->chans, chan, next);
+
+	return chan;
+}
+
+static void chan_event(struct ctrl_server *srv, struct ctrl_chan *chan,
+			uint32_t events)
+{
+	struct ctrl_conn *conn;
+	ssize_t n;
+
+	if (!(events & EPOLLIN) && (events & (EPOLLERR | EPOLLHUP))) {
+		ERROR("Pipe to subprocess closed: %d", chan->pipe);
+		epoll_ctl(srv->epfd, EPOLL_CTL_DEL, chan->pipe, NULL);
+		chan->dead = true;
+		if (chan->busy)
+			nack(srv, chan->busy);
+		chan->busy = NULL;
+		chan_next(srv, chan);
+		return;
+	}
+
+	n = recv(chan->pipe, (char *)&chan->answer + chan->len,
+		 sizeof(chan->answer) - chan->len, MSG_DONTWAIT);
+	if (n <= 0) {
+		if (n == 0 || (errno != EAGAIN && errno != EINTR))
+			chan_event(srv, chan, EPOLLHUP);
+		return;
+	}
+	chan->len += (size_t)n;
+	if (chan->len < sizeof(chan->answer))
+		return;
+	chan->len = 0;
+
+	conn = chan->busy;
+	if (!conn) {
+		/* nobody waits for this answer */
+		chan_next(srv, chan);
+		return;
+	}
+	chan->busy = NULL;
+
+	/*
+	 * ACK/NACK was inserted by the called SUBPROCESS
+	 * It should not be touched here
+	 */
+	conn->msg = chan->answer;
+	answer(srv, conn);
+	chan_next(srv, chan);
+}
+
+/*
+ * Answer with NACK the requests whose subprocess is too
+ * slow, and return the ms until the next deadline.
+ */
+static int check_timeouts(struct ctrl_server *srv)
+{
+	struct ctrl_chan *chan;
+	struct ctrl_conn *conn, *tmp;
+	unsigned long long now = now_ms();
+	unsigned long long next = 0;
+
+	SIMPLEQ_FOREACH(chan, &srv->chans, next) {
+		SIMPLEQ_FOREACH_SAFE(conn, &chan->pending, next, tmp) {
+			if (conn->deadline <= now) {
+				SIMPLEQ_REMOVE(&chan->pending, conn,
+					       ctrl_conn, next);
+				nack(srv, conn);
+			} else if (!next || conn->deadline < next) {
+				next = conn->deadline;
+			}
+		}
+
+		conn = chan->busy;
+		if (conn && conn->deadline <= now) {
+			chan->busy = NULL;
+			nack(srv, conn);
+			chan_next(srv, chan);
+			conn = chan->busy;
+		}
+		if (conn && (!next || conn->deadline < next))
+			next = conn->deadline;
+	}
+
+	return next ? (int)(next - now) : -1;
+}
+
+static void forward_request(struct ctrl_server *srv, struct ctrl_conn *conn)
+{
+	struct ctrl_chan *chan;
+	int pipe, timeout;
+
+	/*
+	 *  this request is not for the installer,
+	 *  but for one of the subprocesses
+	 *  forward the request without checking
+	 *  the payload
+	 */
+	pipe = pctl_getfd_from_type(conn->msg.data.instmsg.source);
+	if (pipe < 0) {
+		ERROR("Cannot find channel for requested process");
+		nack(srv, conn);
+		return;
+	}
+	TRACE("Received Message for %s",
+		pctl_getname_from_type(conn->msg.data.instmsg.source));
+	if (fcntl(pipe, F_GETFL) < 0 && errno == EBADF) {
+		ERROR("Pipe not available or closed: %d", pipe);
+		nack(srv, conn);
+		return;
+	}
+
+	chan = get_chan(srv, pipe);
+	if (!chan) {
+		nack(srv, conn);
+		return;
+	}
+
+	/*
+	 * Do not wait forever for an answer.
+	 * If a message requires more time,
+	 * the destination process should sent an
+	 * answer back explaining this in the payload
+	 */
+	timeout = conn->msg.data.instmsg.timeout;
+	if (timeout <= 0)
+		timeout = DEFAULT_INTERNAL_TIMEOUT;
+	conn->deadline = now_ms() + (unsigned long long)timeout * 1000;
+	conn->state = CONN_WAIT;
+	conn->chan = chan;
+	SIMPLEQ_INSERT_TAIL(&chan->pending, conn, next);
+	chan_next(srv, chan);
+}
+
+/*
+ * Post-update actions running. No installation is started
+ * until they are done: they can reboot or switch the boot
+ * partition under it. Protected by stream_mutex.
+ */
+static unsigned int postupdates;
+
+static void *postupdate_thread(void *data)
+{
+	static pthread_mutex_t postupdate_lock = PTHREAD_MUTEX_INITIALIZER;
+	struct ctrl_conn *conn = (struct ctrl_conn *)data;
+	ipc_message *msg = &conn->msg;
+
+	pthread_mutex_lock(&postupdate_lock);
+	if (postupdate(get_swupdate_cfg(),
+		       msg->data.instmsg.len > 0 ? msg->data.instmsg.buf : NULL) == 0) {
+		msg->type = ACK;
+		sprintf(msg->data.msg, "Post-update actions successfully executed.");
+	} else {
+		msg->type = NACK;
+		sprintf(msg->data.msg, "Post-update actions failed.");
+	}
+	pthread_mutex_unlock(&postupdate_lock);
+
+	pthread_mutex_lock(&stream_mutex);
+	postupdates--;
+	pthread_mutex_unlock(&stream_mutex);
+
+	if (write(conn->fd, msg, sizeof(*msg)) != sizeof(*msg))
+		TRACE("Error write on socket ctrl");
+	close(conn->fd);
+	free(conn);
+
+	return NULL;
+}
+
+/*
+ * Post-update actions can run for a long time, the
+ * connection is handed over to a thread. Installation
+ * requests are refused until they are done.
+ */
+static void run_postupdate(struct ctrl_server *srv, struct ctrl_conn *conn)
+{
+	pthread_attr_t attr;
+	pthread_t id;
+	int ret;
+
+	epoll_ctl(srv->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) & ~O_NONBLOCK);
+
+	pthread_mutex_lock(&stream_mutex);
+	postupdates++;
+	pthread_mutex_unlock(&stream_mutex);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	ret = pthread_create(&id, &attr, postupdate_thread, conn);
+	pthread_attr_destroy(&attr);
+	if (ret) {
+		ERROR("Cannot run post-update actions");
+		pthread_mutex_lock(&stream_mutex);
+		postupdates--;
+		pthread_mutex_unlock(&stream_mutex);
+		conn->msg.type = NACK;
+		sprintf(conn->msg.data.msg, "Post-update actions failed.");
+		if (write(conn->fd, &conn->msg, sizeof(conn->msg)) < 0)
+			TRACE("Error write on socket ctrl");
+		close(conn->fd);
+		free(conn);
+	}
+}
+
+/*
+ * The installer reads the image from the connection:
+ * the ACK is written before it is woken up.
+ */
+static void start_install(struct ctrl_server *srv, struct ctrl_conn *conn)
+{
+	struct installer *instp = srv->instp;
+	ipc_message *msg = &conn->msg;
+
+	TRACE("Incoming network request: processing...");
+	pthread_mutex_lock(&stream_mutex);
+	if (instp->status != IDLE) {
+		pthread_mutex_unlock(&stream_mutex);
+		msg->type = NACK;
+		sprintf(msg->data.msg, "Installation in progress");
+		answer(srv, conn);
+		return;
+	}
+	if (postupdates) {
+		pthread_mutex_unlock(&stream_mutex);
+		msg->type = NACK;
+		sprintf(msg->data.msg, "Post-update in progress");
+		answer(srv, conn);
+		return;
+	}
+
+	epoll_ctl(srv->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) & ~O_NONBLOCK);
+
+	instp->fd = conn->fd;
+	instp->source = msg->data.instmsg.source;
+	instp->len = min(msg->data.instmsg.len, sizeof(instp->info));
+	memcpy(instp->info, msg->data.instmsg.buf, instp->len);
+
+	/*
+	 * Prepare answer
+	 */
+	msg->type = ACK;
+	if (write(conn->fd, msg, sizeof(*msg)) < 0)
+		TRACE("Error write on socket ctrl");
+
+	/* Drop all old notification from last run */
+	cleanum_msg_list();
+
+	/* Wake-up the installer */
+	pthread_cond_signal(&stream_wkup);
+	pthread_mutex_unlock(&stream_mutex);
+
+	/* the installer owns the socket now */
+	conn->fd = -1;
+	SIMPLEQ_INSERT_TAIL(&srv->closed, conn, next);
+}
+
+static void get_status(struct ctrl_server *srv, ipc_message *msg)
+{
+	struct installer *instp = srv->instp;
+	struct msg_elem *notification;
+
+	msg->type = GET_STATUS;
+	memset(msg->data.msg, 0, sizeof(msg->data.msg));
+	pthread_mutex_lock(&stream_mutex);
+	msg->data.status.current = instp->status;
+	msg->data.status.last_result = instp->last_install;
+	msg->data.status.error = instp->last_error;
+	pthread_mutex_unlock(&stream_mutex);
+
+	/* Get first notification from the queue */
+	pthread_mutex_lock(&msglock);
+	notification = SIMPLEQ_FIRST(&notifymsgs);
+	if (notification) {
+		SIMPLEQ_REMOVE_HEAD(&notifymsgs, next);
+		nrmsgs--;
+		strncpy(msg->data.status.desc, notification->msg,
+			sizeof(msg->data.status.desc) - 1);
+#ifdef DEBUG_IPC
+		printf("GET STATUS: %s\n", msg->data.status.desc);
+#endif
+		msg->data.status.current = notification->status;
+		msg->data.status.error = notification->error;
+		put_msg_elem(notification);
+	}
+	pthread_mutex_unlock(&msglock);
+}
+
+/*
+ * A new subscriber gets the notifications of the running or
+ * last update, that GET_STATUS would return, and then the
+ * current status.
+ */
+static void subscribe(struct ctrl_server *srv, struct ctrl_conn *conn)
+{
+	struct installer *instp = srv->instp;
+	struct msg_elem *notification;
+	struct sub_event *ev;
+	int current, last_result, error;
+
+	SIMPLEQ_INIT(&conn->events);
+
+	pthread_mutex_lock(&stream_mutex);
+	current = instp->status;
+	last_result = instp->last_install;
+	error = instp->last_error;
+
+	pthread_mutex_lock(&msglock);
+	SIMPLEQ_FOREACH(notification, &notifymsgs, next) {
+		ev = make_event(notification->status, last_result,
+				notification->error, notification->msg);
+		if (ev)
+			queue_event(conn, ev);
+	}
+	ev = make_event(current, last_result, error, NULL);
+	if (ev)
+		queue_event(conn, ev);
+	SIMPLEQ_INSERT_TAIL(&subscribers.conns, conn, subnext);
+	conn->subscribed = true;
+	pthread_mutex_unlock(&msglock);
+	pthread_mutex_unlock(&stream_mutex);
+
+	memset(&conn->msg.data, 0, sizeof(conn->msg.data));
+	conn->msg.type = ACK;
+}
+
+static void wake_subscribers(struct ctrl_server *srv)
+{
+	struct ctrl_conn *conn, *tmp;
+	uint64_t val;
+
+	if (read(subscribers.wakefd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+		TRACE("Cannot read wake up event");
+
+	/*
+	 * Subscribers are added and removed only by this thread,
+	 * the list can be walked without the lock
+	 */
+	SIMPLEQ_FOREACH_SAFE(conn, &subscribers.conns, subnext, tmp) {
+		if (conn->state == CONN_EVENTS && !conn->pollout)
+			flush_events(srv, conn);
+	}
+}
+
+#ifdef CONFIG_METRICS
+static void get_metrics(ipc_message *msg)
+{
+	struct spool_stats st;
+	int reset = msg->data.metrics.reset;
+
+	memset(&msg->data, 0, sizeof(msg->data));
+	msg->data.metrics.nstages = METRIC_STAGES;
+	metrics_get(msg->data.metrics.stage, IPC_METRICS_STAGES);
+	spool_get_stats(&st);
+	msg->data.metrics.spool_mem_peak = st.mem_peak;
+	msg->data.metrics.spool_disk_peak = st.disk_peak;
+	msg->data.metrics.notify_dropped = notify_get_dropped();
+	if (reset)
+		metrics_reset();
+}
+#endif
+
+static void handle_request(struct ctrl_server *srv, struct ctrl_conn *conn)
+{
+	ipc_message *msg = &conn->msg;
+
+#ifdef DEBUG_IPC
+	TRACE("request header: magic[0x%08X] type[0x%08X]", msg->magic, msg->type);
+#endif
+
+	if (msg->magic != IPC_MAGIC) {
+		/* Wrong request */
+		msg->type = NACK;
+		sprintf(msg->data.msg, "Wrong request: aborting");
+		answer(srv, conn);
+		return;
+	}
+
+	switch (msg->type) {
+	case POST_UPDATE:
+		run_postupdate(srv, conn);
+		return;
+	case SWUPDATE_SUBPROCESS:
+		forward_request(srv, conn);
+		return;
+	case REQ_INSTALL:
+		start_install(srv, conn);
+		return;
+	case GET_STATUS:
+		get_status(srv, msg);
+		break;
+	case SUBSCRIBE:
+		subscribe(srv, conn);
+		break;
+#ifdef CONFIG_METRICS
+	case GET_METRICS:
+		get_metrics(msg);
+		break;
+#endif
+	default:
+		msg->type = NACK;
+	}
+	answer(srv, conn);
+}
+
+static void conn_event(struct ctrl_server *srv, struct ctrl_conn *conn,
+			uint32_t events)
+{
+	char discard[64];
+	ssize_t n;
+
+	if (conn->fd < 0)
+		return;
+
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		close_conn(srv, conn);
+		return;
+	}
+
+	if ((events & EPOLLOUT) && conn->state == CONN_WRITE) {
+		write_answer(srv, conn);
+		return;
+	}
+
+	if ((events & EPOLLOUT) && conn->state == CONN_EVENTS) {
+		flush_events(srv, conn);
+		return;
+	}
+
+	if (!(events & EPOLLIN))
+		return;
+
+	if (conn->state != CONN_READ) {
+		/* nothing more is expected, just notice a close */
+		n = recv(conn->fd, discard, sizeof(discard), MSG_DONTWAIT);
+		if (n == 0)
+			close_conn(srv, conn);
+		return;
+	}
+
+	n = recv(conn->fd, (char *)&conn->msg + conn->len,
+		 sizeof(conn->msg) - conn->len, MSG_DONTWAIT);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (n <= 0) {
+		if (conn->len)
+			TRACE("IPC message too short: fragmentation not supported");
+		close_conn(srv, conn);
+		return;
+	}
+	conn->len += (size_t)n;
+	if (conn->len == sizeof(conn->msg))
+		handle_request(srv, conn);
+}
+
+static void accept_conn(struct ctrl_server *srv, int ctrllisten)
+{
+	struct ctrl_conn *conn;
+	struct epoll_event ev;
+	int fd;
+
+	fd = accept4(ctrllisten, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) {
+		if (errno != EINTR && errno != EAGAIN)
+			TRACE("Accept returns: %s", strerror(errno));
+		return;
+	}
+
+	conn = (struct ctrl_conn *)calloc(1, sizeof(*conn));
+	if (!conn) {
+		ERROR("Out of memory, skipping...");
+		close(fd);
+		return;
+	}
+	conn->kind = CTRL_CONN;
+	conn->fd = fd;
+	conn->state = CONN_READ;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = conn;
+	if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		close(fd);
+		free(conn);
+	}
+}
+
+static void free_closed(struct ctrl_server *srv)
+{
+	struct ctrl_conn *conn;
+
+	while (!SIMPLEQ_EMPTY(&srv->closed)) {
+		conn = SIMPLEQ_FIRST(&srv->closed);
+		SIMPLEQ_REMOVE_HEAD(&srv->closed, next);
+		free(conn);
+	}
 }
 
 void *network_thread (void *data)
 {
 	struct installer *instp = (struct installer *)data;
-	int ctrllisten, ctrlconnfd;
-	socklen_t clilen;
-	struct sockaddr_un cliaddr;
-	ipc_message msg;
-	int nread;
-	struct msg_elem *notification;
-	int ret;
-	int pipe;
-	fd_set pipefds;
-	struct timeval tv;
+	static enum ctrl_kind listen_tag = CTRL_LISTEN;
+	static enum ctrl_kind wake_tag = CTRL_WAKE;
+	struct ctrl_server srv;
+	struct epoll_event ev, events[16];
+	int ctrllisten, nfds, i, timeout;
+	enum ctrl_kind *kind;
 
 	if (!instp) {
 		TRACE("Fatal error: Network thread aborting...");
@@ -196,6 +1101,12 @@ void *network_thread (void *data)
 	}
 
 	SIMPLEQ_INIT(&notifymsgs);
+	subscribers.instp = instp;
+	subscribers.wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (subscribers.wakefd < 0) {
+		TRACE("Cannot set up the control socket, exiting.");
+		exit(2);
+	}
 	register_notifier(network_notifier);
 
 	/* Initialize and bind to UDS */
@@ -210,176 +1121,51 @@ void *network_thread (void *data)
 			  (char*)CONFIG_SOCKET_CTRL_PATH);
 	}
 
-	do {
-		clilen = sizeof(cliaddr);
-		if ( (ctrlconnfd = accept(ctrllisten, (struct sockaddr *) &cliaddr, &clilen)) < 0) {
-			if (errno == EINTR)
-				continue;
-			else {
-				TRACE("Accept returns: %s", strerror(errno));
-				continue;
-			}
-		}
-		nread = read(ctrlconnfd, (void *)&msg, sizeof(msg));
+	memset(&srv, 0, sizeof(srv));
+	srv.instp = instp;
+	SIMPLEQ_INIT(&srv.chans);
+	SIMPLEQ_INIT(&srv.closed);
+	srv.epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (srv.epfd < 0) {
+		TRACE("Cannot set up the control socket, exiting.");
+		exit(2);
+	}
+	fcntl(ctrllisten, F_SETFL, fcntl(ctrllisten, F_GETFL) | O_NONBLOCK);
+	ev.events = EPOLLIN;
+	ev.data.ptr = &listen_tag;
+	epoll_ctl(srv.epfd, EPOLL_CTL_ADD, ctrllisten, &ev);
+	ev.data.ptr = &wake_tag;
+	epoll_ctl(srv.epfd, EPOLL_CTL_ADD, subscribers.wakefd, &ev);
 
-		if (nread != sizeof(msg)) {
-			TRACE("IPC message too short: fragmentation not supported");
-			close(ctrlconnfd);
+	do {
+		timeout = check_timeouts(&srv);
+		nfds = epoll_wait(srv.epfd, events, ARRAY_SIZE(events), timeout);
+		if (nfds < 0) {
+			if (errno != EINTR)
+				TRACE("epoll_wait returns: %s", strerror(errno));
 			continue;
 		}
-#ifdef DEBUG_IPC
-		TRACE("request header: magic[0x%08X] type[0x%08X]", msg.magic, msg.type);
-#endif
 
-		pthread_mutex_lock(&stream_mutex);
-		if (msg.magic == IPC_MAGIC)  {
-			switch (msg.type) {
-			case POST_UPDATE:
-				if (postupdate(get_swupdate_cfg(),
-							   msg.data.instmsg.len > 0 ? msg.data.instmsg.buf : NULL) == 0) {
-					msg.type = ACK;
-					sprintf(msg.data.msg, "Post-update actions successfully executed.");
-				} else {
-					msg.type = NACK;
-					sprintf(msg.data.msg, "Post-update actions failed.");
-				}
+		for (i = 0; i < nfds; i++) {
+			kind = (enum ctrl_kind *)events[i].data.ptr;
+			switch (*kind) {
+			case CTRL_LISTEN:
+				accept_conn(&srv, ctrllisten);
 				break;
-			case SWUPDATE_SUBPROCESS:
-				/*
-				 *  this request is not for the installer,
-				 *  but for one of the subprocesses
-				 *  forward the request without checking
-				 *  the payload
-				 */
-			       
-				pipe = pctl_getfd_from_type(msg.data.instmsg.source);
-				if (pipe < 0) {
-					ERROR("Cannot find channel for requested process");
-					msg.type = NACK;
-					break;
-				}
-				TRACE("Received Message for %s",
-					pctl_getname_from_type(msg.data.instmsg.source));
-				if (fcntl(pipe, F_GETFL) < 0 && errno == EBADF) {
-					ERROR("Pipe not available or closed: %d", pipe);
-					msg.type = NACK;
-					break;
-				}
-
-				/*
-				 * Cleanup the queue to be sure there are not
-				 * outstanding messages
-				 */
-				empty_pipe(pipe);
-
-				ret = write(pipe, &msg, sizeof(msg));
-				if (ret != sizeof(msg)) {
-					ERROR("Writing to pipe failed !");
-					msg.type = NACK;
-					break;
-				}
-
-				/*
-				 * Do not block forever for an answer
-				 * This would block the whole thread
-				 * If a message requires more time,
-				 * the destination process should sent an
-				 * answer back explaining this in the payload
-				 */
-				FD_ZERO(&pipefds);
-				FD_SET(pipe, &pipefds);
-				tv.tv_usec = 0;
-				if (!msg.data.instmsg.timeout)
-					tv.tv_sec = DEFAULT_INTERNAL_TIMEOUT;
-				else
-					tv.tv_sec = msg.data.instmsg.timeout;
-				ret = select(pipe + 1, &pipefds, NULL, NULL, &tv);
-
-				/*
-				 * If there is an error or timeout,
-				 * send a NACK back
-				 */
-				if (ret <= 0 || !FD_ISSET(pipe, &pipefds)) {
-					msg.type = NACK;
-					break;
-				}
-
-				ret = read(pipe, &msg, sizeof(msg));
-				if (ret != sizeof(msg)) {
-					ERROR("Reading from pipe failed !");
-					msg.type = NACK;
-					break;
-				}
-
-				/*
-				 * ACK/NACK was inserted by the called SUBPROCESS
-				 * It should not be touched here
-				 */
-
+			case CTRL_WAKE:
+				wake_subscribers(&srv);
 				break;
-			case REQ_INSTALL:
-				TRACE("Incoming network request: processing...");
-				if (instp->status == IDLE) {
-					instp->fd = ctrlconnfd;
-					instp->source = msg.data.instmsg.source;
-					instp->len = min(msg.data.instmsg.len, sizeof(instp->info));
-					memcpy(instp->info, msg.data.instmsg.buf,
-						instp->len);
-
-					/*
-					 * Prepare answer
-					 */
-					msg.type = ACK;
-
-					/* Drop all old notification from last run */
-					cleanum_msg_list();
-
-					/* Wake-up the installer */
-					pthread_cond_signal(&stream_wkup);
-				} else {
-					msg.type = NACK;
-					sprintf(msg.data.msg, "Installation in progress");
-				}
+			case CTRL_CONN:
+				conn_event(&srv, (struct ctrl_conn *)kind,
+					   events[i].events);
 				break;
-			case GET_STATUS:
-				msg.type = GET_STATUS;
-				memset(msg.data.msg, 0, sizeof(msg.data.msg));
-				msg.data.status.current = instp->status;
-				msg.data.status.last_result = instp->last_install;
-				msg.data.status.error = instp->last_error;
-
-				/* Get first notification from the queue */
-				pthread_mutex_lock(&msglock);
-				notification = SIMPLEQ_FIRST(&notifymsgs);
-				if (notification) {
-					SIMPLEQ_REMOVE_HEAD(&notifymsgs, next);
-					nrmsgs--;
-					strncpy(msg.data.status.desc, notification->msg,
-						sizeof(msg.data.status.desc) - 1);
-#ifdef DEBUG_IPC
-					printf("GET STATUS: %s\n", msg.data.status.desc);
-#endif
-					msg.data.status.current = notification->status;
-					msg.data.status.error = notification->error;
-				}
-				pthread_mutex_unlock(&msglock);
-
+			case CTRL_CHAN:
+				chan_event(&srv, (struct ctrl_chan *)kind,
+					   events[i].events);
 				break;
-			default:
-				msg.type = NACK;
 			}
-		} else {
-			/* Wrong request */
-			msg.type = NACK;
-			sprintf(msg.data.msg, "Wrong request: aborting");
 		}
-		ret = write(ctrlconnfd, &msg, sizeof(msg));
-		if (ret < 0)
-			printf("Error write on socket ctrl");
-
-		if (msg.type != ACK)
-			close(ctrlconnfd);
-		pthread_mutex_unlock(&stream_mutex);
+		free_closed(&srv);
 	} while (1);
 	return (void *)0; 
 }
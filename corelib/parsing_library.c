@@ -132,11 +132,17 @@ int exist_field_string(parsertype p, void *e, const char *path)
 }
 
 void get_hash_value(parsertype p, void *elem, unsigned char *hash)
+{
+	get_named_hash_value(p, elem, "sha256", hash);
+}
+
+void get_named_hash_value(parsertype p, void *elem, const char *name,
+		unsigned char *hash)
 {
 	char hash_ascii[80];
 
 	memset(hash_ascii, 0, sizeof(hash_ascii));
-	GET_FIELD_STRING(p, elem, "sha256", hash_ascii);
+	GET_FIELD_STRING(p, elem, name, hash_ascii);
 
 	ascii_to_hash(hash, hash_ascii);
 }
@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
@@ -31,6 +32,8 @@
 #include <sys/stat.h>
 #include <sys/un.h>
 #include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <pthread.h>
@@ -43,56 +46,136 @@
 #include <progress.h>
 #include "generated/autoconf.h"
 
+/*
+ * Messages are not sent by the thread that reports the
+ * progress: they are queued for each client and the
+ * progress thread writes them without blocking. A percent
+ * update replaces the previous one if it was not sent yet,
+ * and a client that does not read loses the oldest updates
+ * instead of stopping the installer.
+ * A message is encoded when it leaves the queue, for a
+ * compact client against the last one it was sent.
+ */
+#define PROGRESS_QUEUE_LEN	8
+
 struct progress_conn {
 	SIMPLEQ_ENTRY(progress_conn) next;
 	int sockfd;
+	struct progress_msg queue[PROGRESS_QUEUE_LEN];
+	unsigned int head;
+	unsigned int count;
+	unsigned int version;	/* 0: struct progress_msg */
+	bool primed;		/* last is known to the client */
+	struct progress_msg last;
+	char out[PROGRESS_FRAME_MAX];
+	size_t outlen;
+	size_t sent;		/* bytes of out already sent */
+	bool pollout;		/* EPOLLOUT is armed */
+	unsigned long dropped;
 };
 
 SIMPLEQ_HEAD(connections, progress_conn);
 
-/*
- * Structure contains data regarding
- * current installation
- */
 struct swupdate_progress {
 	struct progress_msg msg;
 	char *current_image;
 	const handler *curhnd;
 	struct connections conns;
 	pthread_mutex_t lock;
-	bool step_running;
+	unsigned int steps;	/* steps started */
+	int wakefd;		/* eventfd, wakes up the progress thread */
 };
 static struct swupdate_progress progress;
 
+/*
+ * Images can be installed by several threads at the same
+ * time: each thread runs its own step, and a message
+ * reports the step of the thread that sends it.
+ */
+struct progress_step {
+	unsigned int nr;
+	unsigned int percent;
+	char image[sizeof(((struct progress_msg *)0)->cur_image)];
+	bool running;
+};
+static __thread struct progress_step cur_step;
+
+/* This must be called after acquiring the mutex */
+static void load_step(struct swupdate_progress *prbar)
+{
+	prbar->msg.cur_step = cur_step.nr;
+	prbar->msg.cur_percent = cur_step.percent;
+	strncpy(prbar->msg.cur_image, cur_step.image,
+		sizeof(prbar->msg.cur_image));
+}
+
+/* A pure percent update, it can be replaced by a newer one */
+static bool is_update(struct progress_msg *msg)
+{
+	return msg->status == RUN && !msg->infolen;
+}
+
+static void queue_remove(struct progress_conn *conn, unsigned int pos)
+{
+	unsigned int i, from, to;
+
+	/* shift the messages after pos by one */
+	for (i = pos; i < conn->count - 1; i++) {
+		to = (conn->head + i) % PROGRESS_QUEUE_LEN;
+		from = (conn->head + i + 1) % PROGRESS_QUEUE_LEN;
+		conn->queue[to] = conn->queue[from];
+	}
+	conn->count--;
+	conn->dropped++;
+}
+
+static void queue_msg(struct progress_conn *conn, struct progress_msg *msg)
+{
+	unsigned int i, last;
+
+	if (conn->count) {
+		last = (conn->head + conn->count - 1) % PROGRESS_QUEUE_LEN;
+		if (is_update(msg) && is_update(&conn->queue[last]) &&
+		    conn->queue[last].cur_step == msg->cur_step) {
+			conn->queue[last] = *msg;
+			return;
+		}
+	}
+
+	if (conn->count == PROGRESS_QUEUE_LEN) {
+		/* drop the oldest update, or the oldest message */
+		for (i = 0; i < conn->count; i++) {
+			unsigned int idx = (conn->head + i) % PROGRESS_QUEUE_LEN;
+			if (is_update(&conn->queue[idx]))
+				break;
+		}
+		if (i == conn->count)
+			i = 0;
+		queue_remove(conn, i);
+	}
+
+	conn->queue[(conn->head + conn->count) % PROGRESS_QUEUE_LEN] = *msg;
+	conn->count++;
+}
+
 /*
  * This must be called after acquiring the mutex
  * for the progress structure
  */
 static void send_progress_msg(void)
 {
-	struct progress_conn *conn, *tmp;
+	struct progress_conn *conn;
 	struct swupdate_progress *prbar = &progress;
-	void *buf;
-	size_t count;
-	ssize_t n;
+	uint64_t one = 1;
 
-	SIMPLEQ_FOREACH_SAFE(conn, &prbar->conns, next, tmp) {
-		buf = &prbar->msg;
-		count = sizeof(prbar->msg);
-		while (count > 0) {
-			n = send(conn->sockfd, buf, count, MSG_NOSIGNAL);
-			if (n <= 0) {
-				TRACE("A progress client disappeared, removing it.");
-				close(conn->sockfd);
-				SIMPLEQ_REMOVE(&prbar->conns, conn,
-					       	progress_conn, next);
-				free(conn);
-				break;
-			}
-			count -= (size_t)n;
-			buf = (char*)buf + n;
-		}
-	}
+	if (SIMPLEQ_EMPTY(&prbar->conns))
+		return;
+
+	SIMPLEQ_FOREACH(conn, &prbar->conns, next)
+		queue_msg(conn, &prbar->msg);
+
+	if (write(prbar->wakefd, &one, sizeof(one)) < 0)
+		TRACE("Cannot wake up the progress thread");
 }
 
 void swupdate_progress_init(unsigned int nsteps) {
@@ -101,6 +184,7 @@ void swupdate_progress_init(unsigned int nsteps) {
 
 	prbar->msg.nsteps = nsteps;
 	prbar->msg.cur_step = 0;
+	prbar->steps = 0;
 	prbar->msg.status = START;
 	prbar->msg.cur_percent = 0;
 	prbar->msg.infolen = get_install_info(&prbar->msg.source, prbar->msg.info,
@@ -115,8 +199,10 @@ void swupdate_progress_update(unsigned int perc)
 {
 	struct swupdate_progress *prbar = &progress;
 	pthread_mutex_lock(&prbar->lock);
-	if (perc != prbar->msg.cur_percent && prbar->step_running) {
-		prbar->msg.cur_percent = perc;
+	if (perc != cur_step.percent && cur_step.running) {
+		cur_step.percent = perc;
+		load_step(prbar);
+		prbar->msg.status = RUN;
 		send_progress_msg();
 	}
 	pthread_mutex_unlock(&prbar->lock);
@@ -126,10 +212,11 @@ void swupdate_progress_inc_step(char *image)
 {
 	struct swupdate_progress *prbar = &progress;
 	pthread_mutex_lock(&prbar->lock);
-	prbar->msg.cur_step++;
-	prbar->msg.cur_percent = 0;
-	strncpy(prbar->msg.cur_image, image, sizeof(prbar->msg.cur_image));
-	prbar->step_running = true;
+	cur_step.nr = ++prbar->steps;
+	cur_step.percent = 0;
+	strncpy(cur_step.image, image, sizeof(cur_step.image));
+	cur_step.running = true;
+	load_step(prbar);
 	prbar->msg.status = RUN;
 	send_progress_msg();
 	pthread_mutex_unlock(&prbar->lock);
@@ -139,7 +226,7 @@ void swupdate_progress_step_completed(void)
 {
 	struct swupdate_progress *prbar = &progress;
 	pthread_mutex_lock(&prbar->lock);
-	prbar->step_running = false;
+	cur_step.running = false;
 	prbar->msg.status = IDLE;
 	pthread_mutex_unlock(&prbar->lock);
 }
@@ -148,7 +235,7 @@ void swupdate_progress_end(RECOVERY_STATUS status)
 {
 	struct swupdate_progress *prbar = &progress;
 	pthread_mutex_lock(&prbar->lock);
-	prbar->step_running = false;
+	cur_step.running = false;
 	prbar->msg.status = status;
 	send_progress_msg();
 	pthread_mutex_unlock(&prbar->lock);
@@ -176,7 +263,7 @@ void swupdate_progress_done(const char *info)
 		snprintf(prbar->msg.info, sizeof(prbar->msg.info), "%s", info);
 		prbar->msg.infolen = strlen(prbar->msg.info);
 	}
-	prbar->step_running = false;
+	cur_step.running = false;
 	prbar->msg.status = DONE;
 	send_progress_msg();
 	prbar->msg.infolen = 0;
@@ -188,13 +275,235 @@ static void unlink_socket(void)
 	unlink((char*)CONFIG_SOCKET_PROGRESS_PATH);
 }
 
+/*
+ * A closed client can still have events in the current
+ * batch: it is freed after the batch.
+ */
+static struct connections closed_conns =
+	SIMPLEQ_HEAD_INITIALIZER(closed_conns);
+
+static void close_conn(int epfd, struct progress_conn *conn)
+{
+	struct swupdate_progress *prbar = &progress;
+
+	TRACE("A progress client disappeared, removing it.");
+	epoll_ctl(epfd, EPOLL_CTL_DEL, conn->sockfd, NULL);
+	close(conn->sockfd);
+	conn->sockfd = -1;
+	pthread_mutex_lock(&prbar->lock);
+	SIMPLEQ_REMOVE(&prbar->conns, conn, progress_conn, next);
+	pthread_mutex_unlock(&prbar->lock);
+	SIMPLEQ_INSERT_TAIL(&closed_conns, conn, next);
+}
+
+static void free_closed(void)
+{
+	struct progress_conn *conn;
+
+	while (!SIMPLEQ_EMPTY(&closed_conns)) {
+		conn = SIMPLEQ_FIRST(&closed_conns);
+		SIMPLEQ_REMOVE_HEAD(&closed_conns, next);
+		free(conn);
+	}
+}
+
+static void set_pollout(int epfd, struct progress_conn *conn, bool on)
+{
+	struct epoll_event ev;
+
+	if (conn->pollout == on)
+		return;
+	ev.events = EPOLLIN | EPOLLRDHUP | (on ? EPOLLOUT : 0);
+	ev.data.ptr = conn;
+	if (!epoll_ctl(epfd, EPOLL_CTL_MOD, conn->sockfd, &ev))
+		conn->pollout = on;
+}
+
+static char *put_field(char *p, uint8_t id, const void *data, size_t len)
+{
+	struct progress_field field = {
+		.id = id,
+		.len = (uint16_t)len,
+	};
+
+	memcpy(p, &field, sizeof(field));
+	memcpy(p + sizeof(field), data, len);
+
+	return p + sizeof(field) + len;
+}
+
+static char *put_number(char *p, uint8_t id, unsigned int val,
+			unsigned int old, bool primed)
+{
+	uint32_t v = val;
+
+	if (primed && val == old)
+		return p;
+
+	return put_field(p, id, &v, sizeof(v));
+}
+
+static char *put_string(char *p, uint8_t id, const char *s, size_t size,
+			const char *old, bool primed)
+{
+	size_t len = strnlen(s, size);
+
+	if (primed && !strncmp(s, old, size))
+		return p;
+
+	return put_field(p, id, s, len);
+}
+
+/* Compact frame with the fields changed since conn->last */
+static size_t encode_frame(struct progress_conn *conn,
+			   struct progress_msg *msg)
+{
+	struct progress_msg *old = &conn->last;
+	struct progress_frame frame = {
+		.magic = PROGRESS_MAGIC,
+		.version = (uint16_t)conn->version,
+	};
+	char *start = conn->out + sizeof(frame);
+	char *p = start;
+	bool primed = conn->primed;
+
+	p = put_number(p, PROGRESS_FIELD_STATUS, msg->status,
+		       old->status, primed);
+	p = put_number(p, PROGRESS_FIELD_DWL_PERCENT, msg->dwl_percent,
+		       old->dwl_percent, primed);
+	p = put_number(p, PROGRESS_FIELD_NSTEPS, msg->nsteps,
+		       old->nsteps, primed);
+	p = put_number(p, PROGRESS_FIELD_CUR_STEP, msg->cur_step,
+		       old->cur_step, primed);
+	p = put_number(p, PROGRESS_FIELD_CUR_PERCENT, msg->cur_percent,
+		       old->cur_percent, primed);
+	p = put_string(p, PROGRESS_FIELD_CUR_IMAGE, msg->cur_image,
+		       sizeof(msg->cur_image), old->cur_image, primed);
+	p = put_string(p, PROGRESS_FIELD_HND_NAME, msg->hnd_name,
+		       sizeof(msg->hnd_name), old->hnd_name, primed);
+	p = put_number(p, PROGRESS_FIELD_SOURCE, msg->source,
+		       old->source, primed);
+	if (msg->infolen)
+		p = put_field(p, PROGRESS_FIELD_INFO, msg->info,
+			      min((size_t)msg->infolen, sizeof(msg->info)));
+
+	frame.len = (uint16_t)(p - start);
+	memcpy(conn->out, &frame, sizeof(frame));
+	conn->last = *msg;
+	conn->primed = true;
+
+	return sizeof(frame) + frame.len;
+}
+
+/* Take the head of the queue into conn->out */
+static bool load_out(struct progress_conn *conn)
+{
+	struct swupdate_progress *prbar = &progress;
+	struct progress_msg *msg;
+
+	pthread_mutex_lock(&prbar->lock);
+	if (!conn->count) {
+		pthread_mutex_unlock(&prbar->lock);
+		return false;
+	}
+	msg = &conn->queue[conn->head];
+	if (conn->version) {
+		conn->outlen = encode_frame(conn, msg);
+	} else {
+		memcpy(conn->out, msg, sizeof(*msg));
+		conn->outlen = sizeof(*msg);
+	}
+	conn->head = (conn->head + 1) % PROGRESS_QUEUE_LEN;
+	conn->count--;
+	pthread_mutex_unlock(&prbar->lock);
+	conn->sent = 0;
+
+	return true;
+}
+
+/*
+ * Write the queue of a client until it is empty or the
+ * socket is full. conn->out is owned by this thread, the
+ * lock is not held while sending.
+ * Returns -1 if the client is gone.
+ */
+static int flush_conn(int epfd, struct progress_conn *conn)
+{
+	ssize_t n;
+
+	for (;;) {
+		if (conn->sent == conn->outlen && !load_out(conn)) {
+			set_pollout(epfd, conn, false);
+			return 0;
+		}
+
+		n = send(conn->sockfd, conn->out + conn->sent,
+			 conn->outlen - conn->sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n > 0)
+			conn->sent += (size_t)n;
+
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			set_pollout(epfd, conn, true);
+			return 0;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+	}
+}
+
+/*
+ * A client asks for the compact format with a hello, it is
+ * used from the next message that leaves the queue.
+ * Anything else from a client is discarded.
+ * Returns -1 if the client is gone.
+ */
+static int read_conn(struct progress_conn *conn)
+{
+	struct progress_hello hello;
+	char buf[64];
+	ssize_t n;
+
+	n = recv(conn->sockfd, buf, sizeof(buf), MSG_DONTWAIT);
+	if (n == 0)
+		return -1;
+	if (n < (ssize_t)sizeof(hello))
+		return 0;
+
+	memcpy(&hello, buf, sizeof(hello));
+	if (hello.magic == PROGRESS_MAGIC && hello.version && !conn->version) {
+		conn->version = min((unsigned int)hello.version,
+				    (unsigned int)PROGRESS_VERSION);
+		TRACE("Progress client uses version %u", conn->version);
+	}
+
+	return 0;
+}
+
+static void flush_all(int epfd)
+{
+	struct swupdate_progress *prbar = &progress;
+	struct progress_conn *conn, *tmp;
+
+	/*
+	 * Clients are added and removed only by this thread,
+	 * the list can be walked without the lock
+	 */
+	SIMPLEQ_FOREACH_SAFE(conn, &prbar->conns, next, tmp) {
+		if (!conn->pollout && flush_conn(epfd, conn) < 0)
+			close_conn(epfd, conn);
+	}
+}
+
 void *progress_bar_thread (void __attribute__ ((__unused__)) *data)
 {
-	int listen, connfd;
-	socklen_t clilen;
-	struct sockaddr_un cliaddr;
+	int listen, connfd, epfd, nfds, i;
 	struct swupdate_progress *prbar = &progress;
 	struct progress_conn *conn;
+	struct epoll_event ev, events[16];
+	static int listen_tag, wake_tag;
+	uint64_t val;
 
 	pthread_mutex_init(&prbar->lock, NULL);
 	SIMPLEQ_INIT(&prbar->conns);
@@ -211,28 +520,82 @@ void *progress_bar_thread (void __attribute__ ((__unused__)) *data)
 			  (char*)CONFIG_SOCKET_PROGRESS_PATH);
 	}
 
+	prbar->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (prbar->wakefd < 0 || epfd < 0) {
+		ERROR("Cannot set up the progress thread, exiting.");
+		exit(2);
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = &listen_tag;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, listen, &ev);
+	ev.data.ptr = &wake_tag;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, prbar->wakefd, &ev);
+
 	do {
-		clilen = sizeof(cliaddr);
-		if ( (connfd = accept(listen, (struct sockaddr *) &cliaddr, &clilen)) < 0) {
-			if (errno == EINTR)
+		nfds = epoll_wait(epfd, events, ARRAY_SIZE(events), -1);
+		if (nfds < 0) {
+			if (errno != EINTR)
+				TRACE("epoll_wait returns: %s", strerror(errno));
+			continue;
+		}
+
+		for (i = 0; i < nfds; i++) {
+			if (events[i].data.ptr == &wake_tag) {
+				if (read(prbar->wakefd, &val, sizeof(val)) < 0 &&
+				    errno != EAGAIN)
+					TRACE("Cannot read wake up event");
+				flush_all(epfd);
 				continue;
-			else {
-				TRACE("Accept returns: %s", strerror(errno));
+			}
+
+			if (events[i].data.ptr == &listen_tag) {
+				connfd = accept(listen, NULL, NULL);
+				if (connfd < 0) {
+					if (errno != EINTR)
+						TRACE("Accept returns: %s", strerror(errno));
+					continue;
+				}
+
+				/*
+				 * Save the new connection to be handled by the progress thread
+				 */
+				conn = (struct progress_conn *)calloc(1, sizeof(*conn));
+				if (!conn) {
+					ERROR("Out of memory, skipping...");
+					close(connfd);
+					continue;
+				}
+				conn->sockfd = connfd;
+				ev.events = EPOLLIN | EPOLLRDHUP;
+				ev.data.ptr = conn;
+				if (epoll_ctl(epfd, EPOLL_CTL_ADD, connfd, &ev) < 0) {
+					close(connfd);
+					free(conn);
+					continue;
+				}
+				pthread_mutex_lock(&prbar->lock);
+				SIMPLEQ_INSERT_TAIL(&prbar->conns, conn, next);
+				pthread_mutex_unlock(&prbar->lock);
 				continue;
 			}
-		}
 
-		/*
-		 * Save the new connection to be handled by the progress thread
-		 */
-		conn = (struct progress_conn *)calloc(1, sizeof(*conn));
-		if (!conn) {
-			ERROR("Out of memory, skipping...");
-			continue;
+			conn = (struct progress_conn *)events[i].data.ptr;
+			if (conn->sockfd < 0)
+				continue;
+			if (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+				close_conn(epfd, conn);
+				continue;
+			}
+			if ((events[i].events & EPOLLIN) &&
+			    read_conn(conn) < 0) {
+				close_conn(epfd, conn);
+				continue;
+			}
+			if ((events[i].events & EPOLLOUT) &&
+			    flush_conn(epfd, conn) < 0)
+				close_conn(epfd, conn);
 		}
-		conn->sockfd = connfd;
-		pthread_mutex_lock(&prbar->lock);
-		SIMPLEQ_INSERT_TAIL(&prbar->conns, conn, next);
-		pthread_mutex_unlock(&prbar->lock);
+		free_closed();
 	} while(1);
 }
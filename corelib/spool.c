@@ -0,0 +1,217 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+/*
+ * Staging of images received from the network. Files are
+ * kept in anonymous memory (memfd) while the total stays in
+ * CONFIG_SPOOL_MEM_BUDGET, else they are written to unnamed
+ * files in CONFIG_SPOOL_DIR. No file name is visible, so
+ * nothing is left behind if SWUpdate is killed.
+ * Handlers get a file descriptor as for a file in TMPDIR:
+ * a memfd can be mapped, and no further copy is done.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "generated/autoconf.h"
+#include "bsdqueue.h"
+#include "swupdate.h"
+#include "util.h"
+#include "spool.h"
+
+#define MODULE_NAME "spool"
+
+#define SPOOL_MEM_BUDGET	((unsigned long long)CONFIG_SPOOL_MEM_BUDGET * 1024 * 1024)
+
+struct spool_entry {
+	char fname[MAX_IMAGE_FNAME];
+	int fd;
+	unsigned long long size;
+	int in_memory;
+	LIST_ENTRY(spool_entry) next;
+};
+
+LIST_HEAD(spool_list, spool_entry);
+
+static struct spool_list spool = LIST_HEAD_INITIALIZER(spool);
+static struct spool_stats stats;	/* kept until the next update */
+static pthread_mutex_t spool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *spool_dir(void)
+{
+	return strlen(CONFIG_SPOOL_DIR) ? CONFIG_SPOOL_DIR : get_tmpdir();
+}
+
+static int spool_disk_file(void)
+{
+	char path[MAX_IMAGE_FNAME + 32];
+	int fd;
+
+	fd = open(spool_dir(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+	if (fd >= 0)
+		return fd;
+
+	/* filesystem without O_TMPFILE */
+	snprintf(path, sizeof(path), "%s/spoolXXXXXX", spool_dir());
+	fd = mkostemp(path, O_CLOEXEC);
+	if (fd < 0) {
+		ERROR("Cannot create a file in %s: %s", spool_dir(),
+			strerror(errno));
+		return -1;
+	}
+	unlink(path);
+
+	return fd;
+}
+
+int spool_create(const char *fname, unsigned long long size)
+{
+	struct spool_entry *entry;
+	int in_memory;
+
+	if (strlen(fname) >= sizeof(entry->fname))
+		return -EINVAL;
+
+	entry = (struct spool_entry *)calloc(1, sizeof(*entry));
+	if (!entry)
+		return -ENOMEM;
+
+	pthread_mutex_lock(&spool_lock);
+	if (LIST_EMPTY(&spool))
+		memset(&stats, 0, sizeof(stats));
+	in_memory = stats.mem_used + size <= SPOOL_MEM_BUDGET;
+	if (in_memory)
+		stats.mem_used += size;
+	pthread_mutex_unlock(&spool_lock);
+
+	entry->fd = -1;
+	if (in_memory) {
+		entry->fd = memfd_create(fname, MFD_CLOEXEC);
+		if (entry->fd < 0) {
+			pthread_mutex_lock(&spool_lock);
+			stats.mem_used -= size;
+			pthread_mutex_unlock(&spool_lock);
+			in_memory = 0;
+		}
+	}
+	if (entry->fd < 0)
+		entry->fd = spool_disk_file();
+	if (entry->fd < 0) {
+		free(entry);
+		return -1;
+	}
+
+	strcpy(entry->fname, fname);
+	entry->size = size;
+	entry->in_memory = in_memory;
+
+	pthread_mutex_lock(&spool_lock);
+	if (in_memory) {
+		stats.nmem++;
+		stats.mem_peak = max(stats.mem_peak, stats.mem_used);
+	} else {
+		stats.ndisk++;
+		stats.disk_used += size;
+		stats.disk_peak = max(stats.disk_peak, stats.disk_used);
+	}
+	LIST_INSERT_HEAD(&spool, entry, next);
+	pthread_mutex_unlock(&spool_lock);
+
+	TRACE("Staging %s (%llu bytes) %s", fname, size,
+		in_memory ? "in memory" : "on disk");
+
+	return entry->fd;
+}
+
+/*
+ * A new open file description, so that images using
+ * the same file can be installed at the same time
+ */
+static int spool_reopen(int fd)
+{
+	char path[64];
+	int newfd;
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	newfd = open(path, O_RDONLY | O_CLOEXEC);
+	if (newfd >= 0)
+		return newfd;
+
+	newfd = dup(fd);
+	if (newfd >= 0 && lseek(newfd, 0, SEEK_SET) < 0) {
+		close(newfd);
+		return -1;
+	}
+
+	return newfd;
+}
+
+int spool_open(const char *fname)
+{
+	struct spool_entry *entry;
+	int fd = -ENOENT;
+
+	pthread_mutex_lock(&spool_lock);
+	LIST_FOREACH(entry, &spool, next) {
+		if (!strcmp(entry->fname, fname)) {
+			fd = spool_reopen(entry->fd);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&spool_lock);
+
+	return fd;
+}
+
+void spool_clear(void)
+{
+	struct spool_entry *entry, *tmp;
+
+	pthread_mutex_lock(&spool_lock);
+	if (stats.nmem || stats.ndisk)
+		TRACE("Staged %u files in memory (peak %llu KiB), "
+			"%u on disk (peak %llu KiB)",
+			stats.nmem, stats.mem_peak / 1024,
+			stats.ndisk, stats.disk_peak / 1024);
+
+	LIST_FOREACH_SAFE(entry, &spool, next, tmp) {
+		LIST_REMOVE(entry, next);
+		close(entry->fd);
+		free(entry);
+	}
+	stats.mem_used = 0;
+	stats.disk_used = 0;
+	pthread_mutex_unlock(&spool_lock);
+}
+
+void spool_get_stats(struct spool_stats *st)
+{
+	pthread_mutex_lock(&spool_lock);
+	*st = stats;
+	pthread_mutex_unlock(&spool_lock);
+}
@@ -52,6 +52,7 @@
 #include "network_interface.h"
 #include "mongoose_interface.h"
 #include "installer.h"
+#include "spool.h"
 #include "progress.h"
 #include "pctl.h"
 #include "bootloader.h"
@@ -134,6 +135,7 @@ static int extract_files(int fd, struct swupdate_cfg *software)
 	int skip;
 	uint32_t checksum;
 	int fdout;
+	int spooled;
 	struct img_type *img, *part;
 	char output_file[MAX_IMAGE_FNAME];
 	const char* TMPDIR = get_tmpdir();
@@ -212,20 +214,30 @@ static int extract_files(int fd, struct swupdate_cfg *software)
 			 */
 			switch (skip) {
 			case COPY_FILE:
-				fdout = openfileoutput(img->extract_file);
+				/* scripts are run from TMPDIR */
+				spooled = 0;
+				if (!img->is_script) {
+					fdout = spool_create(img->fname, fdh.size);
+					spooled = fdout >= 0;
+				}
+				if (!spooled)
+					fdout = openfileoutput(img->extract_file);
 				if (fdout < 0)
 					return -1;
 				if (copyfile(fd, &fdout, fdh.size, &offset, 0, 0, 0, &checksum, img->sha256, 0, NULL) < 0) {
-					close(fdout);
+					if (!spooled)
+						close(fdout);
 					return -1;
 				}
 				if (checksum != (unsigned long)fdh.chksum) {
 					ERROR("Checksum WRONG ! Computed 0x%ux, it should be 0x%ux",
 						(unsigned int)checksum, (unsigned int)fdh.chksum);
-					close(fdout);
+					if (!spooled)
+						close(fdout);
 					return -1;
 				}
-				close(fdout);
+				if (!spooled)
+					close(fdout);
 				break;
 
 			case SKIP_FILE:
@@ -257,7 +269,21 @@ static int extract_files(int fd, struct swupdate_cfg *software)
 						part->install_directly = 1;
 					}
 				}
+				/*
+				 * Several images use this file: it is read
+				 * once and passed to all of them
+				 */
+				if (stream_needs_tee(&software->images, img)) {
+					if (stream_tee(fd, &fdh, &offset,
+							&software->images, img)) {
+						ERROR("Error streaming %s", img->fname);
+						return -1;
+					}
+					TRACE("END INSTALLING STREAMING");
+					break;
+				}
 				img->fdin = fd;
+				img->checksum = fdh.chksum;
 				if (install_single_image(img)) {
 					ERROR("Error streaming %s", img->fname);
 					return -1;
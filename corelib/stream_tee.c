@@ -0,0 +1,342 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+/*
+ * Fan-out of a streamed artifact: when several images in
+ * sw-description use the same file, the file is read once
+ * from the stream and passed to all of them. Each handler
+ * runs in its own thread and reads from a socket, as it
+ * would read from the stream. Checksum and hash are verified
+ * once here, the file is also saved in TMPDIR if images
+ * that are not streamed need it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "swupdate.h"
+#include "util.h"
+#include "handler.h"
+#include "cpiohdr.h"
+#include "installer.h"
+#include "spool.h"
+
+#define MODULE_NAME "tee"
+
+#define NPAD_BYTES(o) ((4 - (o % 4)) % 4)
+
+struct tee_consumer {
+	struct img_type *img;
+	int fd;			/* write side of the socket */
+	int ret;
+	pthread_t id;
+	int running;
+	unsigned char sha256[SHA256_HASH_LENGTH];
+};
+
+struct tee {
+	int fd;			/* must be first: file saved in TMPDIR */
+	int spooled;		/* fd belongs to the spool */
+	struct tee_consumer *consumers;
+	unsigned int n;
+};
+
+static bool same_file(struct img_type *img, const char *fname)
+{
+	return img->provided && !strcmp(img->fname, fname);
+}
+
+static unsigned int handler_flags(struct img_type *img)
+{
+	struct installer_handler *hnd = find_handler(img);
+
+	return hnd ? hnd->flags : 0;
+}
+
+/*
+ * Handlers run at the same time, they must allow it.
+ * An image that cannot be streamed with the others is
+ * installed later from TMPDIR.
+ */
+static bool tee_accept(struct tee *t, struct img_type *img)
+{
+	unsigned int flags = handler_flags(img);
+	unsigned int i, other;
+
+	if (!t->n)
+		return true;
+	if (!(flags & HANDLER_PARALLEL))
+		return false;
+
+	for (i = 0; i < t->n; i++) {
+		other = handler_flags(t->consumers[i].img);
+		if (!(other & HANDLER_PARALLEL))
+			return false;
+		if ((flags & HANDLER_MTD) && (other & HANDLER_MTD))
+			return false;
+		if (strlen(img->device) &&
+		    !strcmp(img->device, t->consumers[i].img->device))
+			return false;
+	}
+
+	return true;
+}
+
+bool stream_needs_tee(struct imglist *list, struct img_type *img)
+{
+	struct img_type *other;
+
+	LIST_FOREACH(other, list, next) {
+		if (other != img && same_file(other, img->fname))
+			return true;
+	}
+
+	return false;
+}
+
+static void *tee_consumer_thread(void *data)
+{
+	struct tee_consumer *c = (struct tee_consumer *)data;
+
+	c->ret = install_single_image(c->img);
+	/* the rest of the file is not read */
+	close(c->img->fdin);
+
+	return NULL;
+}
+
+static int tee_save(int fd, const void *buf, unsigned int len)
+{
+	const char *data = (const char *)buf;
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(fd, data, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			ERROR("cannot write %u bytes", len);
+			return -1;
+		}
+		data += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static void tee_send(struct tee *t, const void *buf, unsigned int len)
+{
+	const char *data;
+	unsigned int i, left;
+	ssize_t ret;
+
+	for (i = 0; i < t->n; i++) {
+		data = (const char *)buf;
+		left = len;
+		while (t->consumers[i].fd >= 0 && left > 0) {
+			ret = send(t->consumers[i].fd, data, left, MSG_NOSIGNAL);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret <= 0) {
+				/*
+				 * The handler stopped to read, its
+				 * result is checked at the end
+				 */
+				close(t->consumers[i].fd);
+				t->consumers[i].fd = -1;
+				break;
+			}
+			data += ret;
+			left -= ret;
+		}
+	}
+}
+
+static int tee_write(void *out, const void *buf, unsigned int len)
+{
+	struct tee *t = (struct tee *)out;
+
+	if (t->fd >= 0 && tee_save(t->fd, buf, len) < 0)
+		return -1;
+
+	tee_send(t, buf, len);
+
+	return 0;
+}
+
+static void tee_finish(struct tee *t)
+{
+	unsigned int i;
+
+	for (i = 0; i < t->n; i++) {
+		if (t->consumers[i].fd >= 0) {
+			close(t->consumers[i].fd);
+			t->consumers[i].fd = -1;
+		}
+	}
+}
+
+int stream_tee(int fdin, struct filehdr *fdh, unsigned long *offs,
+		struct imglist *list, struct img_type *img)
+{
+	struct tee t;
+	struct tee_consumer *c;
+	struct img_type *part;
+	unsigned char pad[4] = { 0 };
+	unsigned char hash[SHA256_HASH_LENGTH];
+	const char *extract_file = NULL;
+	uint32_t checksum;
+	unsigned int i, nimgs = 0;
+	int sv[2];
+	int ret = 0;
+
+	memset(hash, 0, sizeof(hash));
+	LIST_FOREACH(part, list, next) {
+		if (!same_file(part, img->fname))
+			continue;
+		nimgs++;
+		if (!IsValidHash(part->sha256))
+			continue;
+		/* the same file must have the same hash */
+		if (IsValidHash(hash) &&
+		    memcmp(part->sha256, hash, sizeof(hash))) {
+			ERROR("sw-description: different sha256 for %s",
+				img->fname);
+			return -EINVAL;
+		}
+		memcpy(hash, part->sha256, sizeof(hash));
+	}
+
+	memset(&t, 0, sizeof(t));
+	t.fd = -1;
+	t.consumers = (struct tee_consumer *)calloc(nimgs,
+					sizeof(*t.consumers));
+	if (!t.consumers)
+		return -ENOMEM;
+
+	LIST_FOREACH(part, list, next) {
+		if (!same_file(part, img->fname))
+			continue;
+		if (part->install_directly && !tee_accept(&t, part)) {
+			TRACE("%s cannot be streamed with other images, "
+				"it is installed from %s",
+				part->fname, part->extract_file);
+			part->install_directly = 0;
+		}
+		if (!part->install_directly) {
+			extract_file = part->extract_file;
+			continue;
+		}
+		c = &t.consumers[t.n++];
+		c->img = part;
+		c->fd = -1;
+		/* checksum and hash are verified here only once */
+		memcpy(c->sha256, part->sha256, sizeof(c->sha256));
+		memset(part->sha256, 0, sizeof(part->sha256));
+	}
+
+	if (extract_file) {
+		t.fd = spool_create(img->fname, fdh->size);
+		t.spooled = t.fd >= 0;
+		if (!t.spooled)
+			t.fd = openfileoutput(extract_file);
+		if (t.fd < 0) {
+			free(t.consumers);
+			return -1;
+		}
+	}
+
+	TRACE("Streaming %s to %u handlers%s", img->fname, t.n,
+		extract_file ? " and TMPDIR" : "");
+
+	for (i = 0; i < t.n; i++) {
+		c = &t.consumers[i];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+			ret = -errno;
+			ERROR("Cannot create socket for %s: %s",
+				c->img->fname, strerror(-ret));
+			break;
+		}
+		c->img->fdin = sv[1];
+		c->img->offset = 0;
+		c->img->size = fdh->size;
+		c->img->checksum = 0;
+		c->fd = sv[0];
+		if (pthread_create(&c->id, NULL, tee_consumer_thread, c)) {
+			ERROR("Cannot start handler for %s", c->img->fname);
+			close(sv[0]);
+			close(sv[1]);
+			c->fd = -1;
+			ret = -EAGAIN;
+			break;
+		}
+		c->running = 1;
+	}
+
+	if (!ret) {
+		ret = copyfile(fdin, &t, fdh->size, offs, 0, 0, 0, &checksum,
+				hash, 0, tee_write);
+		if (!ret && checksum != (unsigned long)fdh->chksum) {
+			ERROR("Checksum WRONG ! Computed 0x%x, it should be 0x%x",
+				(unsigned int)checksum, (unsigned int)fdh->chksum);
+			ret = -EFAULT;
+		}
+		/* as in the archive, handlers read the padding */
+		if (!ret)
+			tee_send(&t, pad, NPAD_BYTES(fdh->size));
+	}
+
+	/*
+	 * End of file for all handlers. If the file was not read
+	 * up to the end, they are told to stop: only the handlers
+	 * read at this time, the stream waits for them.
+	 */
+	if (ret)
+		copy_abort(1);
+	tee_finish(&t);
+
+	for (i = 0; i < t.n; i++) {
+		c = &t.consumers[i];
+		if (c->running)
+			pthread_join(c->id, NULL);
+		memcpy(c->img->sha256, c->sha256, sizeof(c->sha256));
+		if (!c->running)
+			continue;
+		if (c->ret) {
+			ERROR("Error streaming %s", c->img->fname);
+			if (!ret)
+				ret = c->ret;
+		}
+	}
+	copy_abort(0);
+
+	if (t.fd >= 0 && !t.spooled)
+		close(t.fd);
+	free(t.consumers);
+
+	return ret;
+}
@@ -19,18 +19,578 @@
  * Foundation, Inc.
  */
 
+/*
+ * Images are encrypted with AES-256 in one of these modes:
+ *
+ * - CBC (default): serial, the plaintext is padded (PKCS#7).
+ * - CTR: no padding, each block can be decrypted on its own,
+ *   so large buffers are split among a pool of threads.
+ * - GCM: authenticated, the 16 bytes tag follows the ciphertext
+ *   and is checked by swupdate_DECRYPT_final().
+ *
+ * With CONFIG_ENCRYPTED_IMAGES_AF_ALG, CBC and CTR are run by
+ * the kernel crypto API, that can use a hardware engine.
+ */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <openssl/opensslv.h>
 #include "swupdate.h"
 #include "sslapi.h"
 #include "util.h"
 
-struct swupdate_digest *swupdate_DECRYPT_init(unsigned char *key, unsigned char *iv, unsigned char *salt)
+#ifdef CONFIG_ENCRYPTED_IMAGES_AF_ALG
+#include <sys/socket.h>
+#include <linux/if_alg.h>
+#ifndef SOL_ALG
+#define SOL_ALG		279
+#endif
+#endif
+
+#define AES_KEY_LENGTH	32
+#define GCM_TAG_LENGTH	16
+
+/*
+ * A thread does not get less than this from a CTR buffer:
+ * a DECRYPT_PIECE is split in up to 4 slices, smaller
+ * buffers are decrypted by the caller alone.
+ */
+#define CTR_SLICE_MIN	(16 * 1024)
+#define CTR_MAX_SLICES	CONFIG_ENCRYPTED_IMAGES_THREADS
+
+/* data passed to the kernel at once */
+#define AF_ALG_PIECE	(16 * 1024)
+
+struct ctr_pool;
+
+struct ctr_slice {
+	struct ctr_pool *pool;
+	EVP_CIPHER_CTX *ctx;
+	pthread_t thread;
+	unsigned char *out;
+	unsigned char *in;
+	int len;
+	unsigned long long pos;
+	int ret;
+};
+
+struct ctr_pool {
+	struct swupdate_cipher *c;
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	unsigned int gen;
+	unsigned int running;
+	bool stop;
+	unsigned int nslices;	/* slice 0 is run by the caller */
+	struct ctr_slice slice[CTR_MAX_SLICES];
+};
+
+struct swupdate_cipher {
+	int type;
+	unsigned char key[AES_KEY_LENGTH];
+	unsigned char iv[AES_BLOCK_SIZE];
+
+	/* CTR: bytes decrypted so far */
+	unsigned long long pos;
+	bool resync;		/* ctxdec must be moved to pos */
+	struct ctr_pool *pool;
+
+	/* GCM: the last bytes received, they can be the tag */
+	unsigned char tail[GCM_TAG_LENGTH];
+	int ntail;
+
+	/* AF_ALG */
+	int tfm;
+	int op;
+	bool ivset;
+	unsigned char carry[AES_BLOCK_SIZE];	/* incomplete block */
+	int ncarry;
+	unsigned char last[AES_BLOCK_SIZE];	/* CBC: padding is here */
+	bool haslast;
+};
+
+static const EVP_CIPHER *get_evp_cipher(int type)
+{
+	switch (type) {
+	case CIPHER_AES_CBC:
+		return EVP_aes_256_cbc();
+	case CIPHER_AES_CTR:
+		return EVP_aes_256_ctr();
+	case CIPHER_AES_GCM:
+		return EVP_aes_256_gcm();
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * Set a CTR context to decrypt from byte pos of the image:
+ * the counter is the IV plus the number of blocks, as a
+ * 128 bit big endian value.
+ */
+static int ctr_seek(EVP_CIPHER_CTX *ctx, struct swupdate_cipher *c,
+			unsigned long long pos)
+{
+	unsigned char counter[AES_BLOCK_SIZE];
+	unsigned char skip[AES_BLOCK_SIZE];
+	unsigned long long blocks = pos / AES_BLOCK_SIZE;
+	unsigned int sum, carry = 0;
+	int i, len;
+
+	memcpy(counter, c->iv, sizeof(counter));
+	for (i = AES_BLOCK_SIZE - 1; i >= 0; i--) {
+		sum = counter[i] + (blocks & 0xff) + carry;
+		counter[i] = sum & 0xff;
+		carry = sum >> 8;
+		blocks >>= 8;
+	}
+
+	if (EVP_DecryptInit_ex(ctx, EVP_aes_256_ctr(), NULL, c->key,
+				counter) != 1)
+		return -EFAULT;
+
+	/* drop the key stream up to pos */
+	memset(skip, 0, sizeof(skip));
+	if (pos % AES_BLOCK_SIZE &&
+	    EVP_DecryptUpdate(ctx, skip, &len, skip,
+				pos % AES_BLOCK_SIZE) != 1)
+		return -EFAULT;
+
+	return 0;
+}
+
+static int ctr_slice_decrypt(struct ctr_slice *s)
+{
+	int len;
+
+	if (!s->len)
+		return 0;
+
+	if (ctr_seek(s->ctx, s->pool->c, s->pos) < 0 ||
+	    EVP_DecryptUpdate(s->ctx, s->out, &len, s->in, s->len) != 1)
+		return -EFAULT;
+
+	return 0;
+}
+
+static void *ctr_worker(void *data)
+{
+	struct ctr_slice *s = (struct ctr_slice *)data;
+	struct ctr_pool *pool = s->pool;
+	unsigned int gen = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (gen == pool->gen && !pool->stop)
+			pthread_cond_wait(&pool->start, &pool->lock);
+		if (pool->stop)
+			break;
+		gen = pool->gen;
+		pthread_mutex_unlock(&pool->lock);
+
+		s->ret = ctr_slice_decrypt(s);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->running == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+static void ctr_pool_destroy(struct ctr_pool *pool)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nslices; i++) {
+		if (i)
+			pthread_join(pool->slice[i].thread, NULL);
+		EVP_CIPHER_CTX_free(pool->slice[i].ctx);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->start);
+	pthread_cond_destroy(&pool->done);
+	free(pool);
+}
+
+static struct ctr_pool *ctr_pool_create(struct swupdate_cipher *c)
+{
+	struct ctr_pool *pool;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int n = CTR_MAX_SLICES;
+
+	if (ncpus > 0 && (unsigned long)ncpus < n)
+		n = ncpus;
+	if (n < 2)
+		return NULL;
+
+	pool = (struct ctr_pool *)calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	pool->c = c;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	for (pool->nslices = 0; pool->nslices < n; pool->nslices++) {
+		struct ctr_slice *s = &pool->slice[pool->nslices];
+
+		s->pool = pool;
+		s->ctx = EVP_CIPHER_CTX_new();
+		if (!s->ctx)
+			break;
+		if (pool->nslices &&
+		    pthread_create(&s->thread, NULL, ctr_worker, s)) {
+			EVP_CIPHER_CTX_free(s->ctx);
+			break;
+		}
+	}
+
+	if (pool->nslices < 2) {
+		ctr_pool_destroy(pool);
+		return NULL;
+	}
+
+	TRACE("AES-CTR decryption with %u threads", pool->nslices);
+
+	return pool;
+}
+
+static int ctr_update_parallel(struct swupdate_cipher *c, unsigned char *buf,
+				int *outlen, unsigned char *cryptbuf, int inlen)
+{
+	struct ctr_pool *pool = c->pool;
+	unsigned int i, n;
+	int piece, offs = 0, ret = 0;
+
+	n = min(pool->nslices, (unsigned int)(inlen / CTR_SLICE_MIN));
+	piece = (inlen / n + AES_BLOCK_SIZE - 1) & ~(AES_BLOCK_SIZE - 1);
+
+	for (i = 0; i < pool->nslices; i++) {
+		struct ctr_slice *s = &pool->slice[i];
+
+		s->len = (i < n) ? min(piece, inlen - offs) : 0;
+		s->in = cryptbuf + offs;
+		s->out = buf + offs;
+		s->pos = c->pos + offs;
+		s->ret = 0;
+		offs += s->len;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->running = pool->nslices - 1;
+	pool->gen++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	pool->slice[0].ret = ctr_slice_decrypt(&pool->slice[0]);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->running)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nslices; i++) {
+		if (pool->slice[i].ret < 0)
+			ret = pool->slice[i].ret;
+	}
+	if (ret < 0) {
+		ERROR("Update: Decryption error in AES-CTR thread");
+		return ret;
+	}
+
+	c->pos += inlen;
+	c->resync = true;
+	*outlen = inlen;
+
+	return 0;
+}
+
+/*
+ * The tag is not known until the end of the image:
+ * the last GCM_TAG_LENGTH bytes are always kept back.
+ */
+static int gcm_update(struct swupdate_digest *dgst, unsigned char *buf,
+			int *outlen, unsigned char *cryptbuf, int inlen)
+{
+	struct swupdate_cipher *c = dgst->cipher;
+	int n = c->ntail + inlen - GCM_TAG_LENGTH;
+	int fromtail, len1 = 0, len2 = 0;
+
+	*outlen = 0;
+	if (n <= 0) {
+		memcpy(c->tail + c->ntail, cryptbuf, inlen);
+		c->ntail += inlen;
+		return 0;
+	}
+
+	fromtail = min(n, c->ntail);
+	if (fromtail && EVP_DecryptUpdate(SSL_GET_CTXDEC(dgst), buf, &len1,
+					c->tail, fromtail) != 1)
+		goto gcm_error;
+	if (n > fromtail && EVP_DecryptUpdate(SSL_GET_CTXDEC(dgst),
+					buf + len1, &len2, cryptbuf,
+					n - fromtail) != 1)
+		goto gcm_error;
+
+	if (inlen >= GCM_TAG_LENGTH) {
+		memcpy(c->tail, cryptbuf + inlen - GCM_TAG_LENGTH,
+			GCM_TAG_LENGTH);
+	} else {
+		memmove(c->tail, c->tail + fromtail, c->ntail - fromtail);
+		memcpy(c->tail + c->ntail - fromtail, cryptbuf, inlen);
+	}
+	c->ntail = GCM_TAG_LENGTH;
+	*outlen = len1 + len2;
+
+	return 0;
+
+gcm_error:
+	ERROR("Update: Decryption error 0x%lx\n", ERR_get_error());
+	return -EFAULT;
+}
+
+#ifdef CONFIG_ENCRYPTED_IMAGES_AF_ALG
+static int afalg_init(struct swupdate_cipher *c)
+{
+	struct sockaddr_alg sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.salg_family = AF_ALG;
+	strcpy((char *)sa.salg_type, "skcipher");
+	strcpy((char *)sa.salg_name,
+		c->type == CIPHER_AES_CBC ? "cbc(aes)" : "ctr(aes)");
+
+	c->tfm = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (c->tfm < 0)
+		return -1;
+
+	if (bind(c->tfm, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+	    setsockopt(c->tfm, SOL_ALG, ALG_SET_KEY, c->key,
+			sizeof(c->key)) < 0 ||
+	    (c->op = accept4(c->tfm, NULL, 0, SOCK_CLOEXEC)) < 0) {
+		close(c->tfm);
+		c->tfm = -1;
+		return -1;
+	}
+
+	TRACE("Decrypting with %s from the kernel", sa.salg_name);
+
+	return 0;
+}
+
+/*
+ * Decrypt len bytes: with MSG_MORE the kernel keeps the IV
+ * from one request to the next, as for a single stream.
+ * Only the last request can end with an incomplete block.
+ */
+static int afalg_op(struct swupdate_cipher *c, unsigned char *out,
+			unsigned char *in, int len, bool more)
+{
+	char cbuf[CMSG_SPACE(sizeof(__u32)) +
+		  CMSG_SPACE(sizeof(struct af_alg_iv) + AES_BLOCK_SIZE)];
+	struct af_alg_iv *alg_iv;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t n;
+	int piece, done;
+
+	while (len > 0) {
+		piece = min(len, AF_ALG_PIECE);
+
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = in;
+		iov.iov_len = piece;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+
+		if (!c->ivset) {
+			memset(cbuf, 0, sizeof(cbuf));
+			msg.msg_control = cbuf;
+			msg.msg_controllen = sizeof(cbuf);
+
+			cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_ALG;
+			cmsg->cmsg_type = ALG_SET_OP;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(__u32));
+			*(__u32 *)CMSG_DATA(cmsg) = ALG_OP_DECRYPT;
+
+			cmsg = CMSG_NXTHDR(&msg, cmsg);
+			cmsg->cmsg_level = SOL_ALG;
+			cmsg->cmsg_type = ALG_SET_IV;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(struct af_alg_iv) +
+						AES_BLOCK_SIZE);
+			alg_iv = (struct af_alg_iv *)CMSG_DATA(cmsg);
+			alg_iv->ivlen = AES_BLOCK_SIZE;
+			memcpy(alg_iv->iv, c->iv, AES_BLOCK_SIZE);
+			c->ivset = true;
+		}
+
+		n = sendmsg(c->op, &msg,
+			(more || piece < len) ? MSG_MORE : 0);
+		if (n != piece)
+			return -EFAULT;
+
+		for (done = 0; done < piece; done += n) {
+			n = read(c->op, out + done, piece - done);
+			if (n <= 0)
+				return -EFAULT;
+		}
+
+		in += piece;
+		out += piece;
+		len -= piece;
+	}
+
+	return 0;
+}
+
+/* Decrypt whole blocks, for CBC the last one is kept back */
+static int afalg_blocks(struct swupdate_cipher *c, unsigned char *buf,
+			int *outlen, unsigned char *in, int len)
+{
+	unsigned char *dst = buf + *outlen;
+
+	if (c->type != CIPHER_AES_CBC) {
+		if (afalg_op(c, dst, in, len, true) < 0)
+			return -EFAULT;
+		*outlen += len;
+		return 0;
+	}
+
+	if (c->haslast) {
+		memcpy(dst, c->last, AES_BLOCK_SIZE);
+		dst += AES_BLOCK_SIZE;
+		*outlen += AES_BLOCK_SIZE;
+	}
+	if (afalg_op(c, dst, in, len, true) < 0)
+		return -EFAULT;
+	memcpy(c->last, dst + len - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+	c->haslast = true;
+	*outlen += len - AES_BLOCK_SIZE;
+
+	return 0;
+}
+
+static int afalg_update(struct swupdate_cipher *c, unsigned char *buf,
+			int *outlen, unsigned char *cryptbuf, int inlen)
+{
+	int n;
+
+	*outlen = 0;
+
+	if (c->ncarry) {
+		n = min(AES_BLOCK_SIZE - c->ncarry, inlen);
+		memcpy(c->carry + c->ncarry, cryptbuf, n);
+		c->ncarry += n;
+		cryptbuf += n;
+		inlen -= n;
+		if (c->ncarry < AES_BLOCK_SIZE)
+			return 0;
+		c->ncarry = 0;
+		if (afalg_blocks(c, buf, outlen, c->carry, AES_BLOCK_SIZE) < 0)
+			goto afalg_error;
+	}
+
+	n = inlen & ~(AES_BLOCK_SIZE - 1);
+	if (n && afalg_blocks(c, buf, outlen, cryptbuf, n) < 0)
+		goto afalg_error;
+
+	c->ncarry = inlen - n;
+	memcpy(c->carry, cryptbuf + n, c->ncarry);
+
+	return 0;
+
+afalg_error:
+	ERROR("Update: Decryption error from AF_ALG: %s", strerror(errno));
+	return -EFAULT;
+}
+
+static int afalg_final(struct swupdate_cipher *c, unsigned char *buf,
+			int *outlen)
+{
+	int pad, i;
+
+	*outlen = 0;
+
+	if (c->type != CIPHER_AES_CBC) {
+		if (c->ncarry && afalg_op(c, buf, c->carry, c->ncarry, false))
+			return -EFAULT;
+		*outlen = c->ncarry;
+		return 0;
+	}
+
+	/* PKCS#7 padding, as removed by EVP_DecryptFinal_ex() */
+	pad = c->last[AES_BLOCK_SIZE - 1];
+	if (c->ncarry || !c->haslast || pad < 1 || pad > AES_BLOCK_SIZE)
+		return -EFAULT;
+	for (i = AES_BLOCK_SIZE - pad; i < AES_BLOCK_SIZE; i++) {
+		if (c->last[i] != pad)
+			return -EFAULT;
+	}
+
+	*outlen = AES_BLOCK_SIZE - pad;
+	memcpy(buf, c->last, *outlen);
+
+	return 0;
+}
+#else
+static int afalg_init(struct swupdate_cipher __attribute__ ((__unused__)) *c)
+{
+	return -1;
+}
+
+static int afalg_update(struct swupdate_cipher __attribute__ ((__unused__)) *c,
+			unsigned char __attribute__ ((__unused__)) *buf,
+			int __attribute__ ((__unused__)) *outlen,
+			unsigned char __attribute__ ((__unused__)) *cryptbuf,
+			int __attribute__ ((__unused__)) inlen)
+{
+	return -EINVAL;
+}
+
+static int afalg_final(struct swupdate_cipher __attribute__ ((__unused__)) *c,
+			unsigned char __attribute__ ((__unused__)) *buf,
+			int __attribute__ ((__unused__)) *outlen)
+{
+	return -EINVAL;
+}
+#endif
+
+static void cipher_free(struct swupdate_cipher *c)
+{
+	if (!c)
+		return;
+
+	if (c->pool)
+		ctr_pool_destroy(c->pool);
+	if (c->op >= 0)
+		close(c->op);
+	if (c->tfm >= 0)
+		close(c->tfm);
+	OPENSSL_cleanse(c, sizeof(*c));
+	free(c);
+}
+
+struct swupdate_digest *swupdate_DECRYPT_init_cipher(unsigned char *key,
+				unsigned char *iv, unsigned char *salt, int type)
 {
 	struct swupdate_digest *dgst;
+	struct swupdate_cipher *c;
 	int ret;
 
 	if ((key == NULL) || (iv == NULL)) {
@@ -38,13 +598,29 @@ struct swupdate_digest *swupdate_DECRYPT_init(unsigned char *key, unsigned char
 		return NULL;
 	}
 
-	const EVP_CIPHER *cipher = EVP_aes_256_cbc();
+	const EVP_CIPHER *cipher = get_evp_cipher(type);
+	if (!cipher) {
+		ERROR("Unknown cipher %d", type);
+		return NULL;
+	}
 
 	dgst = calloc(1, sizeof(*dgst));
 	if (!dgst) {
 		return NULL;
 	}
 
+	c = calloc(1, sizeof(*c));
+	if (!c) {
+		free(dgst);
+		return NULL;
+	}
+	c->type = type;
+	c->tfm = -1;
+	c->op = -1;
+	memcpy(c->key, key, sizeof(c->key));
+	memcpy(c->iv, iv, sizeof(c->iv));
+	dgst->cipher = c;
+
 	if (salt != NULL) {
 		unsigned char dummy_key[EVP_MAX_KEY_LENGTH];
 		unsigned char dummy_iv[EVP_MAX_IV_LENGTH];
@@ -54,6 +630,7 @@ struct swupdate_digest *swupdate_DECRYPT_init(unsigned char *key, unsigned char
 							1,
 							(unsigned char *)&dummy_key, (unsigned char *)&dummy_iv)) {
 			ERROR("Cannot set salt.");
+			cipher_free(c);
 			free(dgst);
 			return NULL;
 		}
@@ -65,12 +642,14 @@ struct swupdate_digest *swupdate_DECRYPT_init(unsigned char *key, unsigned char
 	dgst->ctxdec = EVP_CIPHER_CTX_new();
 	if (dgst->ctxdec == NULL) {
 		ERROR("Cannot initialize cipher context.");
+		cipher_free(c);
 		free(dgst);
 		return NULL;
 	}
 	if (EVP_CIPHER_CTX_reset(dgst->ctxdec) != 1) {
 		ERROR("Cannot reset cipher context.");
 		EVP_CIPHER_CTX_free(dgst->ctxdec);
+		cipher_free(c);
 		free(dgst);
 		return NULL;
 	}
@@ -79,23 +658,70 @@ struct swupdate_digest *swupdate_DECRYPT_init(unsigned char *key, unsigned char
 	/*
 	 * Check openSSL documentation for return errors
 	 */
-	ret = EVP_DecryptInit_ex(SSL_GET_CTXDEC(dgst), cipher, NULL, key, iv);
+	if (type == CIPHER_AES_GCM) {
+		/* the IV has the same length as for the other modes */
+		ret = EVP_DecryptInit_ex(SSL_GET_CTXDEC(dgst), cipher, NULL,
+					NULL, NULL);
+		if (ret == 1)
+			ret = EVP_CIPHER_CTX_ctrl(SSL_GET_CTXDEC(dgst),
+					EVP_CTRL_GCM_SET_IVLEN,
+					AES_BLOCK_SIZE, NULL);
+		if (ret == 1)
+			ret = EVP_DecryptInit_ex(SSL_GET_CTXDEC(dgst), NULL,
+					NULL, key, iv);
+	} else
+		ret = EVP_DecryptInit_ex(SSL_GET_CTXDEC(dgst), cipher, NULL,
+					key, iv);
 	if (ret != 1) {
 		ERROR("Decrypt Engine not initialized, error 0x%lx\n", ERR_get_error());
-		free(dgst);
+		swupdate_DECRYPT_cleanup(dgst);
 		return NULL;
 	}
 
+	if (type != CIPHER_AES_GCM && afalg_init(c) == 0)
+		return dgst;
+
+	if (type == CIPHER_AES_CTR)
+		c->pool = ctr_pool_create(c);
+
 	return dgst;
 }
 
-int swupdate_DECRYPT_update(struct swupdate_digest *dgst, unsigned char *buf, 
+struct swupdate_digest *swupdate_DECRYPT_init(unsigned char *key, unsigned char *iv, unsigned char *salt)
+{
+	return swupdate_DECRYPT_init_cipher(key, iv, salt, CIPHER_AES_CBC);
+}
+
+int swupdate_DECRYPT_update(struct swupdate_digest *dgst, unsigned char *buf,
 				int *outlen, unsigned char *cryptbuf, int inlen)
 {
+	struct swupdate_cipher *c = dgst->cipher;
+
+	if (c->op >= 0)
+		return afalg_update(c, buf, outlen, cryptbuf, inlen);
+
+	if (c->type == CIPHER_AES_GCM)
+		return gcm_update(dgst, buf, outlen, cryptbuf, inlen);
+
+	if (c->type == CIPHER_AES_CTR) {
+		if (c->pool && inlen >= 2 * CTR_SLICE_MIN)
+			return ctr_update_parallel(c, buf, outlen, cryptbuf,
+						inlen);
+		if (c->resync) {
+			if (ctr_seek(SSL_GET_CTXDEC(dgst), c, c->pos) < 0) {
+				ERROR("Update: Decryption error 0x%lx\n",
+					ERR_get_error());
+				return -EFAULT;
+			}
+			c->resync = false;
+		}
+	}
+
 	if (EVP_DecryptUpdate(SSL_GET_CTXDEC(dgst), buf, outlen, cryptbuf, inlen) != 1) {
 		ERROR("Update: Decryption error 0x%lx\n", ERR_get_error());
 		return -EFAULT;
 	}
+	c->pos += *outlen;
 
 	return 0;
 }
@@ -103,11 +729,36 @@ int swupdate_DECRYPT_update(struct swupdate_digest *dgst, unsigned char *buf,
 int swupdate_DECRYPT_final(struct swupdate_digest *dgst, unsigned char *buf,
 				int *outlen)
 {
+	struct swupdate_cipher *c;
+
 	if (!dgst)
 		return -EINVAL;
 
+	c = dgst->cipher;
+	if (c->op >= 0) {
+		if (afalg_final(c, buf, outlen) < 0) {
+			ERROR("Decryption error from AF_ALG");
+			return -EFAULT;
+		}
+		return 0;
+	}
+
+	if (c->type == CIPHER_AES_GCM) {
+		if (c->ntail != GCM_TAG_LENGTH ||
+		    EVP_CIPHER_CTX_ctrl(SSL_GET_CTXDEC(dgst),
+					EVP_CTRL_GCM_SET_TAG, GCM_TAG_LENGTH,
+					c->tail) != 1) {
+			ERROR("Image too short for the AES-GCM tag");
+			return -EFAULT;
+		}
+	}
+
 	if (EVP_DecryptFinal_ex(SSL_GET_CTXDEC(dgst), buf, outlen) != 1) {
-		ERROR("Decryption error 0x%s\n", 
+		if (c->type == CIPHER_AES_GCM) {
+			ERROR("AES-GCM tag mismatch, image is corrupted");
+			return -EFAULT;
+		}
+		ERROR("Decryption error 0x%s\n",
 				ERR_reason_error_string(ERR_get_error()));
 		return -EFAULT;
 	}
@@ -124,6 +775,7 @@ void swupdate_DECRYPT_cleanup(struct swupdate_digest *dgst)
 #else
 		EVP_CIPHER_CTX_free(SSL_GET_CTXDEC(dgst));
 #endif
+		cipher_free(dgst->cipher);
 		free(dgst);
 		dgst = NULL;
 	}
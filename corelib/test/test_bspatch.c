@@ -0,0 +1,233 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <bzlib.h>
+#include <bspatch.h>
+
+#define OLDSIZE		(256 * 1024)
+#define NEWSIZE		(300 * 1024)
+
+struct patch {
+	unsigned char *buf;
+	unsigned int len;
+};
+
+struct output {
+	unsigned char *buf;
+	unsigned int len;
+};
+
+static void offtout(long long x, unsigned char *buf)
+{
+	long long y = x < 0 ? -x : x;
+	int i;
+
+	for (i = 0; i < 8; i++, y >>= 8)
+		buf[i] = y & 0xff;
+	if (x < 0)
+		buf[7] |= 0x80;
+}
+
+/*
+ * Build a patch from old to new with a fixed layout:
+ * the first half of new is a diff against the beginning
+ * of old, then 5000 extra bytes, then a diff against old
+ * starting at 1000, after a backward seek.
+ */
+static void make_patch(const unsigned char *old, const unsigned char *new,
+		struct patch *patch)
+{
+	unsigned char *body = malloc(NEWSIZE + 10 * 24);
+	unsigned int blen = 0, i, bzlen;
+	long long oldpos = 0, newpos = 0;
+	long long ctrl[2][3] = {
+		{ NEWSIZE / 2, 5000, 0 },
+		{ NEWSIZE - NEWSIZE / 2 - 5000, 0, 0 }
+	};
+	int c;
+
+	assert_non_null(body);
+	ctrl[0][2] = 1000 - NEWSIZE / 2;
+	for (c = 0; c < 2; c++) {
+		offtout(ctrl[c][0], body + blen);
+		offtout(ctrl[c][1], body + blen + 8);
+		offtout(ctrl[c][2], body + blen + 16);
+		blen += 24;
+		for (i = 0; i < ctrl[c][0]; i++) {
+			unsigned char o = (oldpos + i >= 0 && oldpos + i < OLDSIZE) ?
+						old[oldpos + i] : 0;
+			body[blen++] = new[newpos + i] - o;
+		}
+		newpos += ctrl[c][0];
+		oldpos += ctrl[c][0];
+		memcpy(body + blen, new + newpos, ctrl[c][1]);
+		blen += ctrl[c][1];
+		newpos += ctrl[c][1];
+		oldpos += ctrl[c][2];
+	}
+
+	bzlen = blen + blen / 100 + 600;
+	patch->buf = malloc(24 + bzlen);
+	assert_non_null(patch->buf);
+	memcpy(patch->buf, "ENDSLEY/BSDIFF43", 16);
+	offtout(NEWSIZE, patch->buf + 16);
+	assert_int_equal(BZ2_bzBuffToBuffCompress((char *)patch->buf + 24,
+				&bzlen, (char *)body, blen, 9, 0, 0), BZ_OK);
+	patch->len = 24 + bzlen;
+	free(body);
+}
+
+static int collect(void *out, const void *buf, unsigned int len)
+{
+	struct output *o = (struct output *)out;
+
+	assert_true(o->len + len <= NEWSIZE);
+	memcpy(o->buf + o->len, buf, len);
+	o->len += len;
+
+	return 0;
+}
+
+static int source_file(const unsigned char *old)
+{
+	char name[] = "/tmp/test_bspatchXXXXXX";
+	int fd = mkstemp(name);
+
+	assert_true(fd >= 0);
+	unlink(name);
+	assert_int_equal(write(fd, old, OLDSIZE), OLDSIZE);
+
+	return fd;
+}
+
+static void init_data(unsigned char **old, unsigned char **new)
+{
+	unsigned int i;
+
+	*old = malloc(OLDSIZE);
+	*new = malloc(NEWSIZE);
+	assert_non_null(*old);
+	assert_non_null(*new);
+	for (i = 0; i < OLDSIZE; i++)
+		(*old)[i] = (unsigned char)(i * 13 + (i >> 10));
+	for (i = 0; i < NEWSIZE; i++)
+		(*new)[i] = (unsigned char)(i * 13 + (i >> 9) + (i % 4093 == 0));
+}
+
+/* Apply the patch fed in pieces of any size */
+static void test_bspatch_apply(void **state)
+{
+	(void)state;
+
+	unsigned int pieces[] = { 1, 7, 4096, 100000 };
+	unsigned char *old, *new;
+	struct output out;
+	struct patch patch;
+	struct bspatch *bp;
+	unsigned int i, pos, n;
+	int fd;
+
+	init_data(&old, &new);
+	make_patch(old, new, &patch);
+	fd = source_file(old);
+	out.buf = malloc(NEWSIZE);
+	assert_non_null(out.buf);
+
+	for (i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) {
+		out.len = 0;
+		bp = bspatch_init(fd, OLDSIZE, &out, collect);
+		assert_non_null(bp);
+		for (pos = 0; pos < patch.len; pos += n) {
+			n = patch.len - pos < pieces[i] ? patch.len - pos : pieces[i];
+			assert_int_equal(bspatch_write(bp, patch.buf + pos, n), 0);
+		}
+		assert_int_equal(bspatch_end(bp), 0);
+		assert_int_equal(out.len, NEWSIZE);
+		assert_memory_equal(out.buf, new, NEWSIZE);
+	}
+
+	close(fd);
+	free(out.buf);
+	free(patch.buf);
+	free(old);
+	free(new);
+}
+
+static void test_bspatch_truncated(void **state)
+{
+	(void)state;
+
+	unsigned char *old, *new;
+	struct output out;
+	struct patch patch;
+	struct bspatch *bp;
+	int fd;
+
+	init_data(&old, &new);
+	make_patch(old, new, &patch);
+	fd = source_file(old);
+	out.buf = malloc(NEWSIZE);
+	out.len = 0;
+	assert_non_null(out.buf);
+
+	bp = bspatch_init(fd, OLDSIZE, &out, collect);
+	assert_non_null(bp);
+	assert_int_equal(bspatch_write(bp, patch.buf, patch.len - 10), 0);
+	assert_true(bspatch_end(bp) < 0);
+
+	close(fd);
+	free(out.buf);
+	free(patch.buf);
+	free(old);
+	free(new);
+}
+
+static void test_bspatch_bad_magic(void **state)
+{
+	(void)state;
+
+	unsigned char hdr[24] = "ENDSLEY/BSDIFF40";
+	struct output out = { NULL, 0 };
+	struct bspatch *bp;
+
+	bp = bspatch_init(-1, 0, &out, collect);
+	assert_non_null(bp);
+	assert_true(bspatch_write(bp, hdr, sizeof(hdr)) < 0);
+	assert_true(bspatch_end(bp) < 0);
+}
+
+int main(void)
+{
+	int error_count = 0;
+	const struct CMUnitTest bspatch_tests[] = {
+		cmocka_unit_test(test_bspatch_apply),
+		cmocka_unit_test(test_bspatch_truncated),
+		cmocka_unit_test(test_bspatch_bad_magic)
+	};
+	error_count += cmocka_run_group_tests_name("bspatch", bspatch_tests, NULL, NULL);
+	return error_count;
+}
@@ -0,0 +1,159 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <checksum.h>
+
+#define BUFSIZE		(64 * 1024)
+#define BENCH_SIZE	(16 * 1024 * 1024)
+#define BENCH_LOOPS	8
+
+static unsigned char *random_buffer(size_t len, unsigned int seed)
+{
+	unsigned char *buf = malloc(len);
+	size_t i;
+
+	assert_non_null(buf);
+	srand(seed);
+	for (i = 0; i < len; i++)
+		buf[i] = (unsigned char)rand();
+
+	return buf;
+}
+
+/*
+ * Every kernel must return the same value as the scalar one
+ * for any length and any alignment of the buffer
+ */
+static void test_checksum_bitexact(void **state)
+{
+	(void)state;
+
+	const struct cpio_checksum_impl *impls;
+	unsigned int count, i;
+	unsigned char *buf = random_buffer(BUFSIZE, 1);
+	size_t offs, len;
+	uint32_t ref;
+
+	impls = cpio_checksum_impls(&count);
+	for (i = 1; i < count; i++) {
+		if (impls[i].supported && !impls[i].supported())
+			continue;
+		for (offs = 0; offs < 64; offs++) {
+			for (len = 0; len < 1024; len++) {
+				ref = impls[0].fn(offs, buf + offs, len);
+				assert_int_equal(impls[i].fn(offs, buf + offs, len), ref);
+			}
+		}
+		ref = impls[0].fn(0, buf, BUFSIZE);
+		assert_int_equal(impls[i].fn(0, buf, BUFSIZE), ref);
+	}
+	free(buf);
+}
+
+/* The sum is modulo 2^32, also when lanes are folded */
+static void test_checksum_wrap(void **state)
+{
+	(void)state;
+
+	const struct cpio_checksum_impl *impls;
+	unsigned int count, i;
+	unsigned char *buf = malloc(BENCH_SIZE);
+	uint32_t ref;
+
+	assert_non_null(buf);
+	memset(buf, 0xFF, BENCH_SIZE);
+
+	impls = cpio_checksum_impls(&count);
+	ref = impls[0].fn(0xFFFFFF00, buf, BENCH_SIZE);
+	assert_int_equal(ref, (uint32_t)(0xFFFFFF00 + 0xFFULL * BENCH_SIZE));
+	for (i = 1; i < count; i++) {
+		if (impls[i].supported && !impls[i].supported())
+			continue;
+		assert_int_equal(impls[i].fn(0xFFFFFF00, buf, BENCH_SIZE), ref);
+	}
+	free(buf);
+}
+
+static void test_checksum_dispatch(void **state)
+{
+	(void)state;
+
+	unsigned char *buf = random_buffer(BUFSIZE, 2);
+	const struct cpio_checksum_impl *impls;
+	unsigned int count;
+
+	impls = cpio_checksum_impls(&count);
+	cpio_checksum_init();
+	assert_non_null(cpio_checksum_name());
+	assert_int_equal(cpio_checksum(7, buf, BUFSIZE),
+			 impls[0].fn(7, buf, BUFSIZE));
+	free(buf);
+}
+
+/*
+ * Not a test: it prints the throughput of each
+ * kernel to compare them on the target
+ */
+static void test_checksum_throughput(void **state)
+{
+	(void)state;
+
+	const struct cpio_checksum_impl *impls;
+	unsigned int count, i, loop;
+	unsigned char *buf = random_buffer(BENCH_SIZE, 3);
+	struct timespec start, end;
+	volatile uint32_t sum = 0;
+	double secs;
+
+	impls = cpio_checksum_impls(&count);
+	for (i = 0; i < count; i++) {
+		if (impls[i].supported && !impls[i].supported())
+			continue;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (loop = 0; loop < BENCH_LOOPS; loop++)
+			sum = impls[i].fn(sum, buf, BENCH_SIZE);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		secs = (end.tv_sec - start.tv_sec) +
+			(end.tv_nsec - start.tv_nsec) / 1e9;
+		print_message("%-8s %8.1f MiB/s\n", impls[i].name,
+			((double)BENCH_SIZE * BENCH_LOOPS) / (1024 * 1024) / secs);
+	}
+	free(buf);
+}
+
+int main(void)
+{
+	int error_count = 0;
+	const struct CMUnitTest checksum_tests[] = {
+		cmocka_unit_test(test_checksum_bitexact),
+		cmocka_unit_test(test_checksum_wrap),
+		cmocka_unit_test(test_checksum_dispatch),
+		cmocka_unit_test(test_checksum_throughput)
+	};
+	error_count += cmocka_run_group_tests_name("checksum", checksum_tests, NULL, NULL);
+	return error_count;
+}
@@ -135,13 +135,76 @@ static void test_crypt_failure(void **state)
 	free(crypt.crypttext);
 }
 
+static void do_crypt_stream(int cipher, unsigned char *KEY, unsigned char *IV,
+		unsigned char *CRYPTTEXT, unsigned char *PLAINTEXT, int fail)
+{
+	struct cryptdata crypt;
+	int len, outlen;
+	hex2bin((crypt.key = calloc(1, strlen((const char *)KEY))), KEY);
+	hex2bin((crypt.iv = calloc(1, strlen((const char *)IV))), IV);
+	hex2bin((crypt.crypttext = calloc(1, strlen((const char *)CRYPTTEXT))), CRYPTTEXT);
+
+	void *dcrypt = swupdate_DECRYPT_init_cipher(crypt.key, crypt.iv, NULL, cipher);
+	assert_non_null(dcrypt);
+
+	unsigned char *buffer = calloc(1, strlen((const char *)CRYPTTEXT) + EVP_MAX_BLOCK_LENGTH);
+	/* no padding: the plaintext is returned without waiting for the final call */
+	int ret = swupdate_DECRYPT_update(dcrypt, buffer, &outlen, crypt.crypttext, strlen((const char *)CRYPTTEXT) / 2);
+	assert_true(ret == 0);
+	assert_true(outlen == (int)strlen((const char *)PLAINTEXT));
+
+	ret = swupdate_DECRYPT_final(dcrypt, buffer + outlen, &len);
+	if (fail) {
+		assert_true(ret != 0);
+	} else {
+		assert_true(ret == 0);
+		assert_true(len == 0);
+		assert_true(strncmp((const char *)buffer, (const char *)PLAINTEXT, outlen) == 0);
+	}
+	swupdate_DECRYPT_cleanup(dcrypt);
+	free(buffer);
+
+	free(crypt.key);
+	free(crypt.iv);
+	free(crypt.crypttext);
+}
+
+static void test_crypt_ctr(void **state)
+{
+	(void)state;
+
+	unsigned char KEY[] = "E5E9FA1BA31ECD1AE84F75CAAA474F3A663F05F412028F81DA65D26EE56424B2";
+	unsigned char IV[] = "E93DA465B309C53FEC5FF93C9637DA58";
+	unsigned char CRYPTTEXT[] = "3D2F387761BF1503B9";
+	unsigned char PLAINTEXT[] = "CRYPTTEST";
+
+	do_crypt_stream(CIPHER_AES_CTR, KEY, IV, CRYPTTEXT, PLAINTEXT, 0);
+}
+
+static void test_crypt_gcm(void **state)
+{
+	(void)state;
+
+	unsigned char KEY[] = "E5E9FA1BA31ECD1AE84F75CAAA474F3A663F05F412028F81DA65D26EE56424B2";
+	unsigned char IV[] = "E93DA465B309C53FEC5FF93C9637DA58";
+	/* ciphertext followed by the tag */
+	unsigned char CRYPTTEXT[] = "51F5651DB0DFDD01D5032A6A9AD28EE05282675F60487249FC";
+	unsigned char BADTAG[] = "51F5651DB0DFDD01D5032A6A9AD28EE05282675F60487249FD";
+	unsigned char PLAINTEXT[] = "CRYPTTEST";
+
+	do_crypt_stream(CIPHER_AES_GCM, KEY, IV, CRYPTTEXT, PLAINTEXT, 0);
+	do_crypt_stream(CIPHER_AES_GCM, KEY, IV, BADTAG, PLAINTEXT, 1);
+}
+
 int main(void)
 {
 	int error_count = 0;
 	const struct CMUnitTest crypt_tests[] = {
 		cmocka_unit_test(test_crypt_nosalt),
 		cmocka_unit_test(test_crypt_failure),
-		cmocka_unit_test(test_crypt_salt)
+		cmocka_unit_test(test_crypt_salt),
+		cmocka_unit_test(test_crypt_ctr),
+		cmocka_unit_test(test_crypt_gcm)
 	};
 	error_count += cmocka_run_group_tests_name("crypt", crypt_tests, NULL, NULL);
 	return error_count;
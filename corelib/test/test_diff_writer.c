@@ -0,0 +1,185 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <diff_writer.h>
+
+#define BLOCK		4096
+#define NBLOCKS		600	/* more than one chunk */
+#define IMGSIZE		(NBLOCKS * BLOCK)
+#define PIECE		3001	/* as copyfile(), not aligned to blocks */
+
+static unsigned int prepare_calls;
+
+static int count_prepare(void *priv, unsigned long long offset,
+		unsigned int len)
+{
+	(void)priv;
+
+	assert_int_equal(offset % BLOCK, 0);
+	assert_int_equal(len % BLOCK, 0);
+	prepare_calls++;
+
+	return 0;
+}
+
+static int create_target(const unsigned char *data, size_t len)
+{
+	char name[] = "/tmp/test_diff_writerXXXXXX";
+	int fd = mkstemp(name);
+
+	assert_true(fd >= 0);
+	unlink(name);
+	assert_int_equal(write(fd, data, len), len);
+
+	return fd;
+}
+
+static void write_image(struct diff_writer *dw, const unsigned char *data,
+		size_t len)
+{
+	size_t n;
+
+	for (; len > 0; len -= n, data += n) {
+		n = len < PIECE ? len : PIECE;
+		assert_int_equal(diff_writer_write(dw, data, n), 0);
+	}
+}
+
+static void assert_target(int fd, const unsigned char *data, size_t len)
+{
+	unsigned char *buf = malloc(len + 1);
+
+	assert_non_null(buf);
+	assert_int_equal(pread(fd, buf, len + 1, 0), len);
+	assert_memory_equal(buf, data, len);
+	free(buf);
+}
+
+static void test_diff_writer_unchanged(void **state)
+{
+	(void)state;
+
+	unsigned char *img = malloc(IMGSIZE);
+	struct diff_writer dw;
+	int fd;
+
+	assert_non_null(img);
+	memset(img, 0x5a, IMGSIZE);
+	fd = create_target(img, IMGSIZE);
+
+	assert_int_equal(diff_writer_init(&dw, fd, 0, BLOCK, -1), 0);
+	write_image(&dw, img, IMGSIZE);
+	assert_int_equal(diff_writer_close(&dw), 0);
+
+	assert_int_equal(dw.written, 0);
+	assert_int_equal(dw.skipped, NBLOCKS);
+	assert_target(fd, img, IMGSIZE);
+
+	close(fd);
+	free(img);
+}
+
+/*
+ * Single changed bytes and a run of adjacent blocks:
+ * each run must be written with one call
+ */
+static void test_diff_writer_changed(void **state)
+{
+	(void)state;
+
+	unsigned char *img = malloc(IMGSIZE);
+	struct diff_writer dw;
+	unsigned int i;
+	int fd;
+
+	assert_non_null(img);
+	for (i = 0; i < IMGSIZE; i++)
+		img[i] = (unsigned char)(i * 7);
+	fd = create_target(img, IMGSIZE);
+
+	img[0] ^= 1;
+	img[10 * BLOCK + 17] ^= 1;
+	memset(img + 300 * BLOCK, 0, 3 * BLOCK);
+	img[IMGSIZE - 1] ^= 1;
+
+	prepare_calls = 0;
+	assert_int_equal(diff_writer_init(&dw, fd, 0, BLOCK, -1), 0);
+	dw.prepare = count_prepare;
+	write_image(&dw, img, IMGSIZE);
+	assert_int_equal(diff_writer_close(&dw), 0);
+
+	assert_int_equal(dw.written, 6);
+	assert_int_equal(dw.skipped, NBLOCKS - 6);
+	assert_int_equal(prepare_calls, 4);
+	assert_target(fd, img, IMGSIZE);
+
+	close(fd);
+	free(img);
+}
+
+/* A shorter target grows, the tail is padded if requested */
+static void test_diff_writer_tail(void **state)
+{
+	(void)state;
+
+	unsigned char *img = malloc(IMGSIZE);
+	unsigned char *padded = malloc(IMGSIZE);
+	size_t len = 5 * BLOCK + 100;
+	struct diff_writer dw;
+	int fd;
+
+	assert_non_null(img);
+	assert_non_null(padded);
+	memset(img, 0x33, IMGSIZE);
+	fd = create_target(img, 2 * BLOCK);
+
+	assert_int_equal(diff_writer_init(&dw, fd, 0, BLOCK, 0xff), 0);
+	write_image(&dw, img, len);
+	assert_int_equal(diff_writer_close(&dw), 0);
+
+	assert_int_equal(dw.written, 4);
+	assert_int_equal(dw.skipped, 2);
+	memcpy(padded, img, len);
+	memset(padded + len, 0xff, 6 * BLOCK - len);
+	assert_target(fd, padded, 6 * BLOCK);
+
+	close(fd);
+	free(padded);
+	free(img);
+}
+
+int main(void)
+{
+	int error_count = 0;
+	const struct CMUnitTest diff_writer_tests[] = {
+		cmocka_unit_test(test_diff_writer_unchanged),
+		cmocka_unit_test(test_diff_writer_changed),
+		cmocka_unit_test(test_diff_writer_tail)
+	};
+	error_count += cmocka_run_group_tests_name("diff_writer", diff_writer_tests, NULL, NULL);
+	return error_count;
+}
@@ -0,0 +1,273 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cmocka.h>
+#include <download_cache.h>
+
+#define URL	"http://example.com/image.swu"
+#define HASH	"4e1243bd22c66e76c2ba9eddc1f91394e57f9f83"
+#define DATASIZE	(200 * 1024)
+
+struct fixture {
+	char dir[64];
+	struct dl_cache cache;
+	unsigned char *data;
+	unsigned char *out;
+	size_t outlen;
+};
+
+static int setup(void **state)
+{
+	struct fixture *f = calloc(1, sizeof(*f));
+	unsigned int i;
+
+	if (!f)
+		return -1;
+	strcpy(f->dir, "/tmp/test_download_cache.XXXXXX");
+	if (!mkdtemp(f->dir))
+		return -1;
+	f->cache.dir = f->dir;
+	f->data = malloc(DATASIZE);
+	f->out = malloc(DATASIZE);
+	if (!f->data || !f->out)
+		return -1;
+	for (i = 0; i < DATASIZE; i++)
+		f->data[i] = i * 7 + (i >> 8);
+	*state = f;
+
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	struct fixture *f = *state;
+	char path[PATH_MAX];
+	struct dirent *de;
+	DIR *dir;
+
+	dir = opendir(f->dir);
+	while (dir && (de = readdir(dir))) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", f->dir, de->d_name);
+		unlink(path);
+	}
+	if (dir)
+		closedir(dir);
+	rmdir(f->dir);
+	free(f->data);
+	free(f->out);
+	free(f);
+
+	return 0;
+}
+
+static int sink(void *ctx, char *buf, size_t len)
+{
+	struct fixture *f = ctx;
+
+	assert_true(f->outlen + len <= DATASIZE);
+	memcpy(f->out + f->outlen, buf, len);
+	f->outlen += len;
+
+	return 0;
+}
+
+static unsigned int count_files(struct fixture *f)
+{
+	struct dirent *de;
+	unsigned int n = 0;
+	DIR *dir;
+
+	dir = opendir(f->dir);
+	assert_non_null(dir);
+	while ((de = readdir(dir)))
+		if (de->d_name[0] != '.')
+			n++;
+	closedir(dir);
+
+	return n;
+}
+
+/* A download interrupted by a restart goes on from where it was */
+static void test_cache_resume(void **state)
+{
+	struct fixture *f = *state;
+	struct dl_cache_entry e;
+
+	assert_int_equal(dl_cache_open(&f->cache, URL, HASH, &e), 0);
+	assert_int_equal(e.size, 0);
+	assert_int_equal(dl_cache_validate(&e, NULL), 0);
+	dl_cache_write(&e, f->data, 1000);
+	dl_cache_write(&e, f->data + 1000, 50000);
+	dl_cache_close(&e);
+
+	assert_int_equal(dl_cache_open(&f->cache, URL, HASH, &e), 0);
+	assert_int_equal(e.size, 51000);
+	assert_false(e.complete);
+	assert_int_equal(dl_cache_replay(&e, sink, f), 0);
+	assert_int_equal(f->outlen, 51000);
+	assert_memory_equal(f->out, f->data, 51000);
+	dl_cache_write(&e, f->data + 51000, DATASIZE - 51000);
+	dl_cache_done(&e);
+	dl_cache_close(&e);
+
+	/* complete, it is replayed without the network */
+	f->outlen = 0;
+	assert_int_equal(dl_cache_open(&f->cache, URL, HASH, &e), 0);
+	assert_true(e.complete);
+	assert_int_equal(e.size, DATASIZE);
+	assert_int_equal(dl_cache_replay(&e, sink, f), 0);
+	assert_int_equal(f->outlen, DATASIZE);
+	assert_memory_equal(f->out, f->data, DATASIZE);
+	dl_cache_close(&e);
+}
+
+/* Data beyond what the meta file says was synced is dropped */
+static void test_cache_unsynced(void **state)
+{
+	struct fixture *f = *state;
+	struct dl_cache_entry e;
+	char path[PATH_MAX];
+	struct stat st;
+	int fd;
+
+	assert_int_equal(dl_cache_open(&f->cache, URL, HASH, &e), 0);
+	dl_cache_write(&e, f->data, 1000);
+	dl_cache_close(&e);
+
+	/* as if the power went off after a write, before the sync */
+	snprintf(path, sizeof(path), "%s.data", e.name);
+	fd = open(path, O_WRONLY | O_APPEND);
+	assert_true(fd >= 0);
+	assert_int_equal(write(fd, f->data, 3000), 3000);
+	close(fd);
+
+	assert_int_equal(dl_cache_open(&f->cache, URL, HASH, &e), 0);
+	assert_int_equal(e.size, 1000);
+	assert_int_equal(stat(path, &st), 0);
+	assert_int_equal(st.st_size, 1000);
+	dl_cache_close(&e);
+}
+
+/* A download stopped without dl_cache_close() resumes from the last sync */
+static void test_cache_crash(void **state)
+{
+	struct fixture *f = *state;
+	struct dl_cache_entry e;
+	unsigned long long written = 0;
+
+	assert_int_equal(dl_cache_open(&f->cache, URL, HASH, &e), 0);
+	while (written < DL_CACHE_SYNC_SIZE + DATASIZE) {
+		dl_cache_write(&e, f->data, DATASIZE);
+		written += DATASIZE;
+	}
+	assert_true(e.fd >= 0);
+	/* as if the process was killed */
+	close(e.fd);
+	free(e.url);
+
+	assert_int_equal(dl_cache_open(&f->cache, URL, HASH, &e), 0);
+	assert_true(e.size >= DL_CACHE_SYNC_SIZE);
+	assert_true(e.size < written);
+	assert_int_equal(e.size % DATASIZE, 0);
+	assert_false(e.complete);
+	dl_cache_close(&e);
+}
+
+/* The same URL with another hash is another artifact */
+static void test_cache_key(void **state)
+{
+	struct fixture *f = *state;
+	struct dl_cache_entry e;
+
+	assert_int_equal(dl_cache_open(&f->cache, URL, HASH, &e), 0);
+	dl_cache_write(&e, f->data, 4096);
+	dl_cache_done(&e);
+	dl_cache_close(&e);
+
+	assert_int_equal(dl_cache_open(&f->cache, URL, "0123abcd", &e), 0);
+	assert_int_equal(e.size, 0);
+	assert_false(e.complete);
+	dl_cache_remove(&e);
+
+	assert_int_equal(dl_cache_open(&f->cache, URL, HASH, &e), 0);
+	assert_true(e.complete);
+	dl_cache_remove(&e);
+	assert_int_equal(count_files(f), 0);
+
+	assert_int_not_equal(dl_cache_open(&f->cache, URL, "../x", &e), 0);
+	assert_true(e.fd < 0);
+}
+
+/* Old entries make room for a new one, one too big is not cached */
+static void test_cache_evict(void **state)
+{
+	struct fixture *f = *state;
+	struct dl_cache_entry e;
+
+	f->cache.max_size = 150 * 1024;
+
+	assert_int_equal(dl_cache_open(&f->cache, URL, "aa", &e), 0);
+	dl_cache_write(&e, f->data, 100 * 1024);
+	dl_cache_done(&e);
+	dl_cache_close(&e);
+	assert_int_equal(count_files(f), 2);
+
+	assert_int_equal(dl_cache_open(&f->cache, URL, "bb", &e), 0);
+	dl_cache_write(&e, f->data, 60 * 1024);
+	assert_true(e.fd >= 0);
+	dl_cache_done(&e);
+	dl_cache_close(&e);
+	assert_int_equal(count_files(f), 2);
+
+	assert_int_equal(dl_cache_open(&f->cache, URL, "aa", &e), 0);
+	assert_int_equal(e.size, 0);
+	dl_cache_write(&e, f->data, DATASIZE);
+	assert_true(e.fd < 0);
+	dl_cache_close(&e);
+	assert_int_equal(count_files(f), 0);
+}
+
+int main(void)
+{
+	int error_count = 0;
+	const struct CMUnitTest download_cache_tests[] = {
+		cmocka_unit_test_setup_teardown(test_cache_resume, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_cache_unsynced, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_cache_crash, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_cache_key, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_cache_evict, setup, teardown),
+	};
+	error_count += cmocka_run_group_tests_name("download_cache",
+						   download_cache_tests,
+						   NULL, NULL);
+	return error_count;
+}
@@ -0,0 +1,316 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cmocka.h>
+#include <curl/curl.h>
+#include <download_interface.h>
+
+#define IMAGESIZE	(300 * 1024 + 123)
+#define SEGSIZE		(64 * 1024)
+
+/*
+ * A stand-in HTTP server on the loopback: it answers HEAD and
+ * GET with a Range on one connection at a time, with
+ * "Connection: close".
+ */
+struct server {
+	int sock;
+	unsigned short port;
+	pthread_t thread;
+	unsigned char *image;
+	bool ranges;		/* announce and honour ranges */
+	unsigned int drops;	/* close in the middle of so many answers */
+	unsigned int gets;
+};
+
+static void send_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = send(fd, p, len, MSG_NOSIGNAL);
+		if (n <= 0)
+			return;
+		p += n;
+		len -= n;
+	}
+}
+
+static void serve(struct server *srv, int fd)
+{
+	char req[2048] = "", hdr[256], *range;
+	unsigned long start = 0, end = IMAGESIZE - 1;
+	size_t len = 0;
+	ssize_t n;
+	bool head;
+
+	while (len < sizeof(req) - 1 && !strstr(req, "\r\n\r\n")) {
+		n = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+		if (n <= 0)
+			return;
+		len += n;
+		req[len] = '\0';
+	}
+	head = !strncmp(req, "HEAD ", 5);
+	range = strstr(req, "Range: bytes=");
+	if (range && srv->ranges)
+		sscanf(range, "Range: bytes=%lu-%lu", &start, &end);
+	else
+		range = NULL;
+
+	snprintf(hdr, sizeof(hdr),
+		 "HTTP/1.1 %s\r\n%sContent-Length: %lu\r\n"
+		 "Connection: close\r\n\r\n",
+		 range ? "206 Partial Content" : "200 OK",
+		 srv->ranges ? "Accept-Ranges: bytes\r\n" : "",
+		 end - start + 1);
+	send_all(fd, hdr, strlen(hdr));
+	if (head)
+		return;
+
+	srv->gets++;
+	if (srv->drops) {
+		srv->drops--;
+		send_all(fd, srv->image + start, (end - start + 1) / 2);
+		return;
+	}
+	send_all(fd, srv->image + start, end - start + 1);
+}
+
+static void *server_thread(void *data)
+{
+	struct server *srv = (struct server *)data;
+	int fd;
+
+	for (;;) {
+		fd = accept(srv->sock, NULL, NULL);
+		if (fd < 0)
+			break;
+		serve(srv, fd);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+static void server_start(struct server *srv, unsigned char *image,
+			 bool ranges, unsigned int drops)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+
+	memset(srv, 0, sizeof(*srv));
+	srv->image = image;
+	srv->ranges = ranges;
+	srv->drops = drops;
+
+	srv->sock = socket(AF_INET, SOCK_STREAM, 0);
+	assert_true(srv->sock >= 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	assert_int_equal(bind(srv->sock, (struct sockaddr *)&addr, len), 0);
+	assert_int_equal(listen(srv->sock, 16), 0);
+	assert_int_equal(getsockname(srv->sock, (struct sockaddr *)&addr, &len), 0);
+	srv->port = ntohs(addr.sin_port);
+	assert_int_equal(pthread_create(&srv->thread, NULL, server_thread, srv), 0);
+}
+
+static void server_stop(struct server *srv)
+{
+	shutdown(srv->sock, SHUT_RDWR);
+	close(srv->sock);
+	pthread_join(srv->thread, NULL);
+}
+
+struct fixture {
+	unsigned char *image;
+	char outname[64];
+	int out;
+	struct server srv[2];
+	char url[2][64];
+	const char *urls[2];
+	struct dwl_segment_opts opts;
+};
+
+static int setup(void **state)
+{
+	struct fixture *f = calloc(1, sizeof(*f));
+	unsigned int i;
+
+	if (!f)
+		return -1;
+	f->image = malloc(IMAGESIZE);
+	if (!f->image)
+		return -1;
+	srand(1);
+	for (i = 0; i < IMAGESIZE; i++)
+		f->image[i] = rand();
+
+	strcpy(f->outname, "/tmp/test_download_segments.XXXXXX");
+	f->out = mkstemp(f->outname);
+	if (f->out < 0)
+		return -1;
+
+	f->opts.urls = f->urls;
+	f->opts.connections = 4;
+	f->opts.segment_size = SEGSIZE;
+	f->opts.retries = 3;
+	f->opts.lowspeed_time = 10;
+	curl_global_init(CURL_GLOBAL_ALL);
+	*state = f;
+
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	struct fixture *f = *state;
+
+	curl_global_cleanup();
+	close(f->out);
+	unlink(f->outname);
+	free(f->image);
+	free(f);
+
+	return 0;
+}
+
+static void add_server(struct fixture *f, bool ranges, unsigned int drops)
+{
+	unsigned int i = f->opts.nurls++;
+
+	server_start(&f->srv[i], f->image, ranges, drops);
+	snprintf(f->url[i], sizeof(f->url[i]), "http://127.0.0.1:%u/image.swu",
+		 f->srv[i].port);
+	f->urls[i] = f->url[i];
+}
+
+static void check_output(struct fixture *f)
+{
+	unsigned char *buf = malloc(IMAGESIZE + 1);
+	struct stat st;
+
+	assert_non_null(buf);
+	assert_int_equal(fstat(f->out, &st), 0);
+	assert_int_equal(st.st_size, IMAGESIZE);
+	assert_int_equal(pread(f->out, buf, IMAGESIZE + 1, 0), IMAGESIZE);
+	assert_memory_equal(buf, f->image, IMAGESIZE);
+	free(buf);
+}
+
+static void test_segments(void **state)
+{
+	struct fixture *f = *state;
+	unsigned long long sent;
+
+	add_server(f, true, 0);
+	assert_int_equal(download_segments(&f->opts, f->out, &sent), 0);
+	server_stop(&f->srv[0]);
+
+	check_output(f);
+	assert_int_equal(sent, IMAGESIZE);
+	/* 300 KiB in 64 KiB ranges */
+	assert_int_equal(f->srv[0].gets, 5);
+}
+
+static void test_mirrors_resume(void **state)
+{
+	struct fixture *f = *state;
+	unsigned long long sent;
+
+	/* the first server breaks its first two answers */
+	add_server(f, true, 2);
+	add_server(f, true, 0);
+	assert_int_equal(download_segments(&f->opts, f->out, &sent), 0);
+	server_stop(&f->srv[0]);
+	server_stop(&f->srv[1]);
+
+	check_output(f);
+	assert_int_equal(f->srv[0].gets + f->srv[1].gets, 7);
+}
+
+/* After a failure, sent is where a single connection resumes */
+static void test_failure_sent(void **state)
+{
+	struct fixture *f = *state;
+	unsigned long long sent;
+	unsigned char *buf = malloc(IMAGESIZE);
+	struct stat st;
+
+	assert_non_null(buf);
+	f->opts.retries = 1;
+	add_server(f, true, 100);
+	assert_int_not_equal(download_segments(&f->opts, f->out, &sent), 0);
+	server_stop(&f->srv[0]);
+
+	assert_int_equal(fstat(f->out, &st), 0);
+	assert_true(sent > 0);
+	assert_int_equal(sent, st.st_size);
+	assert_int_equal(pread(f->out, buf, sent, 0), sent);
+	assert_memory_equal(buf, f->image, sent);
+	free(buf);
+}
+
+static void test_no_ranges(void **state)
+{
+	struct fixture *f = *state;
+	unsigned long long sent;
+	struct stat st;
+
+	add_server(f, false, 0);
+	assert_int_equal(download_segments(&f->opts, f->out, &sent), -ENOTSUP);
+	assert_int_equal(sent, 0);
+	server_stop(&f->srv[0]);
+
+	/* nothing was sent, the caller can use a single connection */
+	assert_int_equal(fstat(f->out, &st), 0);
+	assert_int_equal(st.st_size, 0);
+	assert_int_equal(f->srv[0].gets, 0);
+}
+
+int main(void)
+{
+	int error_count = 0;
+	const struct CMUnitTest download_segments_tests[] = {
+		cmocka_unit_test_setup_teardown(test_segments, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_mirrors_resume, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_failure_sent, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_no_ranges, setup, teardown),
+	};
+	error_count += cmocka_run_group_tests_name("download_segments",
+						   download_segments_tests,
+						   NULL, NULL);
+	return error_count;
+}
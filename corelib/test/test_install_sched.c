@@ -0,0 +1,333 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <cmocka.h>
+#include <swupdate.h>
+#include <util.h>
+#include <handler.h>
+#include <installer.h>
+
+/* larger than what the copy pipeline buffers */
+#define DATASIZE	(2 * 1024 * 1024)
+#define MAXJOBS		4
+#define PEER_WAIT_MS	200
+
+struct job {
+	struct img_type img;
+	char path[64];
+	bool slow;		/* the copy waits until it is aborted */
+	int started;
+	int ret;
+};
+
+struct fixture {
+	struct swupdate_cfg sw;
+	struct job jobs[MAXJOBS];
+	unsigned int njobs;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static unsigned int running, max_running;
+static int aborted;
+static unsigned int threads_allowed = ~0U;
+
+int __real_pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+			  void *(*start)(void *), void *arg);
+int __wrap_pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+			  void *(*start)(void *), void *arg);
+int __wrap_pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+			  void *(*start)(void *), void *arg)
+{
+	if (!threads_allowed)
+		return EAGAIN;
+	threads_allowed--;
+
+	return __real_pthread_create(thread, attr, start, arg);
+}
+
+void __real_copy_abort(int abort);
+void __wrap_copy_abort(int abort);
+void __wrap_copy_abort(int abort)
+{
+	pthread_mutex_lock(&lock);
+	if (abort)
+		aborted = 1;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+
+	__real_copy_abort(abort);
+}
+
+/* This must be called with the lock held */
+static void wait_ms(unsigned int ms)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	pthread_cond_timedwait(&cond, &lock, &ts);
+}
+
+static int write_slow(void *out, const void __attribute__ ((__unused__)) *buf,
+		      unsigned int __attribute__ ((__unused__)) len)
+{
+	struct job *job = (struct job *)out;
+	unsigned int i;
+
+	if (!job->slow)
+		return 0;
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; !aborted && i < 50; i++)
+		wait_ms(100);
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
+
+static int sched_copy(struct img_type *img, void __attribute__ ((__unused__)) *data)
+{
+	struct job *job = (struct job *)img;
+
+	pthread_mutex_lock(&lock);
+	job->started = 1;
+	running++;
+	if (running > max_running)
+		max_running = running;
+	pthread_cond_broadcast(&cond);
+	/* give a job that can run at the same time the chance to start */
+	if (running < 2)
+		wait_ms(PEER_WAIT_MS);
+	pthread_mutex_unlock(&lock);
+
+	job->ret = copyimage(job, img, write_slow);
+
+	pthread_mutex_lock(&lock);
+	running--;
+	pthread_mutex_unlock(&lock);
+
+	return job->ret;
+}
+
+static int sched_fail(struct img_type *img, void __attribute__ ((__unused__)) *data)
+{
+	struct job *job = (struct job *)img;
+
+	job->started = 1;
+	job->ret = -1;
+
+	return job->ret;
+}
+
+static int sched_barrier(struct img_type *img, void __attribute__ ((__unused__)) *data)
+{
+	struct job *job = (struct job *)img;
+
+	job->started = 1;
+	job->ret = 0;
+
+	return job->ret;
+}
+
+static int group_setup(void **state)
+{
+	(void)state;
+
+	if (register_handler_flags("schedcopy", sched_copy, NULL,
+				   HANDLER_PARALLEL) ||
+	    register_handler_flags("schedfail", sched_fail, NULL,
+				   HANDLER_PARALLEL))
+		return -1;
+
+	return register_handler("schedbarrier", sched_barrier, NULL);
+}
+
+static int setup(void **state)
+{
+	struct fixture *f = calloc(1, sizeof(*f));
+
+	if (!f)
+		return -1;
+	LIST_INIT(&f->sw.images);
+	LIST_INIT(&f->sw.scripts);
+	LIST_INIT(&f->sw.bootloader);
+	running = max_running = 0;
+	aborted = 0;
+	threads_allowed = ~0U;
+	*state = f;
+
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	struct fixture *f = *state;
+	unsigned int i;
+
+	for (i = 0; i < f->njobs; i++)
+		unlink(f->jobs[i].path);
+	free(f);
+
+	return 0;
+}
+
+/* Images are installed in the order they are added */
+static struct job *add_job(struct fixture *f, const char *type,
+			   const char *device)
+{
+	struct job *job = &f->jobs[f->njobs];
+	struct img_type *last = NULL, *img;
+	unsigned char *data;
+	int fd;
+
+	assert_true(f->njobs < MAXJOBS);
+	snprintf(job->path, sizeof(job->path), "%ssched.XXXXXX", get_tmpdir());
+	fd = mkstemp(job->path);
+	assert_true(fd >= 0);
+	data = calloc(1, DATASIZE);
+	assert_non_null(data);
+	assert_int_equal(write(fd, data, DATASIZE), DATASIZE);
+	free(data);
+	close(fd);
+
+	strcpy(job->img.type, type);
+	strcpy(job->img.fname, strrchr(job->path, '/') + 1);
+	strcpy(job->img.device, device);
+	job->img.provided = 1;
+	job->ret = 1;
+
+	LIST_FOREACH(img, &f->sw.images, next)
+		last = img;
+	if (last)
+		LIST_INSERT_AFTER(last, &job->img, next);
+	else
+		LIST_INSERT_HEAD(&f->sw.images, &job->img, next);
+	f->njobs++;
+
+	return job;
+}
+
+static int install(struct fixture *f)
+{
+	return install_images(&f->sw, -1, 0);
+}
+
+static void test_sched_parallel(void **state)
+{
+	struct fixture *f = *state;
+	struct job *a = add_job(f, "schedcopy", "/dev/a");
+	struct job *b = add_job(f, "schedcopy", "/dev/b");
+
+	assert_int_equal(install(f), 0);
+	assert_int_equal(a->ret, 0);
+	assert_int_equal(b->ret, 0);
+	assert_int_equal(max_running, 2);
+}
+
+/* Images for the same device are installed one after the other */
+static void test_sched_conflict(void **state)
+{
+	struct fixture *f = *state;
+	struct job *a = add_job(f, "schedcopy", "/dev/a");
+	struct job *b = add_job(f, "schedcopy", "/dev/a");
+
+	assert_int_equal(install(f), 0);
+	assert_int_equal(a->ret, 0);
+	assert_int_equal(b->ret, 0);
+	assert_int_equal(max_running, 1);
+}
+
+/*
+ * A failure aborts the copy of the running images, and
+ * nothing after a barrier is started.
+ */
+static void test_sched_failure(void **state)
+{
+	struct fixture *f = *state;
+	struct job *slow = add_job(f, "schedcopy", "/dev/a");
+	struct job *fail = add_job(f, "schedfail", "/dev/b");
+	struct job *barrier = add_job(f, "schedbarrier", "/dev/c");
+	struct job *after = add_job(f, "schedcopy", "/dev/d");
+
+	slow->slow = true;
+	assert_int_not_equal(install(f), 0);
+	assert_true(fail->started);
+	assert_true(slow->started);
+	assert_true(slow->ret < 0);
+	assert_false(barrier->started);
+	assert_false(after->started);
+
+	/* the abort does not leak into the next update */
+	slow->slow = false;
+	slow->started = fail->started = 0;
+	LIST_REMOVE(&fail->img, next);
+	assert_int_equal(install(f), 0);
+	assert_int_equal(slow->ret, 0);
+	assert_true(barrier->started);
+	assert_int_equal(after->ret, 0);
+}
+
+static void test_sched_no_threads(void **state)
+{
+	struct fixture *f = *state;
+	struct job *a = add_job(f, "schedcopy", "/dev/a");
+	struct job *b = add_job(f, "schedbarrier", "/dev/b");
+
+	threads_allowed = 0;
+	assert_int_not_equal(install(f), 0);
+	assert_false(a->started);
+	assert_false(b->started);
+
+	threads_allowed = ~0U;
+	assert_int_equal(install(f), 0);
+	assert_int_equal(a->ret, 0);
+	assert_true(b->started);
+}
+
+int main(void)
+{
+	int error_count = 0;
+	const struct CMUnitTest install_sched_tests[] = {
+		cmocka_unit_test_setup_teardown(test_sched_parallel, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_sched_conflict, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_sched_failure, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_sched_no_threads, setup, teardown),
+	};
+	error_count += cmocka_run_group_tests_name("install_sched",
+						   install_sched_tests,
+						   group_setup, NULL);
+	return error_count;
+}
@@ -0,0 +1,162 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <setjmp.h>
+#include <sys/uio.h>
+#include <cmocka.h>
+#include <ipc_batch.h>
+
+#define DATASIZE	(3 * 1024 * 1024 + 1234)
+#define CHUNK		16384	/* as passed by libcurl */
+
+static unsigned char *data;
+static unsigned char *out;
+static size_t outlen;
+static unsigned int sends;
+static bool fail_send;
+
+int __wrap_ipc_send_datav(int connfd, struct iovec *iov, int iovcnt);
+int __wrap_ipc_send_datav(int connfd, struct iovec *iov, int iovcnt)
+{
+	int i, total = 0;
+
+	assert_int_equal(connfd, 42);
+	if (fail_send)
+		return -1;
+	for (i = 0; i < iovcnt; i++) {
+		assert_true(outlen + iov[i].iov_len <= DATASIZE);
+		memcpy(out + outlen, iov[i].iov_base, iov[i].iov_len);
+		outlen += iov[i].iov_len;
+		total += iov[i].iov_len;
+	}
+	sends++;
+
+	return total;
+}
+
+static int setup(void **state)
+{
+	unsigned int i;
+
+	(void)state;
+	data = malloc(DATASIZE);
+	out = malloc(DATASIZE);
+	if (!data || !out)
+		return -1;
+	for (i = 0; i < DATASIZE; i++)
+		data[i] = i * 13 + (i >> 10);
+	outlen = 0;
+	sends = 0;
+	fail_send = false;
+
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	(void)state;
+	free(data);
+	free(out);
+
+	return 0;
+}
+
+static void write_chunks(struct ipc_batch *b, size_t chunk)
+{
+	size_t off, n;
+
+	for (off = 0; off < DATASIZE; off += n) {
+		n = DATASIZE - off < chunk ? DATASIZE - off : chunk;
+		assert_int_equal(ipc_batch_write(b, data + off, n), 0);
+	}
+}
+
+static void run_batch(bool thread, size_t chunk, unsigned int max_sends)
+{
+	struct ipc_batch *b = ipc_batch_new(42, thread);
+
+	assert_non_null(b);
+	write_chunks(b, chunk);
+	assert_int_equal(ipc_batch_close(b), 0);
+	assert_int_equal(outlen, DATASIZE);
+	assert_memory_equal(out, data, DATASIZE);
+	assert_true(sends <= max_sends);
+}
+
+/* Small chunks are sent in blocks of IPC_BATCH_SIZE */
+static void test_batch_direct(void **state)
+{
+	(void)state;
+	run_batch(false, CHUNK, DATASIZE / IPC_BATCH_SIZE + 1);
+}
+
+/* Large chunks are not held back */
+static void test_batch_large(void **state)
+{
+	(void)state;
+	run_batch(false, IPC_BATCH_SIZE * 2, DATASIZE / (IPC_BATCH_SIZE * 2) + 1);
+}
+
+/* The forward thread keeps the order of the data */
+static void test_batch_thread(void **state)
+{
+	(void)state;
+	run_batch(true, CHUNK - 1, DATASIZE / IPC_BATCH_SIZE + 1);
+}
+
+/* A failed write is reported to the following ones */
+static void test_batch_error(void **state)
+{
+	struct ipc_batch *b;
+	unsigned int i;
+
+	(void)state;
+	for (i = 0; i < 2; i++) {
+		b = ipc_batch_new(42, i);
+		assert_non_null(b);
+		fail_send = true;
+		assert_int_equal(ipc_batch_write(b, data, 100), 0);
+		assert_int_not_equal(ipc_batch_flush(b), 0);
+		assert_int_not_equal(ipc_batch_write(b, data, 100), 0);
+		assert_int_not_equal(ipc_batch_close(b), 0);
+		fail_send = false;
+	}
+	assert_int_equal(sends, 0);
+}
+
+int main(void)
+{
+	int error_count = 0;
+	const struct CMUnitTest ipc_batch_tests[] = {
+		cmocka_unit_test_setup_teardown(test_batch_direct, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_batch_large, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_batch_thread, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_batch_error, setup, teardown),
+	};
+	error_count += cmocka_run_group_tests_name("ipc_batch",
+						   ipc_batch_tests,
+						   NULL, NULL);
+	return error_count;
+}
@@ -0,0 +1,226 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <cmocka.h>
+#include <openssl/sha.h>
+#include <swupdate.h>
+#include <util.h>
+#include <checksum.h>
+#include <pipeline.h>
+
+/* more than PIPELINE_MIN_SIZE, without cpio padding */
+#define DATASIZE	(4 * PIPELINE_MIN_SIZE + 124)
+
+struct fixture {
+	char name[64];
+	int fd;
+	unsigned char *data;
+	unsigned char *out;
+	size_t outlen;
+	size_t fail_at;		/* the write fails after so many bytes */
+};
+
+static unsigned int threads;
+static unsigned int threads_allowed = ~0U;
+
+int __real_pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+			  void *(*start)(void *), void *arg);
+int __wrap_pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+			  void *(*start)(void *), void *arg);
+int __wrap_pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+			  void *(*start)(void *), void *arg)
+{
+	if (threads >= threads_allowed)
+		return EAGAIN;
+	threads++;
+
+	return __real_pthread_create(thread, attr, start, arg);
+}
+
+static int setup(void **state)
+{
+	struct fixture *f = calloc(1, sizeof(*f));
+	unsigned int i;
+
+	if (!f)
+		return -1;
+	f->data = malloc(DATASIZE);
+	f->out = malloc(DATASIZE);
+	if (!f->data || !f->out)
+		return -1;
+	for (i = 0; i < DATASIZE; i++)
+		f->data[i] = i * 11 + (i >> 9);
+
+	strcpy(f->name, "/tmp/test_pipeline.XXXXXX");
+	f->fd = mkstemp(f->name);
+	if (f->fd < 0 || write(f->fd, f->data, DATASIZE) != DATASIZE)
+		return -1;
+
+	cpio_checksum_init();
+	threads = 0;
+	threads_allowed = ~0U;
+	copy_abort(0);
+	*state = f;
+
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	struct fixture *f = *state;
+
+	close(f->fd);
+	unlink(f->name);
+	free(f->data);
+	free(f->out);
+	free(f);
+
+	return 0;
+}
+
+static int write_mem(void *out, const void *buf, unsigned int len)
+{
+	struct fixture *f = (struct fixture *)out;
+
+	if (f->fail_at && f->outlen + len > f->fail_at)
+		return -1;
+	assert_true(f->outlen + len <= DATASIZE);
+	memcpy(f->out + f->outlen, buf, len);
+	f->outlen += len;
+
+	return 0;
+}
+
+static int copy(struct fixture *f, unsigned int nbytes, uint32_t *checksum,
+		unsigned char *hash)
+{
+	unsigned long offs = 0;
+	int ret;
+
+	assert_int_equal(lseek(f->fd, 0, SEEK_SET), 0);
+	f->outlen = 0;
+	ret = copyfile(f->fd, f, nbytes, &offs, 0, 0, 0, checksum, hash, 0,
+			write_mem);
+	if (!ret)
+		assert_int_equal(offs, nbytes);
+
+	return ret;
+}
+
+static void check_output(struct fixture *f, uint32_t checksum)
+{
+	assert_int_equal(f->outlen, DATASIZE);
+	assert_memory_equal(f->out, f->data, DATASIZE);
+	assert_int_equal(checksum, cpio_checksum(0, f->data, DATASIZE));
+}
+
+static void test_pipeline_copy(void **state)
+{
+	struct fixture *f = *state;
+	uint32_t checksum;
+
+	assert_int_equal(copy(f, DATASIZE, &checksum, NULL), 0);
+	check_output(f, checksum);
+	assert_true(threads > 0);
+}
+
+/* If a stage cannot be started, the copy goes on serially */
+static void test_pipeline_fallback(void **state)
+{
+	struct fixture *f = *state;
+	unsigned char hash[SHA256_HASH_LENGTH];
+	uint32_t checksum;
+
+	threads_allowed = 0;
+	assert_int_equal(copy(f, DATASIZE, &checksum, NULL), 0);
+	check_output(f, checksum);
+	assert_int_equal(threads, 0);
+
+#ifdef CONFIG_HASH_VERIFY
+	/* the hash stage starts, the reader does not */
+	SHA256(f->data, DATASIZE, hash);
+	threads_allowed = 1;
+	threads = 0;
+	assert_int_equal(copy(f, DATASIZE, &checksum, hash), 0);
+	check_output(f, checksum);
+	assert_int_equal(threads, 1);
+#else
+	(void)hash;
+#endif
+}
+
+static void test_pipeline_write_error(void **state)
+{
+	struct fixture *f = *state;
+	uint32_t checksum;
+
+	f->fail_at = DATASIZE / 2;
+	assert_true(copy(f, DATASIZE, &checksum, NULL) < 0);
+	assert_true(f->outlen <= DATASIZE / 2);
+}
+
+/* The stream ends before the image */
+static void test_pipeline_short_input(void **state)
+{
+	struct fixture *f = *state;
+	uint32_t checksum;
+
+	assert_int_equal(ftruncate(f->fd, DATASIZE / 2), 0);
+	assert_true(copy(f, DATASIZE, &checksum, NULL) < 0);
+	assert_true(f->outlen <= DATASIZE / 2);
+}
+
+static void test_pipeline_abort(void **state)
+{
+	struct fixture *f = *state;
+	uint32_t checksum;
+
+	copy_abort(1);
+	assert_true(copy(f, DATASIZE, &checksum, NULL) < 0);
+	assert_int_equal(f->outlen, 0);
+	copy_abort(0);
+
+	assert_int_equal(copy(f, DATASIZE, &checksum, NULL), 0);
+	check_output(f, checksum);
+}
+
+int main(void)
+{
+	int error_count = 0;
+	const struct CMUnitTest pipeline_tests[] = {
+		cmocka_unit_test_setup_teardown(test_pipeline_copy, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_pipeline_fallback, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_pipeline_write_error, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_pipeline_short_input, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_pipeline_abort, setup, teardown),
+	};
+	error_count += cmocka_run_group_tests_name("pipeline",
+						   pipeline_tests,
+						   NULL, NULL);
+	return error_count;
+}
@@ -0,0 +1,184 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <swupdate.h>
+#include <util.h>
+#include <spool.h>
+
+#define BUDGET	((unsigned long long)CONFIG_SPOOL_MEM_BUDGET * 1024 * 1024)
+#define DATASIZE	1000
+
+static bool memfd_fails;
+
+int __real_memfd_create(const char *name, unsigned int flags);
+int __wrap_memfd_create(const char *name, unsigned int flags);
+int __wrap_memfd_create(const char *name, unsigned int flags)
+{
+	if (memfd_fails) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	return __real_memfd_create(name, flags);
+}
+
+static int setup(void **state)
+{
+	(void)state;
+	memfd_fails = false;
+
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	(void)state;
+	spool_clear();
+
+	return 0;
+}
+
+/* Stage a file and check that it reads back */
+static void stage(const char *fname, unsigned long long size)
+{
+	unsigned char data[DATASIZE], buf[DATASIZE];
+	unsigned int i;
+	int fd, rfd;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i * 13 + fname[0];
+
+	fd = spool_create(fname, size);
+	assert_true(fd >= 0);
+	assert_int_equal(write(fd, data, sizeof(data)), sizeof(data));
+
+	rfd = spool_open(fname);
+	assert_true(rfd >= 0);
+	assert_int_equal(read(rfd, buf, sizeof(buf)), sizeof(buf));
+	assert_memory_equal(buf, data, sizeof(data));
+	close(rfd);
+}
+
+static void test_spool_memory(void **state)
+{
+	struct spool_stats st;
+	unsigned char c1, c2;
+	int fd1, fd2;
+
+	(void)state;
+
+	stage("a", DATASIZE);
+	stage("b", DATASIZE);
+	spool_get_stats(&st);
+	assert_int_equal(st.nmem, 2);
+	assert_int_equal(st.ndisk, 0);
+	assert_int_equal(st.mem_used, 2 * DATASIZE);
+
+	/* each reader has its own position */
+	fd1 = spool_open("a");
+	fd2 = spool_open("a");
+	assert_true(fd1 >= 0 && fd2 >= 0);
+	assert_int_equal(read(fd1, &c1, 1), 1);
+	assert_int_equal(read(fd1, &c1, 1), 1);
+	assert_int_equal(read(fd2, &c2, 1), 1);
+	assert_int_not_equal(c1, c2);
+	close(fd1);
+	close(fd2);
+}
+
+/* What does not fit in the budget goes to disk */
+static void test_spool_over_budget(void **state)
+{
+	struct spool_stats st;
+
+	(void)state;
+
+	stage("a", DATASIZE);
+	stage("big", BUDGET);
+	spool_get_stats(&st);
+	assert_int_equal(st.nmem, 1);
+	assert_int_equal(st.ndisk, 1);
+	assert_int_equal(st.mem_used, DATASIZE);
+	assert_int_equal(st.disk_used, BUDGET);
+}
+
+/* If no memory file can be created, the file goes to disk */
+static void test_spool_memfd_fails(void **state)
+{
+	struct spool_stats st;
+
+	(void)state;
+
+	memfd_fails = true;
+	stage("a", DATASIZE);
+	spool_get_stats(&st);
+	assert_int_equal(st.nmem, 0);
+	assert_int_equal(st.ndisk, 1);
+	assert_int_equal(st.mem_used, 0);
+	assert_int_equal(st.disk_used, DATASIZE);
+
+	/* the budget is not lost */
+	memfd_fails = false;
+	stage("big", BUDGET);
+	spool_get_stats(&st);
+	assert_int_equal(st.nmem, 1);
+	assert_int_equal(st.mem_used, BUDGET);
+}
+
+static void test_spool_not_staged(void **state)
+{
+	char fname[MAX_IMAGE_FNAME + 1];
+
+	(void)state;
+
+	assert_true(spool_open("a") < 0);
+	stage("a", DATASIZE);
+	assert_true(spool_open("b") < 0);
+
+	memset(fname, 'x', sizeof(fname) - 1);
+	fname[sizeof(fname) - 1] = '\0';
+	assert_int_equal(spool_create(fname, DATASIZE), -EINVAL);
+
+	spool_clear();
+	assert_true(spool_open("a") < 0);
+}
+
+int main(void)
+{
+	int error_count = 0;
+	const struct CMUnitTest spool_tests[] = {
+		cmocka_unit_test_setup_teardown(test_spool_memory, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_spool_over_budget, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_spool_memfd_fails, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_spool_not_staged, setup, teardown),
+	};
+	error_count += cmocka_run_group_tests_name("spool", spool_tests,
+						   NULL, NULL);
+	return error_count;
+}
@@ -0,0 +1,215 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <swupdate.h>
+#include <util.h>
+#include <handler.h>
+#include <cpiohdr.h>
+#include <checksum.h>
+#include <installer.h>
+
+/* with two bytes of cpio padding */
+#define DATASIZE	(1024 * 1024 + 6)
+#define NIMGS		2
+
+struct consumer {
+	struct img_type img;
+	unsigned char *out;
+	size_t outlen;
+	bool fail;		/* the handler fails without reading */
+	int ret;
+};
+
+struct fixture {
+	char name[64];
+	int fd;
+	unsigned char *data;
+	struct imglist list;
+	struct consumer c[NIMGS];
+	struct filehdr fdh;
+};
+
+static int write_mem(void *out, const void *buf, unsigned int len)
+{
+	struct consumer *c = (struct consumer *)out;
+
+	assert_true(c->outlen + len <= DATASIZE);
+	memcpy(c->out + c->outlen, buf, len);
+	c->outlen += len;
+
+	return 0;
+}
+
+static int tee_handler(struct img_type *img, void __attribute__ ((__unused__)) *data)
+{
+	struct consumer *c = (struct consumer *)img;
+
+	if (c->fail)
+		return -1;
+	c->ret = copyimage(c, img, write_mem);
+
+	return c->ret;
+}
+
+static int group_setup(void **state)
+{
+	(void)state;
+	cpio_checksum_init();
+
+	return register_handler_flags("teetest", tee_handler, NULL,
+				      HANDLER_PARALLEL);
+}
+
+static int setup(void **state)
+{
+	struct fixture *f = calloc(1, sizeof(*f));
+	unsigned char pad[2] = { 0 };
+	unsigned int i;
+
+	if (!f)
+		return -1;
+	f->data = malloc(DATASIZE);
+	if (!f->data)
+		return -1;
+	for (i = 0; i < DATASIZE; i++)
+		f->data[i] = i * 5 + (i >> 12);
+
+	strcpy(f->name, "/tmp/test_stream_tee.XXXXXX");
+	f->fd = mkstemp(f->name);
+	if (f->fd < 0 || write(f->fd, f->data, DATASIZE) != DATASIZE ||
+	    write(f->fd, pad, sizeof(pad)) != sizeof(pad))
+		return -1;
+	lseek(f->fd, 0, SEEK_SET);
+
+	LIST_INIT(&f->list);
+	for (i = 0; i < NIMGS; i++) {
+		struct consumer *c = &f->c[i];
+
+		c->out = malloc(DATASIZE);
+		if (!c->out)
+			return -1;
+		strcpy(c->img.type, "teetest");
+		strcpy(c->img.fname, "rootfs.img");
+		c->img.provided = 1;
+		c->img.install_directly = 1;
+		c->ret = 1;
+		LIST_INSERT_HEAD(&f->list, &c->img, next);
+	}
+	f->fdh.size = DATASIZE;
+	f->fdh.chksum = cpio_checksum(0, f->data, DATASIZE);
+	strcpy(f->fdh.filename, "rootfs.img");
+	*state = f;
+
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	struct fixture *f = *state;
+	unsigned int i;
+
+	close(f->fd);
+	unlink(f->name);
+	for (i = 0; i < NIMGS; i++)
+		free(f->c[i].out);
+	free(f->data);
+	free(f);
+
+	return 0;
+}
+
+static int tee(struct fixture *f)
+{
+	unsigned long offs = 0;
+
+	assert_true(stream_needs_tee(&f->list, &f->c[0].img));
+
+	return stream_tee(f->fd, &f->fdh, &offs, &f->list, &f->c[0].img);
+}
+
+static void test_tee_all(void **state)
+{
+	struct fixture *f = *state;
+	unsigned int i;
+
+	assert_int_equal(tee(f), 0);
+	for (i = 0; i < NIMGS; i++) {
+		assert_int_equal(f->c[i].ret, 0);
+		assert_int_equal(f->c[i].outlen, DATASIZE);
+		assert_memory_equal(f->c[i].out, f->data, DATASIZE);
+	}
+}
+
+/* The stream ends early: the handlers fail, they do not see an EOF */
+static void test_tee_short_input(void **state)
+{
+	struct fixture *f = *state;
+	unsigned int i;
+
+	assert_int_equal(ftruncate(f->fd, DATASIZE / 2), 0);
+	assert_true(tee(f) < 0);
+	for (i = 0; i < NIMGS; i++) {
+		assert_true(f->c[i].ret < 0);
+		assert_true(f->c[i].outlen <= DATASIZE / 2);
+	}
+}
+
+static void test_tee_bad_checksum(void **state)
+{
+	struct fixture *f = *state;
+
+	f->fdh.chksum++;
+	assert_true(tee(f) < 0);
+}
+
+/* A failing handler does not stop the others */
+static void test_tee_handler_fails(void **state)
+{
+	struct fixture *f = *state;
+
+	f->c[0].fail = true;
+	assert_true(tee(f) < 0);
+	assert_int_equal(f->c[1].ret, 0);
+	assert_int_equal(f->c[1].outlen, DATASIZE);
+	assert_memory_equal(f->c[1].out, f->data, DATASIZE);
+}
+
+int main(void)
+{
+	int error_count = 0;
+	const struct CMUnitTest stream_tee_tests[] = {
+		cmocka_unit_test_setup_teardown(test_tee_all, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_tee_short_input, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_tee_bad_checksum, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_tee_handler_fails, setup, teardown),
+	};
+	error_count += cmocka_run_group_tests_name("stream_tee",
+						   stream_tee_tests,
+						   group_setup, NULL);
+	return error_count;
+}
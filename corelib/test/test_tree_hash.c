@@ -0,0 +1,140 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <openssl/sha.h>
+#include <swupdate.h>
+#include <sslapi.h>
+#include <util.h>
+
+#define CHUNK	64
+#define DATASIZE	(2 * CHUNK + 10)
+
+/* roots computed with the script in doc/source/signed_images.rst */
+#define ROOT_EMPTY \
+	"c0e50f0d90d6e2fea1e6f53d4f758ed5fc9035a399a8eb215c29c6ff3ea05425"
+#define ROOT_SHORT \
+	"bb190b30731322354560202e3678b0564605e1b21e863ab4ca1cad9c6ff178c9"
+#define ROOT_3CHUNKS \
+	"7b40175aa348e4901aae0641285aff49a0eff494a4238537ed9e28b1cac8eaf6"
+
+static void tree_root(const unsigned char *buf, size_t len, size_t piece,
+		      unsigned char *md)
+{
+	struct swupdate_tree_hash *t = swupdate_tree_hash_new(CHUNK);
+	unsigned int md_len = 0;
+	size_t n;
+
+	assert_non_null(t);
+	while (len) {
+		n = len < piece ? len : piece;
+		assert_int_equal(swupdate_tree_hash_update(t, buf, n), 0);
+		buf += n;
+		len -= n;
+	}
+	assert_int_equal(swupdate_tree_hash_final(t, md, &md_len), 1);
+	assert_int_equal(md_len, SHA256_HASH_LENGTH);
+	swupdate_tree_hash_free(t);
+}
+
+static void check_root(const unsigned char *buf, size_t len, const char *hex)
+{
+	unsigned char md[SHA256_HASH_LENGTH], expected[SHA256_HASH_LENGTH];
+	size_t piece;
+
+	assert_int_equal(ascii_to_hash(expected, hex), 0);
+	/* the split of the writes does not matter */
+	for (piece = 1; piece <= len + 1; piece += 37) {
+		tree_root(buf, len, piece, md);
+		assert_memory_equal(md, expected, SHA256_HASH_LENGTH);
+	}
+}
+
+static void fill(unsigned char *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = i * 7 + (i >> 8);
+}
+
+static void test_tree_vectors(void **state)
+{
+	unsigned char buf[DATASIZE];
+	unsigned int i;
+
+	(void)state;
+
+	check_root(buf, 0, ROOT_EMPTY);
+
+	for (i = 0; i < 50; i++)
+		buf[i] = i;
+	check_root(buf, 50, ROOT_SHORT);
+
+	fill(buf, DATASIZE);
+	check_root(buf, DATASIZE, ROOT_3CHUNKS);
+}
+
+/* The leaves of an artifact, given as data, do not have its root */
+static void test_tree_second_preimage(void **state)
+{
+	unsigned char buf[2 * CHUNK], leaf[1 + CHUNK];
+	unsigned char nodes[2 * SHA256_HASH_LENGTH];
+	unsigned char root[SHA256_HASH_LENGTH], forged[SHA256_HASH_LENGTH];
+	unsigned int i;
+
+	(void)state;
+
+	fill(buf, sizeof(buf));
+	tree_root(buf, sizeof(buf), sizeof(buf), root);
+
+	/* the two leaves, with and without the prefix of a leaf */
+	for (i = 0; i < 2; i++) {
+		leaf[0] = 0x00;
+		memcpy(leaf + 1, buf + i * CHUNK, CHUNK);
+		SHA256(leaf, sizeof(leaf), nodes + i * SHA256_HASH_LENGTH);
+	}
+	tree_root(nodes, sizeof(nodes), sizeof(nodes), forged);
+	assert_memory_not_equal(root, forged, SHA256_HASH_LENGTH);
+
+	for (i = 0; i < 2; i++)
+		SHA256(buf + i * CHUNK, CHUNK, nodes + i * SHA256_HASH_LENGTH);
+	tree_root(nodes, sizeof(nodes), sizeof(nodes), forged);
+	assert_memory_not_equal(root, forged, SHA256_HASH_LENGTH);
+}
+
+int main(void)
+{
+	int error_count = 0;
+	const struct CMUnitTest tree_hash_tests[] = {
+		cmocka_unit_test(test_tree_vectors),
+		cmocka_unit_test(test_tree_second_preimage),
+	};
+	error_count += cmocka_run_group_tests_name("tree_hash",
+						   tree_hash_tests,
+						   NULL, NULL);
+	return error_count;
+}
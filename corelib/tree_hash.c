@@ -0,0 +1,314 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+/*
+ * SHA-256 tree hash ("sha256-tree" in sw-description).
+ * The artifact is split in chunks of a fixed size (the last
+ * one can be shorter): each chunk is a leaf, its hash is
+ * SHA-256(0x00 || chunk). A parent node is
+ * SHA-256(0x01 || left || right), a node without a sibling
+ * goes up unchanged. As in RFC 6962, the prefixes keep a
+ * leaf from being taken for a node. The hash of the artifact
+ * is SHA-256(0x02 || length || top node), the length in
+ * bytes as 64 bits big endian, so that the number of chunks
+ * is bound too. An empty artifact has one empty chunk.
+ *
+ * The leaves do not depend on each other, so chunks are
+ * hashed by a pool of threads while data is still read.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <openssl/sha.h>
+#include "swupdate.h"
+#include "sslapi.h"
+#include "util.h"
+
+#define TREE_MAX_THREADS	CONFIG_HASH_TREE_THREADS
+#define TREE_NBUFS		(2 * TREE_MAX_THREADS)
+
+/* domain separation of leaves, nodes and root */
+#define TREE_LEAF		0x00
+#define TREE_NODE		0x01
+#define TREE_ROOT		0x02
+
+typedef enum {
+	CHUNK_FREE,
+	CHUNK_FILLING,
+	CHUNK_READY,
+	CHUNK_HASHING
+} chunk_state;
+
+struct tree_chunk {
+	unsigned char *data;	/* TREE_LEAF, then the chunk */
+	unsigned int len;	/* without the prefix */
+	unsigned long idx;	/* leaf number */
+	chunk_state state;
+};
+
+struct swupdate_tree_hash {
+	unsigned int chunk_size;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t threads[TREE_MAX_THREADS];
+	unsigned int nthreads;
+	bool stop;
+
+	struct tree_chunk chunks[TREE_NBUFS];
+	unsigned int nbufs;
+	struct tree_chunk *cur;
+
+	unsigned char (*leaves)[SHA256_HASH_LENGTH];
+	unsigned long nleaves;
+	unsigned long maxleaves;
+	unsigned long long total;	/* bytes of the artifact */
+};
+
+static void hash_chunk(struct swupdate_tree_hash *t, struct tree_chunk *c)
+{
+	unsigned char md[SHA256_HASH_LENGTH];
+
+	SHA256(c->data, c->len + 1, md);
+
+	pthread_mutex_lock(&t->lock);
+	memcpy(t->leaves[c->idx], md, sizeof(md));
+	c->state = CHUNK_FREE;
+	pthread_cond_broadcast(&t->cond);
+	pthread_mutex_unlock(&t->lock);
+}
+
+static struct tree_chunk *find_chunk(struct swupdate_tree_hash *t,
+					chunk_state state)
+{
+	unsigned int i;
+
+	for (i = 0; i < t->nbufs; i++) {
+		if (t->chunks[i].state == state)
+			return &t->chunks[i];
+	}
+
+	return NULL;
+}
+
+static void *tree_worker(void *data)
+{
+	struct swupdate_tree_hash *t = (struct swupdate_tree_hash *)data;
+	struct tree_chunk *c;
+
+	pthread_mutex_lock(&t->lock);
+	for (;;) {
+		while (!(c = find_chunk(t, CHUNK_READY)) && !t->stop)
+			pthread_cond_wait(&t->cond, &t->lock);
+		if (!c)
+			break;
+		c->state = CHUNK_HASHING;
+		pthread_mutex_unlock(&t->lock);
+
+		hash_chunk(t, c);
+
+		pthread_mutex_lock(&t->lock);
+	}
+	pthread_mutex_unlock(&t->lock);
+
+	return NULL;
+}
+
+/*
+ * Pass the current chunk to the workers, or hash it here
+ * if there are none. The caller gets a new free chunk.
+ */
+static int submit_chunk(struct swupdate_tree_hash *t)
+{
+	struct tree_chunk *c = t->cur;
+
+	pthread_mutex_lock(&t->lock);
+	if (t->nleaves == t->maxleaves) {
+		unsigned long n = t->maxleaves ? 2 * t->maxleaves : 64;
+		void *leaves;
+
+		/* workers write a leaf with the lock held */
+		leaves = realloc(t->leaves, n * SHA256_HASH_LENGTH);
+		if (!leaves) {
+			pthread_mutex_unlock(&t->lock);
+			return -ENOMEM;
+		}
+		t->leaves = leaves;
+		t->maxleaves = n;
+	}
+	c->idx = t->nleaves++;
+	c->state = CHUNK_READY;
+	pthread_mutex_unlock(&t->lock);
+
+	if (!t->nthreads) {
+		c->state = CHUNK_HASHING;
+		hash_chunk(t, c);
+	}
+
+	pthread_mutex_lock(&t->lock);
+	pthread_cond_broadcast(&t->cond);
+	while (!(t->cur = find_chunk(t, CHUNK_FREE)))
+		pthread_cond_wait(&t->cond, &t->lock);
+	t->cur->state = CHUNK_FILLING;
+	t->cur->len = 0;
+	pthread_mutex_unlock(&t->lock);
+
+	return 0;
+}
+
+static void tree_stop(struct swupdate_tree_hash *t)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&t->lock);
+	t->stop = true;
+	pthread_cond_broadcast(&t->cond);
+	pthread_mutex_unlock(&t->lock);
+
+	for (i = 0; i < t->nthreads; i++)
+		pthread_join(t->threads[i], NULL);
+	t->nthreads = 0;
+}
+
+void swupdate_tree_hash_free(struct swupdate_tree_hash *t)
+{
+	unsigned int i;
+
+	if (!t)
+		return;
+
+	tree_stop(t);
+	for (i = 0; i < t->nbufs; i++)
+		free(t->chunks[i].data);
+	free(t->leaves);
+	pthread_mutex_destroy(&t->lock);
+	pthread_cond_destroy(&t->cond);
+	free(t);
+}
+
+struct swupdate_tree_hash *swupdate_tree_hash_new(unsigned int chunk_size)
+{
+	struct swupdate_tree_hash *t;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int nthreads = TREE_MAX_THREADS;
+	unsigned int i;
+
+	if (!chunk_size)
+		return NULL;
+
+	t = (struct swupdate_tree_hash *)calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+
+	t->chunk_size = chunk_size;
+	pthread_mutex_init(&t->lock, NULL);
+	pthread_cond_init(&t->cond, NULL);
+
+	if (ncpus > 0 && (unsigned long)ncpus < nthreads)
+		nthreads = ncpus;
+	if (nthreads < 2)
+		nthreads = 0;	/* hash in the caller */
+
+	/* one chunk is filled while the others are hashed */
+	t->nbufs = nthreads ? 2 * nthreads : 1;
+	for (i = 0; i < t->nbufs; i++) {
+		t->chunks[i].data = (unsigned char *)malloc(chunk_size + 1);
+		if (!t->chunks[i].data) {
+			swupdate_tree_hash_free(t);
+			return NULL;
+		}
+		t->chunks[i].data[0] = TREE_LEAF;
+	}
+
+	for (t->nthreads = 0; t->nthreads < nthreads; t->nthreads++) {
+		if (pthread_create(&t->threads[t->nthreads], NULL,
+					tree_worker, t))
+			break;
+	}
+
+	t->cur = &t->chunks[0];
+	t->cur->state = CHUNK_FILLING;
+
+	return t;
+}
+
+int swupdate_tree_hash_update(struct swupdate_tree_hash *t,
+				const unsigned char *buf, size_t len)
+{
+	unsigned int n;
+
+	while (len > 0) {
+		n = min((size_t)(t->chunk_size - t->cur->len), len);
+		memcpy(t->cur->data + 1 + t->cur->len, buf, n);
+		t->cur->len += n;
+		t->total += n;
+		buf += n;
+		len -= n;
+
+		if (t->cur->len == t->chunk_size && submit_chunk(t) < 0)
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+int swupdate_tree_hash_final(struct swupdate_tree_hash *t,
+				unsigned char *md_value, unsigned int *md_len)
+{
+	unsigned char (*l)[SHA256_HASH_LENGTH];
+	unsigned char node[1 + 2 * SHA256_HASH_LENGTH];
+	unsigned long n, i;
+
+	if (t->cur->len || !t->nleaves) {
+		if (submit_chunk(t) < 0)
+			return -ENOMEM;
+	}
+
+	/* wait for the last leaves */
+	pthread_mutex_lock(&t->lock);
+	while (find_chunk(t, CHUNK_READY) || find_chunk(t, CHUNK_HASHING))
+		pthread_cond_wait(&t->cond, &t->lock);
+	pthread_mutex_unlock(&t->lock);
+	tree_stop(t);
+
+	l = t->leaves;
+	node[0] = TREE_NODE;
+	for (n = t->nleaves; n > 1; n = (n + 1) / 2) {
+		for (i = 0; i < n / 2; i++) {
+			memcpy(node + 1, l[2 * i], SHA256_HASH_LENGTH);
+			memcpy(node + 1 + SHA256_HASH_LENGTH, l[2 * i + 1],
+				SHA256_HASH_LENGTH);
+			SHA256(node, sizeof(node), l[i]);
+		}
+		if (n % 2)
+			memcpy(l[n / 2], l[n - 1], SHA256_HASH_LENGTH);
+	}
+
+	node[0] = TREE_ROOT;
+	for (i = 0; i < 8; i++)
+		node[1 + i] = t->total >> (56 - 8 * i);
+	memcpy(node + 9, l[0], SHA256_HASH_LENGTH);
+	SHA256(node, 9 + SHA256_HASH_LENGTH, md_value);
+	*md_len = SHA256_HASH_LENGTH;
+
+	return 1;
+}
@@ -357,12 +357,34 @@ struct swupdate_digest *swupdate_HASH_init(void)
 	return dgst;
 }
 
+struct swupdate_digest *swupdate_HASH_init_tree(unsigned int chunk_size)
+{
+	struct swupdate_digest *dgst;
+
+	dgst = calloc(1, sizeof(*dgst));
+	if (!dgst) {
+		return NULL;
+	}
+
+	dgst->tree = swupdate_tree_hash_new(chunk_size);
+	if (!dgst->tree) {
+		ERROR("Cannot set up tree hash with %u bytes chunks", chunk_size);
+		free(dgst);
+		return NULL;
+	}
+
+	return dgst;
+}
+
 int swupdate_HASH_update(struct swupdate_digest *dgst, unsigned char *buf,
 				size_t len)
 {
 	if (!dgst)
 		return -EFAULT;
 
+	if (dgst->tree)
+		return swupdate_tree_hash_update(dgst->tree, buf, len);
+
 	EVP_DigestUpdate (dgst->ctx, buf, len);
 
 	return 0;
@@ -374,6 +396,9 @@ int swupdate_HASH_final(struct swupdate_digest *dgst, unsigned char *md_value,
 	if (!dgst)
 		return -EFAULT;
 
+	if (dgst->tree)
+		return swupdate_tree_hash_final(dgst->tree, md_value, md_len);
+
 	return EVP_DigestFinal_ex (dgst->ctx, md_value, md_len);
 
 }
@@ -381,7 +406,10 @@ int swupdate_HASH_final(struct swupdate_digest *dgst, unsigned char *md_value,
 void swupdate_HASH_cleanup(struct swupdate_digest *dgst)
 {
 	if (dgst) {
-		EVP_MD_CTX_destroy(dgst->ctx);
+		if (dgst->tree)
+			swupdate_tree_hash_free(dgst->tree);
+		else
+			EVP_MD_CTX_destroy(dgst->ctx);
 		free(dgst);
 		dgst = NULL;
 	}
@@ -0,0 +1,242 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+/*
+ * The artifact is a binary patch against the content of
+ * another partition ("source"). The new image is rebuilt
+ * while the patch is streamed and written to "device".
+ * The source can be checked with "source-sha256" before
+ * it is used, the result must match "output-sha256".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "swupdate.h"
+#include "handler.h"
+#include "util.h"
+#include "sslapi.h"
+#include "bspatch.h"
+
+#define DELTA_BUF_SIZE	(64 * 1024)
+
+void delta_handler(void);
+
+struct delta_out {
+	int fd;		/* must be first: copyfile() seeks on it */
+	struct bspatch *bp;
+	struct swupdate_digest *dgst;
+};
+
+static int delta_patch(void *out, const void *buf, unsigned int len)
+{
+	struct delta_out *d = (struct delta_out *)out;
+
+	return bspatch_write(d->bp, buf, len);
+}
+
+static int delta_write(void *out, const void *buf, unsigned int len)
+{
+	struct delta_out *d = (struct delta_out *)out;
+	const unsigned char *data = (const unsigned char *)buf;
+	ssize_t ret;
+
+	if (swupdate_HASH_update(d->dgst, (unsigned char *)buf, len) < 0)
+		return -EFAULT;
+
+	while (len > 0) {
+		ret = write(d->fd, data, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			ERROR("cannot write %u bytes: %s", len,
+				ret < 0 ? strerror(errno) : "no space left");
+			return -1;
+		}
+		data += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static int delta_check_hash(struct swupdate_digest *dgst,
+		unsigned char *expected, const char *what)
+{
+	unsigned char md_value[64];
+	unsigned int md_len = 0;
+	char hashstring[2 * SHA256_HASH_LENGTH + 1];
+	char newhashstring[2 * SHA256_HASH_LENGTH + 1];
+
+	if (swupdate_HASH_final(dgst, md_value, &md_len) < 0)
+		return -EFAULT;
+
+	if (md_len != SHA256_HASH_LENGTH ||
+	    swupdate_HASH_compare(expected, md_value)) {
+		hash_to_ascii(expected, hashstring);
+		hash_to_ascii(md_value, newhashstring);
+		ERROR("HASH mismatch for %s : %s <--> %s", what,
+			hashstring, newhashstring);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+static int delta_check_source(int fd, unsigned long long size,
+		unsigned char *hash)
+{
+	struct swupdate_digest *dgst;
+	unsigned char *buf;
+	unsigned long long pos;
+	ssize_t n;
+	int ret = 0;
+
+	dgst = swupdate_HASH_init();
+	buf = (unsigned char *)malloc(DELTA_BUF_SIZE);
+	if (!dgst || !buf) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (pos = 0; pos < size; pos += n) {
+		n = pread(fd, buf, min((unsigned long long)DELTA_BUF_SIZE,
+					size - pos), pos);
+		if (n < 0 && errno == EINTR) {
+			n = 0;
+			continue;
+		}
+		if (n <= 0) {
+			ERROR("Cannot read source at %llu", pos);
+			ret = -EIO;
+			goto out;
+		}
+		if (swupdate_HASH_update(dgst, buf, n) < 0) {
+			ret = -EFAULT;
+			goto out;
+		}
+	}
+
+	ret = delta_check_hash(dgst, hash, "source");
+
+out:
+	if (dgst)
+		swupdate_HASH_cleanup(dgst);
+	free(buf);
+	return ret;
+}
+
+static int install_delta_image(struct img_type *img,
+	void __attribute__ ((__unused__)) *data)
+{
+	struct delta_out d;
+	unsigned long long srcsize;
+	off_t end;
+	int srcfd;
+	int ret, err;
+
+	if (!strlen(img->source)) {
+		ERROR("Image %s: missing source for the patch", img->fname);
+		return -EINVAL;
+	}
+	if (!strcmp(img->source, img->device)) {
+		ERROR("Image %s: patch cannot be applied in place on %s",
+			img->fname, img->device);
+		return -EINVAL;
+	}
+	if (!IsValidHash(img->output_sha256)) {
+		ERROR("Image %s: output-sha256 is required", img->fname);
+		return -EINVAL;
+	}
+
+	srcfd = open(img->source, O_RDONLY);
+	if (srcfd < 0) {
+		ERROR("Source %s cannot be opened: %s",
+			img->source, strerror(errno));
+		return -ENODEV;
+	}
+
+	if (img->source_size > 0) {
+		srcsize = img->source_size;
+	} else {
+		end = lseek(srcfd, 0, SEEK_END);
+		if (end < 0) {
+			ERROR("Size of %s unknown", img->source);
+			close(srcfd);
+			return -EIO;
+		}
+		srcsize = end;
+	}
+
+	if (IsValidHash(img->source_sha256)) {
+		ret = delta_check_source(srcfd, srcsize, img->source_sha256);
+		if (ret < 0) {
+			ERROR("Source %s does not match the patch", img->source);
+			close(srcfd);
+			return ret;
+		}
+	}
+
+	memset(&d, 0, sizeof(d));
+	d.fd = open(img->device, O_RDWR);
+	if (d.fd < 0) {
+		ERROR("Device %s cannot be opened: %s",
+			img->device, strerror(errno));
+		close(srcfd);
+		return -ENODEV;
+	}
+
+	d.dgst = swupdate_HASH_init();
+	d.bp = bspatch_init(srcfd, srcsize, &d, delta_write);
+	if (!d.dgst || !d.bp) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	TRACE("Patching %s from %s", img->device, img->source);
+
+	ret = copyimage(&d, img, delta_patch);
+	err = bspatch_end(d.bp);
+	d.bp = NULL;
+	if (!ret)
+		ret = err;
+	if (!ret)
+		ret = delta_check_hash(d.dgst, img->output_sha256,
+				img->device);
+
+out:
+	if (d.bp)
+		bspatch_end(d.bp);
+	if (d.dgst)
+		swupdate_HASH_cleanup(d.dgst);
+	close(d.fd);
+	close(srcfd);
+	return ret;
+}
+
+__attribute__((constructor))
+void delta_handler(void)
+{
+	register_handler_flags("delta", install_delta_image, NULL,
+				HANDLER_PARALLEL);
+}
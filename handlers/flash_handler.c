@@ -43,6 +43,7 @@
 #include "util.h"
 #include "flash.h"
 #include "progress.h"
+#include "diff_writer.h"
 
 #define PROCMTD	"/proc/mtd"
 #define LINESIZE	80
@@ -267,6 +268,61 @@ closeall:
 	return 0;
 }
 
+struct nor_diff {
+	struct flash_description *flash;
+	struct mtd_dev_info *mtd;
+	int fd;
+};
+
+/* Called by the diff writer for each run of erase blocks that changed */
+static int flash_erase_run(void *priv, unsigned long long offset,
+		unsigned int len)
+{
+	struct nor_diff *nd = (struct nor_diff *)priv;
+	unsigned int eb;
+
+	for (eb = offset / nd->mtd->eb_size;
+	     eb < (offset + len) / nd->mtd->eb_size; eb++) {
+		if (mtd_erase(nd->flash->libmtd, nd->mtd, nd->fd, eb) != 0) {
+			ERROR("MTD Erase failure at block %u", eb);
+			return -EIO;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * The partition is not erased in advance: the erase blocks
+ * that are unchanged are skipped, the others are erased
+ * and written. The blocks after the image are erased
+ * as in the normal case.
+ */
+static int flash_write_nor_diff(int mtdnum, int fdout, struct img_type *img)
+{
+	struct flash_description *flash = get_flash_info();
+	struct diff_writer dw;
+	struct nor_diff nd;
+	int ret, err;
+
+	nd.flash = flash;
+	nd.mtd = &flash->mtd_info[mtdnum].mtd;
+	nd.fd = fdout;
+
+	ret = diff_writer_init(&dw, fdout, 0, nd.mtd->eb_size, EMPTY_BYTE);
+	if (ret < 0)
+		return ret;
+	dw.prepare = flash_erase_run;
+	dw.priv = &nd;
+
+	ret = copyimage(&dw, img, diff_writer_write);
+	err = diff_writer_close(&dw);
+	if (ret < 0 || err < 0)
+		return -1;
+
+	return flash_erase_from(mtdnum, dw.offset / nd.mtd->eb_size);
+}
+
 static int flash_write_nor(int mtdnum, struct img_type *img)
 {
 	int fdout;
@@ -285,7 +341,10 @@ static int flash_write_nor(int mtdnum, struct img_type *img)
 		return -1;
 	}
 
-	ret = copyimage(&fdout, img, NULL);
+	if (img->write_if_different)
+		ret = flash_write_nor_diff(mtdnum, fdout, img);
+	else
+		ret = copyimage(&fdout, img, NULL);
 
 	/* tell 'nbytes == 0' (EOF) from 'nbytes < 0' (read error) */
 	if (ret < 0) {
@@ -313,6 +372,7 @@ static int install_flash_image(struct img_type *img,
 	int mtdnum;
 	int n;
 	const char* TMPDIR = get_tmpdir();
+	struct flash_description *flash = get_flash_info();
 
 	n = snprintf(filename, sizeof(filename), "%s%s", TMPDIR, img->fname);
 	if (n < 0 || n >= sizeof(filename)) {
@@ -330,7 +390,12 @@ static int install_flash_image(struct img_type *img,
 		return -1;
 	}
 
-	if(flash_erase(mtdnum)) {
+	/*
+	 * With write-if-different, a NOR flash is erased
+	 * block by block while it is written
+	 */
+	if ((!img->write_if_different || isNand(flash, mtdnum)) &&
+	    flash_erase(mtdnum)) {
 		ERROR("I cannot erasing %s",
 			img->device);
 		return -1;
@@ -349,5 +414,8 @@ static int install_flash_image(struct img_type *img,
 __attribute__((constructor))
 void flash_handler(void)
 {
-	register_handler("flash", install_flash_image, NULL);
+	/* NAND is written from img->fdin */
+	register_handler_flags("flash", install_flash_image, NULL,
+				HANDLER_PARALLEL | HANDLER_MTD |
+				HANDLER_RAW_INPUT);
 }
@@ -29,24 +29,77 @@
 #include "swupdate.h"
 #include "handler.h"
 #include "util.h"
+#include "async_writer.h"
+#include "diff_writer.h"
 
 void raw_handler(void);
 void raw_filecopy_handler(void);
 
+#define RAW_DIFF_BLOCK_SIZE	4096
+
+/*
+ * Only the blocks that differ from the
+ * content of the device are written
+ */
+static int install_raw_diff(struct img_type *img)
+{
+	struct diff_writer dw;
+	int ret, err;
+	int fdout;
+
+	fdout = open(img->device, O_RDWR);
+	if (fdout < 0) {
+		TRACE("Device %s cannot be opened: %s",
+				img->device, strerror(errno));
+		return -1;
+	}
+
+	ret = diff_writer_init(&dw, fdout, img->seek, RAW_DIFF_BLOCK_SIZE, -1);
+	if (ret < 0) {
+		close(fdout);
+		return ret;
+	}
+	ret = copyimage(&dw, img, diff_writer_write);
+	err = diff_writer_close(&dw);
+
+	close(fdout);
+	return ret < 0 ? ret : err;
+}
+
 static int install_raw_image(struct img_type *img,
 	void __attribute__ ((__unused__)) *data)
 {
-	int ret;
+	struct async_writer *aw;
+	int ret, err;
 	int fdout;
 
+	if (img->write_if_different)
+		return install_raw_diff(img);
+
+	if (img->async_write) {
+		aw = async_writer_open(img->device, img->seek,
+				img->queue_depth);
+		if (aw) {
+			ret = copyimage(aw, img, async_writer_write);
+			err = async_writer_close(aw);
+			return ret < 0 ? ret : err;
+		}
+	}
+
 	fdout = open(img->device, O_RDWR);
 	if (fdout < 0) {
 		TRACE("Device %s cannot be opened: %s",
 				img->device, strerror(errno));
 		return -1;
 	}
-	
-	ret = copyimage(&fdout, img, NULL);
+
+	/*
+	 * Plain images are moved by the kernel,
+	 * go through copyimage() if this is not possible
+	 */
+	ret = copyimage_direct(fdout, img);
+	if (ret == -EAGAIN)
+		ret = copyimage(&fdout, img, NULL);
 
 	close(fdout);
 	return ret;
@@ -90,7 +143,9 @@ static int install_raw_file(struct img_type *img,
 	TRACE("Installing file %s on %s\n",
 		img->fname, path);
 	fdout = openfileoutput(path);
-	ret = copyimage(&fdout, img, NULL);
+	ret = copyimage_direct(fdout, img);
+	if (ret == -EAGAIN)
+		ret = copyimage(&fdout, img, NULL);
 	if (ret< 0) {
 		ERROR("Error copying extracted file\n");
 	}
@@ -106,11 +161,13 @@ static int install_raw_file(struct img_type *img,
 __attribute__((constructor))
 void raw_handler(void)
 {
-	register_handler("raw", install_raw_image, NULL);
+	register_handler_flags("raw", install_raw_image, NULL,
+				HANDLER_PARALLEL);
 }
 
 	__attribute__((constructor))
 void raw_filecopy_handler(void)
 {
-	register_handler("rawfile", install_raw_file, NULL);
+	register_handler_flags("rawfile", install_raw_file, NULL,
+				HANDLER_PARALLEL);
 }
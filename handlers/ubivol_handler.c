@@ -251,6 +251,8 @@ static int adjust_volume(struct img_type *cfg,
 __attribute__((constructor))
 void ubi_handler(void)
 {
-	register_handler("ubivol", install_ubivol_image, NULL);
-	register_handler("ubipartition", adjust_volume, NULL);
+	register_handler_flags("ubivol", install_ubivol_image, NULL,
+				HANDLER_PARALLEL | HANDLER_MTD);
+	register_handler_flags("ubipartition", adjust_volume, NULL,
+				HANDLER_PARALLEL | HANDLER_MTD);
 }
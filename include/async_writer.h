@@ -0,0 +1,68 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#ifndef _SWUPDATE_ASYNC_WRITER_H
+#define _SWUPDATE_ASYNC_WRITER_H
+
+struct async_writer;
+
+/*
+ * Open device for writing with O_DIRECT, starting at offset,
+ * with up to depth writes in flight (0 for the default).
+ * It returns NULL if the device cannot be written this way,
+ * for example if offset is not aligned: the caller should
+ * then write it as usual.
+ *
+ * The writer is passed as "out" to copyimage() together
+ * with async_writer_write() as callback.
+ */
+#ifdef CONFIG_ASYNC_WRITER
+struct async_writer *async_writer_open(const char *device,
+		unsigned long long offset, unsigned int depth);
+int async_writer_write(void *out, const void *buf, unsigned int len);
+
+/*
+ * Flush the data, wait for all writes and release the writer.
+ * It returns the first error of any write.
+ */
+int async_writer_close(struct async_writer *aw);
+#else
+static inline struct async_writer *async_writer_open(
+		const char __attribute__ ((__unused__)) *device,
+		unsigned long long __attribute__ ((__unused__)) offset,
+		unsigned int __attribute__ ((__unused__)) depth)
+{
+	return NULL;
+}
+
+static inline int async_writer_write(void __attribute__ ((__unused__)) *out,
+		const void __attribute__ ((__unused__)) *buf,
+		unsigned int __attribute__ ((__unused__)) len)
+{
+	return -1;
+}
+
+static inline int async_writer_close(
+		struct async_writer __attribute__ ((__unused__)) *aw)
+{
+	return -1;
+}
+#endif
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#ifndef _SWUPDATE_BSPATCH_H
+#define _SWUPDATE_BSPATCH_H
+
+#include "util.h"
+
+struct bspatch;
+
+/*
+ * Apply a patch in bsdiff 4.3 format ("ENDSLEY/BSDIFF43")
+ * while it is streamed. The old data is read from srcfd,
+ * that must be at least srcsize bytes, the new data is
+ * passed to callback with out as first argument.
+ */
+struct bspatch *bspatch_init(int srcfd, unsigned long long srcsize,
+		void *out, writeimage callback);
+
+/* Feed the next len bytes of the patch */
+int bspatch_write(struct bspatch *bp, const void *buf, unsigned int len);
+
+/*
+ * Release the context. It returns an error if the
+ * patch is not complete.
+ */
+int bspatch_end(struct bspatch *bp);
+
+#endif
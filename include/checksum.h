@@ -0,0 +1,55 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#ifndef _SWUPDATE_CHECKSUM_H
+#define _SWUPDATE_CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The checksum of a newc (070702) cpio entry is the
+ * sum of all bytes of the file, truncated to 32 bit.
+ * A kernel adds len bytes from buf to sum and returns it.
+ */
+typedef uint32_t (*cpio_checksum_fn)(uint32_t sum,
+				const unsigned char *buf, size_t len);
+
+struct cpio_checksum_impl {
+	const char *name;
+	cpio_checksum_fn fn;
+	int (*supported)(void);	/* NULL if always available */
+};
+
+/*
+ * Select the fastest kernel the CPU supports.
+ * It is called once at startup, cpio_checksum()
+ * calls it anyway if this was not done.
+ */
+void cpio_checksum_init(void);
+const char *cpio_checksum_name(void);
+uint32_t cpio_checksum(uint32_t sum, const unsigned char *buf, size_t len);
+
+/*
+ * All kernels built into SWUpdate, the first one
+ * is the scalar reference. Used by tests and benchmarks.
+ */
+const struct cpio_checksum_impl *cpio_checksum_impls(unsigned int *count);
+
+#endif
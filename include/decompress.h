@@ -0,0 +1,105 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#ifndef _SWUPDATE_DECOMPRESS_H
+#define _SWUPDATE_DECOMPRESS_H
+
+#include <stdint.h>
+#include "util.h"
+
+/*
+ * Value of the "compressed" attribute of an image.
+ * A boolean "true" in sw-description means zlib (gzip).
+ */
+typedef enum {
+	COMPRESSED_NONE = 0,
+	COMPRESSED_ZLIB = 1,
+	COMPRESSED_ZSTD,
+	COMPRESSED_XZ,
+	COMPRESSED_LZ4
+} compression_type;
+
+/*
+ * Input of a decompressor: the compressed data is read
+ * from the stream, checksum and hash are computed on it
+ * and it is decrypted if required. Progress is updated
+ * while the data is consumed.
+ */
+struct decompress_in {
+	int infile;
+	unsigned long *offs;
+	uint32_t *checksum;
+	void *dgst;
+	void *dcrypt;		/* NULL if not encrypted */
+	unsigned char *cryptbuf;	/* encrypted data before decryption */
+	int decrypted;		/* decryption is finalized */
+	int nbytes;		/* bytes still to be read */
+	int total;
+	unsigned int percent;
+	unsigned long long nsec;	/* time spent in decompress_read() */
+};
+
+/*
+ * Output of a decompressor: data is passed to the
+ * callback of copyfile(), nothing is written if out is NULL
+ */
+struct decompress_out {
+	void *out;
+	writeimage callback;
+	unsigned long long nsec;	/* time spent in decompress_write() */
+	unsigned long long bytes;
+};
+
+typedef int (*decompress_fn)(struct decompress_in *in,
+		struct decompress_out *out);
+
+struct decompressor {
+	const char *desc;
+	compression_type type;
+	decompress_fn decompress;
+};
+
+void print_registered_decompressors(void);
+
+/*
+ * Map the name used in sw-description to the compression type,
+ * returns -1 if the name is unknown
+ */
+int get_compression_type(const char *name);
+const char *get_compression_name(int type);
+
+/*
+ * Read up to size bytes of (decrypted) compressed data into buf.
+ * It returns the number of bytes, 0 at the end of the data
+ * and a negative value on error.
+ */
+int decompress_read(struct decompress_in *in, unsigned char *buf,
+		unsigned int size);
+
+/* Pass len bytes of decompressed data to the output */
+int decompress_write(struct decompress_out *out, const unsigned char *buf,
+		unsigned int len);
+
+/* Backends */
+int gunzip_image(struct decompress_in *in, struct decompress_out *out);
+int zstd_image(struct decompress_in *in, struct decompress_out *out);
+int xz_image(struct decompress_in *in, struct decompress_out *out);
+int lz4_image(struct decompress_in *in, struct decompress_out *out);
+
+#endif
@@ -0,0 +1,61 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#ifndef _SWUPDATE_DIFF_WRITER_H
+#define _SWUPDATE_DIFF_WRITER_H
+
+/*
+ * Called before a run of blocks is written, for example
+ * to erase them on a NOR flash
+ */
+typedef int (*diff_prepare)(void *priv, unsigned long long offset,
+		unsigned int len);
+
+/*
+ * Writer that reads back the target block by block and
+ * writes only the blocks that differ from the new data.
+ * It is passed as "out" to copyimage() together with
+ * diff_writer_write() as callback.
+ */
+struct diff_writer {
+	int fd;		/* must be first: copyfile() seeks on it */
+	unsigned long long offset;	/* offset of buf on the target */
+	unsigned int blocksize;
+	unsigned int chunksize;
+	int fill;	/* the last block is padded with it, -1 if not */
+	unsigned char *buf;
+	unsigned char *cmp;
+	unsigned int len;
+	unsigned long long written;	/* blocks */
+	unsigned long long skipped;
+	diff_prepare prepare;
+	void *priv;
+};
+
+int diff_writer_init(struct diff_writer *dw, int fd,
+		unsigned long long offset, unsigned int blocksize, int fill);
+int diff_writer_write(void *out, const void *buf, unsigned int len);
+
+/*
+ * Write the data still buffered, report the number of
+ * blocks written and skipped and release the buffers
+ */
+int diff_writer_close(struct diff_writer *dw);
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#ifndef _DOWNLOAD_CACHE_H
+#define _DOWNLOAD_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <limits.h>
+#include <errno.h>
+#include <curl/curl.h>
+
+#define DL_CACHE_HASH_MAX	128
+#define DL_CACHE_VALIDATOR_MAX	128
+/* the data is synced, and can be resumed, every so many bytes */
+#define DL_CACHE_SYNC_SIZE	(4 * 1024 * 1024)
+
+/* Where the downloads are kept, max_size 0 means no limit */
+struct dl_cache {
+	char *dir;
+	unsigned long long max_size;
+};
+
+/*
+ * An artifact in the cache, identified by its URL and by the
+ * hash the server announced for it, if any. The data is
+ * kept across restarts: size bytes can be replayed and the
+ * download resumed from there.
+ */
+struct dl_cache_entry {
+	const struct dl_cache *cache;
+	int fd;				/* negative: not cached */
+	char name[PATH_MAX - 16];	/* path without suffix */
+	char *url;
+	char hash[DL_CACHE_HASH_MAX + 1];
+	char validator[DL_CACHE_VALIDATOR_MAX];	/* ETag or Last-Modified */
+	unsigned long long size;	/* bytes in the cache */
+	unsigned long long synced;	/* bytes in the meta file */
+	unsigned long long total;	/* length of the artifact, 0 if not known */
+	unsigned long long others;	/* bytes of the other entries */
+	bool complete;
+};
+
+/* Receives the cached data, returns a negative value on error */
+typedef int (*dl_cache_sink)(void *ctx, char *buf, size_t len);
+
+#ifdef CONFIG_DOWNLOAD_CACHE
+/*
+ * Open the entry of url and hash (it can be NULL), it is
+ * created if it does not exist. The other functions do
+ * nothing on an entry that could not be opened or that was
+ * dropped after an error, the download goes on without cache.
+ */
+int dl_cache_open(const struct dl_cache *cache, const char *url,
+		  const char *hash, struct dl_cache_entry *e);
+
+/*
+ * An entry with a hash is valid as it is. Without a hash,
+ * ask the server with a HEAD request on curl, that is set
+ * up by the caller for url, and drop the data if the
+ * artifact has changed.
+ */
+int dl_cache_validate(struct dl_cache_entry *e, CURL *curl);
+
+/* Pass the cached bytes to sink */
+int dl_cache_replay(struct dl_cache_entry *e, dl_cache_sink sink, void *ctx);
+
+/* Append downloaded data */
+void dl_cache_write(struct dl_cache_entry *e, const void *buf, size_t len);
+
+/* The download is complete */
+void dl_cache_done(struct dl_cache_entry *e);
+
+/* Keep the entry for a later run */
+void dl_cache_close(struct dl_cache_entry *e);
+
+/* Delete the entry, for example if the data is wrong */
+void dl_cache_remove(struct dl_cache_entry *e);
+#else
+static inline int dl_cache_open(const struct dl_cache __attribute__ ((__unused__)) *cache,
+		const char __attribute__ ((__unused__)) *url,
+		const char __attribute__ ((__unused__)) *hash,
+		struct dl_cache_entry *e)
+{
+	e->fd = -1;
+	e->size = 0;
+	e->complete = false;
+	return -ENOSYS;
+}
+
+static inline int dl_cache_validate(struct dl_cache_entry __attribute__ ((__unused__)) *e,
+		CURL __attribute__ ((__unused__)) *curl)
+{
+	return -ENOSYS;
+}
+
+static inline int dl_cache_replay(struct dl_cache_entry __attribute__ ((__unused__)) *e,
+		dl_cache_sink __attribute__ ((__unused__)) sink,
+		void __attribute__ ((__unused__)) *ctx)
+{
+	return 0;
+}
+
+static inline void dl_cache_write(struct dl_cache_entry __attribute__ ((__unused__)) *e,
+		const void __attribute__ ((__unused__)) *buf,
+		size_t __attribute__ ((__unused__)) len) { }
+
+static inline void dl_cache_done(struct dl_cache_entry __attribute__ ((__unused__)) *e) { }
+static inline void dl_cache_close(struct dl_cache_entry __attribute__ ((__unused__)) *e) { }
+static inline void dl_cache_remove(struct dl_cache_entry __attribute__ ((__unused__)) *e) { }
+#endif
+
+#endif
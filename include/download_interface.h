@@ -21,6 +21,8 @@
 #ifndef _DWL_INTERFACE_H
 #define _DWL_INTERFACE_H
 
+#include <stddef.h>
+
 /*
  * This is used by swupdate to start the Downloader Process
  */
@@ -28,4 +30,35 @@ int start_download(const char *cfgfname, int argc, char *argv[]);
 
 void download_print_help(void);
 
+struct dl_cache_entry;
+
+/*
+ * Options of a segmented download: the image is fetched in
+ * segment_size ranges, connections at once, from the urls
+ * that are mirrors of the same image, starting at offset.
+ * The data is also appended to cache, if it is set.
+ */
+struct dwl_segment_opts {
+	const char **urls;
+	unsigned int nurls;
+	unsigned int connections;
+	size_t segment_size;
+	unsigned int retries;		/* per segment, 0 means indefinitely */
+	unsigned int retry_delay;	/* seconds before reusing the same URL */
+	unsigned long lowspeed_time;
+	unsigned long long offset;
+	struct dl_cache_entry *cache;
+};
+
+/*
+ * Download the image and send it in order to the installer on fd.
+ * It returns -ENOTSUP without sending anything if the server
+ * does not support ranges, the caller can then fall back to a
+ * single connection. curl_global_init() must have been called.
+ * sent is set to the offset in the image up to which the data
+ * was sent, also on error: the download can be resumed there.
+ */
+int download_segments(const struct dwl_segment_opts *opts, int fd,
+		      unsigned long long *sent);
+
 #endif
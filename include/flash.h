@@ -31,6 +31,7 @@
 #define UBI_DATA_VOLNAME	"data"
 #define UBI_DATACPY_VOLNAME	"datacpy"
 #define MTD_FS_DEVICE		7
+#define EMPTY_BYTE		0xFF
 
 struct ubi_part {
 	struct ubi_vol_info vol_info;
@@ -68,6 +69,8 @@ void mtd_cleanup (void);
 int get_mtd_from_device(char *s);
 int get_mtd_from_name(const char *s);
 int flash_erase(int mtdnum);
+/* erase the blocks from eb_start to the end, skipping the empty ones */
+int flash_erase_from(int mtdnum, unsigned int eb_start);
 
 struct flash_description *get_flash_info(void);
 #define isNand(flash, index) \
@@ -29,15 +29,29 @@ typedef enum {
 	POSTINSTALL
 } script_fn ;
 
+/* The handler can run at the same time as other handlers */
+#define HANDLER_PARALLEL	(1 << 0)
+/* The handler uses the MTD / UBI layer, that is not shared */
+#define HANDLER_MTD		(1 << 1)
+/*
+ * The handler reads img->fdin itself instead of calling
+ * copyimage(): a tree hash is not checked, and the cpio
+ * checksum may not be either
+ */
+#define HANDLER_RAW_INPUT	(1 << 2)
+
 typedef int (*handler)(struct img_type *img, void *data);
 struct installer_handler{
 	char	desc[64];
 	handler installer;
 	void	*data;
+	unsigned int flags;
 };
 
 int register_handler(const char *desc, 
 		handler installer, void *data);
+int register_handler_flags(const char *desc, handler installer,
+		void *data, unsigned int flags);
 
 struct installer_handler *find_handler(struct img_type *img);
 void print_registered_handlers(void);
@@ -21,6 +21,7 @@
 #ifndef _INSTALLER_H
 #define _INSTALLER_H
 
+#include <stdbool.h>
 #include "swupdate.h"
 #include "handler.h"
 #include "cpiohdr.h"
@@ -30,6 +31,9 @@ int check_if_required(struct imglist *list, struct filehdr *pfdh,
 				struct img_type **pimg);
 int install_images(struct swupdate_cfg *sw, int fdsw, int fromfile);
 int install_single_image(struct img_type *img);
+bool stream_needs_tee(struct imglist *list, struct img_type *img);
+int stream_tee(int fdin, struct filehdr *fdh, unsigned long *offs,
+		struct imglist *list, struct img_type *img);
 int run_prepost_scripts(struct swupdate_cfg *sw, script_fn type);
 int postupdate(struct swupdate_cfg *swcfg, const char *info);
 void cleanup_files(struct swupdate_cfg *software);
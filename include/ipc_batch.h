@@ -0,0 +1,59 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#ifndef _IPC_BATCH_H
+#define _IPC_BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Data is sent to the installer in writes of this size */
+#define IPC_BATCH_SIZE		(256 * 1024)
+
+/* Buffers between the receiver and the forward thread */
+#define IPC_BATCH_BUFFERS	4
+
+#ifdef CONFIG_DOWNLOAD_FORWARD_THREAD
+#define IPC_BATCH_THREAD	true
+#else
+#define IPC_BATCH_THREAD	false
+#endif
+
+struct ipc_batch;
+
+/*
+ * Collect small writes to fd. With thread, the data is
+ * written by a separate thread and ipc_batch_write() only
+ * waits if IPC_BATCH_BUFFERS buffers are already queued.
+ */
+struct ipc_batch *ipc_batch_new(int fd, bool thread);
+
+/*
+ * Add data to the batch. A negative value is returned if
+ * this or a previous write failed.
+ */
+int ipc_batch_write(struct ipc_batch *b, const void *buf, size_t len);
+
+/* Write everything that was added, returns the status */
+int ipc_batch_flush(struct ipc_batch *b);
+
+/* Flush and release the batch, fd is not closed */
+int ipc_batch_close(struct ipc_batch *b);
+
+#endif
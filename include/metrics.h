@@ -0,0 +1,94 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#ifndef _SWUPDATE_METRICS_H
+#define _SWUPDATE_METRICS_H
+
+#include <string.h>
+#include "network_ipc.h"
+
+/*
+ * Stages of the copy path. They are not exclusive: the time
+ * of a handler (METRIC_INSTALL) includes the stages it runs.
+ * There are at most IPC_METRICS_STAGES of them.
+ */
+typedef enum {
+	METRIC_READ,		/* read() of the input */
+	METRIC_CHECKSUM,	/* cpio checksum */
+	METRIC_HASH,		/* SHA-256 of the artifacts */
+	METRIC_DECRYPT,
+	METRIC_DECOMPRESS,	/* without its reads and writes */
+	METRIC_WRITE,		/* output of copyfile() */
+	METRIC_INSTALL,		/* handlers */
+	METRIC_IPC_SEND,	/* ipc_send_data() */
+	METRIC_STAGES
+} metric_stage;
+
+#ifdef CONFIG_METRICS
+/*
+ * Share the counters with the subprocesses, it must be
+ * called before they are started
+ */
+void metrics_init(void);
+
+/* Monotonic time in ns, to be passed to metrics_add() */
+unsigned long long metrics_now(void);
+
+/* Account a call of a stage started at start, that moved bytes */
+void metrics_add(metric_stage stage, unsigned long long start,
+		unsigned long long bytes);
+
+/* Account time measured by the caller */
+void metrics_add_nsec(metric_stage stage, unsigned long long nsec,
+		unsigned long long bytes);
+
+/* Copy the counters into m */
+void metrics_get(struct ipc_metric *m, unsigned int nstages);
+void metrics_reset(void);
+const char *metrics_stage_name(metric_stage stage);
+#else
+static inline void metrics_init(void) { }
+
+static inline unsigned long long metrics_now(void)
+{
+	return 0;
+}
+
+static inline void metrics_add(metric_stage __attribute__ ((__unused__)) stage,
+		unsigned long long __attribute__ ((__unused__)) start,
+		unsigned long long __attribute__ ((__unused__)) bytes) { }
+
+static inline void metrics_add_nsec(metric_stage __attribute__ ((__unused__)) stage,
+		unsigned long long __attribute__ ((__unused__)) nsec,
+		unsigned long long __attribute__ ((__unused__)) bytes) { }
+
+static inline void metrics_get(struct ipc_metric *m, unsigned int nstages)
+{
+	memset(m, 0, nstages * sizeof(*m));
+}
+
+static inline void metrics_reset(void) { }
+
+static inline const char *metrics_stage_name(metric_stage __attribute__ ((__unused__)) stage)
+{
+	return "";
+}
+#endif
+
+#endif
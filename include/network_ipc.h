@@ -21,6 +21,7 @@
  * headers are not exported.
  */
 
+#include <sys/uio.h>
 #include "swupdate_status.h"
 
 #define IPC_MAGIC		0x14052001
@@ -32,6 +33,8 @@ typedef enum {
 	GET_STATUS,
 	POST_UPDATE,
 	SWUPDATE_SUBPROCESS,
+	GET_METRICS,
+	SUBSCRIBE,
 } msgtype;
 
 enum {
@@ -39,6 +42,22 @@ enum {
 	CMD_CONFIG
 };
 
+/*
+ * Counters of a stage of the copy path (GET_METRICS).
+ * hist[i] counts the calls that took less than 2^i us,
+ * the last one the slower calls.
+ */
+#define IPC_METRICS_STAGES	8
+#define IPC_METRICS_BUCKETS	16
+
+struct ipc_metric {
+	char name[16];
+	unsigned long long calls;
+	unsigned long long bytes;
+	unsigned long long nsec;
+	unsigned long long hist[IPC_METRICS_BUCKETS];
+};
+
 typedef union {
 	char msg[128];
 	struct { 
@@ -57,6 +76,14 @@ typedef union {
 				      * with additional information
 				      */
 	} instmsg;
+	struct {
+		int reset;	/* request: clear the counters after reading */
+		unsigned int nstages;
+		struct ipc_metric stage[IPC_METRICS_STAGES];
+		unsigned long long spool_mem_peak;
+		unsigned long long spool_disk_peak;
+		unsigned long long notify_dropped; /* notifications lost */
+	} metrics;
 } msgdata;
 	
 typedef struct {
@@ -65,13 +92,32 @@ typedef struct {
 	msgdata data;
 } ipc_message;
 
+/*
+ * After the ACK to SUBSCRIBE, the connection stays open and
+ * SWUpdate sends an event for each notification, with the
+ * same fields as the answer to GET_STATUS. The header is
+ * followed by len bytes of description, without the
+ * trailing zero.
+ */
+typedef struct {
+	int magic;	/* IPC_MAGIC */
+	int current;
+	int last_result;
+	int error;
+	unsigned int len;
+} ipc_event;
+
 int ipc_inst_start(void);
 int ipc_inst_start_ext(sourcetype source, size_t len, char *info);
 int ipc_send_data(int connfd, char *buf, int size);
+int ipc_send_datav(int connfd, struct iovec *iov, int iovcnt);
 void ipc_end(int connfd);
 int ipc_get_status(ipc_message *msg);
 int ipc_postupdate(ipc_message *msg);
 int ipc_send_cmd(ipc_message *msg);
+int ipc_get_metrics(ipc_message *msg, int reset);
+int ipc_subscribe(void);
+int ipc_get_event(int connfd, ipc_message *msg);
 
 typedef int (*writedata)(char **buf, int *size);
 typedef int (*getstatus)(ipc_message *msg);
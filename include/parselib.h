@@ -75,6 +75,8 @@ void *get_elem_from_idx(parsertype p, void *node, int idx);
 void get_field(parsertype p, void *e, const char *path, void *dest);
 int exist_field_string(parsertype p, void *e, const char *path);
 void get_hash_value(parsertype p, void *elem, unsigned char *hash);
+void get_named_hash_value(parsertype p, void *elem, const char *name,
+		unsigned char *hash);
 void check_field_string(const char *src, char *dst, const size_t max_len);
 
 #define GET_FIELD_STRING(p, e, name, d) \
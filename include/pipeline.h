@@ -0,0 +1,59 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#ifndef _SWUPDATE_PIPELINE_H
+#define _SWUPDATE_PIPELINE_H
+
+#include <stdint.h>
+#include <errno.h>
+#include "util.h"
+
+/*
+ * Images smaller than this are copied serially,
+ * spawning threads does not pay off for them
+ */
+#define PIPELINE_MIN_SIZE	(256 * 1024)
+
+/*
+ * Copy nbytes from fdin to the callback, running reading,
+ * hashing and decryption on separate threads.
+ * dgst and dcrypt are optional (NULL if not required).
+ * It returns -EAGAIN if the pipeline cannot be set up
+ * before any byte was consumed: the caller should then
+ * fall back to the serial copy.
+ */
+#ifdef CONFIG_COPY_PIPELINE
+int copy_pipeline(int fdin, void *out, unsigned int nbytes,
+	unsigned long *offs, uint32_t *checksum,
+	void *dgst, void *dcrypt, writeimage callback);
+#else
+static inline int copy_pipeline(int __attribute__ ((__unused__)) fdin,
+		void __attribute__ ((__unused__)) *out,
+		unsigned int __attribute__ ((__unused__)) nbytes,
+		unsigned long __attribute__ ((__unused__)) *offs,
+		uint32_t __attribute__ ((__unused__)) *checksum,
+		void __attribute__ ((__unused__)) *dgst,
+		void __attribute__ ((__unused__)) *dcrypt,
+		writeimage __attribute__ ((__unused__)) callback)
+{
+	return -EAGAIN;
+}
+#endif
+
+#endif
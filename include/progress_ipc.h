@@ -21,6 +21,7 @@
 #define _PROGRESS_IPC_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <swupdate_status.h>
 
 extern char* SOCKET_PROGRESS_PATH;
@@ -43,6 +44,61 @@ struct progress_msg {
 	char		info[2048];   	/* additional information about install */
 };
 
+/*
+ * Compact format: a client asks for it by sending a hello
+ * after the connect. Each frame carries only the fields
+ * that changed since the previous frame on the connection,
+ * as (id, length, data). The first frame is complete.
+ * A compact frame starts with PROGRESS_MAGIC, a legacy
+ * struct progress_msg with 0.
+ */
+#define PROGRESS_MAGIC		0x53575047	/* "SWPG" */
+#define PROGRESS_VERSION	1
+
+struct progress_hello {
+	uint32_t	magic;		/* PROGRESS_MAGIC */
+	uint16_t	version;	/* highest version of the client */
+	uint16_t	reserved;
+};
+
+struct progress_frame {
+	uint32_t	magic;		/* PROGRESS_MAGIC */
+	uint16_t	version;
+	uint16_t	len;		/* bytes of the fields that follow */
+};
+
+struct progress_field {
+	uint8_t		id;
+	uint8_t		reserved;
+	uint16_t	len;		/* bytes of data that follow */
+};
+
+/*
+ * Numbers are 32 bit, strings are sent without the
+ * trailing zero. Unknown fields must be skipped.
+ */
+enum {
+	PROGRESS_FIELD_STATUS = 1,
+	PROGRESS_FIELD_DWL_PERCENT,
+	PROGRESS_FIELD_NSTEPS,
+	PROGRESS_FIELD_CUR_STEP,
+	PROGRESS_FIELD_CUR_PERCENT,
+	PROGRESS_FIELD_CUR_IMAGE,
+	PROGRESS_FIELD_HND_NAME,
+	PROGRESS_FIELD_SOURCE,
+	PROGRESS_FIELD_INFO,		/* sent only with new info */
+};
+
+/* A frame with all the fields is not bigger than this */
+#define PROGRESS_FRAME_MAX	(sizeof(struct progress_frame) + \
+				 9 * sizeof(struct progress_field) + \
+				 sizeof(struct progress_msg))
+
 int progress_ipc_connect(bool reconnect);
+
+/*
+ * Receive a frame in msg. A compact frame updates only the
+ * fields it carries: msg must be the same between calls.
+ */
 int progress_ipc_receive(int *connfd, struct progress_msg *msg);
 #endif
@@ -0,0 +1,75 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+#ifndef _SWUPDATE_SPOOL_H
+#define _SWUPDATE_SPOOL_H
+
+#include <string.h>
+#include <errno.h>
+
+struct spool_stats {
+	unsigned long long mem_used;	/* bytes currently in memory */
+	unsigned long long mem_peak;
+	unsigned long long disk_used;	/* bytes currently on disk */
+	unsigned long long disk_peak;
+	unsigned int nmem;		/* files staged in memory */
+	unsigned int ndisk;		/* files staged on disk */
+};
+
+#ifdef CONFIG_SPOOL
+/*
+ * Create the staging area for a file of size bytes. It
+ * returns a file descriptor to write it, that belongs to
+ * the spool and must not be closed, or a negative value if
+ * the file must be stored in TMPDIR as usual.
+ */
+int spool_create(const char *fname, unsigned long long size);
+
+/*
+ * Open a staged file for reading, from the beginning. Each
+ * call returns a new descriptor that the caller must close,
+ * or a negative value if fname is not in the spool.
+ */
+int spool_open(const char *fname);
+
+/* Release all staged files */
+void spool_clear(void);
+
+void spool_get_stats(struct spool_stats *stats);
+#else
+static inline int spool_create(const char __attribute__ ((__unused__)) *fname,
+		unsigned long long __attribute__ ((__unused__)) size)
+{
+	return -ENOSYS;
+}
+
+static inline int spool_open(const char __attribute__ ((__unused__)) *fname)
+{
+	return -ENOENT;
+}
+
+static inline void spool_clear(void) { }
+
+static inline void spool_get_stats(struct spool_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
+#endif
+
+#endif
@@ -44,15 +44,20 @@
 #endif
 #include <openssl/opensslv.h>
 
+struct swupdate_cipher;
+struct swupdate_tree_hash;
+
 struct swupdate_digest {
 	EVP_PKEY *pkey;		/* this is used for RSA key */
 	X509_STORE *certs;	/* this is used if CMS is set */
 	EVP_MD_CTX *ctx;
+	struct swupdate_tree_hash *tree;	/* set for a tree hash */
 #if OPENSSL_VERSION_NUMBER < 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
 	EVP_CIPHER_CTX ctxdec;
 #else
 	EVP_CIPHER_CTX *ctxdec;
 #endif
+	struct swupdate_cipher *cipher;	/* mode and backend for decryption */
 };
 
 #if OPENSSL_VERSION_NUMBER < 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
@@ -85,6 +90,8 @@ struct swupdate_digest {
 #if defined(CONFIG_HASH_VERIFY)
 int swupdate_dgst_init(struct swupdate_cfg *sw, const char *keyfile);
 struct swupdate_digest *swupdate_HASH_init(void);
+/* SHA-256 tree hash over chunks of chunk_size bytes */
+struct swupdate_digest *swupdate_HASH_init_tree(unsigned int chunk_size);
 int swupdate_HASH_update(struct swupdate_digest *dgst, unsigned char *buf,
 				size_t len);
 int swupdate_HASH_final(struct swupdate_digest *dgst, unsigned char *md_value,
@@ -94,10 +101,17 @@ int swupdate_verify_file(struct swupdate_digest *dgst, const char *sigfile,
 	       	const char *file);
 int swupdate_HASH_compare(unsigned char *hash1, unsigned char *hash2);
 
+struct swupdate_tree_hash *swupdate_tree_hash_new(unsigned int chunk_size);
+int swupdate_tree_hash_update(struct swupdate_tree_hash *t,
+				const unsigned char *buf, size_t len);
+int swupdate_tree_hash_final(struct swupdate_tree_hash *t,
+				unsigned char *md_value, unsigned int *md_len);
+void swupdate_tree_hash_free(struct swupdate_tree_hash *t);
 
 #else
 #define swupdate_dgst_init(sw, keyfile) ( 0 )
 #define swupdate_HASH_init(p) ( NULL )
+#define swupdate_HASH_init_tree(chunk_size) ( NULL )
 #define swupdate_verify_file(dgst, sigfile, file) ( 0 )
 #define swupdate_HASH_update(p, buf, len)
 #define swupdate_HASH_final(p, result, len)
@@ -105,8 +119,18 @@ int swupdate_HASH_compare(unsigned char *hash1, unsigned char *hash2);
 #define swupdate_HASH_compare(hash1,hash2)	(0)
 #endif
 
+/*
+ * Size of the pieces of encrypted data passed to
+ * swupdate_DECRYPT_update(): AES-CTR is split among
+ * threads only if a piece is large enough.
+ */
+#define DECRYPT_PIECE	(64 * 1024)
+
 #ifdef CONFIG_ENCRYPTED_IMAGES
 struct swupdate_digest *swupdate_DECRYPT_init(unsigned char *key, unsigned char *iv, unsigned char *salt);
+/* cipher is one of cipher_type, swupdate_DECRYPT_init() uses CBC */
+struct swupdate_digest *swupdate_DECRYPT_init_cipher(unsigned char *key,
+				unsigned char *iv, unsigned char *salt, int cipher);
 int swupdate_DECRYPT_update(struct swupdate_digest *dgst, unsigned char *buf, 
 				int *outlen, unsigned char *cryptbuf, int inlen);
 int swupdate_DECRYPT_final(struct swupdate_digest *dgst, unsigned char *buf,
@@ -118,6 +142,8 @@ void swupdate_DECRYPT_cleanup(struct swupdate_digest *dgst);
  * just to avoid compiler warnings
  */
 #define swupdate_DECRYPT_init(key, iv, salt) (((key != NULL) | (ivt != NULL) | (salt != NULL)) ? NULL : NULL)
+#define swupdate_DECRYPT_init_cipher(key, iv, salt, cipher) \
+	(((key != NULL) | (iv != NULL) | (salt != NULL) | (cipher)) ? NULL : NULL)
 #define swupdate_DECRYPT_update(p, buf, len, cbuf, inlen) (-1)
 #define swupdate_DECRYPT_final(p, buf, len) (-1)
 #define swupdate_DECRYPT_cleanup(p)
@@ -31,6 +31,9 @@
  */
 #define SHA256_HASH_LENGTH	32
 
+/* default chunk of a "sha256-tree" hash */
+#define HASH_TREE_CHUNK_SIZE	(1024 * 1024)
+
 typedef enum {
 	FLASH,
 	UBI,
@@ -75,6 +78,9 @@ struct img_type {
 	int compressed;
 	int is_encrypted;
 	int install_directly;
+	int write_if_different;	/* skip blocks that are unchanged */
+	int async_write;	/* O_DIRECT with several writes in flight */
+	int queue_depth;
 	int is_script;
 	int is_partitioner;
 	long long partsize;
@@ -83,6 +89,12 @@ struct img_type {
 	long long size;
 	unsigned int checksum;
 	unsigned char sha256[SHA256_HASH_LENGTH];	/* SHA-256 is 32 byte */
+	unsigned char tree_sha256[SHA256_HASH_LENGTH];	/* root of a tree hash */
+	int hash_chunk_size;
+	char source[MAX_VOLNAME];	/* base of a delta image */
+	long long source_size;
+	unsigned char source_sha256[SHA256_HASH_LENGTH];
+	unsigned char output_sha256[SHA256_HASH_LENGTH];
 	LIST_ENTRY(img_type) next;
 };
 
@@ -139,6 +151,9 @@ struct swupdate_cfg {
 	const char *embscript;
 };
 
+/* Optional index of the files, after sw-description */
+#define SW_INDEX_FILENAME	"sw-index"
+
 #define SEARCH_FILE(type, list, found, offs) do { \
 	if (!found) { \
 		type *p; \
@@ -155,7 +170,8 @@ struct swupdate_cfg {
 } while(0)
 
 off_t extract_sw_description(int fd, const char *descfile, off_t start);
-int cpio_scan(int fd, struct swupdate_cfg *cfg, off_t start);
+int cpio_scan(int fd, struct swupdate_cfg *cfg, off_t start, int verify);
+int cpio_index_scan(int fd, struct swupdate_cfg *cfg, off_t start);
 struct swupdate_cfg *get_swupdate_cfg(void);
 
 #endif
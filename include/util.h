@@ -149,6 +149,8 @@ int copyfile(int fdin, void *out, unsigned int nbytes, unsigned long *offs,
 	int skip_file, int compressed, uint32_t *checksum,
 	unsigned char *hash, int encrypted, writeimage callback);
 int copyimage(void *out, struct img_type *img, writeimage callback);
+int copyimage_direct(int fdout, struct img_type *img);
+void copy_abort(int abort);
 off_t extract_sw_description(int fd, const char *descfile, off_t start);
 off_t extract_next_file(int fd, int fdout, off_t start, int compressed,
 			int encrypted, unsigned char *hash);
@@ -157,6 +159,7 @@ int openfileoutput(const char *filename);
 int register_notifier(notifier client);
 void notify(RECOVERY_STATUS status, int level, const char *msg);
 void notify_init(void);
+unsigned long long notify_get_dropped(void);
 int syslog_init(void);
 
 char **splitargs(char *args, int *argc);
@@ -173,26 +176,28 @@ unsigned char *get_aes_key(void);
 unsigned char *get_aes_ivt(void);
 unsigned char *get_aes_salt(void);
 
+/*
+ * Cipher of an encrypted image (img->is_encrypted).
+ * "encrypted = true" in sw-description selects CBC.
+ */
+typedef enum {
+	CIPHER_NONE,
+	CIPHER_AES_CBC,
+	CIPHER_AES_CTR,
+	CIPHER_AES_GCM
+} cipher_type;
+
+int get_cipher_type(const char *name);
+const char *get_cipher_name(int type);
+
 /* Getting global information */
 int get_install_info(sourcetype *source, char *buf, size_t len);
 
 unsigned long long ustrtoull(const char *cp, char **endp, unsigned int base);
 
-#ifdef CONFIG_GUNZIP
-int decompress_image(int infile, unsigned long *offs, int nbytes,
-	int outfile, uint32_t *checksum, void *dgst);
-#else
-static inline int decompress_image(int __attribute__ ((__unused__))infile,
-		   unsigned long __attribute__ ((__unused__)) *offs,
-		   int __attribute__ ((__unused__)) nbytes,
-		   int __attribute__ ((__unused__)) outfile,
-		   uint32_t __attribute__ ((__unused__)) *checksum,
-		   void __attribute__ ((__unused__)) *dgst) {
-
-		TRACE("Request decompressing, but CONFIG_GUNZIP not set !");
-	return -1;
-}
-#endif
+int decompress_image(int type, int infile, unsigned long *offs, int nbytes,
+	void *out, writeimage callback, uint32_t *checksum,
+	void *dgst, void *dcrypt);
 
 const char* get_tmpdir(void);
 
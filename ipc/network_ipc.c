@@ -34,6 +34,7 @@
 #include <pthread.h>
 
 #include "network_ipc.h"
+#include "metrics.h"
 
 #ifdef CONFIG_SOCKET_CTRL_PATH
 static char* SOCKET_CTRL_PATH = (char*)CONFIG_SOCKET_CTRL_PATH;
@@ -149,6 +150,109 @@ int ipc_get_status(ipc_message *msg)
 	return ret;
 }
 
+int ipc_get_metrics(ipc_message *msg, int reset)
+{
+	int connfd;
+	ssize_t ret;
+
+	connfd = prepare_ipc();
+	if (connfd < 0)
+		return -1;
+
+	memset(msg, 0, sizeof(*msg));
+	msg->magic = IPC_MAGIC;
+	msg->type = GET_METRICS;
+	msg->data.metrics.reset = reset;
+	ret = write(connfd, msg, sizeof(*msg));
+	if (ret == sizeof(*msg))
+		ret = read(connfd, msg, sizeof(*msg));
+	close(connfd);
+
+	if (ret != sizeof(*msg) || msg->type != GET_METRICS)
+		return -1;
+
+	return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len)
+{
+	char *p = (char *)buf;
+	ssize_t n;
+
+	while (len) {
+		n = read(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= (size_t)n;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns a connection that receives the status and the
+ * notifications with ipc_get_event(), to be closed with
+ * ipc_end(). It fails if SWUpdate does not know SUBSCRIBE.
+ */
+int ipc_subscribe(void)
+{
+	int connfd;
+	ipc_message msg;
+
+	connfd = prepare_ipc();
+	if (connfd < 0)
+		return -1;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.magic = IPC_MAGIC;
+	msg.type = SUBSCRIBE;
+	if (write(connfd, &msg, sizeof(msg)) != sizeof(msg) ||
+	    read_all(connfd, &msg, sizeof(msg)) < 0 ||
+	    msg.type != ACK) {
+		close(connfd);
+		return -1;
+	}
+
+	return connfd;
+}
+
+/*
+ * Wait for the next event, msg is filled as the answer
+ * to GET_STATUS.
+ */
+int ipc_get_event(int connfd, ipc_message *msg)
+{
+	ipc_event ev;
+	char discard[256];
+	size_t len, n;
+
+	if (read_all(connfd, &ev, sizeof(ev)) < 0 || ev.magic != IPC_MAGIC)
+		return -1;
+
+	memset(msg, 0, sizeof(*msg));
+	msg->magic = IPC_MAGIC;
+	msg->type = GET_STATUS;
+	msg->data.status.current = ev.current;
+	msg->data.status.last_result = ev.last_result;
+	msg->data.status.error = ev.error;
+
+	len = ev.len;
+	n = len < sizeof(msg->data.status.desc) - 1 ?
+		len : sizeof(msg->data.status.desc) - 1;
+	if (read_all(connfd, msg->data.status.desc, n) < 0)
+		return -1;
+	for (len -= n; len; len -= n) {
+		n = len < sizeof(discard) ? len : sizeof(discard);
+		if (read_all(connfd, discard, n) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
 int ipc_inst_start_ext(sourcetype source, size_t len, char *buf)
 {
 	int connfd;
@@ -216,16 +320,56 @@ int ipc_inst_start(void)
  */
 int ipc_send_data(int connfd, char *buf, int size)
 {
+	unsigned long long t = metrics_now();
 	ssize_t ret;
 
 	ret = write(connfd, buf, (size_t)size);
 	if (ret != size) {
 		return -1;
 	}
+	metrics_add(METRIC_IPC_SEND, t, ret);
 
 	return (int)ret;
 }
 
+/*
+ * Send several buffers with one system call, it returns
+ * the number of bytes or -1. iov is modified if the data
+ * cannot be written at once.
+ */
+int ipc_send_datav(int connfd, struct iovec *iov, int iovcnt)
+{
+	unsigned long long t = metrics_now();
+	size_t total = 0;
+	ssize_t ret;
+
+	while (iovcnt) {
+		ret = writev(connfd, iov, iovcnt);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (!ret && iov->iov_len) {
+			errno = EIO;
+			return -1;
+		}
+		total += ret;
+		while (iovcnt && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+	metrics_add(METRIC_IPC_SEND, t, total);
+
+	return (int)total;
+}
+
 void ipc_end(int connfd)
 {
 	close(connfd);
@@ -240,7 +384,8 @@ int swupdate_image_write(char *buf, int size)
 	return ipc_send_data(rq->connfd, buf, size);
 }
 
-int ipc_wait_for_complete(getstatus callback)
+/* For a SWUpdate without SUBSCRIBE */
+static int wait_for_complete_poll(getstatus callback)
 {
 	int fd;
 	RECOVERY_STATUS status = IDLE;
@@ -273,6 +418,37 @@ int ipc_wait_for_complete(getstatus callback)
 	return message.data.status.last_result;
 }
 
+int ipc_wait_for_complete(getstatus callback)
+{
+	int fd;
+	RECOVERY_STATUS status = IDLE;
+	ipc_message message;
+
+	fd = ipc_subscribe();
+	if (fd < 0)
+		return wait_for_complete_poll(callback);
+
+	do {
+		if (ipc_get_event(fd, &message) < 0) {
+			printf("ipc_get_event failed\n");
+			message.data.status.last_result = FAILURE;
+			break;
+		}
+
+		if ((status != (RECOVERY_STATUS)message.data.status.current) ||
+			strlen(message.data.status.desc)) {
+			if (callback)
+				callback(&message);
+		}
+
+		status = (RECOVERY_STATUS)message.data.status.current;
+	} while(message.data.status.current != IDLE);
+
+	ipc_end(fd);
+
+	return message.data.status.last_result;
+}
+
 static void *swupdate_async_thread(void *data)
 {
 	char *pbuf;
@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <errno.h>
 
 #include <progress_ipc.h>
 
@@ -36,6 +37,10 @@ char* SOCKET_PROGRESS_PATH = (char*)"/tmp/swupdateprog";
 int progress_ipc_connect(bool reconnect)
 {
 	struct sockaddr_un servaddr;
+	struct progress_hello hello = {
+		.magic = PROGRESS_MAGIC,
+		.version = PROGRESS_VERSION,
+	};
 	int fd = socket(AF_LOCAL, SOCK_STREAM, 0);
 	bzero(&servaddr, sizeof(servaddr));
 	servaddr.sun_family = AF_LOCAL;
@@ -55,18 +60,140 @@ int progress_ipc_connect(bool reconnect)
 		usleep(10000);
 	} while (true);
 
+	/*
+	 * Ask for the compact format, an older SWUpdate ignores
+	 * it and goes on with struct progress_msg
+	 */
+	if (write(fd, &hello, sizeof(hello)) != sizeof(hello))
+		fprintf(stderr, "Cannot request compact progress frames\n");
+
 	fprintf(stdout, "Connected to SWUpdate via %s\n", SOCKET_PROGRESS_PATH);
 	return fd;
 }
 
+static int read_all(int fd, void *buf, size_t len)
+{
+	char *p = (char *)buf;
+	ssize_t n;
+
+	while (len) {
+		n = read(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= (size_t)n;
+	}
+
+	return 0;
+}
+
+static void copy_string(char *dst, size_t size, const char *src, size_t len)
+{
+	if (len > size - 1)
+		len = size - 1;
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+}
+
+static int decode_frame(const char *buf, size_t len, struct progress_msg *msg)
+{
+	struct progress_field field;
+	const char *data;
+	uint32_t val = 0;
+
+	/* info is an event, it is not kept from the previous frame */
+	msg->infolen = 0;
+
+	while (len) {
+		if (len < sizeof(field))
+			return -1;
+		memcpy(&field, buf, sizeof(field));
+		data = buf + sizeof(field);
+		if (field.len > len - sizeof(field))
+			return -1;
+		buf += sizeof(field) + field.len;
+		len -= sizeof(field) + field.len;
+
+		if (field.id < PROGRESS_FIELD_CUR_IMAGE ||
+		    field.id == PROGRESS_FIELD_SOURCE) {
+			if (field.len != sizeof(val))
+				continue;
+			memcpy(&val, data, sizeof(val));
+		}
+
+		switch (field.id) {
+		case PROGRESS_FIELD_STATUS:
+			msg->status = (RECOVERY_STATUS)val;
+			break;
+		case PROGRESS_FIELD_DWL_PERCENT:
+			msg->dwl_percent = val;
+			break;
+		case PROGRESS_FIELD_NSTEPS:
+			msg->nsteps = val;
+			break;
+		case PROGRESS_FIELD_CUR_STEP:
+			msg->cur_step = val;
+			break;
+		case PROGRESS_FIELD_CUR_PERCENT:
+			msg->cur_percent = val;
+			break;
+		case PROGRESS_FIELD_SOURCE:
+			msg->source = (sourcetype)val;
+			break;
+		case PROGRESS_FIELD_CUR_IMAGE:
+			copy_string(msg->cur_image, sizeof(msg->cur_image),
+				    data, field.len);
+			break;
+		case PROGRESS_FIELD_HND_NAME:
+			copy_string(msg->hnd_name, sizeof(msg->hnd_name),
+				    data, field.len);
+			break;
+		case PROGRESS_FIELD_INFO:
+			copy_string(msg->info, sizeof(msg->info),
+				    data, field.len);
+			msg->infolen = strlen(msg->info);
+			break;
+		default:
+			/* added by a later version */
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static int receive_msg(int fd, struct progress_msg *msg)
+{
+	struct progress_frame frame;
+	char buf[PROGRESS_FRAME_MAX];
+
+	if (read_all(fd, &frame.magic, sizeof(frame.magic)) < 0)
+		return -1;
+
+	if (frame.magic != PROGRESS_MAGIC) {
+		msg->magic = frame.magic;
+		return read_all(fd, (char *)msg + sizeof(msg->magic),
+				sizeof(*msg) - sizeof(msg->magic));
+	}
+
+	if (read_all(fd, (char *)&frame + sizeof(frame.magic),
+		     sizeof(frame) - sizeof(frame.magic)) < 0 ||
+	    frame.len > sizeof(buf) ||
+	    read_all(fd, buf, frame.len) < 0)
+		return -1;
+
+	return decode_frame(buf, frame.len, msg);
+}
+
 int progress_ipc_receive(int *connfd, struct progress_msg *msg) {
-	int ret = read(*connfd, msg, sizeof(msg));
-	if (ret != sizeof(msg)) {
+	if (receive_msg(*connfd, msg) < 0) {
 		fprintf(stdout, "Connection closing..\n");
 		close(*connfd);
 		*connfd = -1;
 		return -1;
 	}
-	return ret;
+	return sizeof(*msg);
 }
 
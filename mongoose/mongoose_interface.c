@@ -350,6 +350,81 @@ static void recovery_status(struct mg_connection *conn) {
 	mg_write(conn, buf, strlen(buf));
 }
 
+#ifdef CONFIG_METRICS
+/*
+ * Counters in the Prometheus text format. They are shared by
+ * all processes, the uploads of the webserver are included.
+ */
+static void recovery_metrics(struct mg_connection *conn) {
+	struct ipc_metric *m;
+	ipc_message ipc;
+	unsigned long long cumul;
+	unsigned int i, j;
+	char *buf, *p;
+	size_t size = 32 * 1024;
+
+	if (ipc_get_metrics(&ipc, 0)) {
+		mg_printf(conn, "%s", "HTTP/1.0 500 Internal Server Error\r\n\r\n");
+		return;
+	}
+
+	buf = (char *)malloc(size);
+	if (!buf) {
+		mg_printf(conn, "%s", "HTTP/1.0 500 Internal Server Error\r\n\r\n");
+		return;
+	}
+
+	p = buf;
+	p += snprintf(p, size - (p - buf),
+		"# TYPE swupdate_stage_calls_total counter\n"
+		"# TYPE swupdate_stage_bytes_total counter\n"
+		"# TYPE swupdate_stage_seconds histogram\n");
+	for (i = 0; i < min(ipc.data.metrics.nstages,
+				(unsigned int)IPC_METRICS_STAGES); i++) {
+		m = &ipc.data.metrics.stage[i];
+		m->name[sizeof(m->name) - 1] = '\0';
+		p += snprintf(p, size - (p - buf),
+			"swupdate_stage_calls_total{stage=\"%s\"} %llu\n"
+			"swupdate_stage_bytes_total{stage=\"%s\"} %llu\n",
+			m->name, m->calls, m->name, m->bytes);
+		cumul = 0;
+		for (j = 0; j < IPC_METRICS_BUCKETS; j++) {
+			cumul += m->hist[j];
+			if (j < IPC_METRICS_BUCKETS - 1)
+				p += snprintf(p, size - (p - buf),
+					"swupdate_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n",
+					m->name, (1ULL << j) / 1e6, cumul);
+			else
+				p += snprintf(p, size - (p - buf),
+					"swupdate_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n",
+					m->name, cumul);
+		}
+		p += snprintf(p, size - (p - buf),
+			"swupdate_stage_seconds_sum{stage=\"%s\"} %.6f\n"
+			"swupdate_stage_seconds_count{stage=\"%s\"} %llu\n",
+			m->name, m->nsec / 1e9, m->name, m->calls);
+	}
+	p += snprintf(p, size - (p - buf),
+		"# TYPE swupdate_spool_peak_bytes gauge\n"
+		"swupdate_spool_peak_bytes{area=\"memory\"} %llu\n"
+		"swupdate_spool_peak_bytes{area=\"disk\"} %llu\n"
+		"# TYPE swupdate_notifications_dropped_total counter\n"
+		"swupdate_notifications_dropped_total %llu\n",
+		ipc.data.metrics.spool_mem_peak,
+		ipc.data.metrics.spool_disk_peak,
+		ipc.data.metrics.notify_dropped);
+
+	mg_printf(conn,
+		"HTTP/1.1 200 OK\r\n"
+		"Cache: no-cache\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %u\r\n"
+		"\r\n", (unsigned int)strlen(buf));
+	mg_write(conn, buf, strlen(buf));
+	free(buf);
+}
+#endif
+
 static void reboot_target(struct mg_connection *conn) {
 	const struct mg_request_info * reqInfo = mg_get_request_info(conn);
 	int ret;
@@ -404,6 +479,12 @@ static int begin_request_handler(struct mg_connection *conn) {
 		recovery_status(conn);
 		return 1;
 	}
+#ifdef CONFIG_METRICS
+	if (!strcmp(mg_get_request_info(conn)->uri, "/metrics")) {
+		recovery_metrics(conn);
+		return 1;
+	}
+#endif
 	if (!strcmp(mg_get_request_info(conn)->uri, "/rebootTarget")) {
 		reboot_target(conn);
 		return 1;
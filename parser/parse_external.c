@@ -34,6 +34,7 @@
 #include "lauxlib.h"
 #include "lualib.h"
 #include "util.h"
+#include "decompress.h"
 #include "lua_util.h"
 #ifndef CONFIG_SETEXTPARSERNAME
 #define LUA_PARSER	"lua-tools/extparser.lua"
@@ -41,7 +42,14 @@
 #define LUA_PARSER	(CONFIG_EXTPARSERNAME)
 #endif
 
-static void sw_append_stream(struct img_type *img, const char *key,
+/* A flag of the external parser: no value or a boolean one */
+static int is_flag(const char *value)
+{
+	return !value || !strlen(value) || !strcmp(value, "true") ||
+		!strcmp(value, "1") || !strcmp(value, "yes");
+}
+
+static int sw_append_stream(struct img_type *img, const char *key,
 	       const char *value)
 {
 	const char offset[] = "offset";
@@ -89,7 +97,7 @@ static void sw_append_stream(struct img_type *img, const char *key,
 			if (seek_str == endp || (img->seek == ULLONG_MAX && \
 					errno == ERANGE)) {
 				ERROR("offset argument: ustrtoull failed");
-				return;
+				return 0;
 			}
 		} else
 			img->seek = 0;
@@ -101,14 +109,34 @@ static void sw_append_stream(struct img_type *img, const char *key,
 			sizeof(img->path));
 	if (!strcmp(key, "sha256"))
 		ascii_to_hash(img->sha256, value);
-	if (!strcmp(key, "encrypted"))
-		img->is_encrypted = 1;
-	if (!strcmp(key, "compressed"))
-		img->compressed = 1;
+	if (!strcmp(key, "sha256-tree"))
+		ascii_to_hash(img->tree_sha256, value);
+	if (!strcmp(key, "encrypted")) {
+		/* a flag is AES-CBC, else the name of the cipher */
+		img->is_encrypted = is_flag(value) ? CIPHER_AES_CBC :
+					get_cipher_type(value);
+		if (img->is_encrypted < 0) {
+			ERROR("Unknown cipher \"%s\" for %s", value,
+				img->fname);
+			return -1;
+		}
+	}
+	if (!strcmp(key, "compressed")) {
+		/* a flag is zlib, else the name of the compression */
+		img->compressed = is_flag(value) ? COMPRESSED_ZLIB :
+					get_compression_type(value);
+		if (img->compressed < 0) {
+			ERROR("Unknown compression \"%s\" for %s", value,
+				img->fname);
+			return -1;
+		}
+	}
 	if (!strcmp(key, "installed-directly"))
 		img->install_directly = 1;
 	if (!strcmp(key, "install-if-different"))
 		img->id.install_if_different = 1;
+
+	return 0;
 }
 
 int parse_external(struct swupdate_cfg *software, const char *filename)
@@ -177,8 +205,12 @@ int parse_external(struct swupdate_cfg *software, const char *filename)
 				return -ENOMEM;
 			}
 			while (lua_next(L, -2) != 0) {
-				sw_append_stream(image, lua_tostring(L, -2),
-					       lua_tostring(L, -1));
+				if (sw_append_stream(image, lua_tostring(L, -2),
+					       lua_tostring(L, -1))) {
+					free(image);
+					lua_close(L);
+					return 1;
+				}
 
 	       			lua_pop(L, 1);
 			}
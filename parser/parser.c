@@ -35,6 +35,7 @@
 #include "parsers.h"
 #include "swupdate_dict.h"
 #include "lua_util.h"
+#include "decompress.h"
 
 #define MODULE_NAME	"PARSER"
 
@@ -217,6 +218,52 @@ static int run_embscript(parsertype p, void *elem, struct img_type *img,
 	return lua_parser_fn(L, embfcn, img);
 }
 
+/*
+ * "compressed" is either a boolean (zlib) or
+ * the name of the compression, like "zstd"
+ */
+static int get_compression(parsertype p, void *elem, struct img_type *img)
+{
+	const char *type;
+
+	type = get_field_string(p, elem, "compressed");
+	if (!type) {
+		get_field(p, elem, "compressed", &img->compressed);
+		return 0;
+	}
+
+	img->compressed = get_compression_type(type);
+	if (img->compressed < 0) {
+		ERROR("Unknown compression \"%s\" for %s", type, img->fname);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * "encrypted" is either a boolean (AES-CBC) or
+ * the name of the cipher, like "aes-ctr"
+ */
+static int get_encryption(parsertype p, void *elem, struct img_type *img)
+{
+	const char *type;
+
+	type = get_field_string(p, elem, "encrypted");
+	if (!type) {
+		get_field(p, elem, "encrypted", &img->is_encrypted);
+		return 0;
+	}
+
+	img->is_encrypted = get_cipher_type(type);
+	if (img->is_encrypted < 0) {
+		ERROR("Unknown cipher \"%s\" for %s", type, img->fname);
+		return -1;
+	}
+
+	return 0;
+}
+
 static int parse_partitions(parsertype p, void *cfg, struct swupdate_cfg *swcfg)
 {
 	void *setting, *elem;
@@ -309,7 +356,8 @@ static int parse_scripts(parsertype p, void *cfg, struct swupdate_cfg *swcfg)
 		GET_FIELD_STRING(p, elem, "data", script->type_data);
 		get_hash_value(p, elem, script->sha256);
 
-		get_field(p, elem, "encrypted", &script->is_encrypted);
+		if (get_encryption(p, elem, script))
+			return -1;
 
 		/* Scripts as default call the Lua interpreter */
 		if (!strlen(script->type)) {
@@ -424,6 +472,8 @@ static int parse_images(parsertype p, void *cfg, struct swupdate_cfg *swcfg, lua
 		GET_FIELD_STRING(p, elem, "offset", seek_str);
 		GET_FIELD_STRING(p, elem, "data", image->type_data);
 		get_hash_value(p, elem, image->sha256);
+		get_named_hash_value(p, elem, "sha256-tree", image->tree_sha256);
+		get_field(p, elem, "hash-chunk-size", &image->hash_chunk_size);
 
 		/* convert the offset handling multiplicative suffixes */
 		if (seek_str != NULL && strnlen(seek_str, MAX_SEEK_STRING_SIZE) != 0) {
@@ -445,10 +495,19 @@ static int parse_images(parsertype p, void *cfg, struct swupdate_cfg *swcfg, lua
 				strcpy(image->type, "raw");
 		}
 
-		get_field(p, elem, "compressed", &image->compressed);
+		if (get_compression(p, elem, image))
+			return -1;
 		get_field(p, elem, "installed-directly", &image->install_directly);
 		get_field(p, elem, "install-if-different", &image->id.install_if_different);
-		get_field(p, elem, "encrypted", &image->is_encrypted);
+		if (get_encryption(p, elem, image))
+			return -1;
+		get_field(p, elem, "write-if-different", &image->write_if_different);
+		get_field(p, elem, "async-write", &image->async_write);
+		get_field(p, elem, "queue-depth", &image->queue_depth);
+		GET_FIELD_STRING(p, elem, "source", image->source);
+		get_field(p, elem, "source-size", &image->source_size);
+		get_named_hash_value(p, elem, "source-sha256", image->source_sha256);
+		get_named_hash_value(p, elem, "output-sha256", image->output_sha256);
 
 		TRACE("Found %sImage %s %s: %s in %s : %s for handler %s%s %s\n",
 			image->compressed ? "compressed " : "",
@@ -513,14 +572,18 @@ static int parse_files(parsertype p, void *cfg, struct swupdate_cfg *swcfg, lua_
 		GET_FIELD_STRING(p, elem, "type", file->type);
 		GET_FIELD_STRING(p, elem, "data", file->type_data);
 		get_hash_value(p, elem, file->sha256);
+		get_named_hash_value(p, elem, "sha256-tree", file->tree_sha256);
+		get_field(p, elem, "hash-chunk-size", &file->hash_chunk_size);
 
 		if (!strlen(file->type)) {
 			strcpy(file->type, "rawfile");
 		}
-		get_field(p, elem, "compressed", &file->compressed);
+		if (get_compression(p, elem, file))
+			return -1;
 		get_field(p, elem, "installed-directly", &file->install_directly);
 		get_field(p, elem, "install-if-different", &file->id.install_if_different);
-		get_field(p, elem, "encrypted", &file->is_encrypted);
+		if (get_encryption(p, elem, file))
+			return -1;
 		TRACE("Found %sFile %s %s: %s --> %s (%s) %s\n",
 			file->compressed ? "compressed " : "",
 			file->id.name,
@@ -19,6 +19,7 @@
 
 #include <stdbool.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 #include <assert.h>
 #include <stdarg.h>
@@ -29,6 +30,8 @@
 #include <unistd.h>
 #include <network_ipc.h>
 #include <util.h>
+#include <download_cache.h>
+#include <ipc_batch.h>
 #ifdef CONFIG_SURICATTA_SSL
 #include <openssl/sha.h>
 #endif
@@ -55,8 +58,9 @@ typedef struct {
 
 typedef struct {
 	channel_data_t *channel_data;
-	int output;
+	struct ipc_batch *batch;
 	output_data_t *outdata;
+	struct dl_cache_entry *cache;
 } write_callback_t;
 
 #ifdef CONFIG_SURICATTA_SSL
@@ -178,12 +182,13 @@ size_t channel_callback_write_file(void *streamdata, size_t size, size_t nmemb,
 		return 0;
 	}
 #endif
-	if (ipc_send_data(data->output, streamdata, (int)(size * nmemb)) <
-	    0) {
+	if (ipc_batch_write(data->batch, streamdata, size * nmemb) < 0) {
 		ERROR("Writing into SWUpdate IPC stream failed.\n");
 		result_channel_callback_write_file = CHANNEL_EIO;
 		return 0;
 	}
+	if (data->cache)
+		dl_cache_write(data->cache, streamdata, size * nmemb);
 
 	if (data->channel_data->checkdwl && data->channel_data->checkdwl())
 		return 0;
@@ -195,6 +200,25 @@ size_t channel_callback_write_file(void *streamdata, size_t size, size_t nmemb,
 	return size * nmemb;
 }
 
+/* Pass what a previous run left in the cache to the installer */
+static int channel_send_cached(void *ctx, char *buf, size_t len)
+{
+	write_callback_t *data = (write_callback_t *)ctx;
+
+#ifdef CONFIG_SURICATTA_SSL
+	if (SHA1_Update(&checksum_ctx, buf, len) != 1) {
+		ERROR("Updating checksum of chunk failed.\n");
+		return -EIO;
+	}
+#endif
+	if (ipc_batch_write(data->batch, buf, len) < 0) {
+		ERROR("Writing into SWUpdate IPC stream failed.\n");
+		return -EIO;
+	}
+
+	return 0;
+}
+
 size_t channel_callback_membuffer(void *streamdata, size_t size, size_t nmemb,
 				  write_callback_t *data)
 {
@@ -683,10 +707,17 @@ channel_op_res_t channel_get_file(channel_t *this, void *data, int file_handle)
 		assert(file_handle > 0);
 	}
 
+	struct dl_cache_entry cache_entry = { .fd = -1 };
 	write_callback_t wrdata;
 	wrdata.channel_data = channel_data;
-	wrdata.output = file_handle;
+	wrdata.batch = ipc_batch_new(file_handle, IPC_BATCH_THREAD);
+	wrdata.cache = NULL;
 	result_channel_callback_write_file = CHANNEL_OK;
+	if (!wrdata.batch) {
+		ERROR("Cannot allocate the IPC stream buffers.\n");
+		result = CHANNEL_EINIT;
+		goto cleanup_file;
+	}
 	if ((curl_easy_setopt(channel_curl->handle, CURLOPT_WRITEFUNCTION,
 			      channel_callback_write_file) != CURLE_OK) ||
 	    (curl_easy_setopt(channel_curl->handle, CURLOPT_WRITEDATA,
@@ -705,6 +736,33 @@ channel_op_res_t channel_get_file(channel_t *this, void *data, int file_handle)
 	unsigned long long int total_bytes_downloaded = 0;
 	unsigned char try_count = 0;
 	CURLcode curlrc = CURLE_OK;
+
+	/* What a previous run left in the cache goes first */
+	if (channel_data->cache &&
+	    dl_cache_open(channel_data->cache, channel_data->url,
+			  channel_data->hash, &cache_entry) == 0 &&
+	    dl_cache_validate(&cache_entry, channel_curl->handle) == 0) {
+		if (dl_cache_replay(&cache_entry, channel_send_cached,
+				    &wrdata) < 0) {
+			result = CHANNEL_EIO;
+			goto cleanup_file;
+		}
+		wrdata.cache = &cache_entry;
+		total_bytes_downloaded = cache_entry.size;
+		if (cache_entry.complete) {
+			TRACE("Artifact taken from the download cache.\n");
+			goto cached_file;
+		}
+		if (total_bytes_downloaded &&
+		    curl_easy_setopt(channel_curl->handle,
+				     CURLOPT_RESUME_FROM_LARGE,
+				     total_bytes_downloaded) != CURLE_OK) {
+			ERROR("Could not set Channel resume seek.\n");
+			result = CHANNEL_EINIT;
+			goto cleanup_file;
+		}
+	}
+
 	do {
 		if (try_count > 0) {
 			if (channel_data->retries == 0) {
@@ -783,11 +841,14 @@ channel_op_res_t channel_get_file(channel_t *this, void *data, int file_handle)
 	TRACE("Channel operation returned HTTP status code %ld.\n",
 	      http_response_code);
 
-	if (result_channel_callback_write_file != CHANNEL_OK) {
+	if (result_channel_callback_write_file != CHANNEL_OK ||
+	    ipc_batch_flush(wrdata.batch) < 0) {
 		result = CHANNEL_EIO;
 		goto cleanup_file;
 	}
+	dl_cache_done(&cache_entry);
 
+cached_file:
 #ifdef CONFIG_SURICATTA_SSL
 	unsigned char sha1hash[SHA_DIGEST_LENGTH];
 	if (SHA1_Final(sha1hash, &checksum_ctx) != 1) {
@@ -799,9 +860,19 @@ channel_op_res_t channel_get_file(channel_t *this, void *data, int file_handle)
 		sprintf(sha1hexchar, "%02x", sha1hash[i]);
 		strcat(channel_data->sha1hash, sha1hexchar);
 	}
+	/* the cache must not keep what the server did not announce */
+	if (channel_data->hash &&
+	    strcasecmp(channel_data->hash, channel_data->sha1hash))
+		dl_cache_remove(&cache_entry);
 #endif
 
 cleanup_file:
+	if (wrdata.batch && ipc_batch_close(wrdata.batch) < 0 &&
+	    result == CHANNEL_OK) {
+		ERROR("Writing into SWUpdate IPC stream failed.\n");
+		result = CHANNEL_EIO;
+	}
+	dl_cache_close(&cache_entry);
 	/* NOTE ipc_end() calls close() but does not return its error code,
 	 *      so use close() here directly to issue an error in case.
 	 *      Also, for a given file handle, calling ipc_end() would make
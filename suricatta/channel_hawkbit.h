@@ -41,6 +41,8 @@ typedef enum {
 
 #define USE_PROXY_ENV (char *)0x11
 
+struct dl_cache;
+
 typedef struct {
 	char *url;
 	char *json_string;
@@ -57,6 +59,8 @@ typedef struct {
 	bool debug;
 	bool strictssl;
 	int (*checkdwl)(void);
+	const struct dl_cache *cache;	/* NULL: downloads are not cached */
+	const char *hash;	/* announced by the server, key in the cache */
 #ifdef CONFIG_SURICATTA_SSL
 	char sha1hash[SHA_DIGEST_LENGTH * 2 + 1];
 #endif
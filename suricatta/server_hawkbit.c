@@ -39,6 +39,7 @@
 #include "parselib.h"
 #include "swupdate_settings.h"
 #include "swupdate_dict.h"
+#include "download_cache.h"
 
 #define DEFAULT_POLLING_INTERVAL 45
 #define DEFAULT_RESUME_TRIES 5
@@ -74,6 +75,8 @@ static struct option long_options[] = {
     {"retry", required_argument, NULL, 'r'},
     {"retrywait", required_argument, NULL, 'w'},
     {"proxy", optional_argument, NULL, 'y'},
+    {"cache", required_argument, NULL, 'k'},
+    {"cache-size", required_argument, NULL, 'z'},
     {NULL, 0, NULL, 0}};
 
 static unsigned short mandatory_argument_count = 0;
@@ -153,6 +156,9 @@ static channel_data_t channel_data_defaults = {.debug = false,
 
 static struct timeval server_time;
 
+/* Downloaded artifacts kept across restarts, if dir is set */
+static struct dl_cache download_cache;
+
 /* Prototypes for "public" functions */
 server_op_res_t server_has_pending_action(int *action_id);
 server_op_res_t server_stop(void);
@@ -1109,6 +1115,8 @@ server_op_res_t server_process_update_artifact(int action_id,
 		}
 
 		channel_data.checkdwl = server_check_during_dwl;
+		channel_data.hash =
+		    json_object_get_string(json_data_artifact_sha1hash);
 
 		/*
 		 * Retrieve current time to check download time
@@ -1519,7 +1527,11 @@ void suricatta_print_help(void)
 	    "\t  -w, --retrywait     Time to wait prior to retry and "
 	    "resume a download (default: %ds).\n"
 	    "\t  -y, --proxy         Use proxy. Either give proxy URL, else "
-	    "{http,all}_proxy env is tried.\n",
+	    "{http,all}_proxy env is tried.\n"
+	    "\t  -k, --cache         Directory to keep downloads across "
+	    "restarts.\n"
+	    "\t  -z, --cache-size    Size limit of the cache in MiB "
+	    "(default: no limit).\n",
 	    DEFAULT_POLLING_INTERVAL, DEFAULT_RESUME_TRIES,
 	    DEFAULT_RESUME_DELAY);
 }
@@ -1566,6 +1578,12 @@ static int suricatta_settings(void *elem, void  __attribute__ ((__unused__)) *da
 	GET_FIELD_STRING_RESET(LIBCFG_PARSER, elem, "proxy", tmp);
 	if (strlen(tmp))
 		SETSTRING(channel_data_defaults.proxy, tmp);
+	GET_FIELD_STRING_RESET(LIBCFG_PARSER, elem, "cache", tmp);
+	if (strlen(tmp))
+		SETSTRING(download_cache.dir, tmp);
+	GET_FIELD_STRING_RESET(LIBCFG_PARSER, elem, "cache-size", tmp);
+	if (strlen(tmp))
+		download_cache.max_size = strtoull(tmp, NULL, 10) * 1024 * 1024;
 
 	return 0;
 
@@ -1625,7 +1643,7 @@ server_op_res_t server_start(char *fname, int argc, char *argv[])
 
 	/* reset to optind=1 to parse suricatta's argument vector */
 	optind = 1;
-	while ((choice = getopt_long(argc, argv, "t:i:c:u:p:xr:y::w:",
+	while ((choice = getopt_long(argc, argv, "t:i:c:u:p:xr:y::w:k:z:",
 				     long_options, NULL)) != -1) {
 		switch (choice) {
 		case 't':
@@ -1695,6 +1713,13 @@ server_op_res_t server_start(char *fname, int argc, char *argv[])
 			channel_data_defaults.retry_sleep =
 			    (unsigned int)strtoul(optarg, NULL, 10);
 			break;
+		case 'k':
+			SETSTRING(download_cache.dir, optarg);
+			break;
+		case 'z':
+			download_cache.max_size =
+			    strtoull(optarg, NULL, 10) * 1024 * 1024;
+			break;
 		case '?':
 		default:
 			return SERVER_EINIT;
@@ -1712,6 +1737,15 @@ server_op_res_t server_start(char *fname, int argc, char *argv[])
 		return SERVER_EINIT;
 	}
 
+	/* without the SHA-1 check, cached data could not be trusted */
+	if (download_cache.dir) {
+#ifdef CONFIG_SURICATTA_SSL
+		channel_data_defaults.cache = &download_cache;
+#else
+		WARN("Download cache needs CONFIG_SURICATTA_SSL, not used");
+#endif
+	}
+
 	if (channel_hawkbit_init() != CHANNEL_OK)
 		return SERVER_EINIT;
 
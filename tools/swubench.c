@@ -0,0 +1,864 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+/*
+ * Throughput benchmark of the install data path.
+ *
+ * Synthetic SWU bundles are generated in a work directory and
+ * installed with cpio_scan() and install_images(), as SWUpdate
+ * does for a local file, into /dev/null, files or a device.
+ * Each configuration runs in a child process, so that CPU time
+ * and peak RSS are its own.
+ *
+ * Unlike the other tools, swubench is linked with the core
+ * objects: build and run it with "make benchmark".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#ifdef CONFIG_GUNZIP
+#include <zlib.h>
+#endif
+
+#include "generated/autoconf.h"
+#include "swupdate.h"
+#include "util.h"
+#include "installer.h"
+
+#define MIB			(1024 * 1024)
+#define SMALL_FILE_SIZE		(16 * 1024)
+#define TREE_CHUNK		HASH_TREE_CHUNK_SIZE
+#define CPIO_HDR_LEN		110
+#define NPAD_BYTES(o)		((4 - (o % 4)) % 4)
+
+enum bench_sink {
+	SINK_NULL,
+	SINK_FILE,
+	SINK_DEVICE
+};
+
+struct bench_config {
+	const char *name;
+	int nimages;		/* 0: use the -n option */
+	int large;		/* images of -s MiB, else SMALL_FILE_SIZE */
+	int compressed;
+	int encrypted;
+	int sha256;
+	int tree;
+};
+
+static const struct bench_config configs[] = {
+	{ "plain", 2, 1, 0, 0, 0, 0 },
+	{ "small-files", 0, 0, 0, 0, 0, 0 },
+#ifdef CONFIG_GUNZIP
+	{ "gzip", 2, 1, 1, 0, 0, 0 },
+#endif
+#ifdef CONFIG_ENCRYPTED_IMAGES
+	{ "aes-cbc", 2, 1, 0, CIPHER_AES_CBC, 0, 0 },
+	{ "aes-ctr", 2, 1, 0, CIPHER_AES_CTR, 0, 0 },
+#endif
+#ifdef CONFIG_HASH_VERIFY
+	{ "sha256", 2, 1, 0, 0, 1, 0 },
+	{ "sha256-tree", 2, 1, 0, 0, 0, 1 },
+#endif
+#if defined(CONFIG_GUNZIP) && defined(CONFIG_ENCRYPTED_IMAGES) && \
+	defined(CONFIG_HASH_VERIFY)
+	{ "gzip-aes-sha256", 2, 1, 1, CIPHER_AES_CBC, 1, 0 },
+#endif
+};
+
+struct bench_result {
+	unsigned long long bytes;	/* written by the handlers */
+	double seconds;
+	double cpu;
+	long rss_kib;
+	int status;
+};
+
+static const char *workdir;
+static unsigned int image_mib = 64;
+static unsigned int nsmall = 1000;
+static enum bench_sink sink = SINK_NULL;
+static const char *device;
+static unsigned int repeat = 1;
+
+static unsigned char aes_key[32];
+static unsigned char aes_iv[16];	/* AES block */
+
+/* xorshift: the same data on every run */
+static unsigned long long rnd_state = 0x9e3779b97f4a7c15ULL;
+
+static unsigned long long rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 7;
+	rnd_state ^= rnd_state << 17;
+	return rnd_state;
+}
+
+/*
+ * Half of each 4 KiB block is random, the rest is text:
+ * it compresses about as a root filesystem does
+ */
+static void fill_data(unsigned char *buf, size_t len)
+{
+	static const char text[] = "swupdate benchmark data ";
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if ((i % 4096) < 2048) {
+			if (i % 8 == 0) {
+				unsigned long long r = rnd();
+				memcpy(buf + i, &r, min(len - i, (size_t)8));
+			}
+		} else {
+			buf[i] = text[i % (sizeof(text) - 1)];
+		}
+	}
+}
+
+#ifdef CONFIG_GUNZIP
+static size_t gzip_data(unsigned char *in, size_t len, unsigned char *out,
+			size_t outlen)
+{
+	z_stream strm;
+	size_t ret;
+
+	memset(&strm, 0, sizeof(strm));
+	if (deflateInit2(&strm, 6, Z_DEFLATED, 15 + 16, 8,
+			Z_DEFAULT_STRATEGY) != Z_OK)
+		return 0;
+	strm.next_in = in;
+	strm.avail_in = len;
+	strm.next_out = out;
+	strm.avail_out = outlen;
+	ret = (deflate(&strm, Z_FINISH) == Z_STREAM_END) ? strm.total_out : 0;
+	deflateEnd(&strm);
+
+	return ret;
+}
+#endif
+
+static size_t encrypt_data(int cipher, unsigned char *in, size_t len,
+			unsigned char *out)
+{
+	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+	int l1 = 0, l2 = 0;
+
+	if (!ctx)
+		return 0;
+	if (EVP_EncryptInit_ex(ctx, cipher == CIPHER_AES_CTR ?
+				EVP_aes_256_ctr() : EVP_aes_256_cbc(),
+				NULL, aes_key, aes_iv) != 1 ||
+	    EVP_EncryptUpdate(ctx, out, &l1, in, len) != 1 ||
+	    EVP_EncryptFinal_ex(ctx, out + l1, &l2) != 1)
+		l1 = l2 = 0;
+	EVP_CIPHER_CTX_free(ctx);
+
+	return l1 + l2;
+}
+
+/* Same tree as corelib/tree_hash.c, computed independently */
+static void tree_sha256(unsigned char *data, size_t len, unsigned char *md)
+{
+	size_t n = len ? (len + TREE_CHUNK - 1) / TREE_CHUNK : 1;
+	unsigned char (*l)[SHA256_DIGEST_LENGTH];
+	unsigned char node[1 + 2 * SHA256_DIGEST_LENGTH];
+	unsigned char *leaf;
+	size_t i, k;
+
+	l = calloc(n, SHA256_DIGEST_LENGTH);
+	leaf = malloc(1 + TREE_CHUNK);
+	if (!l || !leaf) {
+		free(l);
+		free(leaf);
+		return;
+	}
+	leaf[0] = 0x00;
+	for (i = 0; i < n; i++) {
+		k = min(len - i * TREE_CHUNK, (size_t)TREE_CHUNK);
+		memcpy(leaf + 1, data + i * TREE_CHUNK, k);
+		SHA256(leaf, 1 + k, l[i]);
+	}
+	free(leaf);
+	node[0] = 0x01;
+	for (; n > 1; n = (n + 1) / 2) {
+		for (i = 0; i < n / 2; i++) {
+			memcpy(node + 1, l[2 * i], SHA256_DIGEST_LENGTH);
+			memcpy(node + 1 + SHA256_DIGEST_LENGTH, l[2 * i + 1],
+				SHA256_DIGEST_LENGTH);
+			SHA256(node, sizeof(node), l[i]);
+		}
+		if (n % 2)
+			memcpy(l[n / 2], l[n - 1], SHA256_DIGEST_LENGTH);
+	}
+	node[0] = 0x02;
+	for (i = 0; i < 8; i++)
+		node[1 + i] = (unsigned long long)len >> (56 - 8 * i);
+	memcpy(node + 9, l[0], SHA256_DIGEST_LENGTH);
+	SHA256(node, 9 + SHA256_DIGEST_LENGTH, md);
+	free(l);
+}
+
+static int cpio_add(FILE *fp, const char *name, unsigned char *data,
+		size_t len, unsigned long long *offs)
+{
+	char hdr[CPIO_HDR_LEN + 1];
+	unsigned int chksum = 0;
+	size_t namesize = strlen(name) + 1;
+	static const char pad[4];
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		chksum += data[i];
+
+	snprintf(hdr, sizeof(hdr),
+		"070702%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X",
+		0, 0100644, 0, 0, 1, 0, (unsigned int)len, 0, 0, 0, 0,
+		(unsigned int)namesize, chksum);
+	if (fwrite(hdr, CPIO_HDR_LEN, 1, fp) != 1 ||
+	    fwrite(name, namesize, 1, fp) != 1)
+		return -EIO;
+	*offs += CPIO_HDR_LEN + namesize;
+	if (fwrite(pad, NPAD_BYTES(*offs), 1, fp) > 1)
+		return -EIO;
+	*offs += NPAD_BYTES(*offs);
+	if (len && fwrite(data, len, 1, fp) != 1)
+		return -EIO;
+	*offs += len;
+	if (fwrite(pad, NPAD_BYTES(*offs), 1, fp) > 1)
+		return -EIO;
+	*offs += NPAD_BYTES(*offs);
+
+	return 0;
+}
+
+static void bundle_path(char *path, size_t len, const struct bench_config *c)
+{
+	snprintf(path, len, "%s/swubench-%s.swu", workdir, c->name);
+}
+
+static int image_count(const struct bench_config *c)
+{
+	return c->nimages ? c->nimages : (int)nsmall;
+}
+
+static size_t image_size(const struct bench_config *c)
+{
+	return c->large ? (size_t)image_mib * MIB : SMALL_FILE_SIZE;
+}
+
+/*
+ * The bundle is a valid (unsigned) SWU: the same images are
+ * described in its sw-description, so it can be installed by
+ * swupdate as well
+ */
+static int generate_bundle(const struct bench_config *c)
+{
+	char path[MAX_IMAGE_FNAME * 2];
+	char name[MAX_IMAGE_FNAME];
+	char *desc, *p;
+	unsigned char *data, *payload, *tmp;
+	unsigned char md[SHA256_DIGEST_LENGTH];
+	size_t size = image_size(c), len, desclen;
+	unsigned long long offs = 0;
+	int i, n = image_count(c), ret = 0;
+	FILE *fp;
+
+	desclen = 256 + n * 512;
+	desc = calloc(1, desclen);
+	data = malloc(size);
+	payload = malloc(size + size / 100 + 1024);
+	tmp = malloc(size + size / 100 + 1024);
+	if (!desc || !data || !payload || !tmp) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	bundle_path(path, sizeof(path), c);
+	fp = fopen(path, "w");
+	if (!fp) {
+		fprintf(stderr, "Cannot create %s: %s\n", path, strerror(errno));
+		ret = -EIO;
+		goto out;
+	}
+
+	p = desc;
+	p += sprintf(p, "software =\n{\n\tversion = \"0.0.0\";\n\timages: (\n");
+
+	for (i = 0; i < n && !ret; i++) {
+		snprintf(name, sizeof(name), "image-%d.bin", i);
+		fill_data(data, size);
+		memcpy(payload, data, size);
+		len = size;
+#ifdef CONFIG_GUNZIP
+		if (c->compressed) {
+			len = gzip_data(data, size, payload, size + size / 100 + 1024);
+			if (!len) {
+				ret = -EFAULT;
+				break;
+			}
+		}
+#endif
+		if (c->encrypted) {
+			memcpy(tmp, payload, len);
+			len = encrypt_data(c->encrypted, tmp, len, payload);
+			if (!len) {
+				ret = -EFAULT;
+				break;
+			}
+		}
+
+		p += sprintf(p, "\t\t{\n\t\t\tfilename = \"%s\";\n"
+				"\t\t\ttype = \"raw\";\n"
+				"\t\t\tdevice = \"/dev/null\";\n", name);
+		if (c->compressed)
+			p += sprintf(p, "\t\t\tcompressed = true;\n");
+		if (c->encrypted)
+			p += sprintf(p, "\t\t\tencrypted = \"%s\";\n",
+				get_cipher_name(c->encrypted));
+		if (c->sha256 || c->tree) {
+			char hex[2 * SHA256_DIGEST_LENGTH + 1];
+			int j;
+
+			if (c->tree)
+				tree_sha256(payload, len, md);
+			else
+				SHA256(payload, len, md);
+			for (j = 0; j < SHA256_DIGEST_LENGTH; j++)
+				sprintf(&hex[2 * j], "%02x", md[j]);
+			p += sprintf(p, "\t\t\t%s = \"%s\";\n",
+				c->tree ? "sha256-tree" : "sha256", hex);
+		}
+		p += sprintf(p, "\t\t}%s\n", (i < n - 1) ? "," : "");
+
+		/* empty sw-description, replaced at the end */
+		if (i == 0) {
+			ret = cpio_add(fp, "sw-description", NULL, 0, &offs);
+			if (ret)
+				break;
+		}
+		ret = cpio_add(fp, name, payload, len, &offs);
+	}
+	sprintf(p, "\t);\n}\n");
+
+	if (!ret)
+		ret = cpio_add(fp, "TRAILER!!!", NULL, 0, &offs);
+	fclose(fp);
+
+	/* copy the archive after the final sw-description */
+	if (!ret) {
+		char tmppath[MAX_IMAGE_FNAME * 2 + 8];
+		unsigned long long o = 0;
+		FILE *in, *out;
+		size_t r;
+
+		snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+		in = fopen(path, "r");
+		out = fopen(tmppath, "w");
+		if (!in || !out ||
+		    fseek(in, CPIO_HDR_LEN + sizeof("sw-description") +
+			NPAD_BYTES(CPIO_HDR_LEN + sizeof("sw-description")),
+			SEEK_SET) < 0 ||
+		    cpio_add(out, "sw-description", (unsigned char *)desc,
+				strlen(desc), &o)) {
+			ret = -EIO;
+		} else {
+			while ((r = fread(data, 1, size, in)) > 0) {
+				if (fwrite(data, r, 1, out) != 1) {
+					ret = -EIO;
+					break;
+				}
+			}
+		}
+		if (in)
+			fclose(in);
+		if (out)
+			fclose(out);
+		if (!ret && rename(tmppath, path) < 0)
+			ret = -errno;
+		if (ret)
+			unlink(tmppath);
+	}
+
+out:
+	if (ret)
+		fprintf(stderr, "Cannot generate bundle %s: %d\n", c->name, ret);
+	free(desc);
+	free(data);
+	free(payload);
+	free(tmp);
+
+	return ret;
+}
+
+static struct img_type *new_image(const struct bench_config *c, int i,
+				unsigned long long seek)
+{
+	struct img_type *img;
+
+	img = calloc(1, sizeof(*img));
+	if (!img)
+		return NULL;
+
+	snprintf(img->fname, sizeof(img->fname), "image-%d.bin", i);
+	img->compressed = c->compressed;
+	img->is_encrypted = c->encrypted;
+
+	switch (sink) {
+	case SINK_NULL:
+		strcpy(img->type, "raw");
+		strcpy(img->device, "/dev/null");
+		break;
+	case SINK_FILE:
+		strcpy(img->type, "rawfile");
+		if (snprintf(img->path, sizeof(img->path), "%s/out-%s",
+				workdir, img->fname) >= (int)sizeof(img->path)) {
+			free(img);
+			return NULL;
+		}
+		break;
+	case SINK_DEVICE:
+		strcpy(img->type, "raw");
+		strncpy(img->device, device, sizeof(img->device) - 1);
+		img->seek = seek;
+		break;
+	}
+
+	return img;
+}
+
+/*
+ * The hashes are in sw-description: get them from there
+ * instead of running the parser, that can be disabled
+ */
+static int read_hashes(const char *path, struct swupdate_cfg *cfg)
+{
+	struct img_type *img;
+	char line[256], key[32], value[128];
+	FILE *fp = fopen(path, "r");
+	int cur = -1;
+
+	if (!fp)
+		return -errno;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, " filename = \"image-%d.bin\";", &cur) == 1)
+			continue;
+		if (cur < 0 || sscanf(line, " %31s = \"%127[0-9a-f]\";",
+					key, value) != 2)
+			continue;
+		LIST_FOREACH(img, &cfg->images, next) {
+			int idx;
+
+			if (sscanf(img->fname, "image-%d.bin", &idx) != 1 ||
+			    idx != cur)
+				continue;
+			if (!strcmp(key, "sha256"))
+				ascii_to_hash(img->sha256, value);
+			else if (!strcmp(key, "sha256-tree"))
+				ascii_to_hash(img->tree_sha256, value);
+		}
+		if (!strncmp(line, "\t);", 3))
+			break;
+	}
+	fclose(fp);
+
+	return 0;
+}
+
+static int run_install(const struct bench_config *c, double *seconds)
+{
+	struct swupdate_cfg cfg;
+	struct img_type *img;
+	char path[MAX_IMAGE_FNAME * 2];
+	char descpath[MAX_IMAGE_FNAME * 2 + 32];
+	struct timespec t0, t1;
+	size_t size = image_size(c);
+	int i, fd, ret, verify = 1;
+	off_t pos;
+
+	memset(&cfg, 0, sizeof(cfg));
+	LIST_INIT(&cfg.images);
+	LIST_INIT(&cfg.partitions);
+	LIST_INIT(&cfg.hardware);
+	LIST_INIT(&cfg.scripts);
+	LIST_INIT(&cfg.bootloader);
+	LIST_INIT(&cfg.extprocs);
+
+	/* keep the order of the bundle */
+	for (i = image_count(c) - 1; i >= 0; i--) {
+		img = new_image(c, i, (unsigned long long)i * size);
+		if (!img)
+			return -ENOMEM;
+		LIST_INSERT_HEAD(&cfg.images, img, next);
+	}
+
+	bundle_path(path, sizeof(path), c);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	pos = extract_sw_description(fd, "sw-description", 0);
+	if (pos < 0) {
+		close(fd);
+		return -EFAULT;
+	}
+	snprintf(descpath, sizeof(descpath), "%ssw-description", get_tmpdir());
+	if (c->sha256 || c->tree)
+		read_hashes(descpath, &cfg);
+
+#ifdef CONFIG_SINGLE_PASS_INSTALL
+	verify = 0;
+#endif
+	ret = cpio_scan(fd, &cfg, pos, verify);
+	if (ret >= 0)
+		ret = install_images(&cfg, fd, 1);
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	*seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	if (sink == SINK_FILE) {
+		LIST_FOREACH(img, &cfg.images, next)
+			unlink(img->path);
+	}
+	cleanup_files(&cfg);
+	close(fd);
+
+	return ret;
+}
+
+static int run_config(const struct bench_config *c, struct bench_result *res)
+{
+	struct rusage ru;
+	int status, fds[2];
+	double seconds = 0;
+	pid_t pid;
+
+	if (pipe(fds) < 0)
+		return -errno;
+
+	pid = fork();
+	if (pid < 0)
+		return -errno;
+	if (pid == 0) {
+		int ret;
+
+		close(fds[0]);
+		ret = run_install(c, &seconds);
+		if (write(fds[1], &seconds, sizeof(seconds)) != sizeof(seconds))
+			ret = -EIO;
+		_exit(ret ? 1 : 0);
+	}
+
+	close(fds[1]);
+	if (read(fds[0], &seconds, sizeof(seconds)) != sizeof(seconds))
+		seconds = 0;
+	close(fds[0]);
+
+	if (wait4(pid, &status, 0, &ru) < 0)
+		return -errno;
+
+	res->bytes = (unsigned long long)image_count(c) * image_size(c);
+	res->seconds = seconds;
+	res->cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+		ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+	res->rss_kib = ru.ru_maxrss;
+	res->status = (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+
+	return 0;
+}
+
+static double mibps(const struct bench_result *r)
+{
+	return r->seconds > 0 ? r->bytes / (double)MIB / r->seconds : 0;
+}
+
+/* MiB/s of a configuration in a previous CSV, 0 if not found */
+static double baseline_mibps(const char *fname, const char *name)
+{
+	char line[256], cfgname[64];
+	double val, ret = 0;
+	FILE *fp = fopen(fname, "r");
+
+	if (!fp)
+		return 0;
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%63[^,],%*u,%*f,%lf", cfgname, &val) == 2 &&
+		    !strcmp(cfgname, name))
+			ret = val;
+	}
+	fclose(fp);
+
+	return ret;
+}
+
+static const struct bench_config *find_config(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(configs); i++) {
+		if (!strcmp(configs[i].name, name))
+			return &configs[i];
+	}
+
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	unsigned int i;
+
+	fprintf(stdout,
+		"%s [OPTION]\n"
+		" -w, --workdir <dir>    : directory for the bundles (default: TMPDIR)\n"
+		" -s, --size <MiB>       : size of each large image (default: 64)\n"
+		" -n, --files <count>    : number of files for small-files (default: 1000)\n"
+		" -k, --sink <sink>      : null, file (in workdir) or device (default: null)\n"
+		" -d, --device <dev>     : device for the device sink, e.g. a loop device\n"
+		" -c, --config <list>    : comma separated configurations (default: all)\n"
+		" -r, --repeat <n>       : keep the best of n runs (default: 1)\n"
+		" -o, --output <file>    : write the results as CSV\n"
+		" -b, --baseline <file>  : compare with a previous CSV\n"
+		" -t, --tolerance <pct>  : allowed slowdown against the baseline (default: 10)\n"
+		" -v, --verbose          : print the messages of the installer\n"
+		" -h, --help             : print this help and exit\n"
+		"Configurations:",
+		prog);
+	for (i = 0; i < ARRAY_SIZE(configs); i++)
+		fprintf(stdout, " %s", configs[i].name);
+	fprintf(stdout, "\n");
+}
+
+static struct option long_options[] = {
+	{"workdir", required_argument, NULL, 'w'},
+	{"size", required_argument, NULL, 's'},
+	{"files", required_argument, NULL, 'n'},
+	{"sink", required_argument, NULL, 'k'},
+	{"device", required_argument, NULL, 'd'},
+	{"config", required_argument, NULL, 'c'},
+	{"repeat", required_argument, NULL, 'r'},
+	{"output", required_argument, NULL, 'o'},
+	{"baseline", required_argument, NULL, 'b'},
+	{"tolerance", required_argument, NULL, 't'},
+	{"verbose", no_argument, NULL, 'v'},
+	{"help", no_argument, NULL, 'h'},
+	{NULL, 0, NULL, 0}
+};
+
+int main(int argc, char **argv)
+{
+	const struct bench_config *run[ARRAY_SIZE(configs)];
+	struct bench_result res, best;
+	const char *output = NULL, *baseline = NULL;
+	char *list = NULL, *tok;
+	char keyfile[MAX_IMAGE_FNAME * 2];
+	unsigned int nrun = 0, i, r;
+	int tolerance = 10, c, regressions = 0, failures = 0, verbose = 0;
+	FILE *csv = NULL;
+	FILE *fp;
+
+	while ((c = getopt_long(argc, argv, "w:s:n:k:d:c:r:o:b:t:vh",
+				long_options, NULL)) != EOF) {
+		switch (c) {
+		case 'w':
+			workdir = optarg;
+			break;
+		case 's':
+			image_mib = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			nsmall = strtoul(optarg, NULL, 10);
+			break;
+		case 'k':
+			if (!strcmp(optarg, "null"))
+				sink = SINK_NULL;
+			else if (!strcmp(optarg, "file"))
+				sink = SINK_FILE;
+			else if (!strcmp(optarg, "device"))
+				sink = SINK_DEVICE;
+			else {
+				usage(argv[0]);
+				exit(1);
+			}
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		case 'c':
+			list = optarg;
+			break;
+		case 'r':
+			repeat = max(1UL, strtoul(optarg, NULL, 10));
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'b':
+			baseline = optarg;
+			break;
+		case 't':
+			tolerance = atoi(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			exit(c == 'h' ? 0 : 1);
+		}
+	}
+
+	if (!image_mib || !nsmall || (sink == SINK_DEVICE && !device)) {
+		usage(argv[0]);
+		exit(1);
+	}
+	if (!workdir) {
+		workdir = getenv("TMPDIR");
+		if (!workdir)
+			workdir = "/tmp";
+	}
+	loglevel = verbose ? TRACELEVEL : ERRORLEVEL;
+	if (verbose)
+		notify_init();
+
+	if (list) {
+		for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+			run[nrun] = find_config(tok);
+			if (!run[nrun]) {
+				fprintf(stderr, "Unknown configuration %s\n", tok);
+				exit(1);
+			}
+			if (++nrun == ARRAY_SIZE(run))
+				break;
+		}
+	} else {
+		for (nrun = 0; nrun < ARRAY_SIZE(configs); nrun++)
+			run[nrun] = &configs[nrun];
+	}
+
+	/* a random key for the encrypted bundles */
+	for (i = 0; i < sizeof(aes_key); i++)
+		aes_key[i] = rnd();
+	for (i = 0; i < sizeof(aes_iv); i++)
+		aes_iv[i] = rnd();
+	snprintf(keyfile, sizeof(keyfile), "%s/swubench.key", workdir);
+	fp = fopen(keyfile, "w");
+	if (!fp) {
+		fprintf(stderr, "Cannot write %s: %s\n", keyfile, strerror(errno));
+		exit(1);
+	}
+	for (i = 0; i < sizeof(aes_key); i++)
+		fprintf(fp, "%02x", aes_key[i]);
+	fprintf(fp, " ");
+	for (i = 0; i < sizeof(aes_iv); i++)
+		fprintf(fp, "%02x", aes_iv[i]);
+	fprintf(fp, "\n");
+	fclose(fp);
+#ifdef CONFIG_ENCRYPTED_IMAGES
+	if (load_decryption_key(keyfile)) {
+		fprintf(stderr, "Cannot load %s\n", keyfile);
+		exit(1);
+	}
+#endif
+
+	if (output) {
+		csv = fopen(output, "w");
+		if (!csv) {
+			fprintf(stderr, "Cannot write %s: %s\n", output,
+				strerror(errno));
+			exit(1);
+		}
+		fprintf(csv, "config,bytes,seconds,mibps,cpu,rss_kib\n");
+	}
+
+	printf("%-16s %8s %9s %9s %9s %6s %9s\n", "config", "MiB",
+		"time[s]", "MiB/s", "cpu[s]", "cpu%", "rss[MiB]");
+
+	for (i = 0; i < nrun; i++) {
+		if (generate_bundle(run[i])) {
+			failures++;
+			continue;
+		}
+
+		memset(&best, 0, sizeof(best));
+		for (r = 0; r < repeat; r++) {
+			if (run_config(run[i], &res) < 0 || res.status) {
+				best.status = -1;
+				break;
+			}
+			if (!best.seconds || res.seconds < best.seconds)
+				best = res;
+		}
+
+		if (best.status) {
+			printf("%-16s FAILED\n", run[i]->name);
+			failures++;
+		} else {
+			printf("%-16s %8.1f %9.3f %9.1f %9.3f %6.0f %9.1f",
+				run[i]->name, best.bytes / (double)MIB, best.seconds,
+				mibps(&best), best.cpu,
+				best.seconds > 0 ? 100 * best.cpu / best.seconds : 0,
+				best.rss_kib / 1024.0);
+			if (baseline) {
+				double base = baseline_mibps(baseline, run[i]->name);
+
+				if (base > 0 && mibps(&best) <
+						base * (100 - tolerance) / 100) {
+					printf("  REGRESSION (%.1f MiB/s before)",
+						base);
+					regressions++;
+				}
+			}
+			printf("\n");
+			if (csv)
+				fprintf(csv, "%s,%llu,%f,%f,%f,%ld\n",
+					run[i]->name, best.bytes, best.seconds,
+					mibps(&best), best.cpu, best.rss_kib);
+		}
+
+		{
+			char path[MAX_IMAGE_FNAME * 2];
+
+			bundle_path(path, sizeof(path), run[i]);
+			unlink(path);
+		}
+	}
+
+	if (csv)
+		fclose(csv);
+	unlink(keyfile);
+
+	return (failures || regressions) ? 1 : 0;
+}
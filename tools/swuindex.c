@@ -0,0 +1,107 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.
+ */
+
+/*
+ * Build the index (sw-index) for a .swu. The input is the
+ * cpio archive with the files that follow the index, built
+ * with the same cpio command as the .swu:
+ *
+ *	for i in $IMAGES; do echo $i; done | cpio -ov -H crc > images.cpio
+ *	swuindex images.cpio > sw-index
+ *	for i in sw-description sw-index $IMAGES; do echo $i; done | \
+ *		cpio -ov -H crc > my.swu
+ *
+ * The offsets are relative to the first file, so they are
+ * the same in the .swu.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define CPIO_HDR_LEN	110
+#define NPAD_BYTES(o)	((4 - (o % 4)) % 4)
+
+static unsigned long hex_field(const char *p)
+{
+	char buf[9];
+
+	memcpy(buf, p, 8);
+	buf[8] = '\0';
+
+	return strtoul(buf, NULL, 16);
+}
+
+int main(int argc, char **argv)
+{
+	char hdr[CPIO_HDR_LEN];
+	char name[4096];
+	unsigned long long offset = 0, start;
+	unsigned long size, namesize, chksum;
+	FILE *fp;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <cpio archive>\n", argv[0]);
+		exit(1);
+	}
+
+	fp = fopen(argv[1], "r");
+	if (!fp) {
+		fprintf(stderr, "%s cannot be opened: %s\n", argv[1],
+			strerror(errno));
+		exit(1);
+	}
+
+	for (;;) {
+		start = offset;
+		if (fread(hdr, sizeof(hdr), 1, fp) != 1 ||
+		    (strncmp(hdr, "070701", 6) && strncmp(hdr, "070702", 6))) {
+			fprintf(stderr, "Not a newc/crc cpio archive\n");
+			exit(1);
+		}
+		size = hex_field(hdr + 54);
+		namesize = hex_field(hdr + 94);
+		chksum = hex_field(hdr + 102);
+		if (!namesize || namesize > sizeof(name) ||
+		    fread(name, namesize, 1, fp) != 1) {
+			fprintf(stderr, "Wrong cpio header at %llu\n", start);
+			exit(1);
+		}
+		name[namesize - 1] = '\0';
+		offset += CPIO_HDR_LEN + namesize;
+		offset += NPAD_BYTES(offset);
+
+		if (!strcmp(name, "TRAILER!!!"))
+			break;
+
+		printf("%s %llu %lu %lx\n", name, start, size, chksum);
+
+		offset += size;
+		offset += NPAD_BYTES(offset);
+		if (fseeko(fp, offset, SEEK_SET) < 0) {
+			fprintf(stderr, "Archive truncated\n");
+			exit(1);
+		}
+	}
+
+	fclose(fp);
+
+	return 0;
+}